@@ -65,8 +65,12 @@ void AutoCompactTest::DoReads(int n) {
   }
   ASSERT_OK(dbi->TEST_CompactMemTable());
 
-  // Delete everything
-  for (int i = 0; i < kCount; i++) {
+  //whc change
+  // Delete the keys that will be read.  The rest keep their values: a
+  // range of deletion markers never read again is compacted anyway once
+  // it leaves level-0 (see VersionSet::TombstoneScore), which would
+  // shrink the key space the reads do not touch.
+  for (int i = 0; i < n; i++) {
     ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
   }
   ASSERT_OK(dbi->TEST_CompactMemTable());
@@ -1,47 +1,108 @@
 #include "db/buffer_iterator.h"
-#include "db/version_set.h"
+
+#include <algorithm>
 #include "db/table_cache.h"
-#include <iostream>
+#include "db/version_set.h"
+#include "table/two_level_iterator.h"
+#include "util/coding.h"
 
 namespace leveldb{
 
+// Tables a pool keeps cursors for before it drops idle ones
+static const size_t kMaxIdleCursors = 16;
+
+BufferCursorPool::BufferCursorPool(const ReadOptions& options,
+                                   TableCache* cache)
+  : options_(options),
+    cache_(cache){
+}
+
+BufferCursorPool::~BufferCursorPool(){
+  for (std::map<uint64_t, Cursor>::iterator it = cursors_.begin();
+       it != cursors_.end(); ++it) {
+    assert(!it->second.in_use);
+    delete it->second.iter;
+  }
+}
+
+Iterator* BufferCursorPool::Acquire(uint64_t number, uint64_t filesize) {
+  std::map<uint64_t, Cursor>::iterator it = cursors_.find(number);
+  if (it != cursors_.end()) {
+    if (it->second.in_use) {
+      return cache_->NewIterator(options_, number, filesize);
+    }
+    it->second.in_use = true;
+    return it->second.iter;
+  }
 
-BufferNodeIterator::BufferNodeIterator(const ReadOptions& options,VersionSet* vset,BufferNode* node)
-  :buffernode_(node), 
-  iterator_(vset->ssd_table_cache_->NewIterator(options, node->number, node->filesize)),
-  icmp_(&(vset->icmp_)){
-      //std::cout<<"buffernode iterator build"<<std::endl;
-      //std::cout<<"buffernode iterator file size="<<node->filesize<<std::endl;
-      //std::cout<<"node->number="<<node->number<<std::endl;
-      //if(buffernode_->smallest.Rep().size()>0)
-        //std::cout<<"node->smallest="<<node->smallest.Rep()<<std::endl;
-      //else
-         //::cout<<"node->smallest=0"<<std::endl;
-      SeekToFirst();
+  if (cursors_.size() >= kMaxIdleCursors) {
+    // Scans move on, a table visited long ago is unlikely to come back
+    for (it = cursors_.begin(); it != cursors_.end(); ++it) {
+      if (!it->second.in_use) {
+        delete it->second.iter;
+        cursors_.erase(it);
+        break;
       }
-  
+    }
+  }
+  Cursor cursor;
+  cursor.iter = cache_->NewIterator(options_, number, filesize);
+  cursor.in_use = true;
+  cursors_[number] = cursor;
+  return cursor.iter;
+}
+
+void BufferCursorPool::Release(uint64_t number, Iterator* iter) {
+  std::map<uint64_t, Cursor>::iterator it = cursors_.find(number);
+  if (it != cursors_.end() && it->second.iter == iter) {
+    it->second.in_use = false;
+  } else {
+    delete iter;
+  }
+}
+
+BufferNodeIterator::BufferNodeIterator(const ReadOptions& options,
+                                       TableCache* cache,
+                                       const InternalKeyComparator* icmp,
+                                       const BufferNodeBound& bound,
+                                       BufferCursorPool* pool)
+  : options_(options),
+    cache_(cache),
+    icmp_(icmp),
+    bound_(bound),
+    pool_(pool),
+    iterator_(NULL),
+    exhausted_(false){
+}
+
+BufferNodeIterator::~BufferNodeIterator(){
+  if (iterator_ == NULL) {
+    // Never opened
+  } else if (pool_ != NULL) {
+    pool_->Release(bound_.number, iterator_);
+  } else {
+    delete iterator_;
+  }
+}
+
+void BufferNodeIterator::Open() {
+  if (iterator_ != NULL) {
+    // Already open
+  } else if (pool_ != NULL) {
+    iterator_ = pool_->Acquire(bound_.number, bound_.filesize);
+  } else {
+    iterator_ = cache_->NewIterator(options_, bound_.number, bound_.filesize);
+  }
+}
 
+bool BufferNodeIterator::InRange(const Slice& k) const {
+  return (bound_.inend || icmp_->Compare(k, bound_.smallest) > 0) &&
+      icmp_->Compare(k, bound_.largest) <= 0;
+}
 
 bool BufferNodeIterator::Valid() const {
-    //std::cout<<"buffer node iterator valid node number"<<buffernode_->number<<std::endl;
-    //std::cout<<"buffer node iterator valid smallest:"<<buffernode_->smallest.Rep()<<std::endl;
-    if (!iterator_->Valid()){
-      //std::cout<<"buffer node iterator not valid"<<std::endl;
-      return false; 
-  } 
-  
-  //std::cout<<"buffer node iterator valid"<<std::endl;     
-  Slice k = iterator_->key();
-  bool result;
-  result = (buffernode_->smallest.Rep().size()==0 
-  || icmp_->Compare(k,buffernode_->smallest.Encode()) > 0 )
-      && (icmp_->Compare(k,buffernode_->largest.Encode()) <= 0);
-  
-  //std::cout<<"buffer node iterator valid result"<<result<<std::endl; 
-  if(icmp_->Compare(k,buffernode_->largest.Encode()) > 0){
-      std::cout<<"buffer node iterator valid stop"<<std::endl;
-  }
-  return result;
+  return !exhausted_ && iterator_ != NULL && iterator_->Valid() &&
+      InRange(iterator_->key());
 }
 
 Slice BufferNodeIterator::key() const {
@@ -49,78 +110,417 @@ Slice BufferNodeIterator::key() const {
   return iterator_->key();
 }
 
+Slice BufferNodeIterator::value() const {
+  assert(Valid());
+  return iterator_->value();
+}
+
+Status BufferNodeIterator::status() const {
+  return iterator_ == NULL ? Status::OK() : iterator_->status();
+}
 
 void BufferNodeIterator::Next() {
-  if(Valid())
+  assert(Valid());
   iterator_->Next();
 }
 
-
-
 void BufferNodeIterator::Prev() {
-  if(Valid())
+  assert(Valid());
   iterator_->Prev();
 }
 
-
-Status BufferNodeIterator::status() const {
-  return Status::OK(); 
-}
-
 void BufferNodeIterator::Seek(const Slice& target) {
-  /*
-  if (!iterator_->Valid() || (icmp_->Compare(target,buffernode_->largest.Encode()) > 0)){
-      SeekToLast();
-      return ;
+  if (!bound_.inend && icmp_->Compare(target, bound_.smallest) <= 0) {
+    SeekToFirst();
+    return;
   }
-    
-  if (buffernode_->smallest.Rep().size()>0 && 
-  icmp_->Compare(target,buffernode_->smallest.Encode()) <= 0){
-      SeekToFirst();
-      return ;
+  // Nothing of the node is at or after target, leave the table closed
+  exhausted_ = icmp_->Compare(target, bound_.largest) > 0;
+  if (!exhausted_) {
+    Open();
+    iterator_->Seek(target);
   }
-  */
-  iterator_->Seek(target);
-    
 }
 
 void BufferNodeIterator::SeekToFirst() {
-  if(buffernode_->smallest.Rep().size()==0){
-      iterator_->SeekToFirst();
-      return;
+  exhausted_ = false;
+  Open();
+  if (bound_.inend) {
+    iterator_->SeekToFirst();
+    return;
+  }
+  iterator_->Seek(bound_.smallest);
+  if (iterator_->Valid() &&
+      icmp_->Compare(iterator_->key(), bound_.smallest) == 0) {
+    iterator_->Next();
   }
-      
-  iterator_->Seek((buffernode_->smallest).Encode()); 
-  if(icmp_->Compare(iterator_->key(),buffernode_->smallest.Encode())==0)
-      iterator_->Next();
 }
-  
+
 void BufferNodeIterator::SeekToLast() {
-  iterator_->Seek((buffernode_->largest).Encode()); 
+  exhausted_ = false;
+  Open();
+  iterator_->Seek(bound_.largest);
+  if (!iterator_->Valid()) {
+    iterator_->SeekToLast();
+  } else if (icmp_->Compare(iterator_->key(), bound_.largest) > 0) {
+    iterator_->Prev();
+  }
+}
+
+void GetVisibleBufferNodes(const Buffer* buffer, uint64_t sequence,
+                           std::vector<BufferNodeBound>* nodes,
+                           const RangeDelMap* range_del) {
+  if (buffer == NULL) return;
+  for (size_t i = 0; i < buffer->nodes.size(); i++) {
+    const BufferNode& node = buffer->nodes[i];
+    if (node.sequence > sequence) continue;
+    if (range_del != NULL && BufferNodeDeleted(node, *range_del)) continue;
+    BufferNodeBound bound;
+    bound.number = node.number;
+    bound.filesize = node.filesize;
+    bound.inend = node.inend;
+    if (!node.inend) {
+      bound.smallest = node.smallest.Encode().ToString();
+    }
+    bound.largest = node.largest.Encode().ToString();
+    nodes->push_back(bound);
+  }
 }
 
+namespace {
 
-Slice BufferNodeIterator::value() const {
-  return iterator_->value();
+// Orders nodes by their lower bound, nodes without one first
+struct ByLowerBound {
+  const InternalKeyComparator* icmp;
+  bool operator()(BufferNodeIterator* a, BufferNodeIterator* b) const {
+    if (a->bound().inend || b->bound().inend) {
+      return a->bound().inend && !b->bound().inend;
+    }
+    return icmp->Compare(a->bound().smallest, b->bound().smallest) < 0;
+  }
+};
+
+// Merges a table with the nodes of its buffer.  Moving forward, a node is
+// positioned only once the merged position passes its lower bound, so a
+// short scan opens just the nodes it reaches.  Moving backward positions
+// every node.
+class BufferMergingIterator : public Iterator {
+ public:
+  BufferMergingIterator(const ReadOptions& options,
+                        TableCache* cache,
+                        const InternalKeyComparator* icmp,
+                        Iterator* base,
+                        const std::vector<BufferNodeBound>& nodes,
+                        BufferCursorPool* pool)
+      : icmp_(icmp),
+        base_(base),
+        deferred_(0),
+        current_(NULL),
+        direction_(kForward) {
+    for (size_t i = 0; i < nodes.size(); i++) {
+      nodes_.push_back(
+          new BufferNodeIterator(options, cache, icmp, nodes[i], pool));
+    }
+    ByLowerBound cmp;
+    cmp.icmp = icmp;
+    std::stable_sort(nodes_.begin(), nodes_.end(), cmp);
+  }
+
+  virtual ~BufferMergingIterator() {
+    delete base_;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      delete nodes_[i];
+    }
+  }
+
+  virtual bool Valid() const {
+    return (current_ != NULL);
+  }
+
+  virtual void SeekToFirst() {
+    if (base_ != NULL) base_->SeekToFirst();
+    deferred_ = 0;
+    while (deferred_ < nodes_.size() && nodes_[deferred_]->bound().inend) {
+      nodes_[deferred_++]->SeekToFirst();
+    }
+    direction_ = kForward;
+    FindSmallest();
+  }
+
+  virtual void SeekToLast() {
+    if (base_ != NULL) base_->SeekToLast();
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      nodes_[i]->SeekToLast();
+    }
+    deferred_ = nodes_.size();
+    direction_ = kReverse;
+    FindLargest();
+  }
+
+  virtual void Seek(const Slice& target) {
+    SeekAll(target);
+    direction_ = kForward;
+    FindSmallest();
+  }
+
+  virtual void Next() {
+    assert(Valid());
+
+    // Ensure that all children are positioned after key().
+    if (direction_ != kForward) {
+      std::string k = key().ToString();
+      SeekAll(k);
+      if (base_ != NULL && base_->Valid() &&
+          icmp_->Compare(base_->key(), k) == 0) {
+        base_->Next();
+      }
+      for (size_t i = 0; i < deferred_; i++) {
+        if (nodes_[i]->Valid() && icmp_->Compare(nodes_[i]->key(), k) == 0) {
+          nodes_[i]->Next();
+        }
+      }
+      direction_ = kForward;
+    } else {
+      current_->Next();
+    }
+    FindSmallest();
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+
+    // Ensure that all children are positioned before key().
+    if (direction_ != kReverse) {
+      std::string k = key().ToString();
+      if (base_ != NULL) SeekBefore(base_, k);
+      for (size_t i = 0; i < nodes_.size(); i++) {
+        SeekBefore(nodes_[i], k);
+      }
+      deferred_ = nodes_.size();
+      direction_ = kReverse;
+    } else {
+      current_->Prev();
+    }
+    FindLargest();
+  }
+
+  virtual Slice key() const {
+    assert(Valid());
+    return current_->key();
+  }
+
+  virtual Slice value() const {
+    assert(Valid());
+    return current_->value();
+  }
+
+  virtual Status status() const {
+    Status status;
+    if (base_ != NULL) status = base_->status();
+    for (size_t i = 0; status.ok() && i < nodes_.size(); i++) {
+      status = nodes_[i]->status();
+    }
+    return status;
+  }
+
+ private:
+  // Position base_ and every node starting before target at target.  The
+  // other nodes are left for FindSmallest().
+  void SeekAll(const Slice& target) {
+    if (base_ != NULL) base_->Seek(target);
+    deferred_ = 0;
+    while (deferred_ < nodes_.size() &&
+           (nodes_[deferred_]->bound().inend ||
+            icmp_->Compare(nodes_[deferred_]->bound().smallest, target) < 0)) {
+      nodes_[deferred_++]->Seek(target);
+    }
+  }
+
+  static void SeekBefore(Iterator* iter, const Slice& k) {
+    iter->Seek(k);
+    if (iter->Valid()) {
+      iter->Prev();
+    } else {
+      iter->SeekToLast();
+    }
+  }
+
+  void FindSmallest() {
+    while (true) {
+      current_ = NULL;
+      if (base_ != NULL && base_->Valid()) {
+        current_ = base_;
+      }
+      for (size_t i = 0; i < deferred_; i++) {
+        if (nodes_[i]->Valid() &&
+            (current_ == NULL ||
+             icmp_->Compare(nodes_[i]->key(), current_->key()) < 0)) {
+          current_ = nodes_[i];
+        }
+      }
+      // Every key of a deferred node is after its lower bound
+      if (deferred_ < nodes_.size() &&
+          (current_ == NULL ||
+           icmp_->Compare(nodes_[deferred_]->bound().smallest,
+                          current_->key()) < 0)) {
+        nodes_[deferred_++]->SeekToFirst();
+        continue;
+      }
+      break;
+    }
+  }
+
+  void FindLargest() {
+    assert(deferred_ == nodes_.size());
+    current_ = NULL;
+    if (base_ != NULL && base_->Valid()) {
+      current_ = base_;
+    }
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      if (nodes_[i]->Valid() &&
+          (current_ == NULL ||
+           icmp_->Compare(nodes_[i]->key(), current_->key()) > 0)) {
+        current_ = nodes_[i];
+      }
+    }
+  }
+
+  const InternalKeyComparator* icmp_;
+  Iterator* base_;
+  std::vector<BufferNodeIterator*> nodes_;  // Sorted by lower bound
+  size_t deferred_;     // nodes_[deferred_..] are not positioned yet
+  Iterator* current_;
+
+  // Which direction is the iterator moving?
+  enum Direction {
+    kForward,
+    kReverse
+  };
+  Direction direction_;
+};
+
+// Yields the files of a level.  key() is the largest key of a file and its
+// buffer, value() is the file's index encoded with EncodeFixed64.
+class BufferLevelFileIterator : public Iterator {
+ public:
+  BufferLevelFileIterator(const ReadOptions& options,
+                          TableCache* table_cache,
+                          TableCache* ssd_table_cache,
+                          const InternalKeyComparator* icmp,
+                          const std::vector<BufferedFile>& files)
+      : table_cache_(table_cache),
+        ssd_table_cache_(ssd_table_cache),
+        icmp_(icmp),
+        files_(files),
+        cursors_(options, ssd_table_cache),
+        index_(files.size()) {        // Marks as invalid
+  }
+  virtual bool Valid() const {
+    return index_ < files_.size();
+  }
+  virtual void Seek(const Slice& target) {
+    // Binary search for the first file whose largest key >= target
+    uint32_t left = 0;
+    uint32_t right = files_.size();
+    while (left < right) {
+      uint32_t mid = (left + right) / 2;
+      if (icmp_->Compare(files_[mid].largest, target) < 0) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    index_ = right;
+  }
+  virtual void SeekToFirst() { index_ = 0; }
+  virtual void SeekToLast() {
+    index_ = files_.empty() ? 0 : files_.size() - 1;
+  }
+  virtual void Next() {
+    assert(Valid());
+    index_++;
+  }
+  virtual void Prev() {
+    assert(Valid());
+    if (index_ == 0) {
+      index_ = files_.size();  // Marks as invalid
+    } else {
+      index_--;
+    }
+  }
+  Slice key() const {
+    assert(Valid());
+    return files_[index_].largest;
+  }
+  Slice value() const {
+    assert(Valid());
+    EncodeFixed64(value_buf_, index_);
+    return Slice(value_buf_, sizeof(value_buf_));
+  }
+  virtual Status status() const { return Status::OK(); }
+
+  static Iterator* GetFileIterator(void* arg,
+                                   const ReadOptions& options,
+                                   const Slice& file_value) {
+    BufferLevelFileIterator* level =
+        reinterpret_cast<BufferLevelFileIterator*>(arg);
+    const BufferedFile& f = level->files_[DecodeFixed64(file_value.data())];
+    Iterator* base = level->table_cache_->NewIterator(options, f.number,
+                                                      f.file_size);
+    if (f.nodes.empty()) {
+      return base;
+    }
+    return NewBufferMergingIterator(options, level->ssd_table_cache_,
+                                    level->icmp_, base, f.nodes,
+                                    &level->cursors_);
+  }
+
+ private:
+  TableCache* const table_cache_;
+  TableCache* const ssd_table_cache_;
+  const InternalKeyComparator* const icmp_;
+  const std::vector<BufferedFile> files_;
+  // The two-level iterator deletes its file iterator before this one
+  BufferCursorPool cursors_;
+  uint32_t index_;
+
+  // Backing store for value().  Holds the file index.
+  mutable char value_buf_[8];
+};
+
+}  // namespace
+
+Iterator* NewBufferMergingIterator(const ReadOptions& options,
+                                   TableCache* cache,
+                                   const InternalKeyComparator* icmp,
+                                   Iterator* base,
+                                   const std::vector<BufferNodeBound>& nodes,
+                                   BufferCursorPool* pool) {
+  return new BufferMergingIterator(options, cache, icmp, base, nodes, pool);
 }
 
-BufferNodeIterator::~BufferNodeIterator(){
-  delete iterator_;
+Iterator* NewBufferIterator(const ReadOptions& options,
+                            VersionSet* vset,
+                            const Buffer* buffer,
+                            uint64_t sequence,
+                            const RangeDelMap* range_del) {
+  assert(buffer != NULL);
+  std::vector<BufferNodeBound> nodes;
+  GetVisibleBufferNodes(buffer, sequence, &nodes, range_del);
+  return NewBufferMergingIterator(options, vset->ssd_table_cache_,
+                                  &vset->icmp_, NULL, nodes);
 }
 
-Iterator* NewBufferIterator(const ReadOptions& options,VersionSet* vset,Buffer* buffer){
-    
-     std::vector<Iterator*> list;
-     assert(buffer!=NULL);
-     //std::cout<<"buffer iterator build"<<std::endl;
-     for(int i=0;i<buffer->nodes.size();i++){
-     	 BufferNodeIterator* ptr = new BufferNodeIterator(options,vset,&(buffer->nodes[i]));
-     	 list.push_back(ptr);
-     }
-     Iterator* buffer_iter =
-      NewMergingIterator(&(vset->icmp_), &list[0], list.size());
-      return buffer_iter;
-    }
+Iterator* NewBufferLevelIterator(const ReadOptions& options,
+                                 TableCache* table_cache,
+                                 TableCache* ssd_table_cache,
+                                 const InternalKeyComparator* icmp,
+                                 const std::vector<BufferedFile>& files) {
+  BufferLevelFileIterator* level = new BufferLevelFileIterator(
+      options, table_cache, ssd_table_cache, icmp, files);
+  return NewTwoLevelIterator(level, &BufferLevelFileIterator::GetFileIterator,
+                             level, options);
+}
 
 
-} // namespace leveldb
\ No newline at end of file
+} // namespace leveldb
@@ -1,72 +1,145 @@
 #ifndef STORAGE_LEVELDB_DB_BUFFER_ITERATOR_H_
 #define STORAGE_LEVELDB_DB_BUFFER_ITERATOR_H_
 
+#include <map>
+#include <string>
 #include <vector>
-#include <set>
 #include "db/dbformat.h"
-#include "db/log_writer.h"
-#include "db/snapshot.h"
-#include "leveldb/db.h"
-#include "leveldb/env.h"
-#include "port/port.h"
-#include "port/thread_annotations.h"
-#include "table/merger.h"
 #include "db/version_edit.h"
-#include "db/version_set.h"
 #include "leveldb/iterator.h"
-#include "leveldb/comparator.h"
+#include "leveldb/options.h"
 
 
 namespace leveldb{
-    class BufferNodeIterator : public Iterator{
-    private:
-        BufferNode* buffernode_;
-        Iterator* iterator_;   //对应sst的iterator
-        const InternalKeyComparator* icmp_;
-        
+
+    class TableCache;
+    class VersionSet;
+
+    // Range of a buffer node as seen by one iterator.  Copied out of the
+    // shared Buffer, which later versions keep appending nodes to.
+    struct BufferNodeBound{
+        uint64_t number;        // Source table
+        uint64_t filesize;
+        bool inend;             // Starts at the beginning of the source table
+        std::string smallest;   // Exclusive bound, empty if inend
+        std::string largest;    // Inclusive bound
+    };
+
+    // A level file and the nodes of its buffer as seen by one iterator.
+    struct BufferedFile{
+        uint64_t number;
+        uint64_t file_size;
+        std::string largest;    // Largest key of the file and its nodes
+        std::vector<BufferNodeBound> nodes;
+    };
+
+    // Dispatch cuts a source table into consecutive nodes held by
+    // neighbouring files.  A pool keeps one iterator per source table, so
+    // the nodes of a table visited one after another share its index and
+    // current data block instead of reopening the table each time.
+    // Not thread-safe: each scan or merging thread owns its pool.
+    class BufferCursorPool{
     public:
-        BufferNodeIterator(const ReadOptions& options,VersionSet* vset,BufferNode* node);
-        //在vset中拿到table_cache，icmp
-        //根据传入的ssd_table_cache打开Table，然后拿到这个table的iter,,具体了流程参考table_cache的newiterator代码
-        // ssd_table_cache是为ssd中的文件建立的table_cache
+        BufferCursorPool(const ReadOptions& options, TableCache* cache);
+        ~BufferCursorPool();
 
-        virtual bool Valid() const ;
-        //return iter->Valid() && node_->largest >= iter->key()  && node_->smallest <= iter->key()
+        // Return an iterator over table "number" to be handed back with
+        // Release().  A table whose cursor is in use gets a private one.
+        Iterator* Acquire(uint64_t number, uint64_t filesize);
+        void Release(uint64_t number, Iterator* iter);
 
-        virtual Slice key() const;
-        // return iter->key();
+    private:
+        struct Cursor{
+            Iterator* iter;
+            bool in_use;
+        };
 
-        virtual Slice value() const;
-        //同上
+        const ReadOptions options_;
+        TableCache* const cache_;
+        std::map<uint64_t, Cursor> cursors_;
 
-        virtual Status status() const ;
+        // No copying allowed
+        BufferCursorPool(const BufferCursorPool&);
+        void operator=(const BufferCursorPool&);
+    };
 
-        virtual void Next();
-       // 如果还在buffernode的范围内，将指针右移
-        // if(iter->key() < =node_->largest) iter->next();
+    // Yields the entries of a node's source table that fall in the node's
+    // range.  The table is not opened until the iterator is positioned
+    // inside that range.  "pool" may be NULL.
+    class BufferNodeIterator : public Iterator{
+    public:
+        BufferNodeIterator(const ReadOptions& options,
+                           TableCache* cache,
+                           const InternalKeyComparator* icmp,
+                           const BufferNodeBound& bound,
+                           BufferCursorPool* pool = NULL);
+        virtual ~BufferNodeIterator();
 
+        virtual bool Valid() const;
+        virtual Slice key() const;
+        virtual Slice value() const;
+        virtual Status status() const;
+        virtual void Next();
         virtual void Prev();
-        //同上
-
         virtual void Seek(const Slice& target);
-        // 将指针移到大于等于target的第一个位置，如果没有，将指针指向最后一个数,如果小于最小，指向第一个数
-        // iter->Seek(target)
-        //if(iter->key()>node_->largest)
-        // SeekTolast()
-        //if(iter->key()>node_->largest)
-        // SeekToFirst()
-
         virtual void SeekToFirst();
-        //iter->Seek(node_->smallest)
-        //assert(iter中没有key等于smallest)
         virtual void SeekToLast();
-      //iter->Seek(node_->largest)
-        // assert(类似)
 
-        virtual ~BufferNodeIterator();
-       //delete iter
+        const BufferNodeBound& bound() const { return bound_; }
+
+    private:
+        void Open();
+        bool InRange(const Slice& k) const;
+
+        const ReadOptions options_;
+        TableCache* const cache_;
+        const InternalKeyComparator* const icmp_;
+        const BufferNodeBound bound_;
+        BufferCursorPool* const pool_;
+        Iterator* iterator_;    // NULL until the table is opened
+        bool exhausted_;        // Positioned past the node's range
+
+        // No copying allowed
+        BufferNodeIterator(const BufferNodeIterator&);
+        void operator=(const BufferNodeIterator&);
     };
 
-    extern Iterator* NewBufferIterator(const ReadOptions& options,VersionSet* vset,Buffer* buffer);
+    // Append the nodes of "buffer" visible at version "sequence" to *nodes.
+    // Nodes whose entries "range_del", if not NULL, deletes entirely are
+    // left out.
+    extern void GetVisibleBufferNodes(const Buffer* buffer, uint64_t sequence,
+                                      std::vector<BufferNodeBound>* nodes,
+                                      const RangeDelMap* range_del = NULL);
+
+    // Return an iterator merging "base", which may be NULL, with the
+    // nodes read through "cache", or through "pool" if it is not NULL.
+    // Takes ownership of "base"; "pool" must outlive the result.  A node's
+    // table is opened once the iteration reaches the node's range.
+    extern Iterator* NewBufferMergingIterator(
+        const ReadOptions& options,
+        TableCache* cache,
+        const InternalKeyComparator* icmp,
+        Iterator* base,
+        const std::vector<BufferNodeBound>& nodes,
+        BufferCursorPool* pool = NULL);
+
+    // Return an iterator over the nodes of "buffer" visible at version
+    // "sequence", skipping those "range_del" covers as above.
+    extern Iterator* NewBufferIterator(const ReadOptions& options,
+                                       VersionSet* vset,
+                                       const Buffer* buffer,
+                                       uint64_t sequence,
+                                       const RangeDelMap* range_del = NULL);
+
+    // Return a concatenating iterator over the files of a level, each
+    // merged with its buffer.  Files are opened lazily through
+    // "table_cache" and nodes through "ssd_table_cache", with one cursor
+    // pool shared by all files of the level.
+    extern Iterator* NewBufferLevelIterator(
+        const ReadOptions& options,
+        TableCache* table_cache,
+        TableCache* ssd_table_cache,
+        const InternalKeyComparator* icmp,
+        const std::vector<BufferedFile>& files);
 }
 #endif
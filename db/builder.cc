@@ -11,6 +11,7 @@
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "util/rate_limiter.h"
 
 namespace leveldb {
 
@@ -31,13 +32,24 @@ Status BuildTable(const std::string& dbname,
     if (!s.ok()) {
       return s;
     }
+    //whc add
+    if (options.rate_limiter != NULL) {
+      file = NewRateLimitedWritableFile(file, options.rate_limiter,
+                                        RateLimiter::kIOHigh);
+    }
 
     TableBuilder* builder = new TableBuilder(options, file);
     meta->smallest.DecodeFrom(iter->key());
+    //whc add
+    meta->smallest_seq = kMaxSequenceNumber;
+    meta->largest_seq = 0;
+    meta->num_entries = 0;
+    meta->num_deletions = 0;
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
       meta->largest.DecodeFrom(key);
       builder->Add(key, iter->value());
+      meta->AddEntry(key);  //whc add
     }
 
     // Finish and check for builder errors
@@ -64,9 +76,11 @@ Status BuildTable(const std::string& dbname,
 
     if (s.ok()) {
       // Verify that the table is usable
+      //whc change
+      // Tables built from a memtable start at level 0
       Iterator* it = table_cache->NewIterator(ReadOptions(),
                                               meta->number,
-                                              meta->file_size);
+                                              meta->file_size, NULL, 0);
       s = it->status();
       delete it;
     }
@@ -28,6 +28,7 @@ using leveldb::kMajorVersion;
 using leveldb::kMinorVersion;
 using leveldb::Logger;
 using leveldb::NewBloomFilterPolicy;
+using leveldb::NewClockCache;
 using leveldb::NewLRUCache;
 using leveldb::Options;
 using leveldb::RandomAccessFile;
@@ -438,6 +439,11 @@ void leveldb_options_set_cache(leveldb_options_t* opt, leveldb_cache_t* c) {
   opt->rep.block_cache = c->rep;
 }
 
+//whc add
+void leveldb_options_set_row_cache(leveldb_options_t* opt, leveldb_cache_t* c) {
+  opt->rep.row_cache = c->rep;
+}
+
 void leveldb_options_set_block_size(leveldb_options_t* opt, size_t s) {
   opt->rep.block_size = s;
 }
@@ -563,6 +569,13 @@ leveldb_cache_t* leveldb_cache_create_lru(size_t capacity) {
   return c;
 }
 
+leveldb_cache_t* leveldb_cache_create_clock(size_t capacity,
+                                            int num_shard_bits) {
+  leveldb_cache_t* c = new leveldb_cache_t;
+  c->rep = NewClockCache(capacity, num_shard_bits);
+  return c;
+}
+
 void leveldb_cache_destroy(leveldb_cache_t* cache) {
   delete cache->rep;
   delete cache;
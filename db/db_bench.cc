@@ -96,6 +96,18 @@ static int FLAGS_block_size = 0;
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// If true, use the scan-resistant CLOCK cache rather than the LRU one,
+// split over 2^FLAGS_cache_shard_bits shards (negative picks a default).
+static bool FLAGS_clock_cache = false;
+static int FLAGS_cache_shard_bits = -1;
+
+// If true, charge index and filter blocks to the block cache.
+static bool FLAGS_cache_index_and_filter_blocks = false;
+
+// Number of bytes to use as a cache of point lookup results in table
+// files.  Zero or negative means no row cache.
+static int FLAGS_row_cache_size = 0;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -317,6 +329,7 @@ struct ThreadState {
 class Benchmark {
  private:
   Cache* cache_;
+  Cache* row_cache_;  //whc add
   const FilterPolicy* filter_policy_;
   DB* db_;
   int num_;
@@ -402,7 +415,12 @@ class Benchmark {
 
  public:
   Benchmark()
-  : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
+  : cache_(FLAGS_cache_size < 0 ? NULL :
+           FLAGS_clock_cache ? NewClockCache(FLAGS_cache_size,
+                                             FLAGS_cache_shard_bits) :
+           NewLRUCache(FLAGS_cache_size)),
+    row_cache_(FLAGS_row_cache_size > 0 ? NewLRUCache(FLAGS_row_cache_size)
+                                        : NULL),
     filter_policy_(FLAGS_bloom_bits >= 0
                    ? NewBloomFilterPolicy(FLAGS_bloom_bits)
                    : NULL),
@@ -427,6 +445,7 @@ class Benchmark {
   ~Benchmark() {
     delete db_;
     delete cache_;
+    delete row_cache_;
     delete filter_policy_;
   }
 
@@ -712,6 +731,9 @@ class Benchmark {
     options.env = g_env;
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
+    options.cache_index_and_filter_blocks =
+        FLAGS_cache_index_and_filter_blocks;
+    options.row_cache = row_cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
     options.max_file_size = FLAGS_max_file_size;
     options.block_size = FLAGS_block_size;
@@ -993,6 +1015,16 @@ int main(int argc, char** argv) {
       FLAGS_block_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--clock_cache=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_clock_cache = n;
+    } else if (sscanf(argv[i], "--cache_shard_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_cache_shard_bits = n;
+    } else if (sscanf(argv[i], "--cache_index_and_filter_blocks=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_cache_index_and_filter_blocks = n;
+    } else if (sscanf(argv[i], "--row_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_row_cache_size = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <vector>
+#include "db/buffer_iterator.h"
 #include "db/builder.h"
 #include "db/db_iter.h"
 #include "db/dbformat.h"
@@ -17,9 +18,11 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/range_del.h"
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/status.h"
@@ -28,10 +31,13 @@
 #include "port/port.h"
 #include "table/block.h"
 #include "table/merger.h"
+#include "table/prefetch_iterator.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/rate_limiter.h"
+#include "util/thread_local.h"
 #include <iostream>
 #include <fstream>
 
@@ -50,6 +56,63 @@ struct DBImpl::Writer {
   explicit Writer(port::Mutex* mu) : cv(mu) { }
 };
 
+//whc add
+// The memtables and version a read looks at.  A view holds a reference
+// to each of them, dropped under *mu once the view is no longer used.
+//
+// Reads get their view without locking mutex_: read_views_ holds for
+// each thread NULL or the view it last used, with a reference owned by
+// the cache.  While the thread reads through it, it leaves
+// kReadViewInUse there instead.  InstallReadView() replaces the cached
+// views by NULL and drops their references; a read that finds its
+// kReadViewInUse gone at the end drops the reference it was using.
+struct DBImpl::ReadView {
+  port::Mutex* const mu;
+  MemTable* const mem;
+  MemTable* const imm;         // May be NULL
+  Version* const current;
+  std::atomic<int> refs;
+
+  // Holds a reference to each part.  REQUIRES: *mu held.
+  ReadView(port::Mutex* m, MemTable* mt, MemTable* im, Version* v)
+      : mu(m), mem(mt), imm(im), current(v), refs(1) {
+    mem->Ref();
+    if (imm != NULL) imm->Ref();
+    current->Ref();
+  }
+
+  // REQUIRES: The caller holds a reference
+  void Ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+  // Drop a reference, locking *mu to delete the view unless "mu_held"
+  void Unref(bool mu_held) {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      if (!mu_held) mu->Lock();
+      mem->Unref();
+      if (imm != NULL) imm->Unref();
+      current->Unref();
+      if (!mu_held) mu->Unlock();
+      delete this;
+    }
+  }
+
+  // Called for the cached view of an exiting thread
+  static void UnrefCached(void* ptr) {
+    reinterpret_cast<ReadView*>(ptr)->Unref(false);
+  }
+
+  // Called for the view of a deleted iterator
+  static void CleanupIterator(void* arg1, void* arg2) {
+    UnrefCached(arg1);
+  }
+};
+
+namespace {
+// Left in DBImpl::read_views_ by a thread reading through its view
+char read_view_in_use;
+void* const kReadViewInUse = &read_view_in_use;
+}  // namespace
+
 struct DBImpl::CompactionState {
   Compaction* const compaction;
 
@@ -64,6 +127,17 @@ struct DBImpl::CompactionState {
     uint64_t number;
     uint64_t file_size;
     InternalKey smallest, largest;
+    //whc add
+    SequenceNumber smallest_seq, largest_seq;
+    uint64_t num_entries, num_deletions;
+
+    void AddEntry(const Slice& internal_key) {
+      const SequenceNumber seq = ExtractSequence(internal_key);
+      if (seq < smallest_seq) smallest_seq = seq;
+      if (seq > largest_seq) largest_seq = seq;
+      num_entries++;
+      if (ExtractValueType(internal_key) == kTypeDeletion) num_deletions++;
+    }
   };
   std::vector<Output> outputs;
 
@@ -76,17 +150,64 @@ struct DBImpl::CompactionState {
   //whc add
   std::vector<FileMetaData> buffer_input;
 
+  // Range tombstones no newer than smallest_snapshot, may be NULL.  Not
+  // owned, shared by the threads of one compaction or buffer merge.
+  const RangeDelMap* range_del;
+
+  // Position of Compaction::IsBaseLevelForKey for the files merged with
+  // their buffers through this state
+  size_t level_ptrs[config::kNumLevels];
+
+  // Position of Compaction::ShouldStopBefore for the keys compacted
+  // through this state
+  Compaction::GrandparentState grandparent_state;
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        range_del(NULL) {
+    for (int i = 0; i < config::kNumLevels; i++) {
+      level_ptrs[i] = 0;
+    }
   }
 };
 
 
+//whc add
+// Shared by the threads of one MergeBuffers() call
+struct DBImpl::BufferMergeState {
+  DBImpl* const db;
+  CompactionState* const compact;
+
+  // State below is protected by db->mutex_
+  int next_index;   // Next input file to merge
+  int running;      // Threads that have not finished yet
+  Status status;    // First error seen by any thread
+
+  BufferMergeState(DBImpl* d, CompactionState* c)
+      : db(d), compact(c), next_index(0), running(0) { }
+};
+
+//whc add
+// Shared by the threads of one DoCompactionWork() call
+struct DBImpl::SubcompactionState {
+  DBImpl* const db;
+  CompactionState* const compact;
+  std::vector<std::string> splits;  // See Compaction::GetSubcompactionSplits
+
+  // State below is protected by db->mutex_
+  size_t next_range;  // Next range (splits[i-1], splits[i]] to compact
+  int running;        // Threads that have not finished yet
+  Status status;      // First error seen by any thread
+
+  SubcompactionState(DBImpl* d, CompactionState* c)
+      : db(d), compact(c), next_range(0), running(0) { }
+};
+
 //whc add
 struct DBImpl::PartialCompactionStats{
   int64_t micros;
@@ -243,6 +364,17 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.max_buffer_merge_threads, 1,                    64);
+  ClipToRange(&result.max_background_compactions, 1,                  64);
+  ClipToRange(&result.max_subcompactions, 1,                          64);
+  ClipToRange(&result.block_compression_threads, 0,                   64);
+  for (size_t i = 0; i < result.buffer_merge_threshold.size(); i++) {
+    ClipToRange(&result.buffer_merge_threshold[i], 1,                 1<<20);
+  }
+  ClipToRange(&result.ssd_max_open_files, 16, result.max_open_files / 2);
+  if (result.ssd_env == NULL) {
+    result.ssd_env = result.env;
+  }
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -278,26 +410,43 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       logfile_number_(0),
       log_(NULL),
       seed_(0),
+      read_view_(NULL),
+      read_views_(new ThreadLocalPtr(&ReadView::UnrefCached)),
       tmp_batch_(new WriteBatch),
-      bg_compaction_scheduled_(false),
+      bg_compaction_scheduled_(0),
+      bg_flush_scheduled_(false),
+      flushing_memtable_(false),
+      logging_manifest_(false),
+      reclaiming_table_(false),
+      bg_compaction_blocked_(false),
+      write_controller_(options_.delayed_write_rate,
+                        options_.soft_pending_compaction_bytes_limit),
       manual_compaction_(NULL),
-      ssdname_(dbname) {
+      ssdname_(raw_options.ssd_path.empty() ? dbname : raw_options.ssd_path),
+      ssd_options_(options_) {
   has_imm_.Release_Store(NULL);
 
   // Reserve ten files or so for other uses and give the rest to TableCache.
   //whc change
-  const int ssd_table_cache_size = 200;
+  // The fast tier's cache gets Options::ssd_max_open_files of them
+  const int ssd_table_cache_size = options_.ssd_max_open_files;
   const int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles - ssd_table_cache_size;
   table_cache_ = new TableCache(dbname_, &options_, table_cache_size);
 
   //whc add
-  ssd_table_cache_ = new TableCache(ssdname_, &options_, ssd_table_cache_size);
+  ssd_options_.env = options_.ssd_env;
+  ssd_table_cache_ = new TableCache(ssdname_, &ssd_options_,
+                                    ssd_table_cache_size);
 
 //  versions_ = new VersionSet(dbname_, &options_, table_cache_,
                              //&internal_comparator_);
   versions_ = new VersionSet(dbname_, &options_, table_cache_,
                                &internal_comparator_,ssdname_,ssd_table_cache_);
 
+  //whc add
+  // Compaction workers and one more for memtable flushes
+  env_->SetBackgroundThreads(options_.max_background_compactions + 1);
+
   //whc add
   //versions_ ->SetSSDCache(ssd_table_cache_);
   //whc add
@@ -313,10 +462,22 @@ DBImpl::~DBImpl() {
 	// Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_) {
+  while (bg_compaction_scheduled_ > 0 || bg_flush_scheduled_) {
     bg_cv_.Wait();
   }
+  //whc add
+  // Take back the views cached by threads; none is reading anymore
+  std::vector<void*> cached;
+  read_views_->Scrape(&cached, NULL);
+  for (size_t i = 0; i < cached.size(); i++) {
+    reinterpret_cast<ReadView*>(cached[i])->Unref(true);
+  }
+  if (read_view_ != NULL) {
+    read_view_->Unref(true);
+    read_view_ = NULL;
+  }
   mutex_.Unlock();
+  delete read_views_;
 
   if (db_lock_ != NULL) {
     env_->UnlockFile(db_lock_);
@@ -349,6 +510,7 @@ DBImpl::~DBImpl() {
   delete log_;
   delete logfile_;
   delete table_cache_;
+  delete ssd_table_cache_;  //whc add
 
   if (owns_info_log_) {
     delete options_.info_log;
@@ -399,6 +561,26 @@ void DBImpl::MaybeIgnoreError(Status* s) const {
   }
 }
 
+//whc add
+void DBImpl::DeleteObsoleteTables(const std::set<uint64_t>& live) {
+  Env* const env = options_.ssd_env;
+  std::vector<std::string> filenames;
+  env->GetChildren(ssdname_, &filenames); // Ignoring errors on purpose
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (ParseFileName(filenames[i], &number, &type) &&
+        (type == kTableFile || type == kTempFile) &&
+        live.find(number) == live.end()) {
+      ssd_table_cache_->Evict(number);
+      Log(options_.info_log, "Delete fast tier type=%d #%lld\n",
+          int(type),
+          static_cast<unsigned long long>(number));
+      env->DeleteFile(ssdname_ + "/" + filenames[i]);
+    }
+  }
+}
+
 void DBImpl::DeleteObsoleteFiles() {
   if (!bg_error_.ok()) {
     // After a background error, we don't know whether a new version may
@@ -407,8 +589,15 @@ void DBImpl::DeleteObsoleteFiles() {
   }
 
   // Make a set of all of the live files
+  //whc change
   std::set<uint64_t> live = pending_outputs_;
-  versions_->AddLiveFiles(&live);
+  std::set<uint64_t> ssd_live = pending_outputs_;
+  versions_->AddLiveFiles(&live, &ssd_live);
+  if (ssdname_ == dbname_) {
+    live.insert(ssd_live.begin(), ssd_live.end());
+  } else {
+    DeleteObsoleteTables(ssd_live);
+  }
 
   std::vector<std::string> filenames;
   env_->GetChildren(dbname_, &filenames); // Ignoring errors on purpose
@@ -445,6 +634,10 @@ void DBImpl::DeleteObsoleteFiles() {
       if (!keep) {
         if (type == kTableFile) {
           table_cache_->Evict(number);
+          //whc add
+          if (ssdname_ == dbname_) {
+            ssd_table_cache_->Evict(number);
+          }
         }
         Log(options_.info_log, "Delete type=%d #%lld\n",
             int(type),
@@ -462,6 +655,7 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   // committed only when the descriptor is created, and this directory
   // may already exist from a previous failed creation attempt.
   env_->CreateDir(dbname_);
+  options_.ssd_env->CreateDir(ssdname_);  //whc add
   assert(db_lock_ == NULL);
   Status s = env_->LockFile(LockFileName(dbname_), &db_lock_);
   if (!s.ok()) {
@@ -506,7 +700,13 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
     return s;
   }
   std::set<uint64_t> expected;
-  versions_->AddLiveFiles(&expected);
+  //whc change
+  std::set<uint64_t> ssd_expected;
+  versions_->AddLiveFiles(&expected, &ssd_expected);
+  if (ssdname_ == dbname_) {
+    expected.insert(ssd_expected.begin(), ssd_expected.end());
+    ssd_expected.clear();
+  }
   uint64_t number;
   FileType type;
   std::vector<uint64_t> logs;
@@ -523,6 +723,23 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
              static_cast<int>(expected.size()));
     return Status::Corruption(buf, TableFileName(dbname_, *(expected.begin())));
   }
+  if (!ssd_expected.empty()) {
+    filenames.clear();
+    options_.ssd_env->GetChildren(ssdname_, &filenames);  // Ignoring errors
+    for (size_t i = 0; i < filenames.size(); i++) {
+      if (ParseFileName(filenames[i], &number, &type)) {
+        ssd_expected.erase(number);
+      }
+    }
+    if (!ssd_expected.empty()) {
+      char buf[50];
+      snprintf(buf, sizeof(buf), "%d missing files; e.g.",
+               static_cast<int>(ssd_expected.size()));
+      return Status::Corruption(buf,
+                                TableFileName(ssdname_,
+                                              *(ssd_expected.begin())));
+    }
+  }
 
   // Recover in the order in which the logs were generated
   std::sort(logs.begin(), logs.end());
@@ -622,7 +839,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
       compactions++;
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, NULL);
+      uint64_t number;
+      status = WriteLevel0Table(mem, edit, NULL, &number);
+      pending_outputs_.erase(number);  // Nothing deletes files yet
       mem->Unref();
       mem = NULL;
       if (!status.ok()) {
@@ -661,7 +880,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     // mem did not get reused; compact it.
     if (status.ok()) {
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, NULL);
+      uint64_t number;
+      status = WriteLevel0Table(mem, edit, NULL, &number);
+      pending_outputs_.erase(number);  // Nothing deletes files yet
     }
     mem->Unref();
   }
@@ -670,12 +891,13 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
 }
 
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+                                Version* base, uint64_t* number) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
   meta.number = versions_->NewFileNumber();
   pending_outputs_.insert(meta.number);
+  *number = meta.number;
   Iterator* iter = mem->NewIterator();
   Log(options_.info_log, "Level-0 table #%llu: started",
       (unsigned long long) meta.number);
@@ -683,7 +905,11 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    // Memtables are always flushed to level-0, see kMaxMemCompactLevel
+    //whc change
+    const bool ssd = BCJudge::IsSSDLevel(&options_, 0);
+    s = BuildTable(ssd ? ssdname_ : dbname_, ssd ? options_.ssd_env : env_,
+                   options_, versions_->TableCacheForLevel(0), iter, &meta);
     mutex_.Lock();
   }
 
@@ -692,7 +918,6 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
   delete iter;
-  pending_outputs_.erase(meta.number);
 
 
   // Note that if file_size is zero, the file has been deleted and
@@ -705,7 +930,18 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
     }
     edit->AddFile(level, meta.number, meta.file_size,
-                  meta.smallest, meta.largest);
+                  meta.smallest, meta.largest,
+                  meta.smallest_seq, meta.largest_seq,
+                  meta.num_entries, meta.num_deletions);
+  }
+
+  //whc add
+  // Range tombstones go to the version, they delete entries of any file
+  std::vector<RangeTombstone> tombstones;
+  mem->GetRangeTombstones(kMaxSequenceNumber, &tombstones);
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    edit->AddRangeTombstone(tombstones[i].begin, tombstones[i].end,
+                            tombstones[i].sequence);
   }
 
 /*
@@ -734,12 +970,16 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
   assert(imm_ != NULL);
+  //whc add
+  assert(!flushing_memtable_);
+  flushing_memtable_ = true;
 
   // Save the contents of the memtable as a new Table
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  uint64_t number;
+  Status s = WriteLevel0Table(imm_, &edit, base, &number);
   base->Unref();
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
@@ -750,20 +990,46 @@ void DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
+  pending_outputs_.erase(number);
 
+  flushing_memtable_ = false;
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = NULL;
     has_imm_.Release_Store(NULL);
+    InstallReadView();  //whc add
+    bg_compaction_blocked_ = false;  // Level-0 may need a compaction
     DeleteObsoleteFiles();
   } else {
     RecordBackgroundError(s);
   }
 }
 
+//whc add
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (logging_manifest_) {
+    bg_cv_.Wait();
+  }
+  logging_manifest_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  logging_manifest_ = false;
+  InstallReadView();
+  UpdateWriteController();
+  bg_cv_.SignalAll();
+  return s;
+}
+
+//whc add
+void DBImpl::UpdateWriteController() {
+  mutex_.AssertHeld();
+  write_controller_.Update(env_->NowMicros(), versions_->NumLevelFiles(0),
+                           versions_->CompactionDebt());
+}
+
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   int max_level_with_files = 1;
   {
@@ -844,18 +1110,32 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.Acquire_Load()) {
+  //whc change
+  // Memtables are flushed on a background thread of their own, so that
+  // writers do not wait for compactions to finish
+  if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
+    return;
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == NULL &&
-             manual_compaction_ == NULL &&
-             !versions_->NeedsCompaction()) {
+    return;
+  }
+  if (imm_ != NULL && !bg_flush_scheduled_) {
+    bg_flush_scheduled_ = true;
+    env_->Schedule(&DBImpl::BGFlushWork, this);
+  }
+  if (manual_compaction_ != NULL) {
+    // A manual compaction runs alone, once the others are done
+    if (bg_compaction_scheduled_ == 0) {
+      bg_compaction_scheduled_++;
+      env_->Schedule(&DBImpl::BGWork, this);
+    }
+  } else if (bg_compaction_scheduled_ >= options_.max_background_compactions) {
+    // Enough workers scheduled
+  } else if (bg_compaction_blocked_ || !versions_->NeedsCompaction()) {
     // No work to be done
   } else {
-    bg_compaction_scheduled_ = true;
+    bg_compaction_scheduled_++;
     env_->Schedule(&DBImpl::BGWork, this);
   }
 }
@@ -864,9 +1144,29 @@ void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
 
+//whc add
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (imm_ != NULL && !flushing_memtable_) {
+    CompactMemTable();
+  }
+  bg_flush_scheduled_ = false;
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+}
+
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(bg_compaction_scheduled_ > 0);
   if (shutting_down_.Acquire_Load()) {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
@@ -875,7 +1175,7 @@ void DBImpl::BackgroundCall() {
     BackgroundCompaction();
   }
 
-  bg_compaction_scheduled_ = false;
+  bg_compaction_scheduled_--;
 
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
@@ -883,56 +1183,92 @@ void DBImpl::BackgroundCall() {
   bg_cv_.SignalAll();
 }
 
-//whc add
-void DBImpl::CopyToSSD( void* state2){
-	CompactionState* state = reinterpret_cast<CompactionState*>(state2);
-	std::ifstream in;
-	std::ofstream out;
-	std::string SourceFile;
-	std::string NewFile;
-	std::vector<FileMetaData*>  inputs = state->compaction->GetLevelFIle();
-	for(int i=0;i<inputs.size();i++){
-		SourceFile = TableFileName(dbname_,inputs[i]->number);
-		NewFile = TableFileName(ssdname_,inputs[i]->number);
-		in.open(SourceFile.c_str(),std::ios::binary);//打开源文件
-		  if(in.fail())//打开源文件失败
-		  {
-		     std::cout<<"Error 1: Fail to open the source file."<<std::endl;
-		     in.close();
-		     out.close();
-		     return;
-		  }
-		  out.open(NewFile.c_str(),std::ios::binary);//创建目标文件
-		  if(out.fail())//创建文件失败
-		  {
-		    std:: cout<<"Error 2: Fail to create the new file."<<std::endl;
-		    std::cout<<NewFile<<std::endl;
-		    out.close();
-		     in.close();
-		     return;
-		  }
-		  else//复制文件
-		  {
-		     out<<in.rdbuf();
-		     out.close();
-		     in.close();
-		     return;
-		  }
-	}
-
+//whc change
+Status DBImpl::CopyToSSD(CompactionState* compact) {
+  const int level = compact->compaction->level();
+  if (ssdname_ == dbname_ || BCJudge::IsSSDLevel(&options_, level)) {
+    return Status::OK();
+  }
+  Env* const ssd_env = options_.ssd_env;
+  const std::vector<FileMetaData*>& inputs = compact->compaction->inputs_[0];
+  std::string scratch;
+  scratch.resize(65536);
+  Status s;
+  for (size_t i = 0; s.ok() && i < inputs.size(); i++) {
+    const std::string src = TableFileName(dbname_, inputs[i]->number);
+    const std::string dst = TableFileName(ssdname_, inputs[i]->number);
+    SequentialFile* in;
+    s = env_->NewSequentialFile(src, &in);
+    if (!s.ok()) {
+      break;
+    }
+    WritableFile* out;
+    s = ssd_env->NewWritableFile(dst, &out);
+    if (!s.ok()) {
+      delete in;
+      break;
+    }
+    if (options_.rate_limiter != NULL) {
+      out = NewRateLimitedWritableFile(out, options_.rate_limiter,
+                                       RateLimiter::kIOLow);
+    }
+    while (s.ok()) {
+      Slice fragment;
+      s = in->Read(scratch.size(), &fragment, &scratch[0]);
+      if (!s.ok() || fragment.empty()) {
+        break;
+      }
+      s = out->Append(fragment);
+    }
+    if (s.ok()) {
+      s = out->Sync();
+    }
+    if (s.ok()) {
+      s = out->Close();
+    }
+    delete out;
+    delete in;
+    if (!s.ok()) {
+      ssd_env->DeleteFile(dst);
+    }
+  }
+  return s;
 }
 
 void DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != NULL) {
+  //whc change
+  // Envs running Schedule()d work on one thread leave flushes to us
+  if (imm_ != NULL && !flushing_memtable_) {
     CompactMemTable();
     return;
   }
 
   Compaction* c;
   bool is_manual = (manual_compaction_ != NULL);
+  //whc add
+  if (is_manual && bg_compaction_scheduled_ > 1) {
+    // Scheduled before the manual compaction; the last worker to finish
+    // schedules it
+    return;
+  }
+  if (!is_manual && (bg_compaction_blocked_ || reclaiming_table_)) {
+    bg_compaction_blocked_ = true;
+    return;
+  }
+  //whc add
+  // Files range tombstones deleted entirely are dropped before anything
+  // is picked, so that no compaction reads them
+  if (versions_->NeedsRangeDeletions()) {
+    Status s = DropRangeDeletedFiles();
+    if (!s.ok()) {
+      RecordBackgroundError(s);
+      return;
+    }
+  }
   InternalKey manual_end;
+  bool c_was_buffer_merge = false;
   if (is_manual) {
     ManualCompaction* m = manual_compaction_;
     c = versions_->CompactRange(m->level, m->begin, m->end);
@@ -951,16 +1287,45 @@ void DBImpl::BackgroundCompaction() {
   }
 
   Status status;
+  //whc add
+  if (c != NULL) {
+    // Another worker may pick a compaction not overlapping this one
+    MaybeScheduleCompaction();
+  }
   if (c == NULL) {
-    // Nothing to do
+    //whc change
+    // Rewrite a source table mostly merged away once nothing else is due.
+    // It changes the buffers of a whole level, so it runs alone.
+    if (is_manual) {
+    } else if (versions_->NumRunningCompactions() > 0) {
+      bg_compaction_blocked_ = true;
+    } else {
+      Version* base = versions_->current();
+      status = ReclaimBufferTable();
+      if (versions_->current() == base) {
+        bg_compaction_blocked_ = true;  // Until the version changes
+      }
+    }
+  } else if (c->IsBufferCompact) {
+    //whc add
+    // Merge files with their buffers in place
+    CompactionState* compact = new CompactionState(c);
+    status = MergeBuffers(compact);
+    CleanupCompaction(compact);
+    c->ReleaseInputs();
+    DeleteObsoleteFiles();
+    // The merged range still has to be compacted by a manual compaction
+    c_was_buffer_merge = true;
   } else if (!is_manual && c->IsTrivialMove()) {
     // Move file to next level
     assert(c->num_input_files(0) == 1);
     FileMetaData* f = c->input(0, 0);
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
-                       f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+                       f->smallest, f->largest,
+                       f->smallest_seq, f->largest_seq,
+                       f->num_entries, f->num_deletions);
+    status = LogAndApply(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
@@ -982,7 +1347,8 @@ void DBImpl::BackgroundCompaction() {
    // status = DoCompactionWork(compact);
    //whc change
   //if(compact->compaction->level_== config::kBufferCompactLevel){
-  if(BCJudge::IsBufferCompactLevel(compact->compaction->level_)){
+  if(BCJudge::IsBufferCompactLevel(&options_, compact->compaction->level_) &&
+     compact->compaction->num_input_files(1) > 0){
       //mutex_.Unlock();
       //CopyToSSD(compact);
       //mutex_.Lock();
@@ -996,6 +1362,11 @@ void DBImpl::BackgroundCompaction() {
     c->ReleaseInputs();
     DeleteObsoleteFiles();
   }
+  //whc add
+  if (c != NULL) {
+    versions_->ReleaseCompaction(c);
+    bg_compaction_blocked_ = false;  // Overlapping work may run now
+  }
   delete c;
 
   if (status.ok()) {
@@ -1012,7 +1383,7 @@ void DBImpl::BackgroundCompaction() {
     if (!status.ok()) {
       m->done = true;
     }
-    if (!m->done) {
+    if (!m->done && !c_was_buffer_merge) {
       // We only compacted part of the requested range.  Update *m
       // to the range that is left to be compacted.
       m->tmp_storage = manual_end;
@@ -1057,14 +1428,29 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
     out.number = file_number;
     out.smallest.Clear();
     out.largest.Clear();
+    out.smallest_seq = kMaxSequenceNumber;
+    out.largest_seq = 0;
+    out.num_entries = 0;
+    out.num_deletions = 0;
     compact->outputs.push_back(out);
     mutex_.Unlock();
   }
 
   // Make the output file
-  std::string fname = TableFileName(dbname_, file_number);
-  Status s = env_->NewWritableFile(fname, &compact->outfile);
+  //whc change
+  // Merged files stay at their level, compaction outputs go one level down
+  // unless they merge level-0 files into level-0
+  const Compaction* c = compact->compaction;
+  const int level = c->output_level();
+  const bool ssd = BCJudge::IsSSDLevel(&options_, level);
+  std::string fname = TableFileName(ssd ? ssdname_ : dbname_, file_number);
+  Env* const env = ssd ? options_.ssd_env : env_;
+  Status s = env->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
+    if (options_.rate_limiter != NULL) {
+      compact->outfile = NewRateLimitedWritableFile(
+          compact->outfile, options_.rate_limiter, RateLimiter::kIOLow);
+    }
     compact->builder = new TableBuilder(options_, compact->outfile);
   }
   return s;
@@ -1184,23 +1570,24 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
  //whc change
   const int level = compact->compaction->level();
   // Add compaction outputs
- if(!BCJudge::IsBufferCompactLevel(level))
+  // A dispatch keeps the next level's files and a buffer merge has no
+  // next level inputs, so only the files of "level" are deleted.
+ if(!compact->compaction->IsBufferCompact &&
+    !BCJudge::IsBufferCompactLevel(&options_, level))
 	 compact->compaction->AddInputDeletions(compact->compaction->edit());
  else compact->compaction->AddInputUpDeletions(compact->compaction->edit());
- //const int level = compact->compaction->level();
   //whc change
+  // Merged buffers replace their files in place
+  const int output_level = compact->compaction->output_level();
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
-    //if((!compact->compaction->IsBufferCompact) || level != config::kBufferCompactLevel +1)
-    if((!compact->compaction->IsBufferCompact) || (!BCJudge::IsBufferCompactLevel(level-1)))
     compact->compaction->edit()->AddFile(
-        level + 1,
-        out.number, out.file_size, out.smallest, out.largest);
-    else compact->compaction->edit()->AddFile(
-        level,
-        out.number, out.file_size, out.smallest, out.largest);
+        output_level,
+        out.number, out.file_size, out.smallest, out.largest,
+        out.smallest_seq, out.largest_seq,
+        out.num_entries, out.num_deletions);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return LogAndApply(compact->compaction->edit());
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -1225,33 +1612,159 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   } else {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
+  //whc add
+  RangeDelMap* range_del = NewRangeDelMap(compact->smallest_snapshot);
+  compact->range_del = range_del;
 
-  // Release mutex while we're actually doing the compaction work
-  mutex_.Unlock();
+  //whc change
+  // Large compactions are cut into key ranges merged side by side; this
+  // thread keeps flushing memtables meanwhile so writers are not stalled.
+  Status status;
+  SubcompactionState state(this, compact);
+  compact->compaction->GetSubcompactionSplits(options_.max_subcompactions,
+                                              &state.splits);
+  if (state.splits.empty()) {
+    // Release mutex while we're actually doing the compaction work
+    mutex_.Unlock();
+    status = CompactKeyRange(compact, NULL, NULL, &imm_micros);
+  } else {
+    Log(options_.info_log, "Compacting in %d subcompactions",
+        static_cast<int>(state.splits.size() + 1));
+    state.running = state.splits.size() + 1;
+    for (int i = state.running; i > 0; i--) {
+      env_->StartThread(&DBImpl::SubcompactionWork, &state);
+    }
+    while (state.running > 0) {
+      if (imm_ != NULL && !flushing_memtable_ && bg_error_.ok()) {
+        const uint64_t imm_start = env_->NowMicros();
+        CompactMemTable();
+        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+        imm_micros += (env_->NowMicros() - imm_start);
+      } else {
+        bg_cv_.Wait();
+      }
+    }
+    status = state.status;
+    mutex_.Unlock();
+  }
+  //whc add
+  compact->range_del = NULL;
+  delete range_del;
 
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+/*
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+
+//whc add
+uint64_t up_file = 0;
+for (int i = 0; i < compact->compaction->num_input_files(0); i++) {
+      up_file += compact->compaction->input(0, i)->file_size;
+}
+
+uint64_t down_file = 0;
+for (int i = 0; i < compact->compaction->num_input_files(1); i++) {
+      down_file += compact->compaction->input(1, i)->file_size;
+}
+ */
+
+//whc add
+/*
+  Log(w_log,
+  "whc inlevel%d 1file:%lld 2file:%lld output:%lld \n",
+  compact->compaction->level(),
+  up_file,
+  down_file,
+  output_size);
+*/
+  
+  mutex_.Lock();
+  //stats_[compact->compaction->level() + 1].Add(stats);
+  
+  //whc add
+  //statistics work
+  
+  if (status.ok()){
+      OneTimeCompactionStats ll_stats;
+      OneTimeCompactionStats hl_stats;
+
+      int mylevel = compact->compaction->level();
+      int64_t micros = env_->NowMicros() - start_micros - imm_micros;
+
+      CompactionStats::UpdateWhileCompact(compact, micros, ll_stats, hl_stats);
+      stats_[compact->compaction->level()].Add(ll_stats);
+      stats_[compact->compaction->output_level()].Add(hl_stats);
+  }
+  
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+//whc add
+Status DBImpl::CompactKeyRange(CompactionState* compact,
+                               const std::string* begin,
+                               const std::string* end,
+                               int64_t* imm_micros) {
+  Iterator* input = versions_->MakeInputIterator(compact->compaction,
+                                                 compact->range_del);
+  if (options_.rate_limiter != NULL) {
+    input = NewRateLimitedIterator(input, options_.rate_limiter,
+                                   RateLimiter::kIOLow);
+  }
+  if (options_.compaction_readahead_size > 0) {
+    input = NewPrefetchingIterator(input, env_,
+                                   options_.compaction_readahead_size);
+  }
+  if (begin == NULL) {
+    input->SeekToFirst();
+  } else {
+    // Entries of *begin belong to the previous range
+    InternalKey start(*begin, 0, static_cast<ValueType>(0));
+    input->Seek(start.Encode());
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  std::string filtered_key, filtered_value;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
     //input_size += input->key().size() + input->value().size();
       // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
+    if (imm_micros != NULL && has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
-      if (imm_ != NULL) {
+      if (imm_ != NULL && !flushing_memtable_) {
         CompactMemTable();
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      *imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    Slice value = input->value();
+    if (end != NULL && ParseInternalKey(key, &ikey) &&
+        user_comparator()->Compare(ikey.user_key, *end) > 0) {
+      break;  // Left to the next range
+    }
+    if (compact->compaction->ShouldStopBefore(key,
+                                              &compact->grandparent_state) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -1281,7 +1794,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;    // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        compact->level_ptrs)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -1290,6 +1804,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (compact->range_del != NULL &&
+                 compact->range_del->ShouldDelete(ikey)) {
+        //whc add
+        // Deleted by a range tombstone every snapshot sees
+        drop = true;
+      } else if (options_.compaction_filter != NULL &&
+                 ikey.type == kTypeValue &&
+                 ikey.sequence <= compact->smallest_snapshot) {
+        // Newest value every snapshot sees
+        drop = FilterCompactionEntry(compact, ikey, &key, &value,
+                                     &filtered_key, &filtered_value);
       }
 
       last_sequence_for_key = ikey.sequence;
@@ -1300,7 +1825,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                               compact->level_ptrs),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
@@ -1317,7 +1843,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         compact->current_output()->smallest.DecodeFrom(key);
       }
       compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      compact->builder->Add(key, value);
+      //whc add
+      compact->current_output()->AddEntry(key);
 
       // Close output file if it is big enough
       if (compact->builder->FileSize() >=
@@ -1342,78 +1870,173 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     status = input->status();
   }
   delete input;
-  input = NULL;
+  return status;
+}
 
-/*
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+//whc add
+bool DBImpl::FilterCompactionEntry(CompactionState* compact,
+                                   const ParsedInternalKey& ikey,
+                                   Slice* key, Slice* value,
+                                   std::string* key_buf,
+                                   std::string* value_buf) {
+  bool value_changed = false;
+  value_buf->clear();
+  if (!options_.compaction_filter->Filter(compact->compaction->level(),
+                                          ikey.user_key, *value,
+                                          value_buf, &value_changed)) {
+    if (value_changed) {
+      *value = *value_buf;
     }
+    return false;
   }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
+  if (compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                             compact->level_ptrs)) {
+    // Nothing older is left below, and older entries merged here are
+    // dropped by rule (A)
+    return true;
   }
-
-//whc add
-uint64_t up_file = 0;
-for (int i = 0; i < compact->compaction->num_input_files(0); i++) {
-      up_file += compact->compaction->input(0, i)->file_size;
+  // Keep hiding the older entries of deeper levels
+  key_buf->clear();
+  AppendInternalKey(key_buf, ParsedInternalKey(ikey.user_key, ikey.sequence,
+                                               kTypeDeletion));
+  *key = *key_buf;
+  *value = Slice();
+  return false;
 }
 
-uint64_t down_file = 0;
-for (int i = 0; i < compact->compaction->num_input_files(1); i++) {
-      down_file += compact->compaction->input(1, i)->file_size;
+//whc add
+void DBImpl::SubcompactionWork(void* arg) {
+  SubcompactionState* state = reinterpret_cast<SubcompactionState*>(arg);
+  DBImpl* db = state->db;
+  MutexLock l(&db->mutex_);
+  CompactionState* compact = new CompactionState(state->compact->compaction);
+  compact->smallest_snapshot = state->compact->smallest_snapshot;
+  compact->range_del = state->compact->range_del;
+  const size_t i = state->next_range++;
+  const std::vector<std::string>& splits = state->splits;
+  db->mutex_.Unlock();
+  // Memtables are flushed by DoCompactionWork() meanwhile
+  Status s = db->CompactKeyRange(compact,
+                                 i > 0 ? &splits[i - 1] : NULL,
+                                 i < splits.size() ? &splits[i] : NULL,
+                                 NULL);
+  db->mutex_.Lock();
+  if (!s.ok() && state->status.ok()) {
+    state->status = s;
+  }
+
+  // Hand the outputs over to be installed by DoCompactionWork()
+  state->compact->outputs.insert(state->compact->outputs.end(),
+                                 compact->outputs.begin(),
+                                 compact->outputs.end());
+  state->compact->total_bytes += compact->total_bytes;
+  compact->outputs.clear();
+  db->CleanupCompaction(compact);
+  state->running--;
+  db->bg_cv_.SignalAll();
 }
- */
 
 //whc add
-/*
-  Log(w_log,
-  "whc inlevel%d 1file:%lld 2file:%lld output:%lld \n",
-  compact->compaction->level(),
-  up_file,
-  down_file,
-  output_size);
-*/
-  
-  mutex_.Lock();
-  //stats_[compact->compaction->level() + 1].Add(stats);
-  
-  //whc add
-  //statistics work
-  
-  if (status.ok()){
-      OneTimeCompactionStats ll_stats;
-      OneTimeCompactionStats hl_stats;
+uint64_t DBImpl::GetLevelTotalSize(int level){
+    uint64_t tsize = 0;
+    for(int i=0;i<versions_->current_->files_[level].size();i++)
+        tsize += versions_->current_->files_[level][i]->file_size;
+    return tsize;
+}
 
-      int mylevel = compact->compaction->level();
-      int64_t micros = env_->NowMicros() - start_micros - imm_micros;
+//whc add
+// Return a node serving the keys of "src" in (smallest, largest] from the
+// buffer of "dst", or in [begin of "src", largest] if "inend" is set.
+static BufferNodeEdit NewBufferNodeEdit(const FileMetaData* src,
+                                        const FileMetaData* dst,
+                                        const InternalKey& smallest,
+                                        const InternalKey& largest,
+                                        bool inend) {
+  BufferNodeEdit b;
+  b.snumber = src->number;
+  b.filesize = src->file_size;
+  b.dnumber = dst->number;
+  b.size = 0;
+  b.smallest = smallest;
+  b.largest = largest;
+  b.inend = inend;
+  b.smallest_seq = src->smallest_seq;
+  b.largest_seq = src->largest_seq;
+  return b;
+}
 
-      CompactionStats::UpdateWhileCompact(compact, micros, ll_stats, hl_stats);
-      stats_[compact->compaction->level()].Add(ll_stats);
-      stats_[compact->compaction->level() + 1].Add(hl_stats);
-  }
-  
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
-  }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
+//whc add
+void DBImpl::SizeBufferNodes(std::vector<BufferNodeEdit>* nodes) {
+  // Nodes of one source table are consecutive and cover it in key order.
+  // A node ends at the offset of its largest key, the last one at the end
+  // of the table, so the sizes of the nodes of a table add up to its size.
+  size_t j = 0;
+  while (j < nodes->size()) {
+    const uint64_t number = (*nodes)[j].snumber;
+    const uint64_t filesize = (*nodes)[j].filesize;
+    Table* table = NULL;
+    Iterator* iter = ssd_table_cache_->NewIterator(ReadOptions(), number,
+                                                   filesize, &table);
+    uint64_t start = 0;
+    size_t k = j;
+    for (; k < nodes->size() && (*nodes)[k].snumber == number; k++) {
+      BufferNodeEdit* node = &(*nodes)[k];
+      uint64_t end = filesize;
+      if (table != NULL && k + 1 < nodes->size() &&
+          (*nodes)[k + 1].snumber == number) {
+        end = std::min(filesize, table->ApproximateOffsetOf(
+            node->largest.Encode()));
+      }
+      end = std::max(end, start);
+      node->size = end - start;
+      start = end;
+    }
+    delete iter;
+    j = k;
   }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log,
-      "compacted to: %s", versions_->LevelSummary(&tmp));
-  return status;
 }
 
 //whc add
-uint64_t DBImpl::GetLevelTotalSize(int level){
-    uint64_t tsize = 0;
-    for(int i=0;i<versions_->current_->files_[level].size();i++)
-        tsize += versions_->current_->files_[level][i]->file_size;
-    return tsize;
+void DBImpl::BuildBufferNodeFilters(std::vector<BufferNodeEdit>* nodes) {
+  // Nodes of one source table are consecutive and cover it in key order,
+  // so every source table is read in a single pass.  options_.filter_policy
+  // is the internal policy, it takes one internal key per user key.
+  std::vector<std::string> keys;
+  std::vector<Slice> key_slices;
+  size_t j = 0;
+  while (j < nodes->size()) {
+    const uint64_t number = (*nodes)[j].snumber;
+    Iterator* iter = ssd_table_cache_->NewIterator(ReadOptions(), number,
+                                                   (*nodes)[j].filesize);
+    iter->SeekToFirst();
+    size_t k = j;
+    for (; k < nodes->size() && (*nodes)[k].snumber == number; k++) {
+      BufferNodeEdit* node = &(*nodes)[k];
+      keys.clear();
+      for (; iter->Valid() &&
+               internal_comparator_.Compare(iter->key(),
+                                            node->largest.Encode()) <= 0;
+           iter->Next()) {
+        if (keys.empty() ||
+            user_comparator()->Compare(ExtractUserKey(iter->key()),
+                                       ExtractUserKey(keys.back())) != 0) {
+          keys.push_back(iter->key().ToString());
+        }
+      }
+      key_slices.assign(keys.begin(), keys.end());
+      options_.filter_policy->CreateFilter(
+          key_slices.empty() ? NULL : &key_slices[0],
+          static_cast<int>(key_slices.size()), &node->filter);
+    }
+    if (!iter->status().ok()) {
+      // Lookups probe every node without a filter
+      for (size_t n = j; n < k; n++) {
+        (*nodes)[n].filter.clear();
+      }
+    }
+    delete iter;
+    j = k;
+  }
 }
 
 Status DBImpl::Dispatch(CompactionState* compact) {
@@ -1441,6 +2064,7 @@ Status DBImpl::Dispatch(CompactionState* compact) {
   std::string ptr0_key;
   std::string ptr0_fill;
   int ptr1 = 0;
+  std::vector<BufferNodeEdit> nodes;
 
   //std::cout<<"dispatch:input.size()"<<compact->compaction->inputs_.size()<<std::endl;
   
@@ -1455,7 +2079,8 @@ Status DBImpl::Dispatch(CompactionState* compact) {
         ptr1++;
       
       bool flag = true;
-      while(internal_comparator_.Compare(Slice(ptr0_key),
+      // The first node is always added so that single-key files are kept
+      while(flag || internal_comparator_.Compare(Slice(ptr0_key),
       compact->compaction->inputs_[0][i]->largest.Encode())<0){
           InternalKey nsmallest;
           nsmallest.DecodeFrom(Slice(ptr0_key));
@@ -1474,14 +2099,11 @@ Status DBImpl::Dispatch(CompactionState* compact) {
           
           if(ptr1<compact->compaction->inputs_[1].size()){
               
-              compact->compaction->edit_.AddBufferNode(compact->compaction->level_+1,
-    						compact->compaction->inputs_[0][i]->number,
-                            compact->compaction->inputs_[0][i]->file_size,
-							compact->compaction->inputs_[1][ptr1]->number,
-							0,
+              nodes.push_back(NewBufferNodeEdit(compact->compaction->inputs_[0][i],
+							compact->compaction->inputs_[1][ptr1],
 							nsmallest,
                             nlargest,
-							flag);
+							flag));
                
                             assert(internal_comparator_.Compare(nlargest,
               compact->compaction->inputs_[1][ptr1]->largest)<=0);
@@ -1489,48 +2111,55 @@ Status DBImpl::Dispatch(CompactionState* compact) {
               ptr0_key.assign(compact->compaction->inputs_[1][ptr1]->largest.Rep());
               ptr1++;
           }else{
-              compact->compaction->edit_.AddBufferNode(compact->compaction->level_+1,
-    						compact->compaction->inputs_[0][i]->number,
-                            compact->compaction->inputs_[0][i]->file_size,
-							compact->compaction->inputs_[1][ptr1-1]->number,
-							0,
+              nodes.push_back(NewBufferNodeEdit(compact->compaction->inputs_[0][i],
+							compact->compaction->inputs_[1][ptr1-1],
 							nsmallest,
                             nlargest,
-							flag);
+							flag));
              ptr0_key.assign(compact->compaction->inputs_[0][i]->largest.Rep());
           }
         flag = false;
       }
   }
 
+  // Source tables are read from the fast tier from now on; the copies
+  // are not live until the edit is installed.
+  for (size_t j = 0; j < compact->compaction->inputs_[0].size(); j++) {
+    pending_outputs_.insert(compact->compaction->inputs_[0][j]->number);
+  }
+  mutex_.Unlock();
+  status = CopyToSSD(compact);
+  if (status.ok()) {
+    SizeBufferNodes(&nodes);
+    if (options_.filter_policy != NULL) {
+      BuildBufferNodeFilters(&nodes);
+    }
+  }
+  mutex_.Lock();
+  for (size_t j = 0; j < nodes.size(); j++) {
+    compact->compaction->edit_.AddBufferNode(compact->compaction->level_+1,
+                                             nodes[j].snumber,
+                                             nodes[j].filesize,
+                                             nodes[j].dnumber,
+                                             nodes[j].size,
+                                             nodes[j].smallest,
+                                             nodes[j].largest,
+                                             nodes[j].inend,
+                                             nodes[j].filter,
+                                             nodes[j].smallest_seq,
+                                             nodes[j].largest_seq);
+  }
+
   if (status.ok()) {
     status = InstallCompactionResults(compact);
   }
-  
-  if(versions_->buffer_compact_switch_ ){
-      //std::cout<<"dispatch:going to buffer compact"<<std::endl;
-      Compaction* c;
-      c = versions_->PickCompaction();
-      CompactionState* compact = new CompactionState(c);
-      for(int index = 0;index < compact->compaction->inputs_[0].size();index++){
-          status = BufferCompact(compact,index);
-          if (!status.ok())
-              break;
-      }
-      
-      if(!status.ok()){
-          std::cout<<"buffercompact error!"<<std::endl;
-          //return status;
-      }
-      
-      delete compact->outfile;
-      compact->outfile = NULL;
-      status = InstallCompactionResults(compact);
-      c->ReleaseInputs();
-      delete c;
-      //std::cout<<"dispatch:going to buffer compact end"<<std::endl;  
+  for (size_t j = 0; j < compact->compaction->inputs_[0].size(); j++) {
+    pending_outputs_.erase(compact->compaction->inputs_[0][j]->number);
   }
   
+  // Buffers that reached their threshold are merged by the next
+  // background compaction, see VersionSet::NeedsCompaction
+  
   if (!status.ok()) {
     RecordBackgroundError(status);
   }
@@ -1544,7 +2173,194 @@ Status DBImpl::Dispatch(CompactionState* compact) {
   return status;
 }
 
-Status DBImpl::BufferCompact(CompactionState* compact,int index){
+Status DBImpl::MergeBuffers(CompactionState* compact) {
+  mutex_.AssertHeld();
+  Log(options_.info_log,  "Merging buffers of %d@%d files",
+      compact->compaction->num_input_files(0),
+      compact->compaction->level());
+
+  // Each file is merged by one of the threads; this thread keeps
+  // flushing memtables meanwhile so writers are not stalled.
+  BufferMergeState state(this, compact);
+  //whc add
+  // Snapshots only get newer, so the tombstones older than the oldest
+  // one now are older than the one each BufferCompact() sees
+  RangeDelMap* range_del = NewRangeDelMap(
+      snapshots_.empty() ? versions_->LastSequence()
+                         : snapshots_.oldest()->number_);
+  compact->range_del = range_del;
+  state.running = std::min(options_.max_buffer_merge_threads,
+                           compact->compaction->num_input_files(0));
+  for (int i = state.running; i > 0; i--) {
+    env_->StartThread(&DBImpl::BufferMergeWork, &state);
+  }
+  while (state.running > 0) {
+    if (imm_ != NULL && !flushing_memtable_ && bg_error_.ok()) {
+      CompactMemTable();
+      bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+    } else {
+      bg_cv_.Wait();
+    }
+  }
+
+  compact->range_del = NULL;
+  delete range_del;
+
+  Status status = state.status;
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "merged buffers to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+//whc add
+RangeDelMap* DBImpl::NewRangeDelMap(SequenceNumber snapshot) {
+  mutex_.AssertHeld();
+  std::vector<RangeTombstone> tombstones;
+  versions_->current()->GetRangeTombstones(snapshot, &tombstones);
+  if (tombstones.empty()) {
+    return NULL;
+  }
+  return new RangeDelMap(user_comparator(), tombstones);
+}
+
+Status DBImpl::DropRangeDeletedFiles() {
+  mutex_.AssertHeld();
+  const SequenceNumber smallest_snapshot =
+      snapshots_.empty() ? versions_->LastSequence()
+                         : snapshots_.oldest()->number_;
+  VersionEdit edit;
+  if (!versions_->PickRangeDeletions(smallest_snapshot, &edit)) {
+    return Status::OK();
+  }
+  Status status = LogAndApply(&edit);
+  if (status.ok()) {
+    DeleteObsoleteFiles();
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log, "Dropped range deleted files: %s %s",
+      status.ToString().c_str(), versions_->LevelSummary(&tmp));
+  return status;
+}
+
+Status DBImpl::ReclaimBufferTable() {
+  mutex_.AssertHeld();
+  int level;
+  uint64_t number, filesize;
+  std::vector<BufferNodeBound> nodes;
+  if (!versions_->PickTableToReclaim(&level, &number, &filesize, &nodes)) {
+    return Status::OK();
+  }
+  const uint64_t new_number = versions_->NewFileNumber();
+  pending_outputs_.insert(new_number);
+  Log(options_.info_log, "Reclaiming table #%llu@%d: %d nodes",
+      static_cast<unsigned long long>(number), level,
+      static_cast<int>(nodes.size()));
+  reclaiming_table_ = true;
+  mutex_.Unlock();
+
+  // Older versions keep reading the old table until they are released
+  ReadOptions options;
+  options.verify_checksums = options_.paranoid_checks;
+  options.fill_cache = false;
+  BufferCursorPool cursors(options, ssd_table_cache_);
+  WritableFile* file;
+  Status s = options_.ssd_env->NewWritableFile(
+      TableFileName(ssdname_, new_number), &file);
+  uint64_t new_filesize = 0;
+  if (s.ok() && options_.rate_limiter != NULL) {
+    file = NewRateLimitedWritableFile(file, options_.rate_limiter,
+                                      RateLimiter::kIOLow);
+  }
+  if (s.ok()) {
+    TableBuilder* builder = new TableBuilder(options_, file);
+    for (size_t i = 0; s.ok() && i < nodes.size(); i++) {
+      BufferNodeIterator iter(options, ssd_table_cache_,
+                              &internal_comparator_, nodes[i], &cursors);
+      for (iter.SeekToFirst(); iter.Valid() && !shutting_down_.Acquire_Load();
+           iter.Next()) {
+        builder->Add(iter.key(), iter.value());
+      }
+      s = iter.status();
+      if (s.ok() && shutting_down_.Acquire_Load()) {
+        s = Status::IOError("Deleting DB during compaction");
+      }
+    }
+    if (s.ok()) {
+      s = builder->Finish();
+      new_filesize = builder->FileSize();
+    } else {
+      builder->Abandon();
+    }
+    delete builder;
+    if (s.ok()) {
+      s = file->Sync();
+    }
+    if (s.ok()) {
+      s = file->Close();
+    }
+    delete file;
+  }
+
+  mutex_.Lock();
+  if (s.ok()) {
+    VersionEdit edit;
+    edit.RewriteBufferTable(level, number, new_number, new_filesize);
+    s = LogAndApply(&edit);
+  }
+  pending_outputs_.erase(new_number);
+  reclaiming_table_ = false;
+  if (s.ok()) {
+    Log(options_.info_log, "Reclaimed table #%llu: %llu of %llu bytes kept",
+        static_cast<unsigned long long>(number),
+        static_cast<unsigned long long>(new_filesize),
+        static_cast<unsigned long long>(filesize));
+    DeleteObsoleteFiles();
+  } else {
+    RecordBackgroundError(s);
+  }
+  return s;
+}
+
+void DBImpl::BufferMergeWork(void* arg) {
+  BufferMergeState* state = reinterpret_cast<BufferMergeState*>(arg);
+  DBImpl* db = state->db;
+  MutexLock l(&db->mutex_);
+  CompactionState* compact = new CompactionState(state->compact->compaction);
+  compact->range_del = state->compact->range_del;
+  // Files are claimed in key order, so the nodes a source table left in
+  // neighbouring files are read through one cursor
+  ReadOptions options;
+  options.verify_checksums = db->options_.paranoid_checks;
+  options.fill_cache = false;
+  BufferCursorPool cursors(options, db->ssd_table_cache_);
+  while (state->status.ok() &&
+         state->next_index < compact->compaction->num_input_files(0)) {
+    Status s = db->BufferCompact(compact, state->next_index++, &cursors);
+    if (!s.ok() && state->status.ok()) {
+      state->status = s;
+    }
+  }
+
+  // Hand the outputs over to be installed by MergeBuffers()
+  state->compact->outputs.insert(state->compact->outputs.end(),
+                                 compact->outputs.begin(),
+                                 compact->outputs.end());
+  state->compact->total_bytes += compact->total_bytes;
+  compact->outputs.clear();
+  db->CleanupCompaction(compact);
+  state->running--;
+  db->bg_cv_.SignalAll();
+}
+
+Status DBImpl::BufferCompact(CompactionState* compact,int index,
+                             BufferCursorPool* cursors){
     Status status;
     const uint64_t start_micros = env_->NowMicros();
     int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
@@ -1564,7 +2380,17 @@ Status DBImpl::BufferCompact(CompactionState* compact,int index){
     
     mutex_.Unlock();
 
-  Iterator* input = versions_->MakeBufferInputIterator(compact->compaction->inputs_[0][index]);
+  Iterator* input = versions_->MakeBufferInputIterator(
+      compact->compaction->level(), compact->compaction->inputs_[0][index],
+      cursors, compact->range_del);
+  if (options_.rate_limiter != NULL) {
+    input = NewRateLimitedIterator(input, options_.rate_limiter,
+                                   RateLimiter::kIOLow);
+  }
+  if (options_.compaction_readahead_size > 0) {
+    input = NewPrefetchingIterator(input, env_,
+                                   options_.compaction_readahead_size);
+  }
   //std::cout<<"buffer compact end make iterator"<<std::endl;
   //return status;
   input->SeekToFirst();
@@ -1572,24 +2398,16 @@ Status DBImpl::BufferCompact(CompactionState* compact,int index){
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  std::string filtered_key, filtered_value;
   //std::cout<<"buffer compact going to loop!!!"<<std::endl;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
     //std::cout<<"buffer compact loop!!!"<<std::endl;
       // Prioritize immutable compaction work
     input_size += input->value().size() + input->key().size();
-    if (has_imm_.NoBarrier_Load() != NULL) {
-      //std::cout<<"buffer compact imm!!!"<<std::endl;
-        const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
-      }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
-    }
+    // imm_ is flushed by MergeBuffers() while this runs
     //std::cout<<"buffer compact loop2!!!"<<std::endl;
     Slice key = input->key();
+    Slice value = input->value();
     // Handle key/value, add to state, etc.
     bool drop = false;
     if (!ParseInternalKey(key, &ikey)) {
@@ -1612,7 +2430,8 @@ Status DBImpl::BufferCompact(CompactionState* compact,int index){
         drop = true;    // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        compact->level_ptrs)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -1621,6 +2440,17 @@ Status DBImpl::BufferCompact(CompactionState* compact,int index){
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (compact->range_del != NULL &&
+                 compact->range_del->ShouldDelete(ikey)) {
+        //whc add
+        // Deleted by a range tombstone every snapshot sees
+        drop = true;
+      } else if (options_.compaction_filter != NULL &&
+                 ikey.type == kTypeValue &&
+                 ikey.sequence <= compact->smallest_snapshot) {
+        // Newest value every snapshot sees
+        drop = FilterCompactionEntry(compact, ikey, &key, &value,
+                                     &filtered_key, &filtered_value);
       }
 
       last_sequence_for_key = ikey.sequence;
@@ -1632,14 +2462,15 @@ Status DBImpl::BufferCompact(CompactionState* compact,int index){
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                               compact->level_ptrs),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
     if (!drop) {
       //std::cout<<"not drop"<<std::endl;
         // Open output file if necessary
-      output_size += input->value().size() + input->key().size();
+      output_size += value.size() + key.size();
       if (compact->builder == NULL) {
         status = OpenCompactionOutputFile(compact);
         if (!status.ok()) {
@@ -1650,7 +2481,9 @@ Status DBImpl::BufferCompact(CompactionState* compact,int index){
         compact->current_output()->smallest.DecodeFrom(key);
       }
       compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      compact->builder->Add(key, value);
+      //whc add
+      compact->current_output()->AddEntry(key);
 
       //std::cout<<"buffer compact cur file size"<<compact->builder->FileSize()<<std::endl;
       //std::cout<<"buffer compact max file size"<<compact->compaction->MaxOutputFileSize()<<std::endl;
@@ -1729,53 +2562,82 @@ Status DBImpl::BufferCompact(CompactionState* compact,int index){
 }
     
 
-namespace {
-struct IterState {
-  port::Mutex* mu;
-  Version* version;
-  MemTable* mem;
-  MemTable* imm;
-};
+//whc add
+void DBImpl::InstallReadView() {
+  mutex_.AssertHeld();
+  Version* current = versions_->current();
+  if (read_view_ != NULL && read_view_->mem == mem_ &&
+      read_view_->imm == imm_ && read_view_->current == current) {
+    return;
+  }
+  if (read_view_ != NULL) {
+    read_view_->Unref(true);
+  }
+  read_view_ = new ReadView(&mutex_, mem_, imm_, current);
 
-static void CleanupIteratorState(void* arg1, void* arg2) {
-  IterState* state = reinterpret_cast<IterState*>(arg1);
-  state->mu->Lock();
-  state->mem->Unref();
-  if (state->imm != NULL) state->imm->Unref();
-  state->version->Unref();
-  state->mu->Unlock();
-  delete state;
+  std::vector<void*> cached;
+  read_views_->Scrape(&cached, NULL);
+  for (size_t i = 0; i < cached.size(); i++) {
+    if (cached[i] != kReadViewInUse) {
+      reinterpret_cast<ReadView*>(cached[i])->Unref(true);
+    }
+  }
 }
-}  // namespace
 
-Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
-                                      SequenceNumber* latest_snapshot,
-                                      uint32_t* seed) {
-  IterState* cleanup = new IterState;
-  mutex_.Lock();
+//whc add
+DBImpl::ReadView* DBImpl::AcquireReadView() {
+  void* cached = read_views_->Swap(kReadViewInUse);
+  assert(cached != kReadViewInUse);
+  if (cached != NULL) {
+    return reinterpret_cast<ReadView*>(cached);
+  }
+  MutexLock l(&mutex_);
+  read_view_->Ref();
+  return read_view_;
+}
+
+//whc add
+void DBImpl::ReleaseReadView(ReadView* view) {
+  void* expected = kReadViewInUse;
+  if (!read_views_->CompareAndSwap(view, &expected)) {
+    // InstallReadView() took the cache back, so "view" is stale
+    assert(expected == NULL);
+    view->Unref(false);
+  }
+}
+
+Iterator* DBImpl::NewInternalIterator(
+    const ReadOptions& options, SequenceNumber* latest_snapshot,
+    uint32_t* seed, std::vector<RangeTombstone>* range_tombstones) {
+  //whc change
+  // The sequence is read first: every write up to it is then in the
+  // view, which is at least as new.
   *latest_snapshot = versions_->LastSequence();
+  ReadView* view = AcquireReadView();
+  if (range_tombstones != NULL) {
+    view->mem->GetRangeTombstones(kMaxSequenceNumber, range_tombstones);
+    if (view->imm != NULL) {
+      view->imm->GetRangeTombstones(kMaxSequenceNumber, range_tombstones);
+    }
+    view->current->GetRangeTombstones(kMaxSequenceNumber, range_tombstones);
+  }
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
-  mem_->Ref();
-  if (imm_ != NULL) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  list.push_back(view->mem->NewIterator());
+  if (view->imm != NULL) {
+    list.push_back(view->imm->NewIterator());
   }
-  versions_->current()->AddIterators(options, &list);
+  view->current->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
 
-  cleanup->mu = &mutex_;
-  cleanup->mem = mem_;
-  cleanup->imm = imm_;
-  cleanup->version = versions_->current();
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
+  // The iterator holds a reference of its own
+  view->Ref();
+  internal_iter->RegisterCleanup(&ReadView::CleanupIterator, view, NULL);
+  ReleaseReadView(view);
 
   *seed = ++seed_;
-  mutex_.Unlock();
   return internal_iter;
 }
 
@@ -1790,11 +2652,21 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+//whc add
+int64_t DBImpl::TEST_NumIntraL0Compactions() {
+  MutexLock l(&mutex_);
+  return versions_->NumIntraL0Compactions();
+}
+
+int64_t DBImpl::TEST_NumBufferProbes(int level) {
+  MutexLock l(&mutex_);
+  return versions_->NumLevelBufferProbes(level);
+}
+
 Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
   Status s;
-  MutexLock l(&mutex_);
   SequenceNumber snapshot;
   if (options.snapshot != NULL) {
     snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
@@ -1802,60 +2674,166 @@ Status DBImpl::Get(const ReadOptions& options,
     snapshot = versions_->LastSequence();
   }
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
-  if (imm != NULL) imm->Ref();
-  current->Ref();
+  //whc change
+  // Read through the view of this thread, mutex_ is only locked to
+  // record read statistics
+  ReadView* view = AcquireReadView();
+  MemTable* mem = view->mem;
+  MemTable* imm = view->imm;
+  Version* current = view->current;
 
   bool have_stat_update = false;
   Version::GetStats stats;
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
+  // First look in the memtable, then in the immutable memtable (if any).
+  LookupKey lkey(key, snapshot);
+  if (mem->Get(lkey, value, &s)) {
+    // Done
+  } else if (imm != NULL && imm->Get(lkey, value, &s)) {
+    // Done
+  } else {
+    //s = current->Get(options, lkey, value, &stats);
+    // whc change
+    s = current->BufferGet(options, lkey, value, &stats);
+    have_stat_update = true;
+  }
+
+  //whc change
+  // Reads served by the first file they look at have nothing to record
+  if (have_stat_update &&
+      (stats.seek_file != NULL || stats.buffer_file != NULL)) {
+    MutexLock l(&mutex_);
+    if (current->UpdateStats(stats)) {
+      bg_compaction_blocked_ = false;  //whc add
+      MaybeScheduleCompaction();
+    }
+  }
+  ReleaseReadView(view);
+  return s;
+}
+
+//whc add
+namespace {
+struct KeyIndexLess {
+  const Comparator* ucmp;
+  const std::vector<Slice>* keys;
+  bool operator()(int a, int b) const {
+    const int r = ucmp->Compare((*keys)[a], (*keys)[b]);
+    return r < 0 || (r == 0 && a < b);
+  }
+};
+}  // namespace
+
+void DBImpl::MultiGet(const ReadOptions& options,
+                      const std::vector<Slice>& keys,
+                      std::vector<std::string>* values,
+                      std::vector<Status>* statuses) {
+  const int n = keys.size();
+  values->assign(n, std::string());
+  statuses->assign(n, Status());
+  if (n == 0) {
+    return;
+  }
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+  ReadView* view = AcquireReadView();
+
+  // Keys are looked up in order so that neighbours share files and blocks
+  std::vector<LookupKey*> lkeys(n);
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) {
+    lkeys[i] = new LookupKey(keys[i], snapshot);
+    order[i] = i;
+  }
+  KeyIndexLess less = { user_comparator(), &keys };
+  std::sort(order.begin(), order.end(), less);
+
+  // First the memtables, then the keys left in one pass over the version
+  std::vector<const LookupKey*> pending;
+  std::vector<std::string*> pending_values;
+  std::vector<Status*> pending_statuses;
+  for (int j = 0; j < n; j++) {
+    const int i = order[j];
+    Status* s = &(*statuses)[i];
+    std::string* value = &(*values)[i];
+    if (view->mem->Get(*lkeys[i], value, s)) {
       // Done
-    } else if (imm != NULL && imm->Get(lkey, value, &s)) {
+    } else if (view->imm != NULL && view->imm->Get(*lkeys[i], value, s)) {
       // Done
     } else {
-      //s = current->Get(options, lkey, value, &stats);
-      // whc change
-      s = current->BufferGet(options, lkey, value, &stats);
-      have_stat_update = true;
+      pending.push_back(lkeys[i]);
+      pending_values.push_back(value);
+      pending_statuses.push_back(s);
     }
-    mutex_.Lock();
   }
-
-  //if (have_stat_update && current->UpdateStats(stats)) {
-    //whc change
-  if (have_stat_update) {  
-    MaybeScheduleCompaction();
+  if (!pending.empty()) {
+    std::vector<Version::GetStats> stats(pending.size());
+    view->current->MultiGet(options, pending.size(), &pending[0],
+                            &pending_values[0], &pending_statuses[0],
+                            &stats[0]);
+
+    // Lookups served by the first file they looked at have nothing
+    // to record
+    bool have_stat_update = false;
+    for (size_t i = 0; i < stats.size(); i++) {
+      if (stats[i].seek_file != NULL || stats[i].buffer_file != NULL) {
+        have_stat_update = true;
+      }
+    }
+    if (have_stat_update) {
+      MutexLock l(&mutex_);
+      bool schedule = false;
+      for (size_t i = 0; i < stats.size(); i++) {
+        if (view->current->UpdateStats(stats[i])) {
+          schedule = true;
+        }
+      }
+      if (schedule) {
+        bg_compaction_blocked_ = false;
+        MaybeScheduleCompaction();
+      }
+    }
+  }
+  ReleaseReadView(view);
+  for (int i = 0; i < n; i++) {
+    delete lkeys[i];
   }
-  mem->Unref();
-  if (imm != NULL) imm->Unref();
-  current->Unref();
-  return s;
 }
 
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
-  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed);
-  return NewDBIterator(
-      this, user_comparator(), iter,
+  //whc change
+  std::vector<RangeTombstone> tombstones;
+  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed,
+                                       &tombstones);
+  const SequenceNumber snapshot =
       (options.snapshot != NULL
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
-       : latest_snapshot),
-      seed);
+       : latest_snapshot);
+  // Tombstones newer than the snapshot delete nothing it sees
+  std::vector<RangeTombstone> visible;
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    if (tombstones[i].sequence <= snapshot) {
+      visible.push_back(tombstones[i]);
+    }
+  }
+  RangeDelMap* range_del = NULL;
+  if (!visible.empty()) {
+    range_del = new RangeDelMap(user_comparator(), visible);
+  }
+  return NewDBIterator(this, user_comparator(), iter, snapshot, seed,
+                       range_del);
 }
 
 void DBImpl::RecordReadSample(Slice key) {
   MutexLock l(&mutex_);
   if (versions_->current()->RecordReadSample(key)) {
+    bg_compaction_blocked_ = false;  //whc add
     MaybeScheduleCompaction();
   }
 }
@@ -1879,6 +2857,11 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+Status DBImpl::DeleteRange(const WriteOptions& options, const Slice& begin,
+                           const Slice& end) {
+  return DB::DeleteRange(options, begin, end);
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   Writer w(&mutex_);
   w.batch = my_batch;
@@ -1900,6 +2883,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   Writer* last_writer = &w;
   if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
     WriteBatch* updates = BuildBatchGroup(&last_writer);
+    write_controller_.Consume(WriteBatchInternal::ByteSize(updates));  //whc add
     WriteBatchInternal::SetSequence(updates, last_sequence + 1);
     last_sequence += WriteBatchInternal::Count(updates);
 
@@ -2013,19 +2997,24 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // Yield previous error
       s = bg_error_;
       break;
-    } else if (
-        allow_delay &&
-        versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
-      // We are getting close to hitting a hard limit on the number of
-      // L0 files.  Rather than delaying a single write by several
-      // seconds when we hit the hard limit, start delaying each
-      // individual write by 1ms to reduce latency variance.  Also,
-      // this delay hands over some CPU to the compaction thread in
-      // case it is sharing the same core as the writer.
-      mutex_.Unlock();
-      env_->SleepForMicroseconds(1000);
+    } else if (allow_delay && write_controller_.IsDelayed()) {
+      //whc change
+      // Compactions are falling behind.  Rather than delaying a single
+      // write by several seconds when we hit the hard limit on L0 files,
+      // pace every write group to the rate of the controller to reduce
+      // latency variance.  Also, this delay hands over some CPU to the
+      // compaction threads in case they share the same cores as writers.
+      const uint64_t delay = write_controller_.GetDelay(env_->NowMicros());
       allow_delay = false;  // Do not delay a single write more than once
-      mutex_.Lock();
+      if (delay > 0) {
+        if (options_.rate_limiter != NULL) {
+          options_.rate_limiter->ReportWriteStall();
+        }
+        mutex_.Unlock();
+        env_->SleepForMicroseconds(delay);
+        mutex_.Lock();
+        write_controller_.RecordDelay(delay);
+      }
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
@@ -2034,10 +3023,16 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      if (options_.rate_limiter != NULL) {
+        options_.rate_limiter->ReportWriteStall();  //whc add
+      }
       bg_cv_.Wait();
     } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
+      if (options_.rate_limiter != NULL) {
+        options_.rate_limiter->ReportWriteStall();  //whc add
+      }
       bg_cv_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
@@ -2059,8 +3054,10 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       has_imm_.Release_Store(imm_);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
+      InstallReadView();  //whc add
       force = false;   // Do not force another compaction if have room
       MaybeScheduleCompaction();
+      bg_cv_.SignalAll();  // Wakeup MergeBuffers() to flush imm_
     }
   }
   return s;
@@ -2088,6 +3085,69 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
       *value = buf;
       return true;
     }
+  } else if (in.starts_with("num-buffer-nodes-at-level")) {
+    //whc add
+    in.remove_prefix(strlen("num-buffer-nodes-at-level"));
+    uint64_t level;
+    bool ok = ConsumeDecimalNumber(&in, &level) && in.empty();
+    if (!ok || level >= config::kNumLevels) {
+      return false;
+    } else {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "%d",
+               versions_->NumLevelBufferNodes(static_cast<int>(level)));
+      *value = buf;
+      return true;
+    }
+  } else if (in.starts_with("num-buffer-merges-at-level")) {
+    //whc add
+    in.remove_prefix(strlen("num-buffer-merges-at-level"));
+    uint64_t level;
+    bool ok = ConsumeDecimalNumber(&in, &level) && in.empty();
+    if (!ok || level >= config::kNumLevels) {
+      return false;
+    } else {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "%llu",
+               static_cast<unsigned long long>(
+                   versions_->NumBufferMerges(static_cast<int>(level))));
+      *value = buf;
+      return true;
+    }
+  } else if (in.starts_with("num-buffer-merged-files-at-level")) {
+    //whc add
+    in.remove_prefix(strlen("num-buffer-merged-files-at-level"));
+    uint64_t level;
+    bool ok = ConsumeDecimalNumber(&in, &level) && in.empty();
+    if (!ok || level >= config::kNumLevels) {
+      return false;
+    } else {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "%llu",
+               static_cast<unsigned long long>(
+                   versions_->NumBufferMergedFiles(static_cast<int>(level))));
+      *value = buf;
+      return true;
+    }
+  } else if (in.starts_with("buffer-table-bytes-at-level")) {
+    //whc add
+    in.remove_prefix(strlen("buffer-table-bytes-at-level"));
+    uint64_t level;
+    bool ok = ConsumeDecimalNumber(&in, &level) && in.empty();
+    if (!ok || level >= config::kNumLevels) {
+      return false;
+    } else {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "%lld",
+               static_cast<long long>(versions_->NumLevelBufferTableBytes(
+                   static_cast<int>(level))));
+      *value = buf;
+      return true;
+    }
+  } else if (in == "write-controller") {
+    //whc add
+    *value = write_controller_.DebugString();
+    return true;
   } else if (in == "stats") {
     //whc change
     char buf[200];
@@ -2195,6 +3255,31 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::DeleteRange(const WriteOptions& opt, const Slice& begin,
+                       const Slice& end) {
+  WriteBatch batch;
+  batch.DeleteRange(begin, end);
+  return Write(opt, &batch);
+}
+
+//whc add
+void DB::MultiGet(const ReadOptions& options, const std::vector<Slice>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) {
+  values->assign(keys.size(), std::string());
+  statuses->assign(keys.size(), Status());
+  ReadOptions read_options = options;
+  if (options.snapshot == NULL) {
+    read_options.snapshot = GetSnapshot();
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    (*statuses)[i] = Get(read_options, keys[i], &(*values)[i]);
+  }
+  if (options.snapshot == NULL) {
+    ReleaseSnapshot(read_options.snapshot);
+  }
+}
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -2232,6 +3317,8 @@ Status DB::Open(const Options& options, const std::string& dbname,
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
+    impl->InstallReadView();  //whc add
+    impl->UpdateWriteController();  //whc add
     impl->DeleteObsoleteFiles();
     impl->MaybeScheduleCompaction();
   }
@@ -2272,6 +3359,24 @@ Status DestroyDB(const std::string& dbname, const Options& options) {
         }
       }
     }
+    //whc add
+    // Tables of the fast tier
+    if (!options.ssd_path.empty() && options.ssd_path != dbname) {
+      Env* ssd_env = (options.ssd_env != NULL) ? options.ssd_env : env;
+      filenames.clear();
+      ssd_env->GetChildren(options.ssd_path, &filenames);
+      for (size_t i = 0; i < filenames.size(); i++) {
+        if (ParseFileName(filenames[i], &number, &type) &&
+            (type == kTableFile || type == kTempFile)) {
+          Status del = ssd_env->DeleteFile(options.ssd_path + "/" +
+                                           filenames[i]);
+          if (result.ok() && !del.ok()) {
+            result = del;
+          }
+        }
+      }
+      ssd_env->DeleteDir(options.ssd_path);
+    }
     env->UnlockFile(lock);  // Ignore error since state is already gone
     env->DeleteFile(lockname);
     env->DeleteDir(dbname);  // Ignore error in case dir contains other files
@@ -5,11 +5,14 @@
 #ifndef STORAGE_LEVELDB_DB_DB_IMPL_H_
 #define STORAGE_LEVELDB_DB_DB_IMPL_H_
 
+#include <atomic>
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
+#include "db/write_controller.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "port/port.h"
@@ -18,10 +21,15 @@
 namespace leveldb {
 
 class MemTable;
+class RangeDelMap;
+struct RangeTombstone;
 class TableCache;
+class ThreadLocalPtr;
 class Version;
 class VersionEdit;
 class VersionSet;
+struct BufferNodeEdit;
+class BufferCursorPool;
 //whc add
 //forward define
 //struct CompactionState;
@@ -34,10 +42,16 @@ class DBImpl : public DB {
   // Implementations of the DB interface
   virtual Status Put(const WriteOptions&, const Slice& key, const Slice& value);
   virtual Status Delete(const WriteOptions&, const Slice& key);
+  virtual Status DeleteRange(const WriteOptions&, const Slice& begin,
+                             const Slice& end);
   virtual Status Write(const WriteOptions& options, WriteBatch* updates);
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -62,12 +76,18 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  //whc add
+  // Return the number of intra level-0 compactions picked so far
+  int64_t TEST_NumIntraL0Compactions();
+
+  // Return the number of buffer node tables probed by lookups through the
+  // buffers at the specified level
+  int64_t TEST_NumBufferProbes(int level);
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
   void RecordReadSample(Slice key);
-//whc add
-  void CopyToSSD( void* state);
 //whc add
   uint64_t GetLevelTotalSize(int level);
 
@@ -81,9 +101,29 @@ class DBImpl : public DB {
   struct CompactionState;
   struct Writer;
 
+  //whc change
+  // The range tombstones of the memtables and the current version are
+  // appended to *range_tombstones unless it is NULL.
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
-                                uint32_t* seed);
+                                uint32_t* seed,
+                                std::vector<RangeTombstone>* range_tombstones
+                                    = NULL);
+
+  //whc add
+  struct ReadView;
+
+  // Make a view of mem_, imm_ and the current version the one handed to
+  // new reads if it differs from read_view_.  Views cached by threads
+  // are taken back.
+  void InstallReadView() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Return the view a read should use, see ReleaseReadView().  Only
+  // locks mutex_ if the calling thread holds no current view.
+  ReadView* AcquireReadView();
+
+  // Hand back the result of AcquireReadView() once the read is done
+  void ReleaseReadView(ReadView* view);
 
   Status NewDB();
 
@@ -98,16 +138,33 @@ class DBImpl : public DB {
   // Delete any unneeded files and stale in-memory entries.
   void DeleteObsoleteFiles();
 
+  //whc add
+  // Delete tables of the fast tier's directory that are not in "live".
+  void DeleteObsoleteTables(const std::set<uint64_t>& live);
+
+  // Copy the source tables of a dispatch that live on the slow tier into
+  // the fast tier's directory, from where their buffer nodes are read.
+  Status CopyToSSD(CompactionState* compact);
+
   // Compact the in-memory write buffer to disk.  Switches to a new
   // log-file/memtable and writes a new descriptor iff successful.
   // Errors are recorded in bg_error_.
   void CompactMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  //whc add
+  // versions_->LogAndApply() drops mutex_ while writing the MANIFEST, so
+  // background workers apply their edits one at a time through this.
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  //whc change
+  // The new table stays in pending_outputs_ until the caller installs
+  // *edit and erases *number from it.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+                          uint64_t* number)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
@@ -119,16 +176,58 @@ class DBImpl : public DB {
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
   void BackgroundCall();
+  //whc add
+  static void BGFlushWork(void* db);
+  void BackgroundFlushCall();
   void  BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   //whc add
+  // Merge the input entries with user keys in (*begin, *end] into the
+  // outputs of "compact".  NULL bounds are open.  Memtables are flushed
+  // along the way, and the time spent added to *imm_micros, unless
+  // imm_micros is NULL.
+  Status CompactKeyRange(CompactionState* compact, const std::string* begin,
+                         const std::string* end, int64_t* imm_micros);
+  struct SubcompactionState;
+  static void SubcompactionWork(void* arg);
+  // Pass the value entry "ikey" of "compact", seen by every snapshot, to
+  // options_.compaction_filter.  Returns true iff the entry is to be
+  // dropped.  Otherwise *key and *value may be pointed at a rewritten
+  // entry stored in *key_buf and *value_buf.
+  bool FilterCompactionEntry(CompactionState* compact,
+                             const ParsedInternalKey& ikey,
+                             Slice* key, Slice* value,
+                             std::string* key_buf, std::string* value_buf);
+  //whc add
   Status Dispatch(CompactionState* compact)
   EXCLUSIVE_LOCKS_REQUIRED(mutex_);
-  Status BufferCompact(CompactionState* compact,int index)
+  Status BufferCompact(CompactionState* compact,int index,
+                       BufferCursorPool* cursors)
+  EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Fill in the bytes of its source table each node covers
+  void SizeBufferNodes(std::vector<BufferNodeEdit>* nodes);
+  // Fill in the key filter of each node from its source table
+  void BuildBufferNodeFilters(std::vector<BufferNodeEdit>* nodes);
+  // Rewrite the parts of a source table its buffer nodes still read
+  // into a new table and point the nodes at it
+  Status ReclaimBufferTable()
+  EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Merge every input file with its buffer and install the results
+  Status MergeBuffers(CompactionState* compact)
+  EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Range tombstones of the current version no newer than "snapshot", or
+  // NULL if there is none.  Caller should delete the result.
+  RangeDelMap* NewRangeDelMap(SequenceNumber snapshot)
   EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Remove the files range tombstones deleted entirely and the
+  // tombstones that no longer delete anything
+  Status DropRangeDeletedFiles()
+  EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  struct BufferMergeState;
+  static void BufferMergeWork(void* arg);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -149,6 +248,7 @@ class DBImpl : public DB {
   //whc add
   //const std::string ssdname_ = "/tmp/vssd";
   const std::string ssdname_ ;
+  Options ssd_options_;  // options_ with env == options_.ssd_env
   TableCache* ssd_table_cache_;
   Logger* w_log;
 
@@ -168,7 +268,13 @@ class DBImpl : public DB {
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
-  uint32_t seed_;                // For sampling.
+  std::atomic<uint32_t> seed_;   // For sampling.  //whc change
+
+  //whc add
+  // The memtables and version a read looks at, published to readers
+  // without mutex_.  See db_impl.cc.
+  ReadView* read_view_;          // Handed to new reads
+  ThreadLocalPtr* read_views_;   // The view last used by each thread
 
   // Queue of writers.
   std::deque<Writer*> writers_;
@@ -180,8 +286,35 @@ class DBImpl : public DB {
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
-  // Has a background compaction been scheduled or is running?
-  bool bg_compaction_scheduled_;
+  //whc change
+  // Number of background compactions scheduled or running, at most
+  // options_.max_background_compactions.
+  int bg_compaction_scheduled_;
+
+  //whc add
+  // Has a memtable flush been scheduled on its own background thread?
+  bool bg_flush_scheduled_;
+
+  // Is some thread writing imm_ to a table?
+  bool flushing_memtable_;
+
+  // Is some thread writing the MANIFEST in versions_->LogAndApply()?
+  bool logging_manifest_;
+
+  // Is a source table being rewritten by ReclaimBufferTable()?
+  bool reclaiming_table_;
+
+  // Set when a compaction worker found nothing to do but work that
+  // overlaps running compactions.  No worker is scheduled until the
+  // current version or its read statistics change.
+  bool bg_compaction_blocked_;
+
+  // Paces writes while compactions fall behind, updated with every
+  // version installed
+  WriteController write_controller_;
+
+  // Refresh write_controller_ from the current version
+  void UpdateWriteController() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // Information for a manual compaction
   struct ManualCompaction {
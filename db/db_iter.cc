@@ -7,6 +7,7 @@
 #include "db/filename.h"
 #include "db/db_impl.h"
 #include "db/dbformat.h"
+#include "db/range_del.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "port/port.h"
@@ -49,11 +50,12 @@ class DBIter: public Iterator {
   };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         uint32_t seed, const RangeDelMap* range_del)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        range_del_(range_del),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
@@ -61,6 +63,7 @@ class DBIter: public Iterator {
   }
   virtual ~DBIter() {
     delete iter_;
+    delete range_del_;
   }
   virtual bool Valid() const { return valid_; }
   virtual Slice key() const {
@@ -90,6 +93,16 @@ class DBIter: public Iterator {
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
 
+  //whc add
+  // Type of "ikey", values deleted by a range tombstone count as deletions
+  ValueType TypeOf(const ParsedInternalKey& ikey) const {
+    if (ikey.type == kTypeValue && range_del_ != NULL &&
+        range_del_->ShouldDelete(ikey)) {
+      return kTypeDeletion;
+    }
+    return ikey.type;
+  }
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
@@ -112,6 +125,7 @@ class DBIter: public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  const RangeDelMap* const range_del_;  //whc add, owned, may be NULL
 
   Status status_;
   std::string saved_key_;     // == current key when direction_==kReverse
@@ -177,7 +191,8 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   do {
     ParsedInternalKey ikey;
     if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
-      switch (ikey.type) {
+      //whc change
+      switch (TypeOf(ikey)) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
           // they are hidden by this deletion.
@@ -242,7 +257,8 @@ void DBIter::FindPrevUserEntry() {
           // We encountered a non-deleted value in entries for previous keys,
           break;
         }
-        value_type = ikey.type;
+        //whc change
+        value_type = TypeOf(ikey);
         if (value_type == kTypeDeletion) {
           saved_key_.clear();
           ClearSavedValue();
@@ -310,8 +326,10 @@ Iterator* NewDBIterator(
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+    uint32_t seed,
+    const RangeDelMap* range_del) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed,
+                    range_del);
 }
 
 }  // namespace leveldb
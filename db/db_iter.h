@@ -12,16 +12,21 @@
 namespace leveldb {
 
 class DBImpl;
+class RangeDelMap;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
 // into appropriate user keys.
+//whc change
+// Values "*range_del" deletes are skipped.  Takes ownership of
+// "range_del", which may be NULL.
 extern Iterator* NewDBIterator(
     DBImpl* db,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed);
+    uint32_t seed,
+    const RangeDelMap* range_del = NULL);
 
 }  // namespace leveldb
 
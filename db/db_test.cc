@@ -9,7 +9,9 @@
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/cache.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/table.h"
 #include "util/hash.h"
 #include "util/logging.h"
@@ -78,12 +80,18 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  //whc add
+  // Random reads copy into the caller's buffer rather than pointing into
+  // a mapping of the file, so that blocks read are heap allocated.
+  bool copy_random_reads_;
+
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_data_sync_.Release_Store(NULL);
     data_sync_error_.Release_Store(NULL);
     no_space_.Release_Store(NULL);
     non_writable_.Release_Store(NULL);
     count_random_reads_ = false;
+    copy_random_reads_ = false;
     manifest_sync_error_.Release_Store(NULL);
     manifest_write_error_.Release_Store(NULL);
   }
@@ -178,10 +186,30 @@ class SpecialEnv : public EnvWrapper {
       }
     };
 
+    class CopyingFile : public RandomAccessFile {
+     private:
+      RandomAccessFile* target_;
+     public:
+      explicit CopyingFile(RandomAccessFile* target) : target_(target) { }
+      virtual ~CopyingFile() { delete target_; }
+      virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                          char* scratch) const {
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && result->data() != scratch) {
+          memmove(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
+      }
+    };
+
     Status s = target()->NewRandomAccessFile(f, r);
     if (s.ok() && count_random_reads_) {
       *r = new CountingFile(*r, &random_read_counter_);
     }
+    if (s.ok() && copy_random_reads_) {
+      *r = new CopyingFile(*r);
+    }
     return s;
   }
 };
@@ -419,6 +447,20 @@ class DBTest {
     return static_cast<int>(files.size());
   }
 
+  int CountTableFiles(const std::string& dir) {
+    std::vector<std::string> filenames;
+    env_->GetChildren(dir, &filenames);
+    uint64_t number;
+    FileType type;
+    int count = 0;
+    for (size_t i = 0; i < filenames.size(); i++) {
+      if (ParseFileName(filenames[i], &number, &type) && type == kTableFile) {
+        count++;
+      }
+    }
+    return count;
+  }
+
   uint64_t Size(const Slice& start, const Slice& limit) {
     Range r(start, limit);
     uint64_t size;
@@ -440,10 +482,27 @@ class DBTest {
     }
   }
 
+  //whc add
+  // Memtables are always written to level-0 (kMaxMemCompactLevel is 0),
+  // so this pushes tables down by compactions: one table covering the
+  // specified range at each of levels n-1 down to 0.
+  void MakeTablesAtLevels(int n, const std::string& small,
+                          const std::string& large) {
+    Slice begin(small), end(large);
+    for (int level = n - 1; level >= 0; level--) {
+      Put(small, "begin");
+      Put(large, "end");
+      dbfull()->TEST_CompactMemTable();
+      for (int l = 0; l < level; l++) {
+        dbfull()->TEST_CompactRange(l, &begin, &end);
+      }
+    }
+  }
+
   // Prevent pushing of new sstables into deeper levels by adding
   // tables that cover a specified range to all levels.
   void FillLevels(const std::string& smallest, const std::string& largest) {
-    MakeTables(config::kNumLevels, smallest, largest);
+    MakeTablesAtLevels(config::kNumLevels, smallest, largest);  //whc change
   }
 
   void DumpFileCounts(const char* label) {
@@ -644,16 +703,18 @@ TEST(DBTest, GetEncountersEmptyLevel) {
     // of sstable A.  A bug would cause the compaction to be marked as
     // occurring at level 1 (instead of the correct level 0).
 
-    // Step 1: First place sstables in levels 0 and 2
-    int compaction_count = 0;
-    while (NumTableFilesAtLevel(0) == 0 ||
-           NumTableFilesAtLevel(2) == 0) {
-      ASSERT_LE(compaction_count, 100) << "could not fill levels 0 and 2";
-      compaction_count++;
-      Put("a", "begin");
-      Put("z", "end");
-      dbfull()->TEST_CompactMemTable();
-    }
+    // Step 1: First place sstables in levels 0 and 2.
+    //whc change
+    // Memtables are always written to level-0 (kMaxMemCompactLevel is 0),
+    // so sstable B is pushed down by compactions.
+    Put("a", "begin");
+    Put("z", "end");
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+    Put("a", "begin");
+    Put("z", "end");
+    dbfull()->TEST_CompactMemTable();
 
     // Step 2: clear level 1 if necessary.
     dbfull()->TEST_CompactRange(1, NULL, NULL);
@@ -927,6 +988,182 @@ static std::string Key(int i) {
   return std::string(buf);
 }
 
+//whc add
+TEST(DBTest, MultiGet) {
+  do {
+    // Spread the keys over level-0, deeper levels and the memtable, and
+    // look them up in one unsorted batch with duplicates and misses
+    Random rnd(301);
+    std::map<std::string, std::string> model;
+    for (int i = 0; i < 3000; i++) {
+      const std::string k = Key(rnd.Uniform(1000));
+      if (rnd.OneIn(8)) {
+        ASSERT_OK(Delete(k));
+        model.erase(k);
+      } else {
+        model[k] = RandomString(&rnd, 200);
+        ASSERT_OK(Put(k, model[k]));
+      }
+      if (i == 1000) {
+        dbfull()->TEST_CompactMemTable();
+        dbfull()->TEST_CompactRange(0, NULL, NULL);
+      } else if (i == 2000) {
+        dbfull()->TEST_CompactMemTable();
+      }
+    }
+    ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(100), Key(150)));
+    for (int i = 100; i < 150; i++) {
+      model.erase(Key(i));
+    }
+    const Snapshot* snapshot = db_->GetSnapshot();
+    std::map<std::string, std::string> snapshot_model = model;
+    ASSERT_OK(Put(Key(0), "after snapshot"));
+    model[Key(0)] = "after snapshot";
+
+    std::vector<std::string> key_strings;
+    for (int i = 0; i < 300; i++) {
+      key_strings.push_back(Key(rnd.Uniform(1100)));
+    }
+    key_strings.push_back(Key(0));
+    key_strings.push_back(key_strings[0]);
+    std::vector<Slice> keys(key_strings.begin(), key_strings.end());
+
+    for (int pass = 0; pass < 2; pass++) {
+      const std::map<std::string, std::string>& m =
+          (pass == 0) ? model : snapshot_model;
+      ReadOptions options;
+      options.snapshot = (pass == 0) ? NULL : snapshot;
+      std::vector<std::string> values;
+      std::vector<Status> statuses;
+      db_->MultiGet(options, keys, &values, &statuses);
+      ASSERT_EQ(keys.size(), values.size());
+      ASSERT_EQ(keys.size(), statuses.size());
+      for (size_t i = 0; i < keys.size(); i++) {
+        if (m.count(key_strings[i]) > 0) {
+          ASSERT_OK(statuses[i]);
+          ASSERT_EQ(m.find(key_strings[i])->second, values[i]);
+        } else {
+          ASSERT_TRUE(statuses[i].IsNotFound()) << key_strings[i];
+        }
+      }
+    }
+    db_->ReleaseSnapshot(snapshot);
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, RowCache) {
+  do {
+    Cache* row_cache = NewLRUCache(1 << 20);
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.row_cache = row_cache;
+    DestroyAndReopen(&options);
+
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(Put(Key(i), "v1"));
+    }
+    dbfull()->TEST_CompactMemTable();
+    const Snapshot* snapshot = db_->GetSnapshot();
+
+    // The first reads fill the cache, hits and misses alike, and the
+    // second ones are served from it
+    for (int i = 0; i < 100; i++) {
+      ASSERT_EQ("v1", Get(Key(i)));
+      ASSERT_EQ("NOT_FOUND", Get(Key(i) + "x"));
+    }
+    const size_t charge = row_cache->TotalCharge();
+    ASSERT_GT(charge, 0);
+    for (int i = 0; i < 100; i++) {
+      ASSERT_EQ("v1", Get(Key(i)));
+      ASSERT_EQ("NOT_FOUND", Get(Key(i) + "x"));
+    }
+    ASSERT_EQ(charge, row_cache->TotalCharge());
+
+    // Rows of older files do not hide newer entries, and snapshots older
+    // than a file skip its rows
+    for (int i = 0; i < 50; i++) {
+      if (i % 2 == 0) {
+        ASSERT_OK(Put(Key(i), "v2"));
+      } else {
+        ASSERT_OK(Delete(Key(i)));
+      }
+    }
+    for (int pass = 0; pass < 2; pass++) {
+      if (pass == 0) {
+        dbfull()->TEST_CompactMemTable();
+      } else {
+        dbfull()->TEST_CompactRange(0, NULL, NULL);
+      }
+      std::vector<Slice> keys;
+      std::vector<std::string> key_strings;
+      for (int i = 0; i < 100; i++) {
+        key_strings.push_back(Key(i));
+      }
+      keys.assign(key_strings.begin(), key_strings.end());
+      for (int round = 0; round < 2; round++) {
+        std::vector<std::string> values;
+        std::vector<Status> statuses;
+        db_->MultiGet(ReadOptions(), keys, &values, &statuses);
+        for (int i = 0; i < 100; i++) {
+          const std::string expected =
+              (i >= 50) ? "v1" : (i % 2 == 0) ? "v2" : "NOT_FOUND";
+          ASSERT_EQ(expected, Get(Key(i)));
+          ASSERT_EQ("v1", Get(Key(i), snapshot));
+          if (expected == "NOT_FOUND") {
+            ASSERT_TRUE(statuses[i].IsNotFound());
+          } else {
+            ASSERT_OK(statuses[i]);
+            ASSERT_EQ(expected, values[i]);
+          }
+        }
+      }
+    }
+    db_->ReleaseSnapshot(snapshot);
+    Close();
+    delete row_cache;
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, PinnedMetadataFollowsLevel) {
+  Cache* block_cache = NewLRUCache(1 << 20);
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = block_cache;
+  options.cache_index_and_filter_blocks = true;
+  options.top_level_size = 1;  // Levels overflow until the file sinks deep
+  env_->copy_random_reads_ = true;
+  Reopen(&options);
+
+  // Index and filter blocks are pinned while the file sits at level-0
+  // or level-1
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("b", "vb"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ("va", Get("a"));
+  block_cache->Prune();
+  if (NumTableFilesAtLevel(0) + NumTableFilesAtLevel(1) > 0) {
+    ASSERT_GT(block_cache->TotalCharge(), 0);
+  }
+
+  // Trivial moves take the file further down without reopening it.
+  // Lookups there release the pinned blocks.
+  for (int i = 0; i < 100; i++) {
+    if (NumTableFilesAtLevel(0) + NumTableFilesAtLevel(1) == 0) break;
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(0, NumTableFilesAtLevel(0) + NumTableFilesAtLevel(1));
+  ASSERT_EQ(1, TotalTableFiles());
+  ASSERT_EQ("va", Get("a"));
+  ASSERT_EQ("vb", Get("b"));
+  block_cache->Prune();
+  ASSERT_EQ(0, block_cache->TotalCharge());
+
+  Close();
+  env_->copy_random_reads_ = false;
+  delete block_cache;
+}
+
 TEST(DBTest, MinorCompactionsHappen) {
   Options options = CurrentOptions();
   options.write_buffer_size = 10000;
@@ -1002,6 +1239,186 @@ TEST(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+TEST(DBTest, ParallelCompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.buffer_compact_levels = 1 << 1;
+  options.max_background_compactions = 4;
+  Reopen(&options);
+
+  // Flushes, compactions, dispatches and buffer merges run side by side
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 6000; i++) {
+    const std::string k = Key(rnd.Uniform(2000));
+    if (rnd.OneIn(10)) {
+      ASSERT_OK(Delete(k));
+      model.erase(k);
+    } else {
+      model[k] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(k, model[k]));
+    }
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    std::map<std::string, std::string>::const_iterator m = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+      ASSERT_TRUE(m != model.end());
+      ASSERT_EQ(m->first, iter->key().ToString());
+      ASSERT_EQ(m->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(m == model.end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, IntraL0Compactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 65536;  // Small write buffer
+  options.max_background_compactions = 4;
+  Reopen(&options);
+
+  // While level-0 compactions into level-1 run, the newest level-0 files
+  // get merged among themselves.  Lookups must still find the newest
+  // value of keys overwritten across many level-0 files.
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 30000; i++) {
+    const std::string k = Key(rnd.Uniform(5000));
+    if (rnd.OneIn(10)) {
+      ASSERT_OK(Delete(k));
+      model.erase(k);
+    } else {
+      model[k] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(k, model[k]));
+    }
+    if (i % 1000 == 0) {
+      for (int j = 0; j < 50; j++) {
+        const std::string key = Key(rnd.Uniform(5000));
+        if (model.count(key) > 0) {
+          ASSERT_EQ(model[key], Get(key));
+        } else {
+          ASSERT_EQ("NOT_FOUND", Get(key));
+        }
+      }
+    }
+  }
+  ASSERT_GT(dbfull()->TEST_NumIntraL0Compactions(), 0);
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    std::map<std::string, std::string>::const_iterator m = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+      ASSERT_TRUE(m != model.end());
+      ASSERT_EQ(m->first, iter->key().ToString());
+      ASSERT_EQ(m->second, iter->value().ToString());
+      ASSERT_EQ(m->second, Get(m->first));
+    }
+    ASSERT_TRUE(m == model.end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, UniversalCompaction) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.compaction_style = kCompactionStyleUniversal;
+  Reopen(&options);
+
+  // Runs of the same size are merged once there are enough of them.  The
+  // merge holds the oldest run, so it drops deletions.
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int run = 0; run < config::kL0_CompactionTrigger; run++) {
+    for (int i = 0; i < 50; i++) {
+      const std::string k = Key(run * 50 + i);
+      model[k] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(k, model[k]));
+    }
+    ASSERT_OK(Delete(Key(run)));
+    model.erase(Key(run));
+    dbfull()->TEST_CompactMemTable();
+  }
+  for (int i = 0; i < 100 && NumTableFilesAtLevel(0) > 1; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ("1", FilesPerLevel());
+  ASSERT_EQ("[ ]", AllEntriesFor(Key(1)));
+
+  // Entries never leave level-0 and lookups find the newest of the runs
+  for (int i = 0; i < 8000; i++) {
+    const std::string k = Key(rnd.Uniform(2000));
+    if (rnd.OneIn(10)) {
+      ASSERT_OK(Delete(k));
+      model.erase(k);
+    } else {
+      model[k] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(k, model[k]));
+    }
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    std::map<std::string, std::string>::const_iterator m = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+      ASSERT_TRUE(m != model.end());
+      ASSERT_EQ(m->first, iter->key().ToString());
+      ASSERT_EQ(m->second, iter->value().ToString());
+      ASSERT_EQ(m->second, Get(m->first));
+    }
+    ASSERT_TRUE(m == model.end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    for (int level = 1; level < config::kNumLevels; level++) {
+      ASSERT_EQ(0, NumTableFilesAtLevel(level));
+    }
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, Subcompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 4000; i++) {
+    const std::string k = Key(rnd.Uniform(3000));
+    if (rnd.OneIn(10)) {
+      ASSERT_OK(Delete(k));
+      model.erase(k);
+    } else {
+      model[k] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(k, model[k]));
+    }
+  }
+  // The full range is split between threads merging the same inputs
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_EQ(NumTableFilesAtLevel(1), 0);
+  ASSERT_GT(NumTableFilesAtLevel(2), 1);
+
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    std::map<std::string, std::string>::const_iterator m = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+      ASSERT_TRUE(m != model.end());
+      ASSERT_EQ(m->first, iter->key().ToString());
+      ASSERT_EQ(m->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(m == model.end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    Reopen(&options);
+  }
+}
+
 TEST(DBTest, RepeatedWritesToSameKey) {
   Options options = CurrentOptions();
   options.env = env_;
@@ -1072,6 +1489,85 @@ static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   return result;
 }
 
+TEST(DBTest, WriteControllerProperty) {
+  std::string value;
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-controller", &value));
+  ASSERT_TRUE(value.find("state: normal") != std::string::npos) << value;
+  ASSERT_TRUE(value.find("delayed-writes: 0") != std::string::npos) << value;
+
+  // Writes are not paced while compactions keep up
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  Reopen(&options);
+  Random rnd(301);
+  for (int i = 0; i < 200; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 1000)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-controller", &value));
+  ASSERT_TRUE(value.find("state: normal") != std::string::npos) << value;
+}
+
+TEST(DBTest, RateLimiter) {
+  RateLimiter* limiter = NewGenericRateLimiter(100 << 20);
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.rate_limiter = limiter;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 300; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  for (int i = 0; i < 300; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  // Flushes write at high priority, compactions read and write at low
+  ASSERT_GT(limiter->GetTotalBytesThrough(RateLimiter::kIOHigh), 300000);
+  ASSERT_GT(limiter->GetTotalBytesThrough(RateLimiter::kIOLow), 100000);
+  Close();
+  delete limiter;
+}
+
+TEST(DBTest, PipelinedCompaction) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.block_compression_threads = 2;
+  options.compaction_readahead_size = 64 << 10;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 1000; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  for (int i = 0; i < 1000; i += 7) {
+    ASSERT_OK(Delete(Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(i % 7 == 0 ? "NOT_FOUND" : values[i], Get(Key(i)));
+  }
+
+  Reopen(&options);
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  ASSERT_OK(iter->status());
+  ASSERT_EQ(1000 - 143, count);
+  delete iter;
+}
+
 TEST(DBTest, ApproximateSizes) {
   do {
     Options options = CurrentOptions();
@@ -1256,15 +1752,21 @@ TEST(DBTest, HiddenValuesAreRemoved) {
 }
 
 TEST(DBTest, DeletionMarkers1) {
+  //whc change
+  // Memtables are always written to level-0, so the tables below it are
+  // pushed down by compactions
   Put("foo", "v1");
   ASSERT_OK(dbfull()->TEST_CompactMemTable());
-  const int last = config::kMaxMemCompactLevel;
+  const int last = 2;
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
   ASSERT_EQ(NumTableFilesAtLevel(last), 1);   // foo => v1 is now in last level
 
   // Place a table at level last-1 to prevent merging with preceding mutation
   Put("a", "begin");
   Put("z", "end");
   dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
   ASSERT_EQ(NumTableFilesAtLevel(last), 1);
   ASSERT_EQ(NumTableFilesAtLevel(last-1), 1);
 
@@ -1285,15 +1787,21 @@ TEST(DBTest, DeletionMarkers1) {
 }
 
 TEST(DBTest, DeletionMarkers2) {
+  //whc change
+  // Memtables are always written to level-0, so the tables below it are
+  // pushed down by compactions
   Put("foo", "v1");
   ASSERT_OK(dbfull()->TEST_CompactMemTable());
-  const int last = config::kMaxMemCompactLevel;
+  const int last = 2;
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
   ASSERT_EQ(NumTableFilesAtLevel(last), 1);   // foo => v1 is now in last level
 
   // Place a table at level last-1 to prevent merging with preceding mutation
   Put("a", "begin");
   Put("z", "end");
   dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
   ASSERT_EQ(NumTableFilesAtLevel(last), 1);
   ASSERT_EQ(NumTableFilesAtLevel(last-1), 1);
 
@@ -1310,36 +1818,256 @@ TEST(DBTest, DeletionMarkers2) {
   ASSERT_EQ(AllEntriesFor("foo"), "[ ]");
 }
 
-TEST(DBTest, OverlapInLevel0) {
+TEST(DBTest, DeleteRange) {
   do {
-    ASSERT_EQ(config::kMaxMemCompactLevel, 2) << "Fix test to match config";
+    ASSERT_OK(Put("a", "va"));
+    ASSERT_OK(Put("b", "vb"));
+    ASSERT_OK(Put("c", "vc"));
+    ASSERT_OK(Put("d", "vd"));
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(db_->DeleteRange(WriteOptions(), "b", "d"));
+    ASSERT_EQ("va", Get("a"));
+    ASSERT_EQ("NOT_FOUND", Get("b"));
+    ASSERT_EQ("NOT_FOUND", Get("c"));
+    ASSERT_EQ("vd", Get("d"));
+    ASSERT_EQ("(a->va)(d->vd)", Contents());
+    ASSERT_EQ("vb", Get("b", snapshot));
 
-    // Fill levels 1 and 2 to disable the pushing of new memtables to levels > 0.
-    ASSERT_OK(Put("100", "v100"));
-    ASSERT_OK(Put("999", "v999"));
-    dbfull()->TEST_CompactMemTable();
-    ASSERT_OK(Delete("100"));
-    ASSERT_OK(Delete("999"));
-    dbfull()->TEST_CompactMemTable();
-    ASSERT_EQ("0,1,1", FilesPerLevel());
+    // Writes after the tombstone are not deleted by it
+    ASSERT_OK(Put("c", "vc2"));
+    ASSERT_EQ("(a->va)(c->vc2)(d->vd)", Contents());
 
-    // Make files spanning the following ranges in level-0:
-    //  files[0]  200 .. 900
-    //  files[1]  300 .. 500
-    // Note that files are sorted by smallest key.
-    ASSERT_OK(Put("300", "v300"));
-    ASSERT_OK(Put("500", "v500"));
-    dbfull()->TEST_CompactMemTable();
-    ASSERT_OK(Put("200", "v200"));
-    ASSERT_OK(Put("600", "v600"));
-    ASSERT_OK(Put("900", "v900"));
+    // Tombstones keep deleting once flushed, and after a reopen
     dbfull()->TEST_CompactMemTable();
-    ASSERT_EQ("2,1,1", FilesPerLevel());
+    ASSERT_EQ("NOT_FOUND", Get("b"));
+    ASSERT_EQ("vc2", Get("c"));
+    ASSERT_EQ("vb", Get("b", snapshot));
+    ASSERT_EQ("(a->va)(c->vc2)(d->vd)", Contents());
+    db_->ReleaseSnapshot(snapshot);
+    Reopen();
+    ASSERT_EQ("NOT_FOUND", Get("b"));
+    ASSERT_EQ("(a->va)(c->vc2)(d->vd)", Contents());
 
-    // Compact away the placeholder files we created initially
-    dbfull()->TEST_CompactRange(1, NULL, NULL);
-    dbfull()->TEST_CompactRange(2, NULL, NULL);
-    ASSERT_EQ("2", FilesPerLevel());
+    // Compactions drop the deleted entries
+    dbfull()->CompactRange(NULL, NULL);
+    ASSERT_EQ("[ ]", AllEntriesFor("b"));
+    ASSERT_EQ("[ vc2 ]", AllEntriesFor("c"));
+    ASSERT_EQ("(a->va)(c->vc2)(d->vd)", Contents());
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, DeleteRangeOverlappingSnapshots) {
+  do {
+    // Overlapping tombstones, some flushed and some still in the
+    // memtable, seen from snapshots taken between them
+    Random rnd(301);
+    std::map<std::string, std::string> model;
+    std::vector<const Snapshot*> snapshots;
+    std::vector<std::map<std::string, std::string> > models;
+    for (int round = 0; round < 20; round++) {
+      for (int i = 0; i < 20; i++) {
+        const std::string k = Key(rnd.Uniform(100));
+        model[k] = RandomString(&rnd, 10);
+        ASSERT_OK(Put(k, model[k]));
+      }
+      const int begin = rnd.Uniform(100);
+      const int end = begin + 1 + rnd.Uniform(30);
+      ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(begin), Key(end)));
+      model.erase(model.lower_bound(Key(begin)), model.lower_bound(Key(end)));
+      snapshots.push_back(db_->GetSnapshot());
+      models.push_back(model);
+      if (round % 5 == 4) {
+        dbfull()->TEST_CompactMemTable();
+      }
+      for (size_t s = 0; s < snapshots.size(); s++) {
+        for (int i = 0; i < 100; i++) {
+          std::map<std::string, std::string>::const_iterator it =
+              models[s].find(Key(i));
+          ASSERT_EQ(it == models[s].end() ? "NOT_FOUND" : it->second,
+                    Get(Key(i), snapshots[s]));
+        }
+      }
+    }
+    for (size_t s = 0; s < snapshots.size(); s++) {
+      db_->ReleaseSnapshot(snapshots[s]);
+    }
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, DeleteRangeDropsFiles) {
+  ASSERT_OK(Put("a", "va"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("b1", "vb1"));
+  ASSERT_OK(Put("b2", "vb2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("c", "vc"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(3, TotalTableFiles());
+
+  // The file of "b1" and "b2" is dropped once the tombstone is flushed,
+  // then the tombstone itself
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "b", "c"));
+  dbfull()->TEST_CompactMemTable();
+  std::string property;
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db_->GetProperty("leveldb.sstables", &property));
+    if (TotalTableFiles() == 2 &&
+        property.find("range tombstones") == std::string::npos) {
+      break;
+    }
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(2, TotalTableFiles());
+  ASSERT_EQ(std::string::npos, property.find("range tombstones"));
+  ASSERT_EQ("(a->va)(c->vc)", Contents());
+
+  Reopen();
+  ASSERT_EQ("(a->va)(c->vc)", Contents());
+}
+
+namespace {
+// Removes the values "drop" and replaces the values "old" by "new"
+class TestCompactionFilter : public CompactionFilter {
+ public:
+  virtual const char* Name() const { return "TestCompactionFilter"; }
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const {
+    if (existing_value == "drop") {
+      return true;
+    }
+    if (existing_value == "old") {
+      new_value->assign("new");
+      *value_changed = true;
+    }
+    return false;
+  }
+};
+}  // namespace
+
+TEST(DBTest, CompactionFilter) {
+  TestCompactionFilter filter;
+  Options options = CurrentOptions();
+  options.compaction_filter = &filter;
+  Reopen(&options);
+
+  ASSERT_OK(Put("a", "old"));
+  ASSERT_OK(Put("b", "vb"));
+  ASSERT_OK(Put("c", "vc"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("0,0,1", FilesPerLevel());
+  ASSERT_EQ("new", Get("a"));
+
+  // A removed value above older data becomes a deletion
+  ASSERT_OK(Put("b", "drop"));
+  ASSERT_OK(Put("d", "drop"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("drop", Get("b"));
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ("0,1,1", FilesPerLevel());
+  ASSERT_EQ("[ DEL, vb ]", AllEntriesFor("b"));
+  ASSERT_EQ("[ ]", AllEntriesFor("d"));
+  ASSERT_EQ("(a->new)(c->vc)", Contents());
+
+  // Values newer than a snapshot are kept
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_OK(Put("c", "drop"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ("drop", Get("c"));
+  ASSERT_EQ("vc", Get("c", snapshot));
+  db_->ReleaseSnapshot(snapshot);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("0,0,1", FilesPerLevel());
+  ASSERT_EQ("(a->new)", Contents());
+  ASSERT_EQ("[ ]", AllEntriesFor("b"));
+  ASSERT_EQ("[ ]", AllEntriesFor("c"));
+  Close();
+}
+
+TEST(DBTest, TTLCompactionFilter) {
+  const CompactionFilter* filter = NewTTLCompactionFilter(100, env_);
+  Options options = CurrentOptions();
+  options.compaction_filter = filter;
+  Reopen(&options);
+
+  const uint64_t now = env_->NowMicros() / 1000000;
+  std::string expired("expired"), fresh("fresh");
+  AppendTTLTimestamp(&expired, now - 1000);
+  AppendTTLTimestamp(&fresh, now);
+  ASSERT_OK(Put("a", expired));
+  ASSERT_OK(Put("b", fresh));
+  ASSERT_OK(Put("c", "short"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(expired, Get("a"));
+
+  dbfull()->CompactRange(NULL, NULL);
+  ASSERT_EQ("NOT_FOUND", Get("a"));
+  ASSERT_EQ(fresh, Get("b"));
+  ASSERT_EQ("short", Get("c"));
+  Close();
+  delete filter;
+}
+
+TEST(DBTest, TombstoneCompaction) {
+  for (int i = 0; i < 200; i++) {
+    ASSERT_OK(Put(Key(i), "v"));
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("0,0,1", FilesPerLevel());
+
+  // The deletions are kept above the values they delete, then compacted
+  // with them although both levels are far under their size limits
+  for (int i = 0; i < 200; i++) {
+    ASSERT_OK(Delete(Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  for (int i = 0; i < 100 && TotalTableFiles() > 0; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(0, TotalTableFiles());
+  ASSERT_EQ("", Contents());
+}
+
+TEST(DBTest, OverlapInLevel0) {
+  do {
+    //whc change
+    // Fill levels 1 and 2 to disable the pushing of new memtables to levels > 0.
+    // Memtables are always written to level-0, so compactions push them.
+    ASSERT_OK(Put("100", "v100"));
+    ASSERT_OK(Put("999", "v999"));
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+    ASSERT_OK(Delete("100"));
+    ASSERT_OK(Delete("999"));
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    ASSERT_EQ("0,1,1", FilesPerLevel());
+
+    // Make files spanning the following ranges in level-0:
+    //  files[0]  200 .. 900
+    //  files[1]  300 .. 500
+    // Note that files are sorted by smallest key.
+    ASSERT_OK(Put("300", "v300"));
+    ASSERT_OK(Put("500", "v500"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("200", "v200"));
+    ASSERT_OK(Put("600", "v600"));
+    ASSERT_OK(Put("900", "v900"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_EQ("2,1,1", FilesPerLevel());
+
+    // Compact away the placeholder files we created initially
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+    dbfull()->TEST_CompactRange(2, NULL, NULL);
+    ASSERT_EQ("2", FilesPerLevel());
 
     // Do a memtable compaction.  Before bug-fix, the compaction would
     // not detect the overlap with level-0 files and would incorrectly place
@@ -1473,10 +2201,8 @@ TEST(DBTest, CustomComparator) {
 }
 
 TEST(DBTest, ManualCompaction) {
-  ASSERT_EQ(config::kMaxMemCompactLevel, 2)
-      << "Need to update this test to match kMaxMemCompactLevel";
-
-  MakeTables(3, "p", "q");
+  //whc change
+  MakeTablesAtLevels(3, "p", "q");
   ASSERT_EQ("1,1,1", FilesPerLevel());
 
   // Compaction range falls before files
@@ -1492,7 +2218,7 @@ TEST(DBTest, ManualCompaction) {
   ASSERT_EQ("0,0,1", FilesPerLevel());
 
   // Populate a different range
-  MakeTables(3, "c", "e");
+  MakeTablesAtLevels(3, "c", "e");
   ASSERT_EQ("1,1,2", FilesPerLevel());
 
   // Compact just the new range
@@ -1501,11 +2227,523 @@ TEST(DBTest, ManualCompaction) {
 
   // Compact all
   MakeTables(1, "a", "z");
-  ASSERT_EQ("0,1,2", FilesPerLevel());
+  ASSERT_EQ("1,0,2", FilesPerLevel());
   db_->CompactRange(NULL, NULL);
   ASSERT_EQ("0,0,1", FilesPerLevel());
 }
 
+//whc add
+TEST(DBTest, BufferCompactLevels) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.buffer_compact_levels = 1 << 1;
+  options.buffer_merge_threshold.assign(config::kNumLevels, 3);
+  DestroyAndReopen(&options);
+
+  // Build one table at level-2 to receive the buffer nodes
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("m", "v1"));
+  ASSERT_OK(Put("z", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+
+  // Level-1 tables are dispatched into the level-2 table's buffer.
+  // Lookups would make the table worth merging, so only scan it here.
+  ASSERT_OK(Put("m", "v2"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("1", property);
+  ASSERT_EQ("(a->v1)(m->v2)(z->v1)", Contents());
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->Seek("b");
+  ASSERT_EQ("m->v2", IterStatus(iter));
+  iter->Prev();
+  ASSERT_EQ("a->v1", IterStatus(iter));
+  iter->Next();
+  ASSERT_EQ("m->v2", IterStatus(iter));
+  iter->Seek("n");
+  ASSERT_EQ("z->v1", IterStatus(iter));
+  delete iter;
+
+  Reopen(&options);
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("1", property);
+  ASSERT_EQ("(a->v1)(m->v2)(z->v1)", Contents());
+
+  // A table nobody reads keeps its buffer past the threshold
+  ASSERT_OK(Put("a", "v3"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_OK(Put("z", "v4"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("3", property);
+  ASSERT_EQ("(a->v3)(m->v2)(z->v4)", Contents());
+
+  // Twice the threshold merges the buffer into the table
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(Put("b", "v5"));
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                                 &property));
+    if (property == "0") break;
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ("0", property);
+  ASSERT_EQ("v3", Get("a"));
+  ASSERT_EQ("v5", Get("b"));
+  ASSERT_EQ("v2", Get("m"));
+  ASSERT_EQ("NOT_FOUND", Get("n"));
+  ASSERT_EQ("v4", Get("z"));
+
+  Reopen(&options);
+  ASSERT_EQ("(a->v3)(b->v5)(m->v2)(z->v4)", Contents());
+}
+
+TEST(DBTest, BufferNodeFilters) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  DestroyAndReopen(&options);
+
+  const char* ranges[4][2] = { {"a", "b"}, {"c", "d"}, {"e", "f"}, {"g", "h"} };
+  for (int i = 0; i < 4; i++) {
+    ASSERT_OK(Put(ranges[i][0], "v1"));
+    ASSERT_OK(Put(ranges[i][1], "v1"));
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+  }
+  ASSERT_EQ(4, NumTableFilesAtLevel(2));
+  options.buffer_compact_levels = 1 << 1;
+  options.buffer_merge_threshold.assign(config::kNumLevels, 10);
+  Reopen(&options);
+
+  // One source table cut into a node per level-2 table, each with a
+  // filter over its keys
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 20; j++) {
+      ASSERT_OK(Put(ranges[i][0] + NumberToString(j * 2), "v2"));
+    }
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("4", property);
+
+  // Keys inside a node's range but not in its filter skip its table,
+  // except for the few the filter lets through
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 20; j++) {
+      ASSERT_EQ("NOT_FOUND", Get(ranges[i][0] + NumberToString(j * 2 + 1)));
+      ASSERT_EQ("NOT_FOUND", Get(ranges[i][0] + NumberToString(j) + "x"));
+    }
+  }
+  ASSERT_LT(dbfull()->TEST_NumBufferProbes(2), 8);
+
+  // Keys of every node are still found through their filters
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 20; j++) {
+      ASSERT_EQ("v2", Get(ranges[i][0] + NumberToString(j * 2)));
+    }
+    ASSERT_EQ("v1", Get(ranges[i][0]));
+    ASSERT_EQ("v1", Get(ranges[i][1]));
+  }
+
+  Close();
+  delete options.filter_policy;
+}
+
+TEST(DBTest, BufferMergeHotFile) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.buffer_compact_levels = 1 << 1;
+  options.buffer_merge_threshold.assign(config::kNumLevels, 10);
+  DestroyAndReopen(&options);
+
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("z", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_OK(Put("m", "v2"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("1", property);
+
+  // Probing the node of a small table costs more than merging it
+  ASSERT_EQ("v2", Get("m"));
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                                 &property));
+    if (property == "0") break;
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ("0", property);
+  ASSERT_EQ("(a->v1)(m->v2)(z->v1)", Contents());
+}
+
+TEST(DBTest, BufferTableReclaim) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  // Four level-2 tables, each receiving a node of the same source table.
+  // They are built before level-1 dispatches, which would otherwise put
+  // the later ones into the buffer of the first.
+  const char* ranges[4][2] = { {"a", "b"}, {"c", "d"}, {"e", "f"}, {"g", "h"} };
+  for (int i = 0; i < 4; i++) {
+    ASSERT_OK(Put(ranges[i][0], "v1"));
+    ASSERT_OK(Put(ranges[i][1], "v1"));
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+  }
+  ASSERT_EQ(4, NumTableFilesAtLevel(2));
+  options.buffer_compact_levels = 1 << 1;
+  options.buffer_merge_threshold.assign(config::kNumLevels, 10);
+  Reopen(&options);
+  Random rnd(301);
+  std::string big[4];
+  for (int i = 0; i < 4; i++) {
+    big[i] = RandomString(&rnd, 10000);
+    ASSERT_OK(Put(ranges[i][0], big[i]));
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("4", property);
+  ASSERT_TRUE(db_->GetProperty("leveldb.buffer-table-bytes-at-level2",
+                               &property));
+  const int64_t pinned = atoll(property.c_str());
+  ASSERT_GT(pinned, 40000);
+
+  // Reading three of the tables merges their nodes, leaving a quarter of
+  // the source table live, which then gets rewritten
+  ASSERT_EQ(big[0], Get("a"));
+  ASSERT_EQ(big[1], Get("c"));
+  ASSERT_EQ(big[2], Get("e"));
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db_->GetProperty("leveldb.buffer-table-bytes-at-level2",
+                                 &property));
+    if (atoll(property.c_str()) < pinned / 2) break;
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_LT(atoll(property.c_str()), pinned / 2);
+  ASSERT_GT(atoll(property.c_str()), 10000);
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("1", property);
+  ASSERT_EQ(big[3], Get("g"));
+  ASSERT_EQ("v1", Get("h"));
+  ASSERT_EQ("NOT_FOUND", Get("i"));
+
+  Reopen(&options);
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(big[i], Get(ranges[i][0]));
+    ASSERT_EQ("v1", Get(ranges[i][1]));
+  }
+}
+
+TEST(DBTest, BufferNodesOfOneSourceTable) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  const char* ranges[4][2] = { {"a", "b"}, {"c", "d"}, {"e", "f"}, {"g", "h"} };
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 2; j++) {
+      model[ranges[i][j]] = "v1";
+      ASSERT_OK(Put(ranges[i][j], "v1"));
+    }
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+  }
+  ASSERT_EQ(4, NumTableFilesAtLevel(2));
+  options.buffer_compact_levels = 1 << 1;
+  options.buffer_merge_threshold.assign(config::kNumLevels, 10);
+  Reopen(&options);
+
+  // Each level-1 table is cut into one node per level-2 table, and a scan
+  // reads all nodes of a source table through one shared cursor.  Only
+  // scan, since lookups would get the small tables merged.
+  Random rnd(301);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 50; j++) {
+        std::string k = ranges[i][0] + NumberToString(rnd.Uniform(100));
+        if (rnd.OneIn(5)) {
+          ASSERT_OK(Delete(k));
+          model.erase(k);
+        } else {
+          model[k] = RandomString(&rnd, 100);
+          ASSERT_OK(Put(k, model[k]));
+        }
+      }
+    }
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+  }
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("8", property);
+
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  std::map<std::string, std::string>::const_iterator m = model.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+    ASSERT_TRUE(m != model.end());
+    ASSERT_EQ(m->first, iter->key().ToString());
+    ASSERT_EQ(m->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(m == model.end());
+  std::map<std::string, std::string>::const_reverse_iterator r =
+      model.rbegin();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++r) {
+    ASSERT_TRUE(r != model.rend());
+    ASSERT_EQ(r->first, iter->key().ToString());
+    ASSERT_EQ(r->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(r == model.rend());
+
+  // Seeks jump between nodes of the same source table, and each step
+  // may cross from one node into the next in either direction
+  for (int i = 0; i < 200; i++) {
+    std::string k = std::string(1, 'a' + rnd.Uniform(9)) +
+                    NumberToString(rnd.Uniform(100));
+    iter->Seek(k);
+    m = model.lower_bound(k);
+    for (int step = 0; step < 10; step++) {
+      if (m == model.end()) {
+        ASSERT_TRUE(!iter->Valid());
+        break;
+      }
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(m->first, iter->key().ToString());
+      ASSERT_EQ(m->second, iter->value().ToString());
+      if (rnd.OneIn(3)) {
+        if (m == model.begin()) break;
+        iter->Prev();
+        --m;
+      } else {
+        iter->Next();
+        ++m;
+      }
+    }
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                               &property));
+  ASSERT_EQ("8", property);
+}
+
+TEST(DBTest, BufferMergeParallel) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  const char* ranges[6][2] = { {"a", "b"}, {"c", "d"}, {"e", "f"},
+                               {"g", "h"}, {"i", "j"}, {"k", "l"} };
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 6; i++) {
+    for (int j = 0; j < 2; j++) {
+      model[ranges[i][j]] = "v1";
+      ASSERT_OK(Put(ranges[i][j], "v1"));
+    }
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+  }
+  ASSERT_EQ(6, NumTableFilesAtLevel(2));
+  options.buffer_compact_levels = 1 << 1;
+  options.buffer_merge_threshold.assign(config::kNumLevels, 1);
+  options.max_buffer_merge_threads = 4;
+  Reopen(&options);
+
+  // The second dispatch saturates all six files at once, so one merge
+  // spreads them over the merge threads while writes go on
+  Random rnd(301);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 6; i++) {
+      for (int j = 0; j < 20; j++) {
+        std::string k = ranges[i][0] + NumberToString(j);
+        model[k] = RandomString(&rnd, 1000);
+        ASSERT_OK(Put(k, model[k]));
+      }
+    }
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    dbfull()->TEST_CompactRange(1, NULL, NULL);
+  }
+  for (int i = 0; i < 100; i++) {
+    std::string k = Key(i);
+    model[k] = RandomString(&rnd, 100);
+    ASSERT_OK(Put(k, model[k]));
+  }
+  std::string property;
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-nodes-at-level2",
+                                 &property));
+    if (property == "0") break;
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ("0", property);
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-merges-at-level2",
+                               &property));
+  const int merges = atoi(property.c_str());
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-merged-files-at-level2",
+                               &property));
+  ASSERT_GT(merges, 0);
+  ASSERT_GT(atoi(property.c_str()), merges);
+  ASSERT_EQ(6, NumTableFilesAtLevel(2));
+
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    std::map<std::string, std::string>::const_iterator m = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+      ASSERT_TRUE(m != model.end());
+      ASSERT_EQ(m->first, iter->key().ToString());
+      ASSERT_EQ(m->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(m == model.end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, BufferMergeTwoLevels) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.top_level_size = 200000;
+  options.buffer_compact_levels = (1 << 1) | (1 << 2);
+  options.buffer_merge_threshold.assign(config::kNumLevels, 2);
+  options.max_background_compactions = 4;
+  DestroyAndReopen(&options);
+
+  // Merges queued at levels 2 and 3 run as separate background jobs
+  // next to flushes and dispatches
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  std::string merges2, merges3;
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 2000; i++) {
+      const std::string k = Key(rnd.Uniform(4000));
+      if (rnd.OneIn(10)) {
+        ASSERT_OK(Delete(k));
+        model.erase(k);
+      } else {
+        model[k] = RandomString(&rnd, 500);
+        ASSERT_OK(Put(k, model[k]));
+      }
+      if (i % 100 == 0) {
+        const std::string r = Key(rnd.Uniform(4000));
+        ASSERT_EQ(model.count(r) ? model[r] : "NOT_FOUND", Get(r));
+      }
+    }
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-merges-at-level2",
+                                 &merges2));
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-buffer-merges-at-level3",
+                                 &merges3));
+    if (merges2 != "0" && merges3 != "0") break;
+  }
+  ASSERT_NE("0", merges2);
+  ASSERT_NE("0", merges3);
+
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    std::map<std::string, std::string>::const_iterator m = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+      ASSERT_TRUE(m != model.end());
+      ASSERT_EQ(m->first, iter->key().ToString());
+      ASSERT_EQ(m->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(m == model.end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, TwoTierStorage) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.ssd_path = test::TmpDir() + "/db_test_ssd";
+  options.ssd_levels = 1;
+  Close();
+  DestroyDB(dbname_, options);
+  Reopen(&options);
+
+  // Level-0 tables are written to the fast tier, deeper ones to dbname
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("z", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+  ASSERT_EQ(1, CountTableFiles(options.ssd_path));
+  ASSERT_EQ(0, CountTableFiles(dbname_));
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+  ASSERT_EQ(0, CountTableFiles(options.ssd_path));
+  ASSERT_EQ(1, CountTableFiles(dbname_));
+
+  // A level-1 table dispatched into level-2 buffers moves to the fast
+  // tier, from where its nodes are read
+  options.buffer_compact_levels = 1 << 1;
+  Reopen(&options);
+  ASSERT_OK(Put("a", "v2"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(1, NumTableFilesAtLevel(1));
+  ASSERT_EQ(2, CountTableFiles(dbname_));
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  ASSERT_EQ(1, CountTableFiles(options.ssd_path));
+  ASSERT_EQ(1, CountTableFiles(dbname_));
+  ASSERT_EQ("v2", Get("a"));
+  ASSERT_EQ("v1", Get("z"));
+
+  Reopen(&options);
+  ASSERT_EQ("v2", Get("a"));
+  ASSERT_EQ("v1", Get("z"));
+  Close();
+  ASSERT_OK(DestroyDB(dbname_, options));
+  ASSERT_EQ(0, CountTableFiles(options.ssd_path));
+}
+
 TEST(DBTest, DBOpen_Options) {
   std::string dbname = test::TmpDir() + "/db_options_test";
   DestroyDB(dbname, Options());
@@ -1853,6 +3091,103 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+//whc add
+namespace {
+
+static const int kReadViewKeys = 100;
+
+struct ReadViewState {
+  DB* db;
+  port::AtomicPointer round;      // Rounds of writes completed
+  port::AtomicPointer stop;
+  port::AtomicPointer done[kNumThreads];
+  port::AtomicPointer failed;
+};
+
+struct ReadViewThread {
+  ReadViewState* state;
+  int id;
+};
+
+// Reads must see every round completed before they started
+static void ReadViewBody(void* arg) {
+  ReadViewThread* t = reinterpret_cast<ReadViewThread*>(arg);
+  ReadViewState* state = t->state;
+  Random rnd(301 + t->id);
+  std::string value;
+  while (state->stop.Acquire_Load() == NULL) {
+    const int round = static_cast<int>(
+        reinterpret_cast<uintptr_t>(state->round.Acquire_Load()));
+    if (rnd.OneIn(10)) {
+      Iterator* iter = state->db->NewIterator(ReadOptions());
+      int n = 0;
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next(), n++) {
+        if (atoi(iter->value().ToString().c_str()) < round) {
+          state->failed.Release_Store(t);
+        }
+      }
+      if (round > 0 && n != kReadViewKeys) {
+        state->failed.Release_Store(t);
+      }
+      delete iter;
+    } else {
+      char key[20];
+      snprintf(key, sizeof(key), "key%06d", rnd.Uniform(kReadViewKeys));
+      Status s = state->db->Get(ReadOptions(), key, &value);
+      if (round > 0 && (!s.ok() || atoi(value.c_str()) < round)) {
+        state->failed.Release_Store(t);
+      }
+    }
+  }
+  state->done[t->id].Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, ReadViewsAcrossFlushes) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  Reopen(&options);
+
+  // Readers keep using the views they cached while memtables get
+  // switched and flushed and compactions install new versions
+  ReadViewState state;
+  state.db = db_;
+  state.round.Release_Store(NULL);
+  state.stop.Release_Store(NULL);
+  state.failed.Release_Store(NULL);
+  ReadViewThread thread[kNumThreads];
+  for (int id = 0; id < kNumThreads; id++) {
+    state.done[id].Release_Store(NULL);
+    thread[id].state = &state;
+    thread[id].id = id;
+    env_->StartThread(ReadViewBody, &thread[id]);
+  }
+  for (int round = 1; round <= 200; round++) {
+    for (int i = 0; i < kReadViewKeys; i++) {
+      char value[20];
+      snprintf(value, sizeof(value), "%d", round);
+      ASSERT_OK(Put(Key(i), std::string(value) + std::string(100, ' ')));
+    }
+    if (round % 50 == 0) {
+      dbfull()->TEST_CompactMemTable();
+    }
+    state.round.Release_Store(reinterpret_cast<void*>(round));
+  }
+  state.stop.Release_Store(&state);
+  for (int id = 0; id < kNumThreads; id++) {
+    while (state.done[id].Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+  ASSERT_TRUE(state.failed.Acquire_Load() == NULL);
+
+  // The readers are gone, their cached views with them
+  ASSERT_EQ("200", Get(Key(0)).substr(0, 3));
+  Reopen(&options);
+  ASSERT_EQ("200", Get(Key(kReadViewKeys - 1)).substr(0, 3));
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -1872,6 +3207,10 @@ class ModelDB: public DB {
   virtual Status Delete(const WriteOptions& o, const Slice& key) {
     return DB::Delete(o, key);
   }
+  virtual Status DeleteRange(const WriteOptions& o, const Slice& begin,
+                             const Slice& end) {
+    return DB::DeleteRange(o, begin, end);
+  }
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) {
     assert(false);      // Not implemented
@@ -1907,6 +3246,12 @@ class ModelDB: public DB {
       virtual void Delete(const Slice& key) {
         map_->erase(key.ToString());
       }
+      virtual void DeleteRange(const Slice& begin, const Slice& end) {
+        if (begin.compare(end) < 0) {
+          map_->erase(map_->lower_bound(begin.ToString()),
+                      map_->lower_bound(end.ToString()));
+        }
+      }
     };
     Handler handler;
     handler.map_ = &map_;
@@ -2037,11 +3382,16 @@ TEST(DBTest, Randomized) {
         ASSERT_OK(model.Put(WriteOptions(), k, v));
         ASSERT_OK(db_->Put(WriteOptions(), k, v));
 
-      } else if (p < 90) {                        // Delete
+      } else if (p < 88) {                        // Delete
         k = RandomKey(&rnd);
         ASSERT_OK(model.Delete(WriteOptions(), k));
         ASSERT_OK(db_->Delete(WriteOptions(), k));
 
+      } else if (p < 90) {                        // DeleteRange
+        k = RandomKey(&rnd);
+        v = RandomKey(&rnd);
+        ASSERT_OK(model.DeleteRange(WriteOptions(), k, v));
+        ASSERT_OK(db_->DeleteRange(WriteOptions(), k, v));
 
       } else {                                    // Multi-element batch
         WriteBatch b;
@@ -30,6 +30,11 @@ static const int kL0_SlowdownWritesTrigger = 8;
 // Maximum number of level-0 files.  We stop writes at this point.
 static const int kL0_StopWritesTrigger = 12;
 
+//whc add
+// Least number of the newest level-0 files merged into one level-0 file
+// while their compaction into level-1 cannot run.
+static const int kMinIntraL0Files = 4;
+
 // Maximum level to which a new compacted memtable is pushed if it
 // does not create overlap.  We try to push to level 2 to avoid the
 // relatively expensive level 0=>1 compactions and to avoid some
@@ -43,11 +48,33 @@ static const int kMaxMemCompactLevel = 0;
 static const int kReadBytesPeriod = 1048576;
 
 //whc add
-static const int kBufferCompactLevel  = 10;
+// Tables opened for levels below this one keep their index and filter
+// blocks pinned in the block cache, see
+// Options::cache_index_and_filter_blocks.
+static const int kNumPinnedMetadataLevels = 2;
 
 //whc add
+// Number of buffer nodes at which a file is merged with its buffer, for
+// levels that Options::buffer_merge_threshold does not cover.
 static const int kThresholdBufferNum  = 5;
 
+// A lookup probing a buffer node is charged like a seek, i.e. like
+// merging this many bytes (see VersionSet::Builder::Apply).  Once the
+// probes of a file cost as much as rewriting it with its buffer, merging
+// pays back.
+static const int kBufferProbeBytes = 16384;
+
+// A source table is rewritten once the buffer nodes still reading it
+// cover less than this percentage of its bytes.
+static const int kBufferTableLivePercent = 50;
+
+// A file of at least kTombstoneCompactionMinEntries entries is compacted,
+// even if its level is under its size limit, once this percentage of its
+// entries are deletion markers, or of the bytes compacting it rewrites
+// are estimated to be deleted by them.
+static const int kTombstoneCompactionPercent = 50;
+static const int kTombstoneCompactionMinEntries = 100;
+
 
 }  // namespace config
 
@@ -55,9 +82,22 @@ static const int kThresholdBufferNum  = 5;
 //whc add
 class BCJudge{
     public:
-    static bool IsBufferCompactLevel(int level){
-        //return (level >= config::kBufferCompactLevel);
-        return (level==config::kBufferCompactLevel);
+    // Does a compaction out of "level" dispatch instead of merging?
+    static bool IsBufferCompactLevel(const Options* options, int level){
+        return level > 0 && level < config::kNumLevels - 1 &&
+            ((options->buffer_compact_levels >> level) & 1) != 0;
+    }
+
+    // Number of buffer nodes at which a file of "level" gets merged.
+    static size_t BufferMergeThreshold(const Options* options, int level){
+        if (level < static_cast<int>(options->buffer_merge_threshold.size()))
+            return options->buffer_merge_threshold[level];
+        return config::kThresholdBufferNum;
+    }
+
+    // Do the tables of "level" live on the fast tier, Options::ssd_path?
+    static bool IsSSDLevel(const Options* options, int level){
+        return !options->ssd_path.empty() && level < options->ssd_levels;
     }
 };
 
@@ -70,7 +110,12 @@ class InternalKey;
 // data structures.
 enum ValueType {
   kTypeDeletion = 0x0,
-  kTypeValue = 0x1
+  kTypeValue = 0x1,
+  //whc add
+  // Tags WriteBatch records deleting a range of keys.  Range tombstones
+  // are kept apart from point entries (see MemTable::AddRangeDeletion
+  // and VersionEdit::AddRangeTombstone), so tables never hold this type.
+  kTypeRangeDeletion = 0x2
 };
 // kValueTypeForSeek defines the ValueType that should be passed when
 // constructing a ParsedInternalKey object for seeking to a particular
@@ -128,6 +173,13 @@ inline ValueType ExtractValueType(const Slice& internal_key) {
   return static_cast<ValueType>(c);
 }
 
+//whc add
+inline SequenceNumber ExtractSequence(const Slice& internal_key) {
+  assert(internal_key.size() >= 8);
+  const size_t n = internal_key.size();
+  return DecodeFixed64(internal_key.data() + n - 8) >> 8;
+}
+
 // A comparator for internal keys that uses a specified comparator for
 // the user key portion and breaks ties by decreasing sequence number.
 class InternalKeyComparator : public Comparator {
@@ -188,7 +240,7 @@ class InternalKey {
   std::string DebugString() const;
   
   //whc add
-  std::string Rep(){return rep_;}
+  std::string Rep() const {return rep_;}
 };
 
 inline int InternalKeyComparator::Compare(
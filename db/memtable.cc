@@ -18,14 +18,38 @@ static Slice GetLengthPrefixedSlice(const char* data) {
   return Slice(p, len);
 }
 
+//whc add
+// A RangeDelMap of the first "count" tombstones of range_del_table_.
+// Lookups hold a reference while they use it, so that it can be
+// replaced meanwhile.
+struct MemTable::CachedRangeDelMap {
+  RangeDelMap map;
+  size_t count;
+  std::atomic<int> refs;
+
+  CachedRangeDelMap(const Comparator* ucmp,
+                    const std::vector<RangeTombstone>& tombstones)
+      : map(ucmp, tombstones), count(tombstones.size()), refs(1) { }
+};
+
+void MemTable::UnrefRangeDelMap(CachedRangeDelMap* m) {
+  if (m != NULL && m->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete m;
+  }
+}
+
 MemTable::MemTable(const InternalKeyComparator& cmp)
     : comparator_(cmp),
       refs_(0),
-      table_(comparator_, &arena_) {
+      table_(comparator_, &arena_),
+      range_del_table_(comparator_, &arena_),
+      num_range_dels_(0),
+      range_del_map_(NULL) {
 }
 
 MemTable::~MemTable() {
   assert(refs_ == 0);
+  UnrefRangeDelMap(range_del_map_);
 }
 
 size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
@@ -79,9 +103,11 @@ Iterator* MemTable::NewIterator() {
   return new MemTableIterator(&table_);
 }
 
-void MemTable::Add(SequenceNumber s, ValueType type,
-                   const Slice& key,
-                   const Slice& value) {
+//whc change
+// Encode an entry of table_ or range_del_table_ in *arena
+static const char* EncodeEntry(Arena* arena, SequenceNumber s,
+                               ValueType type, const Slice& key,
+                               const Slice& value) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -93,7 +119,7 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   const size_t encoded_len =
       VarintLength(internal_key_size) + internal_key_size +
       VarintLength(val_size) + val_size;
-  char* buf = arena_.Allocate(encoded_len);
+  char* buf = arena->Allocate(encoded_len);
   char* p = EncodeVarint32(buf, internal_key_size);
   memcpy(p, key.data(), key_size);
   p += key_size;
@@ -102,10 +128,67 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
   assert((p + val_size) - buf == encoded_len);
-  table_.Insert(buf);
+  return buf;
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type,
+                   const Slice& key,
+                   const Slice& value) {
+  table_.Insert(EncodeEntry(&arena_, s, type, key, value));
+}
+
+//whc add
+void MemTable::AddRangeDeletion(SequenceNumber s, const Slice& begin,
+                                const Slice& end) {
+  range_del_table_.Insert(
+      EncodeEntry(&arena_, s, kTypeRangeDeletion, begin, end));
+  num_range_dels_.fetch_add(1, std::memory_order_release);
+}
+
+void MemTable::GetRangeTombstones(SequenceNumber snapshot,
+                                  std::vector<RangeTombstone>* result) {
+  Table::Iterator iter(&range_del_table_);
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    const Slice ikey = GetLengthPrefixedSlice(iter.key());
+    const SequenceNumber seq = ExtractSequence(ikey);
+    if (seq <= snapshot) {
+      const Slice end = GetLengthPrefixedSlice(ikey.data() + ikey.size());
+      result->push_back(RangeTombstone(ExtractUserKey(ikey), end, seq));
+    }
+  }
+}
+
+//whc add
+SequenceNumber MemTable::MaxCoveringTombstone(const Slice& user_key,
+                                              SequenceNumber snapshot) {
+  const size_t count = num_range_dels_.load(std::memory_order_acquire);
+  if (count == 0) {
+    return 0;
+  }
+  // Tombstones up to "snapshot" were all counted before the lookup
+  // started, so a map of at least "count" of them holds them all
+  range_del_mu_.Lock();
+  if (range_del_map_ == NULL || range_del_map_->count < count) {
+    std::vector<RangeTombstone> tombstones;
+    GetRangeTombstones(kMaxSequenceNumber, &tombstones);
+    UnrefRangeDelMap(range_del_map_);
+    range_del_map_ = new CachedRangeDelMap(
+        comparator_.comparator.user_comparator(), tombstones);
+  }
+  CachedRangeDelMap* m = range_del_map_;
+  m->refs.fetch_add(1, std::memory_order_relaxed);
+  range_del_mu_.Unlock();
+
+  const SequenceNumber result = m->map.MaxCoveringSequence(user_key, snapshot);
+  UnrefRangeDelMap(m);
+  return result;
 }
 
 bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+  //whc add
+  const SequenceNumber tombstone = MaxCoveringTombstone(
+      key.user_key(), ExtractSequence(key.internal_key()));
+
   Slice memkey = key.memtable_key();
   Table::Iterator iter(&table_);
   iter.Seek(memkey.data());
@@ -127,6 +210,11 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
             key.user_key()) == 0) {
       // Correct user key
       const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+      //whc add
+      if ((tag >> 8) < tombstone) {
+        *s = Status::NotFound(Slice());
+        return true;
+      }
       switch (static_cast<ValueType>(tag & 0xff)) {
         case kTypeValue: {
           Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
@@ -136,9 +224,19 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
         case kTypeDeletion:
           *s = Status::NotFound(Slice());
           return true;
+        case kTypeRangeDeletion:
+          // AddRangeDeletion stores them in range_del_table_, never in
+          // table_.  The tombstone check above applies them.
+          assert(false);
+          break;
       }
     }
   }
+  //whc add
+  if (tombstone > 0) {
+    *s = Status::NotFound(Slice());
+    return true;
+  }
   return false;
 }
 
@@ -5,10 +5,14 @@
 #ifndef STORAGE_LEVELDB_DB_MEMTABLE_H_
 #define STORAGE_LEVELDB_DB_MEMTABLE_H_
 
+#include <atomic>
 #include <string>
+#include <vector>
 #include "leveldb/db.h"
 #include "db/dbformat.h"
+#include "db/range_del.h"
 #include "db/skiplist.h"
+#include "port/port.h"
 #include "util/arena.h"
 
 namespace leveldb {
@@ -54,9 +58,22 @@ class MemTable {
            const Slice& key,
            const Slice& value);
 
+  //whc add
+  // Add a tombstone deleting the keys of [begin, end) older than "seq",
+  // see WriteBatch::DeleteRange().
+  void AddRangeDeletion(SequenceNumber seq, const Slice& begin,
+                        const Slice& end);
+
+  // Append the range tombstones no newer than "snapshot" to *result.
+  void GetRangeTombstones(SequenceNumber snapshot,
+                          std::vector<RangeTombstone>* result);
+
   // If memtable contains a value for key, store it in *value and return true.
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
+  //whc change
+  // A key deleted by a range tombstone of this memtable counts as a
+  // deletion, since older memtables and tables only hold older entries.
   // Else, return false.
   bool Get(const LookupKey& key, std::string* value, Status* s);
 
@@ -73,10 +90,28 @@ class MemTable {
 
   typedef SkipList<const char*, KeyComparator> Table;
 
+  //whc add
+  // Largest sequence no newer than "snapshot" of a range tombstone
+  // covering "user_key", or zero.  Looks the key up in a RangeDelMap of
+  // range_del_table_, built by the first lookup after a tombstone was
+  // added.
+  SequenceNumber MaxCoveringTombstone(const Slice& user_key,
+                                      SequenceNumber snapshot);
+
+  struct CachedRangeDelMap;
+  static void UnrefRangeDelMap(CachedRangeDelMap* m);
+
   KeyComparator comparator_;
   int refs_;
   Arena arena_;
   Table table_;
+  //whc add
+  // Range tombstones, keyed by the internal key of their beginning with
+  // their end as value
+  Table range_del_table_;
+  std::atomic<size_t> num_range_dels_;   // Entries of range_del_table_
+  port::Mutex range_del_mu_;
+  CachedRangeDelMap* range_del_map_;     // Guarded by range_del_mu_
 
   // No copying allowed
   MemTable(const MemTable&);
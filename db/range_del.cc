@@ -0,0 +1,140 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/range_del.h"
+
+#include <algorithm>
+#include "leveldb/comparator.h"
+
+namespace leveldb {
+
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  bool operator()(const std::string& a, const std::string& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+
+struct ByBegin {
+  const Comparator* ucmp;
+  bool operator()(const RangeTombstone* a, const RangeTombstone* b) const {
+    return ucmp->Compare(a->begin, b->begin) < 0;
+  }
+};
+}  // namespace
+
+RangeDelMap::RangeDelMap(const Comparator* ucmp,
+                         const std::vector<RangeTombstone>& tombstones)
+    : ucmp_(ucmp) {
+  std::vector<const RangeTombstone*> sorted;
+  std::vector<std::string> points;
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    const RangeTombstone& t = tombstones[i];
+    if (ucmp_->Compare(t.begin, t.end) < 0) {
+      sorted.push_back(&t);
+      points.push_back(t.begin);
+      points.push_back(t.end);
+    }
+  }
+  ByBegin by_begin = { ucmp_ };
+  std::sort(sorted.begin(), sorted.end(), by_begin);
+  UserKeyLess less = { ucmp_ };
+  std::sort(points.begin(), points.end(), less);
+
+  // Sweep the boundaries in order, keeping the tombstones that cover the
+  // span from one boundary to the next
+  std::vector<const RangeTombstone*> active;
+  size_t next = 0;
+  for (size_t i = 0; i + 1 < points.size(); i++) {
+    const std::string& p = points[i];
+    const std::string& q = points[i + 1];
+    if (ucmp_->Compare(p, q) == 0) continue;
+    for (size_t j = 0; j < active.size(); ) {
+      if (ucmp_->Compare(active[j]->end, p) <= 0) {
+        active[j] = active.back();
+        active.pop_back();
+      } else {
+        j++;
+      }
+    }
+    while (next < sorted.size() &&
+           ucmp_->Compare(sorted[next]->begin, p) <= 0) {
+      active.push_back(sorted[next++]);
+    }
+    if (active.empty()) continue;
+
+    std::vector<SequenceNumber> seqs(active.size());
+    for (size_t j = 0; j < active.size(); j++) {
+      seqs[j] = active[j]->sequence;
+    }
+    std::sort(seqs.begin(), seqs.end());
+    if (!fragments_.empty() && fragments_.back().sequences == seqs &&
+        ucmp_->Compare(fragments_.back().end, p) == 0) {
+      fragments_.back().end = q;
+    } else {
+      fragments_.push_back(Fragment());
+      Fragment& f = fragments_.back();
+      f.begin = p;
+      f.end = q;
+      f.sequence = seqs.back();
+      f.sequences.swap(seqs);
+    }
+  }
+}
+
+size_t RangeDelMap::FindFragment(const Slice& user_key) const {
+  // Find the last fragment beginning at or before user_key
+  size_t left = 0;
+  size_t right = fragments_.size();
+  while (left < right) {
+    const size_t mid = (left + right) / 2;
+    if (ucmp_->Compare(fragments_[mid].begin, user_key) <= 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  if (left == 0 || ucmp_->Compare(user_key, fragments_[left - 1].end) >= 0) {
+    return fragments_.size();
+  }
+  return left - 1;
+}
+
+SequenceNumber RangeDelMap::MaxCoveringSequence(const Slice& user_key) const {
+  const size_t i = FindFragment(user_key);
+  return (i < fragments_.size()) ? fragments_[i].sequence : 0;
+}
+
+SequenceNumber RangeDelMap::MaxCoveringSequence(
+    const Slice& user_key, SequenceNumber snapshot) const {
+  const size_t i = FindFragment(user_key);
+  if (i == fragments_.size()) {
+    return 0;
+  }
+  const std::vector<SequenceNumber>& seqs = fragments_[i].sequences;
+  std::vector<SequenceNumber>::const_iterator it =
+      std::upper_bound(seqs.begin(), seqs.end(), snapshot);
+  return (it == seqs.begin()) ? 0 : *(it - 1);
+}
+
+bool RangeDelMap::CoversRange(const Slice& smallest, const Slice& largest,
+                              SequenceNumber sequence) const {
+  for (size_t i = FindFragment(smallest); i < fragments_.size(); i++) {
+    const Fragment& f = fragments_[i];
+    if (f.sequence <= sequence) {
+      return false;
+    }
+    if (ucmp_->Compare(largest, f.end) < 0) {
+      return true;
+    }
+    if (i + 1 < fragments_.size() &&
+        ucmp_->Compare(fragments_[i + 1].begin, f.end) != 0) {
+      return false;  // Gap after f
+    }
+  }
+  return false;
+}
+
+}  // namespace leveldb
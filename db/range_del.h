@@ -0,0 +1,84 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A range tombstone, written by WriteBatch::DeleteRange(), deletes the
+// entries of the user keys in [begin, end) that are older than it.
+// Tombstones are kept apart from point entries: in the memtable until it
+// is flushed (see MemTable::AddRangeDeletion), then in the version (see
+// VersionEdit::AddRangeTombstone) until no file can hold an entry they
+// delete.
+
+#ifndef STORAGE_LEVELDB_DB_RANGE_DEL_H_
+#define STORAGE_LEVELDB_DB_RANGE_DEL_H_
+
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+class Comparator;
+
+struct RangeTombstone {
+  std::string begin;        // Inclusive
+  std::string end;          // Exclusive
+  SequenceNumber sequence;
+
+  RangeTombstone() : sequence(0) { }
+  RangeTombstone(const Slice& b, const Slice& e, SequenceNumber s)
+      : begin(b.data(), b.size()), end(e.data(), e.size()), sequence(s) { }
+};
+
+// A set of range tombstones cut into disjoint fragments, each holding the
+// sequences of the tombstones covering it.
+//
+// Immutable once built, so it may be shared by several threads.
+class RangeDelMap {
+ public:
+  RangeDelMap(const Comparator* ucmp,
+              const std::vector<RangeTombstone>& tombstones);
+
+  bool empty() const { return fragments_.empty(); }
+
+  // Return the largest sequence of a tombstone covering "user_key", or
+  // zero if there is none.
+  SequenceNumber MaxCoveringSequence(const Slice& user_key) const;
+
+  // Return the largest sequence no newer than "snapshot" of a tombstone
+  // covering "user_key", or zero if there is none.
+  SequenceNumber MaxCoveringSequence(const Slice& user_key,
+                                     SequenceNumber snapshot) const;
+
+  // Returns true iff the entry "key" is deleted by a newer tombstone.
+  bool ShouldDelete(const ParsedInternalKey& key) const {
+    return key.sequence < MaxCoveringSequence(key.user_key);
+  }
+
+  // Returns true iff every user key in [smallest, largest] is covered by
+  // a tombstone newer than "sequence".
+  bool CoversRange(const Slice& smallest, const Slice& largest,
+                   SequenceNumber sequence) const;
+
+ private:
+  struct Fragment {
+    std::string begin;
+    std::string end;
+    SequenceNumber sequence;                // Largest of sequences
+    std::vector<SequenceNumber> sequences;  // Ascending
+  };
+
+  // Index of the fragment covering "user_key", or fragments_.size()
+  size_t FindFragment(const Slice& user_key) const;
+
+  const Comparator* const ucmp_;
+  std::vector<Fragment> fragments_;   // In key order
+
+  // No copying allowed
+  RangeDelMap(const RangeDelMap&);
+  void operator=(const RangeDelMap&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_RANGE_DEL_H_
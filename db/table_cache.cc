@@ -4,6 +4,7 @@
 
 #include "db/table_cache.h"
 
+#include <vector>
 #include "db/filename.h"
 #include "leveldb/env.h"
 #include "leveldb/table.h"
@@ -16,6 +17,7 @@ namespace leveldb {
 struct TableAndFile {
   RandomAccessFile* file;
   Table* table;
+  bool pinned;  //whc add: opened with pinned metadata
 };
 
 static void DeleteEntry(const Slice& key, void* value) {
@@ -31,26 +33,90 @@ static void UnrefEntry(void* arg1, void* arg2) {
   cache->Release(h);
 }
 
+//whc add
+// A row cache entry maps (row_cache_id_, file number, user key) to what a
+// lookup of the user key finds in the file: the length prefixed internal
+// key followed by the value, or an empty string if the file holds no
+// entry for the user key.  File numbers are never reused, so entries of
+// deleted files just age out.
+
+static void DeleteRow(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+// Call (*saver)(arg, ...) as the table would have for the cached "row"
+static void ReplayRow(const std::string& row, void* arg,
+                      void (*saver)(void*, const Slice&, const Slice&)) {
+  if (row.empty()) {
+    return;
+  }
+  Slice input(row);
+  Slice found_key;
+  if (GetLengthPrefixedSlice(&input, &found_key)) {
+    (*saver)(arg, found_key, input);
+  }
+}
+
+// Passes the entry found by a table on to the caller's saver while
+// recording it as a row cache entry
+struct RowSaver {
+  const Comparator* user_comparator;
+  Slice user_key;
+  void* arg;
+  void (*saver)(void*, const Slice&, const Slice&);
+  std::string row;
+};
+
+static void SaveRow(void* arg, const Slice& key, const Slice& value) {
+  RowSaver* r = reinterpret_cast<RowSaver*>(arg);
+  if (key.size() >= 8 &&
+      r->user_comparator->Compare(ExtractUserKey(key), r->user_key) == 0) {
+    r->row.clear();
+    PutLengthPrefixedSlice(&r->row, key);
+    r->row.append(value.data(), value.size());
+  }
+  (*r->saver)(r->arg, key, value);
+}
+
 TableCache::TableCache(const std::string& dbname,
                        const Options* options,
                        int entries)
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      row_cache_(options->row_cache),
+      row_cache_id_(row_cache_ != NULL ? row_cache_->NewId() : 0) {
 }
 
 TableCache::~TableCache() {
   delete cache_;
 }
 
+//whc add
+bool TableCache::PinsMetadata(int level) {
+  return level >= 0 && level < config::kNumPinnedMetadataLevels;
+}
+
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
-                             Cache::Handle** handle) {
+                             Cache::Handle** handle, int level) {
   Status s;
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   Slice key(buf, sizeof(buf));
   *handle = cache_->Lookup(key);
+  //whc add
+  // Pinning follows the current level of the file, which changes when a
+  // trivial move pushes it down, so a table opened at another level is
+  // reopened.  Lookups of unknown level take the table as it is.
+  const bool pin = PinsMetadata(level);
+  if (*handle != NULL && level >= 0 &&
+      options_->cache_index_and_filter_blocks &&
+      reinterpret_cast<TableAndFile*>(cache_->Value(*handle))->pinned != pin) {
+    cache_->Release(*handle);
+    cache_->Erase(key);
+    *handle = NULL;
+  }
   if (*handle == NULL) {
     std::string fname = TableFileName(dbname_, file_number);
     //std::cout<<"table cache findtable file name"<<fname<<std::endl;
@@ -65,7 +131,7 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       }
     }
     if (s.ok()) {
-      s = Table::Open(*options_, file, file_size, &table);
+      s = Table::Open(*options_, file, file_size, &table, pin);
     }
 
     if (!s.ok()) {
@@ -78,6 +144,7 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       TableAndFile* tf = new TableAndFile;
       tf->file = file;
       tf->table = table;
+      tf->pinned = pin;
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
   }
@@ -87,13 +154,14 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
 Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number,
                                   uint64_t file_size,
-                                  Table** tableptr) {
+                                  Table** tableptr,
+                                  int level) {
   if (tableptr != NULL) {
     *tableptr = NULL;
   }
 
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, &handle, level);
   if (!s.ok()) {
       //std::cout<<"table cache iterator fail"<<std::endl;
       return NewErrorIterator(s);
@@ -110,22 +178,157 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+//whc add
+bool TableCache::UseRowCache(const Slice& k,
+                             SequenceNumber largest_seq) const {
+  // An older snapshot may see an older entry than the newest one in the
+  // file, which is all the row cache keeps
+  return row_cache_ != NULL && largest_seq != kMaxSequenceNumber &&
+         k.size() >= 8 && ExtractSequence(k) >= largest_seq;
+}
+
+void TableCache::RowCacheKey(uint64_t file_number, const Slice& k,
+                             std::string* result) const {
+  const Slice user_key = ExtractUserKey(k);
+  result->clear();
+  PutFixed64(result, row_cache_id_);
+  PutFixed64(result, file_number);
+  result->append(user_key.data(), user_key.size());
+}
+
+void TableCache::InsertRow(const ReadOptions& options,
+                           const std::string& row_key,
+                           const std::string& row) {
+  if (options.fill_cache) {
+    std::string* value = new std::string(row);
+    row_cache_->Release(row_cache_->Insert(
+        row_key, value, row_key.size() + row.size(), &DeleteRow));
+  }
+}
+
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
                        const Slice& k,
                        void* arg,
-                       void (*saver)(void*, const Slice&, const Slice&)) {
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       int level,
+                       SequenceNumber largest_seq) {
+  //whc add
+  std::string row_key;
+  const bool use_row_cache = UseRowCache(k, largest_seq);
+  if (use_row_cache) {
+    RowCacheKey(file_number, k, &row_key);
+    Cache::Handle* row_handle = row_cache_->Lookup(row_key);
+    if (row_handle != NULL) {
+      ReplayRow(*reinterpret_cast<std::string*>(row_cache_->Value(row_handle)),
+                arg, saver);
+      row_cache_->Release(row_handle);
+      return Status::OK();
+    }
+  }
+
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, &handle, level);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, saver);
+    if (use_row_cache) {
+      // options_ are the sanitized options of a DB, so the comparator is
+      // an InternalKeyComparator
+      RowSaver r;
+      r.user_comparator = static_cast<const InternalKeyComparator*>(
+          options_->comparator)->user_comparator();
+      r.user_key = ExtractUserKey(k);
+      r.arg = arg;
+      r.saver = saver;
+      s = t->InternalGet(options, k, &r, &SaveRow);
+      if (s.ok()) {
+        InsertRow(options, row_key, r.row);
+      }
+    } else {
+      s = t->InternalGet(options, k, arg, saver);
+    }
     cache_->Release(handle);
   }
   return s;
 }
 
+//whc add
+void TableCache::MultiGet(const ReadOptions& options,
+                          uint64_t file_number,
+                          uint64_t file_size,
+                          int n, const Slice* keys, void* const* args,
+                          Status* statuses,
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          int level,
+                          SequenceNumber largest_seq) {
+  // Serve what we can from the row cache and look the rest up in the
+  // table, keeping their order
+  std::vector<int> misses;
+  std::vector<std::string> row_keys(row_cache_ != NULL ? n : 0);
+  std::vector<bool> use_row_cache(n, false);
+  for (int i = 0; i < n; i++) {
+    statuses[i] = Status::OK();
+    if (UseRowCache(keys[i], largest_seq)) {
+      use_row_cache[i] = true;
+      RowCacheKey(file_number, keys[i], &row_keys[i]);
+      Cache::Handle* row_handle = row_cache_->Lookup(row_keys[i]);
+      if (row_handle != NULL) {
+        ReplayRow(
+            *reinterpret_cast<std::string*>(row_cache_->Value(row_handle)),
+            args[i], saver);
+        row_cache_->Release(row_handle);
+        continue;
+      }
+    }
+    misses.push_back(i);
+  }
+  if (misses.empty()) {
+    return;
+  }
+
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, &handle, level);
+  if (!s.ok()) {
+    for (size_t j = 0; j < misses.size(); j++) {
+      statuses[misses[j]] = s;
+    }
+    return;
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  if (row_cache_ == NULL) {
+    t->InternalMultiGet(options, n, keys, args, statuses, saver);
+  } else {
+    const Comparator* user_comparator =
+        static_cast<const InternalKeyComparator*>(
+            options_->comparator)->user_comparator();
+    const int m = misses.size();
+    std::vector<Slice> miss_keys(m);
+    std::vector<RowSaver> savers(m);
+    std::vector<void*> miss_args(m);
+    std::vector<Status> miss_statuses(m);
+    for (int j = 0; j < m; j++) {
+      const int i = misses[j];
+      miss_keys[j] = keys[i];
+      savers[j].user_comparator = user_comparator;
+      savers[j].user_key = ExtractUserKey(keys[i]);
+      savers[j].arg = args[i];
+      savers[j].saver = saver;
+      miss_args[j] = &savers[j];
+    }
+    t->InternalMultiGet(options, m, &miss_keys[0], &miss_args[0],
+                        &miss_statuses[0], &SaveRow);
+    for (int j = 0; j < m; j++) {
+      const int i = misses[j];
+      statuses[i] = miss_statuses[j];
+      if (use_row_cache[i] && statuses[i].ok()) {
+        InsertRow(options, row_keys[i], savers[j].row);
+      }
+    }
+  }
+  cache_->Release(handle);
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
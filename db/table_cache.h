@@ -30,19 +30,49 @@ class TableCache {
   // the returned iterator.  The returned "*tableptr" object is owned by
   // the cache and should not be deleted, and is valid for as long as the
   // returned iterator is live.
+  //
+  //whc change
+  // "level" is the level of the file, or -1 if unknown.  A table looked
+  // up at a level below config::kNumPinnedMetadataLevels pins its index
+  // and filter blocks, see Options::cache_index_and_filter_blocks, until
+  // it is looked up at a deeper level.  For the table of a buffer node,
+  // this is the level of the file holding the buffer.  The same holds
+  // for the methods below.
   Iterator* NewIterator(const ReadOptions& options,
                         uint64_t file_number,
                         uint64_t file_size,
-                        Table** tableptr = NULL);
+                        Table** tableptr = NULL,
+                        int level = -1);
 
   // If a seek to internal key "k" in specified file finds an entry,
   // call (*handle_result)(arg, found_key, found_value).
+  //
+  //whc change
+  // "largest_seq" is the largest sequence number in the file, or
+  // kMaxSequenceNumber if unknown.  When it is not above the sequence of
+  // "k" the result does not depend on the snapshot, so it is served from
+  // and kept in Options::row_cache.  Same for MultiGet().
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
              const Slice& k,
              void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             int level = -1,
+             SequenceNumber largest_seq = kMaxSequenceNumber);
+
+  //whc add
+  // Like Get() for each of the "n" internal keys of "keys", sorted by
+  // internal key, calling (*handle_result)(args[i], ...) and storing the
+  // status of the lookup in statuses[i].  The file is looked up once.
+  void MultiGet(const ReadOptions& options,
+                uint64_t file_number,
+                uint64_t file_size,
+                int n, const Slice* keys, void* const* args,
+                Status* statuses,
+                void (*handle_result)(void*, const Slice&, const Slice&),
+                int level = -1,
+                SequenceNumber largest_seq = kMaxSequenceNumber);
 
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
@@ -52,8 +82,22 @@ class TableCache {
   const std::string dbname_;
   const Options* options_;
   Cache* cache_;
+  //whc add
+  Cache* const row_cache_;        // Options::row_cache, may be NULL
+  const uint64_t row_cache_id_;   // Prefix of our keys in row_cache_
+
+  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**,
+                   int level);
+  //whc add
+  static bool PinsMetadata(int level);
 
-  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  //whc add
+  // Row cache helpers, see table_cache.cc
+  bool UseRowCache(const Slice& k, SequenceNumber largest_seq) const;
+  void RowCacheKey(uint64_t file_number, const Slice& k,
+                   std::string* result) const;
+  void InsertRow(const ReadOptions& options, const std::string& row_key,
+                 const std::string& row);
 };
 
 }  // namespace leveldb
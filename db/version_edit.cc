@@ -20,7 +20,15 @@ enum Tag {
   kDeletedFile          = 6,
   kNewFile              = 7,
   // 8 was used for large value refs
-  kPrevLogNumber        = 9
+  kPrevLogNumber        = 9,
+  //whc add
+  kBufferNode           = 10,
+  kBufferTable          = 11,
+  kBufferTableRewrite   = 12,
+  kNewFile2             = 13,  // kNewFile with the sequence range
+  kRangeTombstone       = 14,
+  kDeletedRangeTombstone = 15,
+  kNewFile3             = 16   // kNewFile2 with the entry counts
 };
 
 void VersionEdit::Clear() {
@@ -36,6 +44,11 @@ void VersionEdit::Clear() {
   has_last_sequence_ = false;
   deleted_files_.clear();
   new_files_.clear();
+  new_buffer_nodes.clear();
+  buffer_tables_.clear();
+  buffer_table_rewrites_.clear();
+  new_range_tombstones_.clear();
+  deleted_range_tombstones_.clear();
 }
 
 void VersionEdit::EncodeTo(std::string* dst) const {
@@ -76,12 +89,75 @@ void VersionEdit::EncodeTo(std::string* dst) const {
 
   for (size_t i = 0; i < new_files_.size(); i++) {
     const FileMetaData& f = new_files_[i].second;
-    PutVarint32(dst, kNewFile);
+    //whc change
+    const bool has_counts = (f.num_entries != 0);
+    const bool has_seqs = has_counts || (f.smallest_seq != 0 ||
+                                         f.largest_seq != kMaxSequenceNumber);
+    PutVarint32(dst, has_counts ? kNewFile3 : has_seqs ? kNewFile2 : kNewFile);
     PutVarint32(dst, new_files_[i].first);  // level
     PutVarint64(dst, f.number);
     PutVarint64(dst, f.file_size);
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
+    if (has_seqs) {
+      PutVarint64(dst, f.smallest_seq);
+      PutVarint64(dst, f.largest_seq);
+    }
+    if (has_counts) {
+      PutVarint64(dst, f.num_entries);
+      PutVarint64(dst, f.num_deletions);
+    }
+  }
+
+  //whc add
+  for (size_t i = 0; i < new_buffer_nodes.size(); i++) {
+    const BufferNodeEdit& b = new_buffer_nodes[i].second;
+    PutVarint32(dst, kBufferNode);
+    PutVarint32(dst, new_buffer_nodes[i].first);  // level
+    PutVarint64(dst, b.dnumber);
+    PutVarint64(dst, b.snumber);
+    PutVarint64(dst, b.filesize);
+    PutVarint64(dst, b.size);
+    PutVarint64(dst, b.sequence);
+    // A node that starts at the beginning of its source table has no
+    // lower bound.
+    PutVarint32(dst, b.inend ? 1 : 0);
+    if (!b.inend) {
+      PutLengthPrefixedSlice(dst, b.smallest.Encode());
+    }
+    PutLengthPrefixedSlice(dst, b.largest.Encode());
+  }
+
+  for (size_t i = 0; i < buffer_tables_.size(); i++) {
+    const BufferTable& t = buffer_tables_[i].second;
+    PutVarint32(dst, kBufferTable);
+    PutVarint32(dst, buffer_tables_[i].first);  // level
+    PutVarint64(dst, t.number);
+    PutVarint32(dst, t.refs);
+  }
+
+  for (size_t i = 0; i < buffer_table_rewrites_.size(); i++) {
+    const BufferTableRewrite& t = buffer_table_rewrites_[i].second;
+    PutVarint32(dst, kBufferTableRewrite);
+    PutVarint32(dst, buffer_table_rewrites_[i].first);  // level
+    PutVarint64(dst, t.number);
+    PutVarint64(dst, t.new_number);
+    PutVarint64(dst, t.filesize);
+  }
+
+  for (size_t i = 0; i < new_range_tombstones_.size(); i++) {
+    const RangeTombstone& t = new_range_tombstones_[i];
+    PutVarint32(dst, kRangeTombstone);
+    PutVarint64(dst, t.sequence);
+    PutLengthPrefixedSlice(dst, t.begin);
+    PutLengthPrefixedSlice(dst, t.end);
+  }
+
+  for (std::set<SequenceNumber>::const_iterator iter =
+           deleted_range_tombstones_.begin();
+       iter != deleted_range_tombstones_.end(); ++iter) {
+    PutVarint32(dst, kDeletedRangeTombstone);
+    PutVarint64(dst, *iter);
   }
 }
 
@@ -118,6 +194,9 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   FileMetaData f;
   Slice str;
   InternalKey key;
+  BufferNodeEdit b;
+  uint32_t inend;
+  uint32_t refs;
 
   while (msg == NULL && GetVarint32(&input, &tag)) {
     switch (tag) {
@@ -192,6 +271,110 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      //whc add
+      case kNewFile2:
+        if (GetLevel(&input, &level) &&
+            GetVarint64(&input, &f.number) &&
+            GetVarint64(&input, &f.file_size) &&
+            GetInternalKey(&input, &f.smallest) &&
+            GetInternalKey(&input, &f.largest) &&
+            GetVarint64(&input, &f.smallest_seq) &&
+            GetVarint64(&input, &f.largest_seq)) {
+          new_files_.push_back(std::make_pair(level, f));
+          f.smallest_seq = 0;
+          f.largest_seq = kMaxSequenceNumber;
+        } else {
+          msg = "new-file2 entry";
+        }
+        break;
+
+      case kNewFile3:
+        if (GetLevel(&input, &level) &&
+            GetVarint64(&input, &f.number) &&
+            GetVarint64(&input, &f.file_size) &&
+            GetInternalKey(&input, &f.smallest) &&
+            GetInternalKey(&input, &f.largest) &&
+            GetVarint64(&input, &f.smallest_seq) &&
+            GetVarint64(&input, &f.largest_seq) &&
+            GetVarint64(&input, &f.num_entries) &&
+            GetVarint64(&input, &f.num_deletions)) {
+          new_files_.push_back(std::make_pair(level, f));
+          f.smallest_seq = 0;
+          f.largest_seq = kMaxSequenceNumber;
+          f.num_entries = 0;
+          f.num_deletions = 0;
+        } else {
+          msg = "new-file3 entry";
+        }
+        break;
+
+      case kRangeTombstone: {
+        uint64_t seq;
+        Slice begin, end;
+        if (GetVarint64(&input, &seq) &&
+            GetLengthPrefixedSlice(&input, &begin) &&
+            GetLengthPrefixedSlice(&input, &end)) {
+          new_range_tombstones_.push_back(RangeTombstone(begin, end, seq));
+        } else {
+          msg = "range-tombstone entry";
+        }
+        break;
+      }
+
+      case kDeletedRangeTombstone:
+        if (GetVarint64(&input, &number)) {
+          deleted_range_tombstones_.insert(number);
+        } else {
+          msg = "deleted range-tombstone entry";
+        }
+        break;
+
+      //whc add
+      case kBufferNode:
+        if (GetLevel(&input, &level) && level > 0 &&
+            GetVarint64(&input, &b.dnumber) &&
+            GetVarint64(&input, &b.snumber) &&
+            GetVarint64(&input, &b.filesize) &&
+            GetVarint64(&input, &b.size) &&
+            GetVarint64(&input, &b.sequence) &&
+            GetVarint32(&input, &inend) &&
+            (inend != 0 || GetInternalKey(&input, &b.smallest)) &&
+            GetInternalKey(&input, &b.largest)) {
+          b.inend = (inend != 0);
+          if (b.inend) {
+            b.smallest.Clear();
+          }
+          new_buffer_nodes.push_back(std::make_pair(level, b));
+        } else {
+          msg = "buffer-node entry";
+        }
+        break;
+
+      case kBufferTable:
+        if (GetLevel(&input, &level) &&
+            GetVarint64(&input, &number) &&
+            GetVarint32(&input, &refs)) {
+          buffer_tables_.push_back(
+              std::make_pair(level, BufferTable(number, refs)));
+        } else {
+          msg = "buffer-table entry";
+        }
+        break;
+
+      case kBufferTableRewrite: {
+        uint64_t new_number, filesize;
+        if (GetLevel(&input, &level) && level < config::kNumLevels - 1 &&
+            GetVarint64(&input, &number) &&
+            GetVarint64(&input, &new_number) &&
+            GetVarint64(&input, &filesize)) {
+          buffer_table_rewrites_.push_back(std::make_pair(
+              level, BufferTableRewrite(number, new_number, filesize)));
+        } else {
+          msg = "buffer-table-rewrite entry";
+        }
+        break;
+      }
+
       default:
         msg = "unknown tag";
         break;
@@ -258,6 +441,72 @@ std::string VersionEdit::DebugString() const {
     r.append(f.smallest.DebugString());
     r.append(" .. ");
     r.append(f.largest.DebugString());
+    //whc add
+    if (f.smallest_seq != 0 || f.largest_seq != kMaxSequenceNumber) {
+      r.append(" seq ");
+      AppendNumberTo(&r, f.smallest_seq);
+      r.append(" .. ");
+      AppendNumberTo(&r, f.largest_seq);
+    }
+    if (f.num_entries != 0) {
+      r.append(" deletions ");
+      AppendNumberTo(&r, f.num_deletions);
+      r.append("/");
+      AppendNumberTo(&r, f.num_entries);
+    }
+  }
+  for (size_t i = 0; i < new_buffer_nodes.size(); i++) {
+    const BufferNodeEdit& b = new_buffer_nodes[i].second;
+    r.append("\n  AddBufferNode: ");
+    AppendNumberTo(&r, new_buffer_nodes[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, b.dnumber);
+    r.append(" <- ");
+    AppendNumberTo(&r, b.snumber);
+    r.append(":");
+    AppendNumberTo(&r, b.filesize);
+    r.append(" @");
+    AppendNumberTo(&r, b.sequence);
+    r.append(" (");
+    r.append(b.inend ? "begin" : b.smallest.DebugString());
+    r.append(" .. ");
+    r.append(b.largest.DebugString());
+    r.append("]");
+  }
+  for (size_t i = 0; i < buffer_tables_.size(); i++) {
+    r.append("\n  BufferTable: ");
+    AppendNumberTo(&r, buffer_tables_[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, buffer_tables_[i].second.number);
+    r.append(" refs=");
+    AppendNumberTo(&r, buffer_tables_[i].second.refs);
+  }
+  for (size_t i = 0; i < buffer_table_rewrites_.size(); i++) {
+    const BufferTableRewrite& t = buffer_table_rewrites_[i].second;
+    r.append("\n  BufferTableRewrite: ");
+    AppendNumberTo(&r, buffer_table_rewrites_[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, t.number);
+    r.append(" -> ");
+    AppendNumberTo(&r, t.new_number);
+    r.append(":");
+    AppendNumberTo(&r, t.filesize);
+  }
+  for (size_t i = 0; i < new_range_tombstones_.size(); i++) {
+    const RangeTombstone& t = new_range_tombstones_[i];
+    r.append("\n  RangeTombstone: ");
+    AppendNumberTo(&r, t.sequence);
+    r.append(" [");
+    AppendEscapedStringTo(&r, t.begin);
+    r.append(" .. ");
+    AppendEscapedStringTo(&r, t.end);
+    r.append(")");
+  }
+  for (std::set<SequenceNumber>::const_iterator iter =
+           deleted_range_tombstones_.begin();
+       iter != deleted_range_tombstones_.end(); ++iter) {
+    r.append("\n  DeleteRangeTombstone: ");
+    AppendNumberTo(&r, *iter);
   }
   r.append("\n}\n");
   return r;
@@ -9,6 +9,7 @@
 #include <utility>
 #include <vector>
 #include "db/dbformat.h"
+#include "db/range_del.h"
 
 namespace leveldb {
 
@@ -25,8 +26,26 @@ struct FileMetaData {
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
   Buffer* buffer;               //whc add
+  //whc add
+  // Sequence range of the entries, [0, kMaxSequenceNumber] if unknown
+  SequenceNumber smallest_seq;
+  SequenceNumber largest_seq;
+  // Number of entries and of deletion markers, zero if unknown
+  uint64_t num_entries;
+  uint64_t num_deletions;
+
+  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0),buffer(NULL),
+                   smallest_seq(0), largest_seq(kMaxSequenceNumber),
+                   num_entries(0), num_deletions(0) { }
 
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0),buffer(NULL) { }
+  // Account for the entry "internal_key" added to the file
+  void AddEntry(const Slice& internal_key) {
+    const SequenceNumber seq = ExtractSequence(internal_key);
+    if (seq < smallest_seq) smallest_seq = seq;
+    if (seq > largest_seq) largest_seq = seq;
+    num_entries++;
+    if (ExtractValueType(internal_key) == kTypeDeletion) num_deletions++;
+  }
   
   //~FileMetaData(){delete buffer;}
 };
@@ -36,7 +55,18 @@ struct BufferTable{
 	int refs;
 	uint64_t number;
 
-	BufferTable(uint64_t n):number(n),refs(0){}
+	BufferTable(uint64_t n,int r = 0):refs(r),number(n){}
+};
+
+// Source table "number" replaced by "new_number", which holds only the
+// entries still covered by buffer nodes
+struct BufferTableRewrite{
+	uint64_t number;
+	uint64_t new_number;
+	uint64_t filesize;  // Size of new_number
+
+	BufferTableRewrite(uint64_t n,uint64_t nn,uint64_t s)
+	    :number(n),new_number(nn),filesize(s){}
 };
 
 struct BufferNode{
@@ -46,22 +76,46 @@ struct BufferNode{
 	uint64_t size;
 	uint64_t sequence;
     uint64_t filesize;
+	bool inend;             // smallest is empty, the node starts its table
+	std::string filter;     // Filter over the node's user keys, may be empty
+	// Sequence range of the source table, [0, kMaxSequenceNumber] if
+	// unknown.  Kept in memory only, like filter.
+	SequenceNumber smallest_seq;
+	SequenceNumber largest_seq;
 
 	BufferNode(InternalKey& s,InternalKey& l,uint64_t n,uint64_t si,uint64_t se,uint64_t fs):smallest(s),
 			largest(l),
 			number(n),
 			size(si),
 			sequence(se),
-            filesize(fs){}
+            filesize(fs),
+			inend(false),
+			smallest_seq(0),
+			largest_seq(kMaxSequenceNumber){}
 };
 
+//whc add
+// Returns true iff "range_del" deletes every entry "node" may hold.  A
+// node starting its table has no lower bound and is never deleted.
+inline bool BufferNodeDeleted(const BufferNode& node,
+                              const RangeDelMap& range_del) {
+  return !node.inend &&
+         range_del.CoversRange(node.smallest.user_key(),
+                               node.largest.user_key(), node.largest_seq);
+}
+
 struct Buffer{
 	std::vector<BufferNode> nodes;
 	InternalKey smallest;
 	InternalKey largest;
-	uint64_t size;
+	uint64_t size;           // Bytes of the source tables held by the nodes
+
+	// Read statistics since the file got its buffer, updated by
+	// Version::UpdateStats under the db mutex
+	uint64_t probes;         // Node tables probed by lookups
+	uint64_t hits;           // Lookups answered by a node
 
-	Buffer(){}
+	Buffer() : size(0), probes(0), hits(0) {}
 
 };
 
@@ -72,7 +126,13 @@ struct BufferNodeEdit{
 	uint64_t dnumber; // destination number
 	uint64_t size;
     uint64_t filesize;
+	uint64_t sequence; // version sequence the node became visible at
 	bool inend; //true is in end buffer false is not
+	std::string filter; // Kept in memory only, not written to the MANIFEST
+	SequenceNumber smallest_seq;  // Of the source table, in memory only
+	SequenceNumber largest_seq;
+
+	BufferNodeEdit() : smallest_seq(0), largest_seq(kMaxSequenceNumber) {}
 };
 
 class VersionEdit {
@@ -109,15 +169,26 @@ class VersionEdit {
   // Add the specified file at the specified number.
   // REQUIRES: This version has not been saved (see VersionSet::SaveTo)
   // REQUIRES: "smallest" and "largest" are smallest and largest keys in file
+  //whc change
+  // "smallest_seq" and "largest_seq" bound the sequences of its entries,
+  // "num_deletions" of its "num_entries" entries are deletion markers.
   void AddFile(int level, uint64_t file,
                uint64_t file_size,
                const InternalKey& smallest,
-               const InternalKey& largest) {
+               const InternalKey& largest,
+               SequenceNumber smallest_seq = 0,
+               SequenceNumber largest_seq = kMaxSequenceNumber,
+               uint64_t num_entries = 0,
+               uint64_t num_deletions = 0) {
     FileMetaData f;
     f.number = file;
     f.file_size = file_size;
     f.smallest = smallest;
     f.largest = largest;
+    f.smallest_seq = smallest_seq;
+    f.largest_seq = largest_seq;
+    f.num_entries = num_entries;
+    f.num_deletions = num_deletions;
     new_files_.push_back(std::make_pair(level, f));
   }
 
@@ -132,7 +203,10 @@ class VersionEdit {
 		  uint64_t size,
 		  InternalKey& smallest,
 		  InternalKey& largest,
-		 bool inend ){
+		 bool inend,
+		 const std::string& filter = std::string(),
+		 SequenceNumber smallest_seq = 0,
+		 SequenceNumber largest_seq = kMaxSequenceNumber){
 	  BufferNodeEdit b;
 	  InternalKey fill;
       b.snumber = snumber;
@@ -146,10 +220,42 @@ class VersionEdit {
           
       b.largest = largest;
 	  b.inend = inend;
+	  b.filter = filter;
+	  b.smallest_seq = smallest_seq;
+	  b.largest_seq = largest_seq;
       b.filesize = ssize;
+      b.sequence = 0;  // Stamped by VersionSet::LogAndApply
 	  new_buffer_nodes.push_back(std::make_pair(level, b));
   }
 
+  // Record that source table "number" at "level" is referenced by "refs"
+  // buffer nodes.  Only written into MANIFEST snapshots; the counts
+  // supersede the references implied by the nodes of the same edit.
+  void AddBufferTable(int level, uint64_t number, int refs) {
+    buffer_tables_.push_back(std::make_pair(level, BufferTable(number, refs)));
+  }
+
+  // Record that the buffer nodes reading source table "number" at "level"
+  // now read "new_number" of size "filesize" instead.
+  void RewriteBufferTable(int level, uint64_t number, uint64_t new_number,
+                          uint64_t filesize) {
+    buffer_table_rewrites_.push_back(std::make_pair(
+        level, BufferTableRewrite(number, new_number, filesize)));
+  }
+
+  //whc add
+  // Add a range tombstone flushed out of a memtable, see db/range_del.h.
+  // Tombstones are named by their sequence.
+  void AddRangeTombstone(const Slice& begin, const Slice& end,
+                         SequenceNumber seq) {
+    new_range_tombstones_.push_back(RangeTombstone(begin, end, seq));
+  }
+
+  // Drop the range tombstone of sequence "seq".
+  void DeleteRangeTombstone(SequenceNumber seq) {
+    deleted_range_tombstones_.insert(seq);
+  }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
 
@@ -176,7 +282,11 @@ class VersionEdit {
   std::vector< std::pair<int, FileMetaData> > new_files_;
   //whc add
   std::vector< std::pair<int, BufferNodeEdit> > new_buffer_nodes;
+  std::vector< std::pair<int, BufferTable> > buffer_tables_;
+  std::vector< std::pair<int, BufferTableRewrite> > buffer_table_rewrites_;
   std::vector<int> reset_end_levels;
+  std::vector<RangeTombstone> new_range_tombstones_;
+  std::set<SequenceNumber> deleted_range_tombstones_;
 };
 
 }  // namespace leveldb
@@ -39,6 +39,64 @@ TEST(VersionEditTest, EncodeDecode) {
   TestEncodeDecode(edit);
 }
 
+TEST(VersionEditTest, BufferNodes) {
+  static const uint64_t kBig = 1ull << 50;
+
+  VersionEdit edit;
+  for (int i = 0; i < 4; i++) {
+    TestEncodeDecode(edit);
+    InternalKey smallest("foo", kBig + 500 + i, kTypeValue);
+    InternalKey largest("zoo", kBig + 600 + i, kTypeDeletion);
+    // Even nodes start at the beginning of their source table
+    edit.AddBufferNode(2, kBig + 100 + i, kBig + 200 + i, kBig + 300 + i,
+                       kBig + 400 + i, smallest, largest, (i % 2) == 0);
+    edit.AddBufferTable(1, kBig + 100 + i, i + 1);
+    edit.RewriteBufferTable(1, kBig + 100 + i, kBig + 700 + i, kBig + 800 + i);
+  }
+  TestEncodeDecode(edit);
+
+  // A buffer node can never refer to a source table below level-0
+  VersionEdit bad;
+  InternalKey k("foo", 1, kTypeValue);
+  bad.AddBufferNode(0, 10, 20, 30, 0, k, k, false);
+  std::string encoded;
+  bad.EncodeTo(&encoded);
+  VersionEdit parsed;
+  ASSERT_TRUE(parsed.DecodeFrom(encoded).IsCorruption());
+}
+
+TEST(VersionEditTest, RangeTombstones) {
+  static const uint64_t kBig = 1ull << 50;
+
+  VersionEdit edit;
+  for (int i = 0; i < 4; i++) {
+    TestEncodeDecode(edit);
+    // Files whose sequences are known are saved along with them
+    edit.AddFile(3, kBig + 300 + i, kBig + 400 + i,
+                 InternalKey("foo", kBig + 500 + i, kTypeValue),
+                 InternalKey("zoo", kBig + 600 + i, kTypeDeletion),
+                 kBig + 10 + i, kBig + 20 + i);
+    edit.AddRangeTombstone("bar", "baz", kBig + 30 + i);
+    edit.DeleteRangeTombstone(kBig + 40 + i);
+  }
+  TestEncodeDecode(edit);
+}
+
+TEST(VersionEditTest, EntryCounts) {
+  static const uint64_t kBig = 1ull << 50;
+
+  VersionEdit edit;
+  for (int i = 0; i < 4; i++) {
+    TestEncodeDecode(edit);
+    edit.AddFile(3, kBig + 300 + i, kBig + 400 + i,
+                 InternalKey("foo", kBig + 500 + i, kTypeValue),
+                 InternalKey("zoo", kBig + 600 + i, kTypeDeletion),
+                 (i % 2) ? 0 : kBig + 10 + i, kMaxSequenceNumber,
+                 kBig + 700 + i, kBig + 800 + i);
+  }
+  TestEncodeDecode(edit);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -79,8 +79,69 @@ static bool ExistFileWithoutBuffer(const std::vector<FileMetaData*>& files) {
     return false;
 }
 
+static bool ExistFileWithBuffer(const std::vector<FileMetaData*>& files) {
+    for (size_t i = 0; i < files.size(); i++) {
+        if(files[i]->buffer != NULL)
+            return true;
+    }
+    return false;
+}
+
+// Most files merged with their buffers by one compaction
+static const size_t kMaxBufferMergeFiles = 16;
+
+// Expected read savings of merging f with its buffer per byte rewritten:
+// the cost of the node probes lookups made so far over the merge cost.
+static double BufferMergeScore(const FileMetaData* f) {
+    const double probe_bytes =
+        static_cast<double>(f->buffer->probes) * config::kBufferProbeBytes;
+    return probe_bytes / (f->file_size + f->buffer->size + 1);
+}
+
+// Should f, a file of "level", be merged with its buffer now?  Files
+// whose probes paid for the merge go first whatever their number of
+// nodes.  Files over the threshold wait while nearly nobody reads them,
+// up to twice the threshold so that fragmentation stays bounded.
+static bool BufferNeedsMerge(const Options* options, int level,
+                             const FileMetaData* f) {
+    if (f->buffer == NULL || f->buffer->nodes.empty())
+        return false;
+    const size_t threshold = BCJudge::BufferMergeThreshold(options, level);
+    const size_t nodes = f->buffer->nodes.size();
+    const double score = BufferMergeScore(f);
+    return score >= 1 ||
+        (nodes >= threshold && score >= 0.1) ||
+        nodes >= 2 * threshold;
+}
+
+// Returns true iff deletion markers make up enough of the entries of f
+// for it to be compacted on their account.
+static bool HasDenseDeletions(const FileMetaData* f) {
+    return f->num_entries >= config::kTombstoneCompactionMinEntries &&
+        f->num_deletions * 100 >=
+        f->num_entries * config::kTombstoneCompactionPercent;
+}
+
+// Orders the nodes of one source table by their upper bound
+struct ByNodeLargest {
+    const InternalKeyComparator* icmp;
+    explicit ByNodeLargest(const InternalKeyComparator* c) : icmp(c) { }
+    bool operator()(const BufferNodeBound& a,
+                    const BufferNodeBound& b) const {
+        return icmp->Compare(a.largest, b.largest) < 0;
+    }
+};
+
+// Higher read savings per merge byte first
+struct ByBufferMergeScore {
+    bool operator()(FileMetaData* a, FileMetaData* b) const {
+        return BufferMergeScore(a) > BufferMergeScore(b);
+    }
+};
+
 Version::~Version() {
   assert(refs_ == 0);
+  delete range_del_map_;  //whc add
 
   // Remove from linked list
   prev_->next_ = next_;
@@ -180,14 +241,18 @@ bool SomeFileOverlapsRange(
 // An internal iterator.  For a given version/level pair, yields
 // information about the files in the level.  For a given entry, key()
 // is the largest key that occurs in the file, and value() is an
-// 16-byte value containing the file number and file size, both
-// encoded using EncodeFixed64.
+// 20-byte value containing the file number and file size, both
+// encoded using EncodeFixed64, and the level encoded using
+// EncodeFixed32.
 class Version::LevelFileNumIterator : public Iterator {
  public:
+  //whc change
   LevelFileNumIterator(const InternalKeyComparator& icmp,
-                       const std::vector<FileMetaData*>* flist)
+                       const std::vector<FileMetaData*>* flist,
+                       int level)
       : icmp_(icmp),
         flist_(flist),
+        level_(level),
         index_(flist->size()) {        // Marks as invalid
   }
   virtual bool Valid() const {
@@ -220,37 +285,40 @@ class Version::LevelFileNumIterator : public Iterator {
     assert(Valid());
     EncodeFixed64(value_buf_, (*flist_)[index_]->number);
     EncodeFixed64(value_buf_+8, (*flist_)[index_]->file_size);
+    EncodeFixed32(value_buf_+16, level_);
     return Slice(value_buf_, sizeof(value_buf_));
   }
   virtual Status status() const { return Status::OK(); }
  private:
   const InternalKeyComparator icmp_;
   const std::vector<FileMetaData*>* const flist_;
+  const int level_;
   uint32_t index_;
 
-  // Backing store for value().  Holds the file number and size.
-  mutable char value_buf_[16];
+  // Backing store for value().  Holds the file number, size and level.
+  mutable char value_buf_[20];
 };
 
 static Iterator* GetFileIterator(void* arg,
                                  const ReadOptions& options,
                                  const Slice& file_value) {
   TableCache* cache = reinterpret_cast<TableCache*>(arg);
-  if (file_value.size() != 16) {
+  if (file_value.size() != 20) {
     return NewErrorIterator(
         Status::Corruption("FileReader invoked with unexpected value"));
   } else {
     return cache->NewIterator(options,
                               DecodeFixed64(file_value.data()),
-                              DecodeFixed64(file_value.data() + 8));
+                              DecodeFixed64(file_value.data() + 8), NULL,
+                              DecodeFixed32(file_value.data() + 16));
   }
 }
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
   return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]),
-      &GetFileIterator, vset_->table_cache_, options);
+      new LevelFileNumIterator(vset_->icmp_, &files_[level], level),
+      &GetFileIterator, vset_->TableCacheForLevel(level), options);
 }
 
 void Version::AddIterators(const ReadOptions& options,
@@ -258,8 +326,8 @@ void Version::AddIterators(const ReadOptions& options,
   // Merge all level zero files together since they may overlap
   for (size_t i = 0; i < files_[0].size(); i++) {
     iters->push_back(
-        vset_->table_cache_->NewIterator(
-            options, files_[0][i]->number, files_[0][i]->file_size));
+        vset_->TableCacheForLevel(0)->NewIterator(
+            options, files_[0][i]->number, files_[0][i]->file_size, NULL, 0));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
@@ -267,9 +335,50 @@ void Version::AddIterators(const ReadOptions& options,
   // lazily.
   for (int level = 1; level < config::kNumLevels; level++) {
     if (!files_[level].empty()) {
-      iters->push_back(NewConcatenatingIterator(options, level));
+      //whc change
+      if (HasBuffers(level)) {
+        iters->push_back(NewBufferLevelIterator(options, level));
+      } else {
+        iters->push_back(NewConcatenatingIterator(options, level));
+      }
+    }
+  }
+}
+
+//whc add
+bool Version::HasBuffers(int level) const {
+  for (size_t i = 0; i < files_[level].size(); i++) {
+    if (files_[level][i]->buffer != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//whc add
+Iterator* Version::NewBufferLevelIterator(const ReadOptions& options,
+                                          int level) const {
+  // The nodes are copied now so that the iterator does not depend on
+  // this version staying alive.  Buffers shared between versions are
+  // never changed in place, see VersionSet::Builder::SaveTo.
+  std::vector<BufferedFile> files(files_[level].size());
+  for (size_t i = 0; i < files_[level].size(); i++) {
+    const FileMetaData* f = files_[level][i];
+    BufferedFile* bf = &files[i];
+    bf->number = f->number;
+    bf->file_size = f->file_size;
+    bf->largest = f->largest.Encode().ToString();
+    GetVisibleBufferNodes(f->buffer, sequence_, &bf->nodes);
+    for (size_t j = 0; j < bf->nodes.size(); j++) {
+      if (vset_->icmp_.Compare(bf->nodes[j].largest, bf->largest) > 0) {
+        bf->largest = bf->nodes[j].largest;
+      }
     }
   }
+  return leveldb::NewBufferLevelIterator(options,
+                                         vset_->TableCacheForLevel(level),
+                                         vset_->ssd_table_cache_,
+                                         &vset_->icmp_, files);
 }
 
 // Callback from TableCache::Get()
@@ -285,6 +394,7 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  SequenceNumber sequence;  //whc add, of the entry found
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -295,6 +405,7 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
       s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
+      s->sequence = parsed_key.sequence;
       if (s->state == kFound) {
         s->value->assign(v.data(), v.size());
       }
@@ -302,10 +413,41 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
   }
 }
 
+//whc add
+void Version::GetRangeTombstones(SequenceNumber snapshot,
+                                 std::vector<RangeTombstone>* result) const {
+  for (size_t i = 0; i < range_tombstones_.size(); i++) {
+    if (range_tombstones_[i].sequence <= snapshot) {
+      result->push_back(range_tombstones_[i]);
+    }
+  }
+}
+
+SequenceNumber Version::MaxCoveringTombstone(const Slice& user_key,
+                                             SequenceNumber snapshot) const {
+  if (range_del_map_ == NULL) {
+    return 0;
+  }
+  return range_del_map_->MaxCoveringSequence(user_key, snapshot);
+}
+
 static bool NewestFirst(FileMetaData* a, FileMetaData* b) {
+  //whc change
+  // Intra level-0 compactions give older entries than the flushes that
+  // finish meanwhile larger file numbers.  They only run once every
+  // level-0 file knows its sequences.
+  if (a->largest_seq != kMaxSequenceNumber &&
+      b->largest_seq != kMaxSequenceNumber) {
+    return a->largest_seq > b->largest_seq;
+  }
   return a->number > b->number;
 }
 
+//whc add
+static FileMetaData* OldestFile(const std::vector<FileMetaData*>& files) {
+  return *std::max_element(files.begin(), files.end(), NewestFirst);
+}
+
 void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
                                  void* arg,
                                  bool (*func)(void*, int, FileMetaData*)) {
@@ -359,9 +501,17 @@ Status Version::Get(const ReadOptions& options,
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
   Status s;
+  //whc add
+  const SequenceNumber tombstone =
+      MaxCoveringTombstone(user_key, ExtractSequence(ikey));
 
   stats->seek_file = NULL;
   stats->seek_file_level = -1;
+  //whc add
+  stats->buffer_file = NULL;
+  stats->buffer_file_level = -1;
+  stats->buffer_probes = 0;
+  stats->buffer_hit = false;
   FileMetaData* last_file_read = NULL;
   int last_file_read_level = -1;
 
@@ -427,8 +577,10 @@ Status Version::Get(const ReadOptions& options,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
-      s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+      s = vset_->TableCacheForLevel(level)->Get(options, f->number,
+                                                f->file_size, ikey, &saver,
+                                                SaveValue, level,
+                                                f->largest_seq);
       if (!s.ok()) {
         return s;
       }
@@ -436,6 +588,10 @@ Status Version::Get(const ReadOptions& options,
         case kNotFound:
           break;      // Keep searching in other files
         case kFound:
+          //whc change
+          if (saver.sequence < tombstone) {
+            s = Status::NotFound(Slice());
+          }
           return s;
         case kDeleted:
           s = Status::NotFound(Slice());  // Use empty error message for speed
@@ -459,9 +615,17 @@ Status Version::BufferGet(const ReadOptions& options,
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
   Status s;
+  //whc add
+  const SequenceNumber tombstone =
+      MaxCoveringTombstone(user_key, ExtractSequence(ikey));
 
   stats->seek_file = NULL;
   stats->seek_file_level = -1;
+  //whc add
+  stats->buffer_file = NULL;
+  stats->buffer_file_level = -1;
+  stats->buffer_probes = 0;
+  stats->buffer_hit = false;
   FileMetaData* last_file_read = NULL;
   int last_file_read_level = -1;
 
@@ -522,22 +686,45 @@ Status Version::BufferGet(const ReadOptions& options,
       
       //whc add
       if(f->buffer != NULL){
+          const FilterPolicy* policy = vset_->options_->filter_policy;
           for(int i=f->buffer->nodes.size()-1;i>=0;i--){
-              if(f->buffer->nodes[i].sequence > sequence_)
+              const BufferNode& node = f->buffer->nodes[i];
+              if(node.sequence > sequence_)
                 continue;
               
-              if(ucmp->Compare(user_key, f->buffer->nodes[i].largest.user_key()) > 0)
+              if(ucmp->Compare(user_key, node.largest.user_key()) > 0)
+                continue;
+              // smallest is exclusive, but older entries of its user key
+              // still belong to this node
+              if(!node.inend &&
+                 ucmp->Compare(user_key, node.smallest.user_key()) < 0)
+                continue;
+              if(policy != NULL && !node.filter.empty() &&
+                 !policy->KeyMayMatch(ikey, node.filter))
                 continue;
               
+              if(stats->buffer_file == NULL){
+                  stats->buffer_file = f;
+                  stats->buffer_file_level = level;
+              }
+              if(stats->buffer_file == f)
+                  stats->buffer_probes++;
               s = vset_->ssd_table_cache_->Get(options, f->buffer->nodes[i].number, f->buffer->nodes[i].filesize,
-                                   ikey, &saver, SaveValue);
+                                   ikey, &saver, SaveValue, level,
+                                   f->buffer->nodes[i].largest_seq);
               if (!s.ok()) {
                 return s;
               }
+              if(saver.state != kNotFound && stats->buffer_file == f)
+                  stats->buffer_hit = true;
               switch (saver.state) {
                 case kNotFound:
                     continue;      // Keep searching in other files
                 case kFound:
+                    //whc change
+                    if (saver.sequence < tombstone) {
+                      s = Status::NotFound(Slice());
+                    }
                     return s;
                 case kDeleted:
                     s = Status::NotFound(Slice());  // Use empty error message for speed
@@ -552,8 +739,10 @@ Status Version::BufferGet(const ReadOptions& options,
           
       }
       
-      s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+      s = vset_->TableCacheForLevel(level)->Get(options, f->number,
+                                                f->file_size, ikey, &saver,
+                                                SaveValue, level,
+                                                f->largest_seq);
       if (!s.ok()) {
         return s;
       }
@@ -561,6 +750,10 @@ Status Version::BufferGet(const ReadOptions& options,
         case kNotFound:
           break;      // Keep searching in other files
         case kFound:
+          //whc change
+          if (saver.sequence < tombstone) {
+            s = Status::NotFound(Slice());
+          }
           return s;
         case kDeleted:
           s = Status::NotFound(Slice());  // Use empty error message for speed
@@ -575,9 +768,239 @@ Status Version::BufferGet(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+//whc add
+struct Version::MultiGetKey {
+  const LookupKey* key;
+  Saver saver;
+  SequenceNumber tombstone;      // Newest range tombstone covering key
+  Status* status;
+  GetStats* stats;
+  FileMetaData* last_file_read;
+  int last_file_read_level;
+  bool done;
+};
+
+void Version::MultiGet(const ReadOptions& options, int n,
+                       const LookupKey* const* keys,
+                       std::string* const* values, Status* const* statuses,
+                       GetStats* stats) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  std::vector<MultiGetKey> state(n);
+  for (int i = 0; i < n; i++) {
+    MultiGetKey* k = &state[i];
+    k->key = keys[i];
+    k->saver.state = kNotFound;
+    k->saver.ucmp = ucmp;
+    k->saver.user_key = keys[i]->user_key();
+    k->saver.value = values[i];
+    k->tombstone = MaxCoveringTombstone(
+        keys[i]->user_key(), ExtractSequence(keys[i]->internal_key()));
+    k->status = statuses[i];
+    k->stats = &stats[i];
+    k->stats->seek_file = NULL;
+    k->stats->seek_file_level = -1;
+    k->stats->buffer_file = NULL;
+    k->stats->buffer_file_level = -1;
+    k->stats->buffer_probes = 0;
+    k->stats->buffer_hit = false;
+    k->last_file_read = NULL;
+    k->last_file_read_level = -1;
+    k->done = false;
+  }
+
+  // Level-0 files may overlap each other, so each of them is searched
+  // for the keys it covers, from newest to oldest
+  std::vector<MultiGetKey*> group;
+  std::vector<FileMetaData*> level0(files_[0]);
+  std::sort(level0.begin(), level0.end(), NewestFirst);
+  for (size_t j = 0; j < level0.size(); j++) {
+    FileMetaData* f = level0[j];
+    group.clear();
+    for (int i = 0; i < n; i++) {
+      const Slice user_key = state[i].key->user_key();
+      if (!state[i].done &&
+          ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
+          ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
+        group.push_back(&state[i]);
+      }
+    }
+    if (!group.empty()) {
+      MultiGetFromFile(options, 0, f, group);
+    }
+  }
+
+  // The keys map to files of the other levels in order.  Like
+  // BufferGet(), keys past the last file still search its buffer.
+  for (int level = 1; level < config::kNumLevels; level++) {
+    const size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+    group.clear();
+    uint32_t group_index = 0;
+    for (int i = 0; i < n; i++) {
+      if (state[i].done) continue;
+      uint32_t index = FindFile(vset_->icmp_, files_[level],
+                                state[i].key->internal_key());
+      if (index >= num_files) {
+        index = num_files - 1;
+      }
+      if (!group.empty() && index != group_index) {
+        MultiGetFromFile(options, level, files_[level][group_index], group);
+        group.clear();
+      }
+      group_index = index;
+      group.push_back(&state[i]);
+    }
+    if (!group.empty()) {
+      MultiGetFromFile(options, level, files_[level][group_index], group);
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (!state[i].done) {
+      *state[i].status = Status::NotFound(Slice());
+    }
+  }
+}
+
+void Version::MultiGetFromFile(const ReadOptions& options, int level,
+                               FileMetaData* f,
+                               const std::vector<MultiGetKey*>& keys) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  for (size_t i = 0; i < keys.size(); i++) {
+    MultiGetKey* k = keys[i];
+    if (k->last_file_read != NULL && k->stats->seek_file == NULL) {
+      // We have had more than one seek for this read.  Charge the 1st file.
+      k->stats->seek_file = k->last_file_read;
+      k->stats->seek_file_level = k->last_file_read_level;
+    }
+    k->last_file_read = f;
+    k->last_file_read_level = level;
+  }
+
+  std::vector<MultiGetKey*> probe;
+  if (f->buffer != NULL) {
+    const FilterPolicy* policy = vset_->options_->filter_policy;
+    for (int j = f->buffer->nodes.size() - 1; j >= 0; j--) {
+      const BufferNode& node = f->buffer->nodes[j];
+      if (node.sequence > sequence_) continue;
+      probe.clear();
+      for (size_t i = 0; i < keys.size(); i++) {
+        MultiGetKey* k = keys[i];
+        const Slice user_key = k->key->user_key();
+        if (k->done ||
+            ucmp->Compare(user_key, node.largest.user_key()) > 0 ||
+            // smallest is exclusive, but older entries of its user key
+            // still belong to this node
+            (!node.inend &&
+             ucmp->Compare(user_key, node.smallest.user_key()) < 0) ||
+            (policy != NULL && !node.filter.empty() &&
+             !policy->KeyMayMatch(k->key->internal_key(), node.filter))) {
+          continue;
+        }
+        if (k->stats->buffer_file == NULL) {
+          k->stats->buffer_file = f;
+          k->stats->buffer_file_level = level;
+        }
+        if (k->stats->buffer_file == f) {
+          k->stats->buffer_probes++;
+        }
+        probe.push_back(k);
+      }
+      if (!probe.empty()) {
+        MultiGetFromTable(options, vset_->ssd_table_cache_, node.number,
+                          node.filesize, level, node.largest_seq, f,
+                          probe);
+      }
+    }
+  }
+
+  probe.clear();
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!keys[i]->done) {
+      probe.push_back(keys[i]);
+    }
+  }
+  if (!probe.empty()) {
+    MultiGetFromTable(options, vset_->TableCacheForLevel(level), f->number,
+                      f->file_size, level, f->largest_seq, NULL, probe);
+  }
+}
+
+void Version::MultiGetFromTable(const ReadOptions& options,
+                                TableCache* cache, uint64_t number,
+                                uint64_t file_size, int level,
+                                SequenceNumber largest_seq,
+                                FileMetaData* buffer_file,
+                                const std::vector<MultiGetKey*>& keys) {
+  const int n = keys.size();
+  std::vector<Slice> ikeys(n);
+  std::vector<void*> args(n);
+  std::vector<Status> statuses(n);
+  for (int i = 0; i < n; i++) {
+    ikeys[i] = keys[i]->key->internal_key();
+    args[i] = &keys[i]->saver;
+  }
+  cache->MultiGet(options, number, file_size, n, &ikeys[0], &args[0],
+                  &statuses[0], SaveValue, level, largest_seq);
+
+  for (int i = 0; i < n; i++) {
+    MultiGetKey* k = keys[i];
+    if (!statuses[i].ok()) {
+      *k->status = statuses[i];
+      k->done = true;
+      continue;
+    }
+    if (buffer_file != NULL && k->saver.state != kNotFound &&
+        k->stats->buffer_file == buffer_file) {
+      k->stats->buffer_hit = true;
+    }
+    switch (k->saver.state) {
+      case kNotFound:
+        break;      // Keep searching in other files
+      case kFound:
+        *k->status = (k->saver.sequence < k->tombstone)
+                         ? Status::NotFound(Slice()) : Status::OK();
+        k->done = true;
+        break;
+      case kDeleted:
+        *k->status = Status::NotFound(Slice());
+        k->done = true;
+        break;
+      case kCorrupt:
+        *k->status = Status::Corruption("corrupted key for ",
+                                        k->key->user_key());
+        k->done = true;
+        break;
+    }
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
+  //whc add
+  // Lookups going through a buffer make it a better merge candidate
+  FileMetaData* b = stats.buffer_file;
+  if (b != NULL && b->buffer != NULL) {
+    const bool needed = BufferNeedsMerge(vset_->options_,
+                                         stats.buffer_file_level, b);
+    b->buffer->probes += stats.buffer_probes;
+    if (stats.buffer_hit) {
+      b->buffer->hits++;
+    }
+    if (!needed &&
+        BufferNeedsMerge(vset_->options_, stats.buffer_file_level, b)) {
+      std::vector<FileMetaData*>& queue =
+          buffer_merges_[stats.buffer_file_level];
+      if (std::find(queue.begin(), queue.end(), b) == queue.end()) {
+        queue.push_back(b);
+      }
+      return true;
+    }
+  }
+
   FileMetaData* f = stats.seek_file;
-  if (f != NULL) {
+  //whc change
+  // Files holding buffer nodes are only compacted by merging their buffer
+  if (f != NULL && f->buffer == NULL) {
     f->allowed_seeks--;
     if (f->allowed_seeks <= 0 && file_to_compact_ == NULL) {
       file_to_compact_ = f;
@@ -613,6 +1036,7 @@ bool Version::RecordReadSample(Slice internal_key) {
 
   State state;
   state.matches = 0;
+  state.stats.buffer_file = NULL;  //whc add
   ForEachOverlapping(ikey.user_key, internal_key, &state, &State::Match);
 
   // Must have at least two matches since we want to merge across
@@ -808,6 +1232,22 @@ std::string Version::DebugString() const {
       r.append("]\n");
     }
   }
+  //whc add
+  // E.g.,
+  //   --- range tombstones ---
+  //   @42['a' .. 'd')
+  if (!range_tombstones_.empty()) {
+    r.append("--- range tombstones ---\n");
+    for (size_t i = 0; i < range_tombstones_.size(); i++) {
+      r.append(" @");
+      AppendNumberTo(&r, range_tombstones_[i].sequence);
+      r.append("['");
+      AppendEscapedStringTo(&r, range_tombstones_[i].begin);
+      r.append("' .. '");
+      AppendEscapedStringTo(&r, range_tombstones_[i].end);
+      r.append("')\n");
+    }
+  }
   return r;
 }
 
@@ -832,16 +1272,31 @@ class VersionSet::Builder {
   };
 
   typedef std::set<FileMetaData*, BySmallestKey> FileSet;
+  //whc add
+  struct TableRewrite {
+    BufferTableRewrite table;
+    uint64_t live;   // Bytes of the nodes pointed at the new table
+    int nodes;
+
+    explicit TableRewrite(const BufferTableRewrite& t)
+        : table(t), live(0), nodes(0) { }
+  };
   struct LevelState {
     std::set<uint64_t> deleted_files;
     FileSet* added_files;
     std::vector<  BufferNodeEdit>  added_buffer_nodes;
+    // Buffer node references held on the source tables of this level
+    std::map<uint64_t,int> buffer_tables;
     bool reset_end;
+    // Source tables of this level rewritten by the edits applied so far
+    std::vector<TableRewrite> rewrites;
   };
 
   VersionSet* vset_;
   Version* base_;
   LevelState levels_[config::kNumLevels];
+  //whc add
+  std::map<SequenceNumber, RangeTombstone> range_tombstones_;
 
  public:
   // Initialize a builder with the files from *base and other info from *vset
@@ -857,6 +1312,15 @@ class VersionSet::Builder {
       if(base->endbuffers_clean_[level])
         levels_[level].reset_end = true;
       else levels_[level].reset_end = false;
+      std::map<uint64_t,BufferTable>::const_iterator t;
+      for (t = base->files_in_ssd_[level].begin();
+           t != base->files_in_ssd_[level].end(); ++t) {
+        levels_[level].buffer_tables[t->first] = t->second.refs;
+      }
+    }
+    for (size_t i = 0; i < base->range_tombstones_.size(); i++) {
+      const RangeTombstone& t = base->range_tombstones_[i];
+      range_tombstones_[t.sequence] = t;
     }
   }
 
@@ -885,6 +1349,10 @@ class VersionSet::Builder {
   void BufferAddNode(Buffer** buffer,BufferNodeEdit be,uint64_t sequence){
 	  //std::cout<<"buffer add node begin"<<std::endl;
       BufferNode newnode(be.smallest,be.largest,be.snumber,be.size,sequence,be.filesize);
+      newnode.inend = be.inend;
+      newnode.filter = be.filter;
+      newnode.smallest_seq = be.smallest_seq;
+      newnode.largest_seq = be.largest_seq;
 	  BySmallestKey cmp;
 	  cmp.internal_comparator = &vset_->icmp_;
 	  if((*buffer) == NULL){
@@ -909,6 +1377,105 @@ class VersionSet::Builder {
 	  //std::cout<<"num of nodes:"<<(*buffer)->nodes.size()<<std::endl;
   }
 
+  //whc add
+  // Drop the buffer node references held by file "number" at "level",
+  // which is being deleted.  Both the buffer of a file in base_ and nodes
+  // added by earlier edits applied to this builder are released.
+  void ReleaseBufferNodes(int level, uint64_t number) {
+    if (level == 0) return;
+    std::map<uint64_t,int>& tables = levels_[level-1].buffer_tables;
+    const std::vector<FileMetaData*>& base_files = base_->files_[level];
+    for (size_t i = 0; i < base_files.size(); i++) {
+      const FileMetaData* f = base_files[i];
+      if (f->number == number && f->buffer != NULL) {
+        for (size_t j = 0; j < f->buffer->nodes.size(); j++) {
+          // Nodes attached to a shared FileMetaData by later versions
+          // are not part of base_.
+          if (f->buffer->nodes[j].sequence <= base_->sequence_) {
+            tables[f->buffer->nodes[j].number]--;
+          }
+        }
+      }
+    }
+    std::vector<BufferNodeEdit>& added = levels_[level].added_buffer_nodes;
+    for (size_t i = 0; i < added.size(); ) {
+      if (added[i].dnumber == number) {
+        tables[added[i].snumber]--;
+        added.erase(added.begin() + i);
+      } else {
+        i++;
+      }
+    }
+  }
+
+  // Size of a node of "r" in the new table.  The new table only holds
+  // what the nodes cover, so their sizes are scaled up to add up to it.
+  static uint64_t RewrittenSize(const TableRewrite& r, uint64_t size) {
+    if (r.live > 0) {
+      return size * r.table.filesize / r.live;
+    }
+    return r.table.filesize / r.nodes;
+  }
+
+  // Point "node", of a file of level+1 in base_, at the tables that
+  // replaced its source table in the edits applied so far.  Returns true
+  // if the node changed.
+  bool RewriteBaseNode(int level, BufferNode* node) const {
+    bool changed = false;
+    const std::vector<TableRewrite>& rewrites = levels_[level].rewrites;
+    for (size_t i = 0; i < rewrites.size(); i++) {
+      if (node->number == rewrites[i].table.number) {
+        node->size = RewrittenSize(rewrites[i], node->size);
+        node->number = rewrites[i].table.new_number;
+        node->filesize = rewrites[i].table.filesize;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Move the nodes reading source table t.number of "level" over to
+  // t.new_number, along with their references.
+  void RewriteBufferTable(int level, const BufferTableRewrite& t) {
+    TableRewrite r(t);
+    const std::vector<FileMetaData*>& base_files = base_->files_[level+1];
+    for (size_t i = 0; i < base_files.size(); i++) {
+      const FileMetaData* f = base_files[i];
+      if (f->buffer == NULL ||
+          levels_[level+1].deleted_files.count(f->number) > 0) {
+        continue;
+      }
+      for (size_t j = 0; j < f->buffer->nodes.size(); j++) {
+        BufferNode node = f->buffer->nodes[j];
+        if (node.sequence > base_->sequence_) continue;
+        RewriteBaseNode(level, &node);
+        if (node.number == t.number) {
+          r.live += node.size;
+          r.nodes++;
+        }
+      }
+    }
+    std::vector<BufferNodeEdit>& added = levels_[level+1].added_buffer_nodes;
+    for (size_t i = 0; i < added.size(); i++) {
+      if (added[i].snumber == t.number) {
+        r.live += added[i].size;
+        r.nodes++;
+      }
+    }
+    if (r.nodes == 0) return;
+    for (size_t i = 0; i < added.size(); i++) {
+      if (added[i].snumber == t.number) {
+        added[i].size = RewrittenSize(r, added[i].size);
+        added[i].snumber = t.new_number;
+        added[i].filesize = t.filesize;
+      }
+    }
+    std::map<uint64_t,int>& tables = levels_[level].buffer_tables;
+    tables[t.number] -= r.nodes;
+    tables[t.new_number] += r.nodes;
+    levels_[level].rewrites.push_back(r);
+  }
+
   // Apply all of the edits in *edit to the current state.
 void Apply(VersionEdit* edit) {
     // Update compaction pointers
@@ -925,6 +1492,10 @@ void Apply(VersionEdit* edit) {
          ++iter) {
       const int level = iter->first;
       const uint64_t number = iter->second;
+      //whc add
+      if (levels_[level].deleted_files.count(number) == 0) {
+        ReleaseBufferNodes(level, number);
+      }
       levels_[level].deleted_files.insert(number);
     }
 
@@ -960,6 +1531,32 @@ void Apply(VersionEdit* edit) {
     	 const int level = edit->new_buffer_nodes[i].first;
     	 BufferNodeEdit b = edit->new_buffer_nodes[i].second;
     	 levels_[level].added_buffer_nodes.push_back(b);
+    	 levels_[level-1].buffer_tables[b.snumber]++;
+    }
+
+    // Point the nodes of rewritten source tables at their new tables
+    for (size_t i = 0; i < edit->buffer_table_rewrites_.size(); i++) {
+      RewriteBufferTable(edit->buffer_table_rewrites_[i].first,
+                         edit->buffer_table_rewrites_[i].second);
+    }
+
+    // Reference counts recorded by a snapshot supersede the ones
+    // implied by its nodes
+    for (size_t i = 0; i < edit->buffer_tables_.size(); i++) {
+      const int level = edit->buffer_tables_[i].first;
+      const BufferTable& t = edit->buffer_tables_[i].second;
+      levels_[level].buffer_tables[t.number] = t.refs;
+    }
+
+    //whc add
+    for (std::set<SequenceNumber>::const_iterator it =
+             edit->deleted_range_tombstones_.begin();
+         it != edit->deleted_range_tombstones_.end(); ++it) {
+      range_tombstones_.erase(*it);
+    }
+    for (size_t i = 0; i < edit->new_range_tombstones_.size(); i++) {
+      const RangeTombstone& t = edit->new_range_tombstones_[i];
+      range_tombstones_[t.sequence] = t;
     }
   }
 
@@ -971,6 +1568,15 @@ void Apply(VersionEdit* edit) {
     //whc add
     v->sequence_ = vset_->LastVersionSequence();
     vset_->SetLastVersionSequence(v->sequence_ +1);
+    for (std::map<SequenceNumber, RangeTombstone>::const_iterator it =
+             range_tombstones_.begin();
+         it != range_tombstones_.end(); ++it) {
+      v->range_tombstones_.push_back(it->second);
+    }
+    if (!v->range_tombstones_.empty()) {
+      v->range_del_map_ = new RangeDelMap(vset_->icmp_.user_comparator(),
+                                          v->range_tombstones_);
+    }
 
     for (int level = 0; level < config::kNumLevels; level++) {
       // Merge the set of added files with the set of pre-existing files.
@@ -982,7 +1588,16 @@ void Apply(VersionEdit* edit) {
             v->endbuffers_[level] = NULL;
     	else 
             v->endbuffers_[level] = base_->endbuffers_[level];
-    	v->files_in_ssd_[level] = base_->files_in_ssd_[level];
+    	// Source tables stay alive while some buffer node refers to them
+    	v->files_in_ssd_[level].clear();
+    	for (std::map<uint64_t,int>::const_iterator t =
+    	         levels_[level].buffer_tables.begin();
+    	     t != levels_[level].buffer_tables.end(); ++t) {
+    	  if (t->second > 0) {
+    	    v->files_in_ssd_[level].insert(
+    	        std::make_pair(t->first, BufferTable(t->first, t->second)));
+    	  }
+    	}
 
     const std::vector<FileMetaData*>& base_files = base_->files_[level];
       std::vector<FileMetaData*>::const_iterator base_iter = base_files.begin();
@@ -1024,6 +1639,41 @@ void Apply(VersionEdit* edit) {
       }
 #endif
       //whc add
+      // Files of base_ reading a rewritten source table get a copy of
+      // their buffer.  Older versions keep reading the old table through
+      // the shared one.
+      if (level > 0 && !levels_[level-1].rewrites.empty()) {
+        for (size_t i = 0; i < v->files_[level].size(); i++) {
+          FileMetaData* f = v->files_[level][i];
+          if (f->buffer == NULL) continue;
+          Buffer* buffer = new Buffer();
+          buffer->smallest = f->buffer->smallest;
+          buffer->largest = f->buffer->largest;
+          buffer->probes = f->buffer->probes;
+          buffer->hits = f->buffer->hits;
+          bool changed = false;
+          for (size_t j = 0; j < f->buffer->nodes.size(); j++) {
+            BufferNode node = f->buffer->nodes[j];
+            if (node.sequence > base_->sequence_) continue;
+            if (RewriteBaseNode(level-1, &node)) {
+              changed = true;
+            }
+            buffer->size += node.size;
+            buffer->nodes.push_back(node);
+          }
+          if (!changed) {
+            delete buffer;
+            continue;
+          }
+          FileMetaData* copy = new FileMetaData(*f);
+          copy->refs = 1;
+          copy->buffer = buffer;
+          f->refs--;  // Still held by base_
+          assert(f->refs > 0);
+          v->files_[level][i] = copy;
+        }
+      }
+
       // add newbuffer and new ssd file to *v
       //std::cout<<"1"<<std::endl;
       for(int j=0;j<levels_[level].added_buffer_nodes.size();j++){
@@ -1033,14 +1683,7 @@ void Apply(VersionEdit* edit) {
     	 //std::cout<<" d:"<< levels_[level].added_buffer_nodes[j].dnumber<<std::endl;
     	 //std::cout<<" size:"<< levels_[level].added_buffer_nodes[j].size<<std::endl;
     	 //std::cout<<" inend:"<< levels_[level].added_buffer_nodes[j].inend<<std::endl;
-    	  uint64_t s = levels_[level].added_buffer_nodes[j].snumber;
-    	 if(v->files_in_ssd_[level-1].find(s) == v->files_in_ssd_[level-1].end()){    // this file never save
-    		 BufferTable* newbuffertable = new BufferTable(s);
-    		 newbuffertable->refs++;
-    		 v->files_in_ssd_[level-1].insert(std::make_pair(s,newbuffertable));
-    	 }else{
-    		 v->files_in_ssd_[level-1][s]->refs++;
-    	 }
+    	 // source ssd table refs were taken in Apply
     	 //std::cout<<"s2:"<< levels_[level].added_buffer_nodes[j].snumber<<std::endl;
     	 //std::cout<<"2"<<std::endl;
     	 /*
@@ -1069,19 +1712,24 @@ void Apply(VersionEdit* edit) {
     		 }
     	 }
     	 assert(f!=NULL);
-        
-    	 BufferNodeEdit& be = levels_[level].added_buffer_nodes[j];
-    	 BufferAddNode(&(f->buffer),be,v->sequence_);
-         
-         if(f->buffer->nodes.size() >= config::kThresholdBufferNum){
-             vset_->buffer_compact_switch_ = true;
-             v->bc_compaction_level_ = level;
-             if(std::find(v->need_compact_[level].begin(),v->need_compact_[level].end(),f)
-             ==v->need_compact_[level].end())
-                 v->need_compact_[level].push_back(f);
-            //std::cout<<"buffer fill: ="<<ptr<<"!"<<std::endl;
+
+         // Reads search the buffers of older versions without the db
+         // mutex, so a file shared with them gets its own copy of the
+         // buffer before the node is added
+         if (f->refs > 1) {
+           FileMetaData* copy = new FileMetaData(*f);
+           copy->refs = 1;
+           if (f->buffer != NULL) {
+             copy->buffer = new Buffer(*f->buffer);
+           }
+           f->refs--;  // Still held by base_ or this builder
+           v->files_[level][ptr] = copy;
+           f = copy;
          }
-         
+
+    	 BufferNodeEdit& be = levels_[level].added_buffer_nodes[j];
+    	 BufferAddNode(&(f->buffer),be,be.sequence);
+         // Files now needing a merge are queued by Finalize
       }
 
     }
@@ -1131,8 +1779,13 @@ VersionSet::VersionSet(const std::string& dbname,
       descriptor_log_(NULL),
       dummy_versions_(this),
       current_(NULL) ,
-	  last_version_sequence_(0) ,            //whc add
-      buffer_compact_switch_(false){                    //whc add
+	  last_version_sequence_(0),            //whc add
+	  range_deletions_pending_(false),
+	  intra_l0_compactions_(0) {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    buffer_merges_[level] = 0;
+    buffer_merged_files_[level] = 0;
+  }
   AppendVersion(new Version(this));
 }
 
@@ -1159,8 +1812,13 @@ VersionSet::VersionSet(const std::string& dbname,
       current_(NULL),
 	  ssdname_(ssdname),
 	  ssd_table_cache_(ssd_table_cache),
-	  last_version_sequence_(0),    //whc add
-      buffer_compact_switch_(false){   //whc add
+	  last_version_sequence_(0),   //whc add
+	  range_deletions_pending_(false),
+	  intra_l0_compactions_(0) {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    buffer_merges_[level] = 0;
+    buffer_merged_files_[level] = 0;
+  }
   AppendVersion(new Version(this));
 }
 
@@ -1201,7 +1859,13 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
-  edit->SetLastSequence(last_sequence_);
+  edit->SetLastSequence(LastSequence());
+
+  //whc add
+  // New buffer nodes become visible with the version built below
+  for (size_t i = 0; i < edit->new_buffer_nodes.size(); i++) {
+    edit->new_buffer_nodes[i].second.sequence = last_version_sequence_;
+  }
 
   Version* v = new Version(this);
   {
@@ -1260,6 +1924,14 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
       AppendVersion(v);
     log_number_ = edit->log_number_;
     prev_log_number_ = edit->prev_log_number_;
+    //whc add
+    // New tombstones may delete whole files, removed files may have been
+    // the last ones a tombstone deleted entries of
+    if (!v->range_tombstones_.empty() &&
+        (!edit->new_range_tombstones_.empty() ||
+         !edit->deleted_files_.empty())) {
+      range_deletions_pending_ = true;
+    }
   } else {
     
       delete v;
@@ -1309,6 +1981,7 @@ Status VersionSet::Recover(bool *save_manifest) {
   uint64_t last_sequence = 0;
   uint64_t log_number = 0;
   uint64_t prev_log_number = 0;
+  uint64_t max_buffer_sequence = 0;
   Builder builder(this, current_);
 
   {
@@ -1333,6 +2006,12 @@ Status VersionSet::Recover(bool *save_manifest) {
         builder.Apply(&edit);
       }
 
+      //whc add
+      for (size_t i = 0; i < edit.new_buffer_nodes.size(); i++) {
+        max_buffer_sequence = std::max(max_buffer_sequence,
+                                       edit.new_buffer_nodes[i].second.sequence);
+      }
+
       if (edit.has_log_number_) {
         log_number = edit.log_number_;
         have_log_number = true;
@@ -1375,14 +2054,20 @@ Status VersionSet::Recover(bool *save_manifest) {
   }
 
   if (s.ok()) {
+    // Recovered buffer nodes must be visible in the recovered version
+    if (max_buffer_sequence >= last_version_sequence_) {
+      SetLastVersionSequence(max_buffer_sequence + 1);
+    }
     Version* v = new Version(this);
     builder.SaveTo(v);
     // Install recovered version
     Finalize(v);
     AppendVersion(v);
+    //whc add
+    range_deletions_pending_ = !v->range_tombstones_.empty();
     manifest_file_number_ = next_file;
     next_file_number_ = next_file + 1;
-    last_sequence_ = last_sequence;
+    last_sequence_.store(last_sequence);
     log_number_ = log_number;
     prev_log_number_ = prev_log_number;
 
@@ -1434,19 +2119,55 @@ void VersionSet::MarkFileNumberUsed(uint64_t number) {
   }
 }
 
+//whc add
+double VersionSet::TombstoneScore(Version* v, int level,
+                                  const FileMetaData* f) const {
+  // Share of the entries that are deletion markers
+  double score = static_cast<double>(f->num_deletions) / f->num_entries;
+
+  // Share of the bytes compacting f into the next level rewrites that
+  // its markers delete, assuming each deletes an entry of the average
+  // size found there
+  std::vector<FileMetaData*> overlaps;
+  v->GetOverlappingInputs(level + 1, &f->smallest, &f->largest, &overlaps);
+  uint64_t overlap_bytes = 0;
+  uint64_t counted_bytes = 0;
+  uint64_t counted_entries = 0;
+  for (size_t i = 0; i < overlaps.size(); i++) {
+    overlap_bytes += overlaps[i]->file_size;
+    if (overlaps[i]->num_entries > 0) {
+      counted_bytes += overlaps[i]->file_size;
+      counted_entries += overlaps[i]->num_entries;
+    }
+  }
+  if (counted_entries > 0) {
+    const double deleted_bytes = std::min<double>(
+        overlap_bytes,
+        static_cast<double>(f->num_deletions) * counted_bytes /
+            counted_entries);
+    score = std::max(score, deleted_bytes / (f->file_size + overlap_bytes));
+  }
+  return score;
+}
+
 void VersionSet::Finalize(Version* v) {
   //whc add
-  
-  if(buffer_compact_switch_==true){
-      v->compaction_level_ = v->bc_compaction_level_;
-      std::cout<<"finalize going to buffer compact"<<std::endl;
-      return;
+  // Queue the files whose buffers should be merged; they are picked
+  // ahead of the scores below except for level-0, see PickCompaction
+  for (int level = 1; level < config::kNumLevels; level++) {
+    v->buffer_merges_[level].clear();
+    for (size_t i = 0; i < v->files_[level].size(); i++) {
+      FileMetaData* f = v->files_[level][i];
+      if (BufferNeedsMerge(options_, level, f)) {
+        v->buffer_merges_[level].push_back(f);
+      }
+    }
   }
-   
-    
+
   // Precomputed best level for next compaction
   int best_level = -1;
   double best_score = -1;
+  uint64_t debt = 0;  //whc add
 
   for (int level = 0; level < config::kNumLevels-1; level++) {
     double score;
@@ -1464,6 +2185,14 @@ void VersionSet::Finalize(Version* v) {
       // overwrites/deletions).
       score = v->files_[level].size() /
           static_cast<double>(config::kL0_CompactionTrigger);
+      //whc add
+      if (score >= 1) {
+        debt += TotalFileSize(v->files_[level]);
+        if (options_->compaction_style == kCompactionStyleUniversal) {
+          // Only the runs newer than the oldest are due for a merge
+          debt -= OldestFile(v->files_[level])->file_size;
+        }
+      }
     } else {
       // Compute the ratio of current size to size limit.
       const uint64_t level_bytes = TotalFileSize(v->files_[level]);
@@ -1472,8 +2201,17 @@ void VersionSet::Finalize(Version* v) {
         score =
             static_cast<double>(level_bytes) / MaxBytesForLevel(options_, level);
       else score = -1;
+      //whc add
+      if (score > 1) {
+        debt += level_bytes -
+                static_cast<uint64_t>(MaxBytesForLevel(options_, level));
+      }
+      for (size_t i = 0; i < v->buffer_merges_[level].size(); i++) {
+        debt += v->buffer_merges_[level][i]->buffer->size;
+      }
     }
 
+    v->compaction_scores_[level] = score;  //whc add
     if (score > best_score) {
       best_level = level;
       best_score = score;
@@ -1482,6 +2220,184 @@ void VersionSet::Finalize(Version* v) {
 
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
+  v->compaction_debt_ = debt;  //whc add
+
+  //whc add
+  // Pick the file whose deletion markers reclaim the most, so that ranges
+  // deleted and never written again do not keep their markers and the
+  // data below them
+  v->tombstone_file_to_compact_ = NULL;
+  v->tombstone_file_to_compact_level_ = -1;
+  double best_tombstone_score = config::kTombstoneCompactionPercent / 100.0;
+  for (int level = 1; level < config::kNumLevels - 1; level++) {
+    for (size_t i = 0; i < v->files_[level].size(); i++) {
+      FileMetaData* f = v->files_[level][i];
+      if (f->buffer != NULL || f->num_deletions == 0 ||
+          f->num_entries < config::kTombstoneCompactionMinEntries) {
+        continue;
+      }
+      const double score = TombstoneScore(v, level, f);
+      if (score >= best_tombstone_score) {
+        best_tombstone_score = score;
+        v->tombstone_file_to_compact_ = f;
+        v->tombstone_file_to_compact_level_ = level;
+      }
+    }
+  }
+
+  //whc add
+  // Pick the source table whose nodes cover the smallest part of it
+  v->table_to_reclaim_ = 0;
+  v->table_to_reclaim_level_ = -1;
+  double best_live = config::kBufferTableLivePercent / 100.0;
+  for (int level = 1; level < config::kNumLevels; level++) {
+    // Bytes still read by nodes and size of each source table
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> > tables;
+    for (size_t i = 0; i < v->files_[level].size(); i++) {
+      const Buffer* buffer = v->files_[level][i]->buffer;
+      if (buffer == NULL) continue;
+      for (size_t j = 0; j < buffer->nodes.size(); j++) {
+        const BufferNode& node = buffer->nodes[j];
+        std::pair<uint64_t, uint64_t>& t = tables[node.number];
+        t.first += node.size;
+        t.second = node.filesize;
+      }
+    }
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::const_iterator t;
+    for (t = tables.begin(); t != tables.end(); ++t) {
+      if (t->second.second == 0) continue;
+      const double live =
+          static_cast<double>(t->second.first) / t->second.second;
+      if (live < best_live) {
+        best_live = live;
+        v->table_to_reclaim_ = t->first;
+        v->table_to_reclaim_level_ = level - 1;
+      }
+    }
+  }
+}
+
+bool VersionSet::PickTableToReclaim(int* level, uint64_t* number,
+                                    uint64_t* filesize,
+                                    std::vector<BufferNodeBound>* nodes) {
+  Version* v = current_;
+  if (v->table_to_reclaim_ == 0) {
+    return false;
+  }
+  *level = v->table_to_reclaim_level_;
+  *number = v->table_to_reclaim_;
+  nodes->clear();
+  const std::vector<FileMetaData*>& files = v->files_[*level + 1];
+  for (size_t i = 0; i < files.size(); i++) {
+    std::vector<BufferNodeBound> visible;
+    GetVisibleBufferNodes(files[i]->buffer, v->sequence_, &visible);
+    for (size_t j = 0; j < visible.size(); j++) {
+      if (visible[j].number == *number) {
+        *filesize = visible[j].filesize;
+        nodes->push_back(visible[j]);
+      }
+    }
+  }
+  // Nodes of one source table do not overlap
+  std::sort(nodes->begin(), nodes->end(), ByNodeLargest(&icmp_));
+  return !nodes->empty();
+}
+
+//whc add
+// Returns true iff "range_del" deletes every entry of f and of the nodes
+// of its buffer visible in v.
+static bool FileDeleted(const Version* v, const FileMetaData* f,
+                        const RangeDelMap& range_del) {
+  if (!range_del.CoversRange(f->smallest.user_key(), f->largest.user_key(),
+                             f->largest_seq)) {
+    return false;
+  }
+  if (f->buffer != NULL) {
+    for (size_t i = 0; i < f->buffer->nodes.size(); i++) {
+      const BufferNode& node = f->buffer->nodes[i];
+      if (node.sequence <= v->sequence_ &&
+          !BufferNodeDeleted(node, range_del)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Returns true iff some node of "buffer" visible at version "sequence"
+// may hold an entry of [t.begin, t.end) older than t.
+static bool BufferNeedsTombstone(const Comparator* ucmp, const Buffer* buffer,
+                                 uint64_t sequence, const RangeTombstone& t) {
+  if (buffer == NULL) return false;
+  for (size_t i = 0; i < buffer->nodes.size(); i++) {
+    const BufferNode& node = buffer->nodes[i];
+    if (node.sequence <= sequence && node.smallest_seq < t.sequence &&
+        ucmp->Compare(node.largest.user_key(), t.begin) >= 0 &&
+        (node.inend || ucmp->Compare(node.smallest.user_key(), t.end) < 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool VersionSet::PickRangeDeletions(SequenceNumber smallest_snapshot,
+                                    VersionEdit* edit) {
+  range_deletions_pending_ = false;
+  Version* v = current_;
+  if (v->range_tombstones_.empty()) {
+    return false;
+  }
+  const Comparator* ucmp = icmp_.user_comparator();
+  bool changed = false;
+
+  // Drop the files whose entries are all deleted for every snapshot
+  std::set<uint64_t> dropped;
+  std::vector<RangeTombstone> tombstones;
+  v->GetRangeTombstones(smallest_snapshot, &tombstones);
+  RangeDelMap range_del(ucmp, tombstones);
+  for (int level = 0; level < config::kNumLevels && !range_del.empty();
+       level++) {
+    for (size_t i = 0; i < v->files_[level].size(); i++) {
+      FileMetaData* f = v->files_[level][i];
+      if (!FileDeleted(v, f, range_del)) continue;
+      InternalKey smallest, largest;
+      GetFileRange(v, level, f, &smallest, &largest);
+      if (OverlapsRunningCompaction(level, smallest, largest)) continue;
+      edit->DeleteFile(level, f->number);
+      dropped.insert(f->number);
+      changed = true;
+    }
+  }
+
+  // Forget the tombstones no remaining file or buffer node may hold an
+  // older entry of
+  for (size_t i = 0; i < v->range_tombstones_.size(); i++) {
+    const RangeTombstone& t = v->range_tombstones_[i];
+    bool needed = false;
+    for (int level = 0; level < config::kNumLevels && !needed; level++) {
+      const std::vector<FileMetaData*>& files = v->files_[level];
+      for (size_t j = 0; j < files.size() && !needed; j++) {
+        const FileMetaData* f = files[j];
+        if (dropped.count(f->number) > 0) continue;
+        if (f->smallest_seq < t.sequence &&
+            ucmp->Compare(f->largest.user_key(), t.begin) >= 0 &&
+            ucmp->Compare(f->smallest.user_key(), t.end) < 0) {
+          needed = true;
+        } else {
+          needed = BufferNeedsTombstone(ucmp, f->buffer, v->sequence_, t);
+        }
+      }
+      if (!needed) {
+        needed = BufferNeedsTombstone(ucmp, v->endbuffers_[level],
+                                      v->sequence_, t);
+      }
+    }
+    if (!needed) {
+      edit->DeleteRangeTombstone(t.sequence);
+      changed = true;
+    }
+  }
+  return changed;
 }
 
 Status VersionSet::WriteSnapshot(log::Writer* log) {
@@ -1505,8 +2421,46 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      //whc change
+      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest,
+                   f->smallest_seq, f->largest_seq,
+                   f->num_entries, f->num_deletions);
+
+      //whc add
+      // Save the buffer nodes dispatched into this file, oldest first
+      if (f->buffer != NULL) {
+        for (size_t j = 0; j < f->buffer->nodes.size(); j++) {
+          const BufferNode& node = f->buffer->nodes[j];
+          if (node.sequence > current_->sequence_) {
+            continue;  // Attached by a version that was never installed
+          }
+          BufferNodeEdit b;
+          b.smallest = node.smallest;
+          b.largest = node.largest;
+          b.snumber = node.number;
+          b.dnumber = f->number;
+          b.size = node.size;
+          b.filesize = node.filesize;
+          b.sequence = node.sequence;
+          b.inend = node.smallest.Rep().empty();
+          edit.new_buffer_nodes.push_back(std::make_pair(level, b));
+        }
+      }
     }
+
+    // Save the source tables pinned by buffer nodes
+    std::map<uint64_t,BufferTable>::const_iterator t;
+    for (t = current_->files_in_ssd_[level].begin();
+         t != current_->files_in_ssd_[level].end(); ++t) {
+      edit.AddBufferTable(level, t->first, t->second.refs);
+    }
+  }
+
+  //whc add
+  // Save range tombstones
+  for (size_t i = 0; i < current_->range_tombstones_.size(); i++) {
+    const RangeTombstone& t = current_->range_tombstones_[i];
+    edit.AddRangeTombstone(t.begin, t.end, t.sequence);
   }
 
   std::string record;
@@ -1520,6 +2474,57 @@ int VersionSet::NumLevelFiles(int level) const {
   return current_->files_[level].size();
 }
 
+//whc add
+int VersionSet::NumLevelBufferNodes(int level) const {
+  assert(level >= 0);
+  assert(level < config::kNumLevels);
+  int result = 0;
+  for (size_t i = 0; i < current_->files_[level].size(); i++) {
+    const Buffer* buffer = current_->files_[level][i]->buffer;
+    if (buffer == NULL) continue;
+    for (size_t j = 0; j < buffer->nodes.size(); j++) {
+      if (buffer->nodes[j].sequence <= current_->sequence_) {
+        result++;
+      }
+    }
+  }
+  return result;
+}
+
+int64_t VersionSet::NumLevelBufferTableBytes(int level) const {
+  assert(level >= 0);
+  assert(level < config::kNumLevels);
+  std::map<uint64_t, uint64_t> tables;
+  for (size_t i = 0; i < current_->files_[level].size(); i++) {
+    const Buffer* buffer = current_->files_[level][i]->buffer;
+    if (buffer == NULL) continue;
+    for (size_t j = 0; j < buffer->nodes.size(); j++) {
+      if (buffer->nodes[j].sequence <= current_->sequence_) {
+        tables[buffer->nodes[j].number] = buffer->nodes[j].filesize;
+      }
+    }
+  }
+  int64_t result = 0;
+  std::map<uint64_t, uint64_t>::const_iterator t;
+  for (t = tables.begin(); t != tables.end(); ++t) {
+    result += t->second;
+  }
+  return result;
+}
+
+int64_t VersionSet::NumLevelBufferProbes(int level) const {
+  assert(level >= 0);
+  assert(level < config::kNumLevels);
+  int64_t result = 0;
+  for (size_t i = 0; i < current_->files_[level].size(); i++) {
+    const Buffer* buffer = current_->files_[level][i]->buffer;
+    if (buffer != NULL) {
+      result += buffer->probes;
+    }
+  }
+  return result;
+}
+
 const char* VersionSet::LevelSummary(LevelSummaryStorage* scratch) const {
   // Update code if kNumLevels changes
   assert(config::kNumLevels == 7);
@@ -1555,7 +2560,7 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
         // "ikey" falls in the range for this table.  Add the
         // approximate offset of "ikey" within the table.
         Table* tableptr;
-        Iterator* iter = table_cache_->NewIterator(
+        Iterator* iter = TableCacheForLevel(level)->NewIterator(
             ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
         if (tableptr != NULL) {
           result += tableptr->ApproximateOffsetOf(ikey.Encode());
@@ -1569,22 +2574,28 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
 
 
 void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
+  AddLiveFiles(live, live);
+}
+
+void VersionSet::AddLiveFiles(std::set<uint64_t>* live,
+                              std::set<uint64_t>* ssd_live) {
   for (Version* v = dummy_versions_.next_;
        v != &dummy_versions_;
        v = v->next_) {
     for (int level = 0; level < config::kNumLevels; level++) {
+      std::set<uint64_t>* tier =
+          BCJudge::IsSSDLevel(options_, level) ? ssd_live : live;
       const std::vector<FileMetaData*>& files = v->files_[level];
       for (size_t i = 0; i < files.size(); i++) {
-        live->insert(files[i]->number);
+        tier->insert(files[i]->number);
       }
       
       //whc add
-      // when no ssd
-      for(int level = 0; level < config::kNumLevels; level++){
-          std::map<uint64_t,BufferTable*>::iterator ptr = v->files_in_ssd_[level].begin();
-          for(;ptr!= v->files_in_ssd_[level].end();ptr++){
-              live->insert((*ptr).first);
-          }
+      // Source tables read by buffer nodes live on the fast tier
+      std::map<uint64_t,BufferTable>::const_iterator ptr;
+      for (ptr = v->files_in_ssd_[level].begin();
+           ptr != v->files_in_ssd_[level].end(); ++ptr) {
+        ssd_live->insert(ptr->first);
       }
     }
   }
@@ -1650,7 +2661,8 @@ void VersionSet::GetRange2(const std::vector<FileMetaData*>& inputs1,
   GetRange(all, smallest, largest);
 }
 
-Iterator* VersionSet::MakeInputIterator(Compaction* c) {
+Iterator* VersionSet::MakeInputIterator(Compaction* c,
+                                        const RangeDelMap* range_del) {
   ReadOptions options;
   options.verify_checksums = options_->paranoid_checks;
   options.fill_cache = false;
@@ -1659,10 +2671,11 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   // we will make a concatenating iterator per level.
   // TODO(opt): use concatenating iterator for level-0 if there is no overlap
   int space = (c->level() == 0 ? c->inputs_[0].size() + 1 : 2);
-  Iterator** list = new Iterator*[space];
   //whc add
-  space += c->inputs_[0].size();
+  // Buffer nodes held by input files are merged along with them
+  space += c->inputs_[0].size() + c->inputs_[1].size();
   space += 1;
+  Iterator** list = new Iterator*[space];
   
   int num = 0;
   for (int which = 0; which < 2; which++) {
@@ -1670,152 +2683,375 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
       if (c->level() + which == 0) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
-          list[num++] = table_cache_->NewIterator(
-              options, files[i]->number, files[i]->file_size);
+          //whc add
+          if (range_del != NULL &&
+              range_del->CoversRange(files[i]->smallest.user_key(),
+                                     files[i]->largest.user_key(),
+                                     files[i]->largest_seq)) {
+            continue;
+          }
+          list[num++] = TableCacheForLevel(0)->NewIterator(
+              options, files[i]->number, files[i]->file_size, NULL, 0);
         }
       } else {
         // Create concatenating iterator for the files from this level
         //whc add
-        /*
-        for(int i=0;i<c->inputs_[which].size();i++){
-            if(c->inputs_[which][i]->buffer!=NULL){
-                assert(which!=0 || c->level()!=2);
-                list[num++] = NewBufferIterator(options,this,c->inputs_[which][i]->buffer);
-            }
-                //list[num++] = NewBufferIterator(options,this,c->inputs_[which][i]->buffer);
+        for(size_t i=0;i<c->inputs_[which].size();i++){
+            if(c->inputs_[which][i]->buffer!=NULL)
+                list[num++] = NewBufferIterator(options,this,c->inputs_[which][i]->buffer,
+                                                c->input_version_->sequence_,
+                                                range_del);
         }
-        */
-        //if(c->endbuffer!=NULL)
-            //list[num++] = NewBufferIterator(options,this,c->endbuffer);
         
         list[num++] = NewTwoLevelIterator(
-            new Version::LevelFileNumIterator(icmp_, &c->inputs_[which]),
-            &GetFileIterator, table_cache_, options);
+            new Version::LevelFileNumIterator(icmp_, &c->inputs_[which],
+                                              c->level() + which),
+            &GetFileIterator, TableCacheForLevel(c->level() + which),
+            options);
       }
     }
   }
   
   if(c->endbuffer!=NULL)
-            list[num++] = NewBufferIterator(options,this,c->endbuffer);
+            list[num++] = NewBufferIterator(options,this,c->endbuffer,
+                                            c->input_version_->sequence_,
+                                            range_del);
             
-    //std::cout<<"input[0].size="<<c->inputs_[0].size()<<std::endl;
-    //std::cout<<"num="<<num<<std::endl;
   assert(num <= space);
   Iterator* result = NewMergingIterator(&icmp_, list, num);
   delete[] list;
-  //std::cout<<"input[0].size="<<c->inputs_[0].size()<<std::endl;
-    //std::cout<<"num="<<num<<std::endl;
   return result;
 }
 
 //whc add
-Iterator* VersionSet::MakeBufferInputIterator(FileMetaData* f) {
-    assert(f->buffer != NULL);
-    assert(f->buffer->nodes.size()>0);
-    ReadOptions options;
-    options.verify_checksums = options_->paranoid_checks;
-    options.fill_cache = false;
-
-  // Level-0 files have to be merged together.  For other levels,
-  // we will make a concatenating iterator per level.
-  // TODO(opt): use concatenating iterator for level-0 if there is no overlap
- //whc add
-  const int space = 2;
-
-  // whc add
-  //space--;
+Iterator* VersionSet::MakeBufferInputIterator(int level, FileMetaData* f,
+                                              BufferCursorPool* cursors,
+                                              const RangeDelMap* range_del) {
+  assert(f->buffer != NULL);
+  assert(f->buffer->nodes.size()>0);
+  ReadOptions options;
+  options.verify_checksums = options_->paranoid_checks;
+  options.fill_cache = false;
 
-  Iterator** list = new Iterator*[space];
-  int num = 0;
- //whc change
-  
-  
-      list[num++] = NewBufferIterator(options,this,f->buffer);
-  
-  
-     list[num++] = table_cache_->NewIterator(
-              options, f->number, f->file_size);
-  
-  assert(num <= space);
-  Iterator* result = NewMergingIterator(&icmp_, list, num);
-  delete[] list;
-  return result;
+  // Dispatches adding nodes to f never run alongside its merge, see
+  // OverlapsRunningCompaction, so every node of f is visible in current_
+  std::vector<BufferNodeBound> nodes;
+  GetVisibleBufferNodes(f->buffer, current_->sequence_, &nodes, range_del);
+  return NewBufferMergingIterator(
+      options, ssd_table_cache_, &icmp_,
+      TableCacheForLevel(level)->NewIterator(options, f->number,
+                                             f->file_size),
+      nodes, cursors);
 }
 
 
 
 Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
+  Compaction* c = NULL;
 
-  //whc add
-  if(buffer_compact_switch_){
-      level = current_->bc_compaction_level_;
-      std::cout<<"pickcompaction:bc compaction level is: "<<current_->bc_compaction_level_<<std::endl;
-      c = new Compaction(options_, level);
-      c->inputs_[0] = current_->need_compact_[level];
-      //std::cout<<"pickcompaction:bc compaction input num "<<c->inputs_[0].size()<<std::endl;
-      //std::cout<<"pickcompaction:bc compaction input[0][0].s= "<<c->inputs_[0][0]->smallest.Rep()<<std::endl;
-      //std::cout<<"pickcompaction:bc compaction input[0][0].l= "<<c->inputs_[0][0]->largest.Rep()<<std::endl;
-      c->input_version_ = current_;
-      c->input_version_->Ref();
-      if(current_->endbuffers_need_[level]){
-          c->endbuffer = current_->endbuffers_[level];
-          current_->endbuffers_clean_[level] = true;
-          std::cout<<"pickcompaction:bc compaction end buffer go "<<std::endl;
-      }
-      c->IsBufferCompact = true;    
-      buffer_compact_switch_ = false;
-      return c;
+  //whc change
+  // Writers stall on a level-0 backlog, so it is compacted first.  Then
+  // the queued buffer merges, the other levels by score, and seek
+  // compactions last.  Candidates overlapping a running compaction are
+  // passed over, so that background workers get disjoint jobs.
+  const bool level0_backlog = (current_->compaction_level_ == 0 &&
+                               current_->compaction_score_ >= 1);
+  //whc change
+  const bool universal =
+      (options_->compaction_style == kCompactionStyleUniversal);
+  if (universal) {
+    c = PickUniversalCompaction();
+  } else if (level0_backlog) {
+    c = PickLevelCompaction(0);
+    if (c == NULL) {
+      c = PickIntraL0Compaction();
+    }
   }
-  
-  
+  if (c == NULL) {
+    c = PickBufferMerge();
+  }
+
   // We prefer compactions triggered by too much data in a level over
   // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level+1 < config::kNumLevels);
-    c = new Compaction(options_, level);
-
-    // Pick the first file that comes after compact_pointer_[level]
-    //whc change
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
-      if( f->buffer == NULL && 
-      (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0)) {
-        c->inputs_[0].push_back(f);
-        break;
+  if (c == NULL) {
+    std::vector<std::pair<double, int> > levels;
+    // Universal compaction keeps level-0 files at level-0
+    for (int level = universal ? 1 : 0; level < config::kNumLevels - 1;
+         level++) {
+      if (current_->compaction_scores_[level] >= 1) {
+        levels.push_back(std::make_pair(-current_->compaction_scores_[level],
+                                        level));
       }
     }
-    if (c->inputs_[0].empty()) {
-       //whc change
-        // Wrap-around to the beginning of the key space
-      //c->inputs_[0].push_back(current_->files_[level][0]);
-      
-      for (size_t i = 0; i < current_->files_[level].size(); i++){
-          FileMetaData* f = current_->files_[level][i];
-          if(f->buffer == NULL){
-              c->inputs_[0].push_back(f);
-              break;
-          }
-      }
+    std::sort(levels.begin(), levels.end());
+    for (size_t i = 0; c == NULL && i < levels.size(); i++) {
+      c = PickLevelCompaction(levels[i].second);
     }
-    //whc add
-    assert(!c->inputs_[0].empty());
-    
-  } else if (seek_compaction) {
+  }
+  //whc add
+  if (c == NULL && current_->tombstone_file_to_compact_ != NULL) {
+    Log(options_->info_log, "Tombstone compaction of #%llu at level-%d\n",
+        static_cast<unsigned long long>(
+            current_->tombstone_file_to_compact_->number),
+        current_->tombstone_file_to_compact_level_);
+    c = CompactionForFile(current_->tombstone_file_to_compact_level_,
+                          current_->tombstone_file_to_compact_);
+  }
+  if (c == NULL && current_->file_to_compact_ != NULL &&
+      current_->file_to_compact_->buffer == NULL &&
+      !(universal && current_->file_to_compact_level_ == 0)) {
     std::cout<<"pickcompaction:seek_compaction "<<std::endl;
-    level = current_->file_to_compact_level_;
-    c = new Compaction(options_, level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
-  } else {
+    c = CompactionForFile(current_->file_to_compact_level_,
+                          current_->file_to_compact_);
+  }
+  if (c != NULL) {
+    RegisterCompaction(c);
+  }
+  return c;
+}
+
+//whc add
+Compaction* VersionSet::PickBufferMerge() {
+  // The level holding the best candidate goes first, with at most
+  // kMaxBufferMergeFiles of its files in the order of their read savings
+  // per merge byte.  The rest stay queued for the next compactions, each
+  // a separate job memtable flushes run between.
+  std::vector<FileMetaData*> full;
+  int level = -1;
+  for (int l = 1; l < config::kNumLevels; l++) {
+    std::vector<FileMetaData*> candidates;
+    for (size_t i = 0; i < current_->buffer_merges_[l].size(); i++) {
+      FileMetaData* f = current_->buffer_merges_[l][i];
+      InternalKey smallest, largest;
+      GetFileRange(current_, l, f, &smallest, &largest);
+      if (!OverlapsRunningCompaction(l, smallest, largest)) {
+        candidates.push_back(f);
+      }
+    }
+    if (candidates.empty())
+      continue;
+    // Reads keep changing the scores while files wait
+    std::sort(candidates.begin(), candidates.end(), ByBufferMergeScore());
+    if (full.empty() ||
+        BufferMergeScore(candidates[0]) > BufferMergeScore(full[0])) {
+      full.swap(candidates);
+      level = l;
+    }
+  }
+  if (full.empty()) {
     return NULL;
   }
+  if (full.size() > kMaxBufferMergeFiles)
+    full.resize(kMaxBufferMergeFiles);
+  // Threads merging several files check their keys against lower
+  // levels in order, see Compaction::IsBaseLevelForKey
+  std::set<FileMetaData*> picked(full.begin(), full.end());
+  full.clear();
+  for (size_t i = 0; i < current_->files_[level].size(); i++) {
+    if (picked.count(current_->files_[level][i]) > 0)
+      full.push_back(current_->files_[level][i]);
+  }
+  Log(options_->info_log, "Buffer merge of %d files at level-%d\n",
+      static_cast<int>(full.size()), level);
+  buffer_merges_[level]++;
+  buffer_merged_files_[level] += full.size();
+  Compaction* c = new Compaction(options_, level);
+  c->inputs_[0] = full;
+  c->input_version_ = current_;
+  c->input_version_->Ref();
+  if(current_->endbuffers_need_[level]){
+      c->endbuffer = current_->endbuffers_[level];
+      current_->endbuffers_clean_[level] = true;
+      Log(options_->info_log, "Buffer merge at level-%d takes the end buffer\n",
+          level);
+  }
+  c->IsBufferCompact = true;
+  return c;
+}
 
+bool VersionSet::GetLevel0Runs(std::vector<FileMetaData*>* runs,
+                               std::set<uint64_t>* busy) const {
+  *runs = current_->files_[0];
+  for (size_t i = 0; i < runs->size(); i++) {
+    if ((*runs)[i]->largest_seq == kMaxSequenceNumber) {
+      return false;  // Order unknown
+    }
+  }
+  std::sort(runs->begin(), runs->end(), NewestFirst);
+  busy->clear();
+  std::set<Compaction*>::const_iterator it;
+  for (it = running_compactions_[0].begin();
+       it != running_compactions_[0].end(); ++it) {
+    for (size_t i = 0; i < (*it)->inputs_[0].size(); i++) {
+      busy->insert((*it)->inputs_[0][i]->number);
+    }
+  }
+  return true;
+}
+
+Compaction* VersionSet::NewIntraL0Compaction(
+    const std::vector<FileMetaData*>& runs, size_t start, size_t end) {
+  Compaction* c = new Compaction(options_, 0);
+  c->inputs_[0].assign(runs.begin() + start, runs.begin() + end);
+  c->input_version_ = current_;
+  c->input_version_->Ref();
+  c->intra_l0_ = true;
+  c->includes_oldest_l0_ = (end == runs.size());
+  if (options_->compaction_style == kCompactionStyleUniversal) {
+    // Each run is written into a single file
+    c->max_output_file_size_ = ~static_cast<uint64_t>(0);
+  }
+  return c;
+}
+
+Compaction* VersionSet::PickIntraL0Compaction() {
+  // Level-1 is busy, so merge the newest level-0 files not being
+  // compacted into one, so that reads probe fewer files meanwhile.  They
+  // must directly follow each other in sequence order, and only one such
+  // compaction runs at a time, so that its outputs are ordered against
+  // the other level-0 files by their largest sequence.
+  std::set<Compaction*>::const_iterator it;
+  for (it = running_compactions_[0].begin();
+       it != running_compactions_[0].end(); ++it) {
+    if ((*it)->IsIntraL0()) {
+      return NULL;
+    }
+  }
+  std::vector<FileMetaData*> files;
+  std::set<uint64_t> busy;
+  if (!GetLevel0Runs(&files, &busy)) {
+    return NULL;
+  }
+
+  size_t end = 0;
+  int64_t bytes = 0;
+  for (; end < files.size(); end++) {
+    FileMetaData* f = files[end];
+    if (busy.count(f->number) > 0 ||
+        (end > 0 &&
+         bytes + f->file_size > ExpandedCompactionByteSizeLimit(options_))) {
+      break;
+    }
+    bytes += f->file_size;
+  }
+  if (end < static_cast<size_t>(config::kMinIntraL0Files)) {
+    return NULL;
+  }
+  Log(options_->info_log, "Intra level-0 compaction of %d files\n",
+      static_cast<int>(end));
+  intra_l0_compactions_++;
+  return NewIntraL0Compaction(files, 0, end);
+}
+
+Compaction* VersionSet::PickUniversalCompaction() {
+  std::vector<FileMetaData*> runs;
+  std::set<uint64_t> busy;
+  if (!GetLevel0Runs(&runs, &busy)) {
+    // Files written before sequences were recorded cannot be ordered
+    // against merged runs, so they are pushed into level-1 first
+    return PickLevelCompaction(0);
+  }
+  if (runs.size() < static_cast<size_t>(config::kL0_CompactionTrigger)) {
+    return NULL;
+  }
+  const size_t min_width =
+      std::max(2, options_->universal_min_merge_width);
+
+  // Merge every run once the newer runs take too much space next to the
+  // oldest one and the levels below
+  if (busy.empty()) {
+    uint64_t older = runs.back()->file_size;
+    for (int level = 1; level < config::kNumLevels; level++) {
+      older += TotalFileSize(current_->files_[level]);
+    }
+    const uint64_t newer = TotalFileSize(runs) - runs.back()->file_size;
+    if (newer * 100 > older * static_cast<uint64_t>(
+            options_->universal_max_size_amplification_percent)) {
+      Log(options_->info_log,
+          "Universal compaction of %d runs by size amplification\n",
+          static_cast<int>(runs.size()));
+      return NewIntraL0Compaction(runs, 0, runs.size());
+    }
+  }
+
+  // Merge the newest free runs each at most universal_size_ratio percent
+  // larger than the runs before it together
+  for (size_t start = 0; start < runs.size(); start++) {
+    if (busy.count(runs[start]->number) > 0) {
+      continue;
+    }
+    uint64_t sum = runs[start]->file_size;
+    size_t end = start + 1;
+    for (; end < runs.size() && busy.count(runs[end]->number) == 0; end++) {
+      if (runs[end]->file_size * 100 >
+          sum * (100 + options_->universal_size_ratio)) {
+        break;
+      }
+      sum += runs[end]->file_size;
+    }
+    if (end - start >= min_width) {
+      Log(options_->info_log,
+          "Universal compaction of %d runs by size ratio\n",
+          static_cast<int>(end - start));
+      return NewIntraL0Compaction(runs, start, end);
+    }
+  }
+
+  // Otherwise merge the newest free runs, enough of them to bring the
+  // number of runs back under the trigger
+  const size_t width = std::max(
+      min_width, runs.size() - config::kL0_CompactionTrigger + 1);
+  size_t start = 0;
+  while (start < runs.size() && busy.count(runs[start]->number) > 0) {
+    start++;
+  }
+  size_t end = start;
+  while (end < runs.size() && end - start < width &&
+         busy.count(runs[end]->number) == 0) {
+    end++;
+  }
+  if (end - start < min_width) {
+    return NULL;
+  }
+  Log(options_->info_log, "Universal compaction of %d runs by run count\n",
+      static_cast<int>(end - start));
+  return NewIntraL0Compaction(runs, start, end);
+}
+
+Compaction* VersionSet::PickLevelCompaction(int level) {
+  // Pick the first file without buffer that comes after
+  // compact_pointer_[level], wrapping around to the beginning of the key
+  // space, and the next ones if it overlaps a running compaction
+  if (level == 0 && !running_compactions_[0].empty()) {
+    return NULL;  // Level-0 files may overlap each other
+  }
+  const std::vector<FileMetaData*>& files = current_->files_[level];
+  size_t start = 0;
+  if (!compact_pointer_[level].empty()) {
+    while (start < files.size() &&
+           icmp_.Compare(files[start]->largest.Encode(),
+                         compact_pointer_[level]) <= 0) {
+      start++;
+    }
+  }
+  for (size_t i = 0; i < files.size(); i++) {
+    FileMetaData* f = files[(start + i) % files.size()];
+    if (f->buffer != NULL) {
+      continue;
+    }
+    Compaction* c = CompactionForFile(level, f);
+    if (c != NULL) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+Compaction* VersionSet::CompactionForFile(int level, FileMetaData* f) {
+  assert(level >= 0);
+  assert(level+1 < config::kNumLevels);
+  Compaction* c = new Compaction(options_, level);
+  c->inputs_[0].push_back(f);
   c->input_version_ = current_;
   c->input_version_->Ref();
 
@@ -1830,16 +3066,123 @@ Compaction* VersionSet::PickCompaction() {
     assert(!c->inputs_[0].empty());
   }
 
+  const std::string pointer = compact_pointer_[level];
   SetupOtherInputs(c);
   c->IsBufferCompact = false;
+  InternalKey smallest, largest;
+  GetCompactionRange(c, &smallest, &largest);
+  if (OverlapsRunningCompaction(level, smallest, largest)) {
+    compact_pointer_[level] = pointer;  // Come back to this range later
+    delete c;
+    return NULL;
+  }
   std::cout<<"pickcompaction:level= "<<level<<std::endl;
-  assert(c->inputs_[0][0]->buffer == NULL);
-  //std::cout<<"pick compaction level: "<< c->level()<<std::endl;
-  //std::cout<<"pick compaction up num: "<< c->inputs_[0].size()<<std::endl;
-  //std::cout<<"pick compaction down num: "<< c->inputs_[1].size()<<std::endl;
   return c;
 }
 
+void VersionSet::GetFileRange(Version* v, int level, const FileMetaData* f,
+                              InternalKey* smallest,
+                              InternalKey* largest) const {
+  *smallest = f->smallest;
+  *largest = f->largest;
+  if (f->buffer == NULL) {
+    return;
+  }
+  bool from_table_start = false;
+  for (size_t i = 0; i < f->buffer->nodes.size(); i++) {
+    const BufferNode& node = f->buffer->nodes[i];
+    if (node.smallest.Rep().empty()) {
+      from_table_start = true;
+    } else if (icmp_.Compare(node.smallest, *smallest) < 0) {
+      *smallest = node.smallest;
+    }
+    if (icmp_.Compare(node.largest, *largest) > 0) {
+      *largest = node.largest;
+    }
+  }
+  if (from_table_start) {
+    // Such a node still lies after the previous file of the level
+    const std::vector<FileMetaData*>& files = v->files_[level];
+    const int index = FindFile(icmp_, files, f->largest.Encode());
+    if (index == 0) {
+      smallest->Clear();
+    } else if (icmp_.Compare(files[index - 1]->largest, *smallest) < 0) {
+      *smallest = files[index - 1]->largest;
+    }
+  }
+}
+
+void VersionSet::GetCompactionRange(const Compaction* c,
+                                    InternalKey* smallest,
+                                    InternalKey* largest) const {
+  bool first = true;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      InternalKey file_smallest, file_largest;
+      GetFileRange(c->input_version_, c->level() + which,
+                   c->inputs_[which][i], &file_smallest, &file_largest);
+      if (first || (!smallest->Rep().empty() &&
+                    (file_smallest.Rep().empty() ||
+                     icmp_.Compare(file_smallest, *smallest) < 0))) {
+        *smallest = file_smallest;
+      }
+      if (first || icmp_.Compare(file_largest, *largest) > 0) {
+        *largest = file_largest;
+      }
+      first = false;
+    }
+  }
+}
+
+bool VersionSet::OverlapsRunningCompaction(int level,
+                                           const InternalKey& smallest,
+                                           const InternalKey& largest) const {
+  // A compaction of level L works on levels L and L+1, so it can only
+  // collide with those of levels L-1 to L+1
+  const Comparator* user_cmp = icmp_.user_comparator();
+  for (int l = std::max(level - 1, 0);
+       l <= std::min(level + 1, config::kNumLevels - 1); l++) {
+    std::set<Compaction*>::const_iterator it;
+    for (it = running_compactions_[l].begin();
+         it != running_compactions_[l].end(); ++it) {
+      const Compaction* c = *it;
+      if (level == 0 && l == 0) {
+        return true;  // Level-0 files may overlap each other
+      }
+      if (c->IsIntraL0()) {
+        continue;  //whc add: touches level-0 files only
+      }
+      // An empty smallest key stands for the beginning of the key space
+      if ((c->smallest_.Rep().empty() ||
+           user_cmp->Compare(largest.user_key(),
+                             c->smallest_.user_key()) >= 0) &&
+          (smallest.Rep().empty() ||
+           user_cmp->Compare(smallest.user_key(),
+                             c->largest_.user_key()) <= 0)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void VersionSet::RegisterCompaction(Compaction* c) {
+  GetCompactionRange(c, &c->smallest_, &c->largest_);
+  running_compactions_[c->level()].insert(c);
+}
+
+void VersionSet::ReleaseCompaction(Compaction* c) {
+  running_compactions_[c->level()].erase(c);
+}
+
+int VersionSet::NumRunningCompactions() const {
+  int n = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    n += running_compactions_[level].size();
+  }
+  return n;
+}
+
 void VersionSet::SetupOtherInputs(Compaction* c) {
   const int level = c->level();
   InternalKey smallest, largest;
@@ -1849,10 +3192,23 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
 
   //whc change
   
-  if(BCJudge::IsBufferCompactLevel(level))
+  // Buffer nodes of level+1 files may lie outside of their files' ranges
+  if(BCJudge::IsBufferCompactLevel(options_, level) ||
+     ExistFileWithBuffer(current_->files_[level+1]))
 	  current_->BufferGetOverlappingInputs(level+1, &smallest, &largest, &c->inputs_[1]);
   else current_->GetOverlappingInputs(level+1, &smallest, &largest, &c->inputs_[1]);
-  
+
+  //whc add
+  // Compute the set of grandparent files that overlap this compaction
+  // (parent == level+1; grandparent == level+2), so that outputs are cut
+  // before they overlap too much of level+2
+  if (level + 2 < config::kNumLevels) {
+    InternalKey all_start, all_limit;
+    GetRange2(c->inputs_[0], c->inputs_[1], &all_start, &all_limit);
+    current_->GetOverlappingInputs(level + 2, &all_start, &all_limit,
+                                   &c->grandparents_);
+  }
+
   //current_->GetOverlappingInputs(level+1, &smallest, &largest, &c->inputs_[1]);
   /*
   //whc add
@@ -1934,6 +3290,25 @@ Compaction* VersionSet::CompactRange(
     return NULL;
   }
 
+  //whc add
+  // Files holding buffer nodes are merged with their buffers first; the
+  // caller picks the range up again afterwards.
+  std::vector<FileMetaData*> buffered;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (inputs[i]->buffer != NULL) {
+      buffered.push_back(inputs[i]);
+    }
+  }
+  if (!buffered.empty()) {
+    Compaction* c = new Compaction(options_, level);
+    c->input_version_ = current_;
+    c->input_version_->Ref();
+    c->inputs_[0] = buffered;
+    c->IsBufferCompact = true;
+    RegisterCompaction(c);  //whc add
+    return c;
+  }
+
   // Avoid compacting too much in one shot in case the range is large.
   // But we cannot do this for level-0 since level-0 files can overlap
   // and we must not pick one file and drop another older file if the
@@ -1956,17 +3331,18 @@ Compaction* VersionSet::CompactRange(
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
   SetupOtherInputs(c);
+  RegisterCompaction(c);  //whc add
   return c;
 }
 
 Compaction::Compaction(const Options* options, int level)
     : level_(level),
+      IsBufferCompact(false),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
       input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) ,
-      endbuffer(NULL){               //whc add
+      endbuffer(NULL),               //whc add
+      intra_l0_(false),
+      includes_oldest_l0_(false){
   for (int i = 0; i < config::kNumLevels; i++) {
     level_ptrs_[i] = 0;
   }
@@ -1984,14 +3360,30 @@ bool Compaction::IsTrivialMove() const {
   // Otherwise, the move could create a parent file that will require
   // a very expensive merge later on.
   //whc change
-  if(BCJudge::IsBufferCompactLevel(level_) &&
+  // A file holding buffer nodes must be merged with them, never moved
+  if (IsBufferCompact || intra_l0_ || num_input_files(0) != 1 ||
+      input(0, 0)->buffer != NULL) {
+    return false;
+  }
+  // Nor a file picked for its deletion markers, which only a merge drops
+  if (HasDenseDeletions(input(0, 0))) {
+    return false;
+  }
+  // Moving a file to the other storage tier has to rewrite it
+  if (BCJudge::IsSSDLevel(vset->options_, level_) !=
+      BCJudge::IsSSDLevel(vset->options_, level_ + 1)) {
+    return false;
+  }
+  const bool buffer_level =
+      BCJudge::IsBufferCompactLevel(vset->options_, level_);
+  if(buffer_level &&
   level_+1 < config::kNumLevels
   && vset->current_->files_[level_+1].size()==0 )
       return true;
   
   return (num_input_files(0) == 1 && num_input_files(1) == 0 &&
           TotalFileSize(grandparents_) <=
-              MaxGrandParentOverlapBytes(vset->options_) && !(BCJudge::IsBufferCompactLevel(level_)));
+              MaxGrandParentOverlapBytes(vset->options_) && !buffer_level);
 }
 
 void Compaction::AddInputDeletions(VersionEdit* edit) {
@@ -2014,55 +3406,129 @@ void Compaction::AddInputUpDeletions(VersionEdit* edit) {
 }
 
 bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+  return IsBaseLevelForKey(user_key, level_ptrs_);
+}
+
+bool Compaction::IsBaseLevelForKey(const Slice& user_key, size_t* level_ptrs) {
+  //whc add
+  // Older level-0 files may hold the key
+  if (intra_l0_ && !includes_oldest_l0_) {
+    return false;
+  }
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
   //whc change
+  // A buffer merge rewrites files of level_ in place
   int level_begin;
-  if(level_!=2)
+  if(!IsBufferCompact && !intra_l0_)
       level_begin = level_+2;
   else level_begin = level_+1;
   
   for (int lvl = level_begin; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
-      if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
+    for (; level_ptrs[lvl] < files.size(); ) {
+      FileMetaData* f = files[level_ptrs[lvl]];
+      //whc change
+      // Buffer nodes may hold keys between the previous file and f, or
+      // after the last file of the level
+      Slice largest = f->largest.user_key();
+      if (f->buffer != NULL) {
+        for (size_t i = 0; i < f->buffer->nodes.size(); i++) {
+          Slice node_largest = f->buffer->nodes[i].largest.user_key();
+          if (user_cmp->Compare(node_largest, largest) > 0) {
+            largest = node_largest;
+          }
+        }
+      }
+      if (user_cmp->Compare(user_key, largest) <= 0) {
         // We've advanced far enough
-        if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
+        if (f->buffer != NULL ||
+            user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
           // Key falls in this file's range, so definitely not base level
           return false;
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
 bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+  return ShouldStopBefore(internal_key, &grandparent_state_);
+}
+
+bool Compaction::ShouldStopBefore(const Slice& internal_key,
+                                  GrandparentState* state) {
   const VersionSet* vset = input_version_->vset_;
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &vset->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
+  while (state->grandparent_index < grandparents_.size() &&
       icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+          grandparents_[state->grandparent_index]->largest.Encode()) > 0) {
+    if (state->seen_key) {
+      state->overlapped_bytes +=
+          grandparents_[state->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    state->grandparent_index++;
   }
-  seen_key_ = true;
+  state->seen_key = true;
 
-  if (overlapped_bytes_ > MaxGrandParentOverlapBytes(vset->options_)) {
+  if (state->overlapped_bytes > MaxGrandParentOverlapBytes(vset->options_)) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    state->overlapped_bytes = 0;
     return true;
   } else {
     return false;
   }
 }
 
+//whc add
+namespace {
+struct ByLargestUserKey {
+  const Comparator* ucmp;
+  bool operator()(FileMetaData* a, FileMetaData* b) const {
+    return ucmp->Compare(a->largest.user_key(), b->largest.user_key()) < 0;
+  }
+};
+}  // namespace
+
+void Compaction::GetSubcompactionSplits(
+    int n, std::vector<std::string>* splits) const {
+  splits->clear();
+  std::vector<FileMetaData*> files(inputs_[0]);
+  files.insert(files.end(), inputs_[1].begin(), inputs_[1].end());
+  //whc change
+  // Level-0 files merged into level-0 make a single sorted run
+  if (n <= 1 || files.size() <= 1 || intra_l0_) {
+    return;
+  }
+  ByLargestUserKey cmp;
+  cmp.ucmp = input_version_->vset_->icmp_.user_comparator();
+  std::sort(files.begin(), files.end(), cmp);
+  uint64_t total = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    total += files[i]->file_size;
+  }
+
+  // A range ends after the file that brings it to its share of the bytes.
+  // Files reaching past the cut are counted whole in the next range.
+  const Slice last = files.back()->largest.user_key();
+  uint64_t done = 0;
+  for (size_t i = 0; i + 1 < files.size() &&
+                     splits->size() + 1 < static_cast<size_t>(n); i++) {
+    done += files[i]->file_size;
+    const Slice key = files[i]->largest.user_key();
+    if (done * n < total * (splits->size() + 1) ||
+        cmp.ucmp->Compare(key, last) >= 0 ||
+        (!splits->empty() && cmp.ucmp->Compare(key, splits->back()) <= 0)) {
+      continue;
+    }
+    splits->push_back(key.ToString());
+  }
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != NULL) {
     input_version_->Unref();
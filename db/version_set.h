@@ -15,6 +15,7 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_SET_H_
 #define STORAGE_LEVELDB_DB_VERSION_SET_H_
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
@@ -27,6 +28,8 @@ namespace leveldb {
 
 namespace log { class Writer; }
 
+class BufferCursorPool;
+struct BufferNodeBound;
 class Compaction;
 class Iterator;
 class MemTable;
@@ -61,6 +64,7 @@ class Version {
   // Append to *iters a sequence of iterators that will
   // yield the contents of this Version when merged together.
   // REQUIRES: This version has been saved (see VersionSet::SaveTo)
+  // May be called without the db mutex.
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
   // Lookup the value for key.  If found, store it in *val and
@@ -69,6 +73,11 @@ class Version {
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
+    //whc add
+    FileMetaData* buffer_file;  // First file whose buffer was probed
+    int buffer_file_level;
+    int buffer_probes;          // Node tables of buffer_file probed
+    bool buffer_hit;            // A node of buffer_file answered the lookup
   };
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
@@ -77,6 +86,21 @@ class Version {
   Status BufferGet(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
 
+  //whc add
+  // Like BufferGet() for each of the "n" keys of "keys", which are sorted
+  // by user key and share one sequence.  Stores the result for keys[i]
+  // in *values[i] and *statuses[i] and fills stats[i].  Keys covered by
+  // the same file are looked up in one batch.
+  void MultiGet(const ReadOptions&, int n, const LookupKey* const* keys,
+                std::string* const* values, Status* const* statuses,
+                GetStats* stats);
+
+  //whc add
+  // Append to *result the range tombstones of this version no newer
+  // than "snapshot".
+  void GetRangeTombstones(SequenceNumber snapshot,
+                          std::vector<RangeTombstone>* result) const;
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -137,6 +161,28 @@ class Version {
 
   class LevelFileNumIterator;
   Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
+  //whc add
+  // Does any file of "level" hold buffer nodes?
+  bool HasBuffers(int level) const;
+  // Like NewConcatenatingIterator, merging each file with its buffer
+  Iterator* NewBufferLevelIterator(const ReadOptions&, int level) const;
+
+  // Pending key of MultiGet()
+  struct MultiGetKey;
+  // Look the "keys" up in "f" of "level", its buffer nodes first
+  void MultiGetFromFile(const ReadOptions& options, int level,
+                        FileMetaData* f,
+                        const std::vector<MultiGetKey*>& keys);
+  // Look the "keys" up in table "number" of "cache" at "level", which is
+  // the level of the file holding the buffer for the table of a buffer
+  // node.  "buffer_file" is the file whose buffer node reads the table,
+  // NULL if none.  "largest_seq" is the largest
+  // sequence number in the table.
+  void MultiGetFromTable(const ReadOptions& options, TableCache* cache,
+                         uint64_t number, uint64_t file_size, int level,
+                         SequenceNumber largest_seq,
+                         FileMetaData* buffer_file,
+                         const std::vector<MultiGetKey*>& keys);
 
   // Call func(arg, level, f) for every file that overlaps user_key in
   // order from newest to oldest.  If an invocation of func returns
@@ -147,6 +193,12 @@ class Version {
                           void* arg,
                           bool (*func)(void*, int, FileMetaData*));
 
+  //whc add
+  // Largest sequence no newer than "snapshot" of a range tombstone
+  // covering "user_key", or zero if there is none.
+  SequenceNumber MaxCoveringTombstone(const Slice& user_key,
+                                      SequenceNumber snapshot) const;
+
   VersionSet* vset_;            // VersionSet to which this Version belongs
   Version* next_;               // Next version in linked list
   Version* prev_;               // Previous version in linked list
@@ -160,10 +212,18 @@ class Version {
 
   //whc add
  Buffer* endbuffers_[config::kNumLevels];
- std::map<uint64_t,BufferTable*> files_in_ssd_[config::kNumLevels];
+ std::map<uint64_t,BufferTable> files_in_ssd_[config::kNumLevels];
  bool endbuffers_need_[config::kNumLevels];
  bool endbuffers_clean_[config::kNumLevels];
- std::vector<FileMetaData*> need_compact_[config::kNumLevels];
+ // Files of each level whose buffer should be merged, see
+ // BufferNeedsMerge.  Initialized by Finalize() and extended by
+ // UpdateStats() as reads make more of them worth merging.
+ std::vector<FileMetaData*> buffer_merges_[config::kNumLevels];
+ // Range tombstones flushed out of memtables, in sequence order.  They
+ // delete entries of the files and buffer nodes below.
+ std::vector<RangeTombstone> range_tombstones_;
+ // range_tombstones_ fragmented for lookups, NULL if there are none
+ RangeDelMap* range_del_map_;
  const std::string ssdname_;
 
   int file_to_compact_level_;
@@ -175,17 +235,44 @@ class Version {
   int compaction_level_;
 
   //whc add
-  int bc_compaction_level_;
+  // Compaction score of every level, initialized by Finalize().
+  double compaction_scores_[config::kNumLevels];
+
+  // Bytes compactions have to rewrite to bring every level back under
+  // its limit, initialized by Finalize().  Counts level-0 once it is due
+  // for compaction, the excess of the other levels and the buffers
+  // waiting to be merged.
+  uint64_t compaction_debt_;
+
+  // Source table whose buffer nodes cover the smallest part of it, if
+  // that is below config::kBufferTableLivePercent, and its level.  These
+  // fields are initialized by Finalize().
+  uint64_t table_to_reclaim_;
+  int table_to_reclaim_level_;
+
+  // File whose deletion markers are worth compacting even if its level is
+  // under its size limit, see VersionSet::TombstoneScore, and its level.
+  // These fields are initialized by Finalize().
+  FileMetaData* tombstone_file_to_compact_;
+  int tombstone_file_to_compact_level_;
 
   explicit Version(VersionSet* vset)
-      : vset_(vset), next_(this), prev_(this), refs_(0),
+      : sequence_(0), vset_(vset), next_(this), prev_(this), refs_(0),
         file_to_compact_(NULL),
+        range_del_map_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1){
+        compaction_level_(-1),
+        compaction_debt_(0),
+        table_to_reclaim_(0),
+        table_to_reclaim_level_(-1),
+        tombstone_file_to_compact_(NULL),
+        tombstone_file_to_compact_level_(-1){
 	  //whc add
 	  for(int i=0;i<config::kNumLevels;i++)
 		  endbuffers_[i] = NULL;
+	  for(int i=0;i<config::kNumLevels;i++)
+		  compaction_scores_[i] = -1;
         for(int i=0;i<config::kNumLevels;i++)
 		  endbuffers_need_[i] = false;
       for(int i=0;i<config::kNumLevels;i++)
@@ -248,16 +335,38 @@ class VersionSet {
   // Return the number of Table files at the specified level.
   int NumLevelFiles(int level) const;
 
+  //whc add
+  // Return the number of buffer nodes held by the files at the specified level.
+  int NumLevelBufferNodes(int level) const;
+
+  // Return the combined size of the source tables whose buffer nodes are
+  // held by the files at the specified level.
+  int64_t NumLevelBufferTableBytes(int level) const;
+
+  // Return the number of buffer node tables probed by lookups through
+  // the buffers of the files at the specified level.
+  int64_t NumLevelBufferProbes(int level) const;
+
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
+  //whc add
+  // Return the compaction debt of the current version, see
+  // Version::compaction_debt_.
+  uint64_t CompactionDebt() const { return current_->compaction_debt_; }
+
   // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  //whc change
+  // May be called without the db mutex; the writes up to the result are
+  // then visible to the caller.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
-    assert(s >= last_sequence_);
-    last_sequence_ = s;
+    assert(s >= LastSequence());
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   //whc add
@@ -284,38 +393,109 @@ class VersionSet {
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
+  //whc change
+  // Compactions overlapping a running one are never picked.  The result
+  // is running until passed to ReleaseCompaction().
   Compaction* PickCompaction();
 
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns NULL if there is nothing in that
   // level that overlaps the specified range.  Caller should delete
   // the result.
+  //whc change
+  // The result is running until passed to ReleaseCompaction().
   Compaction* CompactRange(
       int level,
       const InternalKey* begin,
       const InternalKey* end);
 
+  //whc add
+  // Forget "c", a compaction returned by PickCompaction() or
+  // CompactRange(), before it is deleted.
+  void ReleaseCompaction(Compaction* c);
+
+  // Return the number of compactions running.
+  int NumRunningCompactions() const;
+
+  //whc add
+  // Return the number of level-0 compactions picked to merge level-0
+  // files among themselves while level-1 was busy.
+  int64_t NumIntraL0Compactions() const { return intra_l0_compactions_; }
+
+  // Return the number of buffer merges picked at the specified level, and
+  // the number of files they merged.
+  int64_t NumBufferMerges(int level) const { return buffer_merges_[level]; }
+  int64_t NumBufferMergedFiles(int level) const {
+    return buffer_merged_files_[level];
+  }
+
   // Return the maximum overlapping data (in bytes) at next level for any
   // file at a level >= 1.
   int64_t MaxNextLevelOverlappingBytes();
 
   // Create an iterator that reads over the compaction inputs for "*c".
   // The caller should delete the iterator when no longer needed.
-  Iterator* MakeInputIterator(Compaction* c);
+  //whc change
+  // Level-0 inputs and buffer nodes that "range_del" covers entirely are
+  // not read.
+  Iterator* MakeInputIterator(Compaction* c,
+                              const RangeDelMap* range_del = NULL);
 
   //whc add
-  Iterator* MakeBufferInputIterator(FileMetaData* c);
+  // Create an iterator merging "f", a file of "level", with its buffer
+  // for a buffer merge.  Nodes are read through "cursors", which may be
+  // NULL, and skipped if "range_del" covers them entirely.
+  Iterator* MakeBufferInputIterator(int level, FileMetaData* f,
+                                    BufferCursorPool* cursors,
+                                    const RangeDelMap* range_del = NULL);
+
+  // Return the table cache of the tier holding the tables of "level".
+  TableCache* TableCacheForLevel(int level) const {
+    return BCJudge::IsSSDLevel(options_, level) ? ssd_table_cache_
+                                                : table_cache_;
+  }
 
   // Returns true iff some level needs a compaction.
   bool NeedsCompaction() const {
     Version* v = current_;
-    return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL);
+    //whc change
+    for (int level = 1; level < config::kNumLevels; level++) {
+      if (!v->buffer_merges_[level].empty()) return true;
+    }
+    return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL) ||
+        (v->table_to_reclaim_ != 0) || range_deletions_pending_ ||
+        (v->tombstone_file_to_compact_ != NULL);
   }
 
+  //whc add
+  // Returns true iff range tombstones were added or files were removed
+  // since the last call to PickRangeDeletions().
+  bool NeedsRangeDeletions() const { return range_deletions_pending_; }
+
+  // Add to *edit the deletion of the files of the current version whose
+  // entries are all deleted by range tombstones no newer than
+  // "smallest_snapshot", and of the tombstones no file or buffer node can
+  // hold an entry of anymore.  Files a running compaction works on are
+  // kept.  Returns true iff *edit was changed.
+  bool PickRangeDeletions(SequenceNumber smallest_snapshot, VersionEdit* edit);
+
+  //whc add
+  // If a source table of the current version is mostly no longer read
+  // by buffer nodes, store its level, number and size in *level, *number
+  // and *filesize, the ranges of the nodes still reading it in *nodes,
+  // in key order, and return true.
+  bool PickTableToReclaim(int* level, uint64_t* number, uint64_t* filesize,
+                          std::vector<BufferNodeBound>* nodes);
+
   // Add all files listed in any live version to *live.
   // May also mutate some internal state.
   void AddLiveFiles(std::set<uint64_t>* live);
 
+  //whc add
+  // Same, adding the files of the fast tier (see Options::ssd_path) to
+  // *ssd_live instead.
+  void AddLiveFiles(std::set<uint64_t>* live, std::set<uint64_t>* ssd_live);
+
   // Return the approximate offset in the database of the data for
   // "key" as of version "v".
   uint64_t ApproximateOffsetOf(Version* v, const InternalKey& key);
@@ -339,8 +519,6 @@ class VersionSet {
  //whc add
    //void CopyToSSD( void* state);
 
- //whc add
-    bool buffer_compact_switch_;
    
 //whc change
     const InternalKeyComparator icmp_;
@@ -357,6 +535,11 @@ class VersionSet {
 
   void Finalize(Version* v);
 
+  //whc add
+  // Share, from 0 to 1, of f or of the bytes compacting f from "level"
+  // rewrites that its deletion markers are estimated to remove.
+  double TombstoneScore(Version* v, int level, const FileMetaData* f) const;
+
   void GetRange(const std::vector<FileMetaData*>& inputs,
                 InternalKey* smallest,
                 InternalKey* largest);
@@ -368,6 +551,46 @@ class VersionSet {
 
   void SetupOtherInputs(Compaction* c);
 
+  //whc add
+  // Helpers of PickCompaction() returning NULL if every candidate
+  // overlaps a running compaction.
+  Compaction* PickBufferMerge();
+  Compaction* PickLevelCompaction(int level);
+  // Compaction of the newest level-0 files into level-0, or NULL if too
+  // few of them are free.
+  Compaction* PickIntraL0Compaction();
+  // Compaction of level-0 runs picked by Options::compaction_style
+  // kCompactionStyleUniversal, or NULL if none is due.
+  Compaction* PickUniversalCompaction();
+  // Store the level-0 files in *runs, newest first, and the numbers of
+  // those being compacted in *busy.  Returns false if the order of some
+  // file is unknown.
+  bool GetLevel0Runs(std::vector<FileMetaData*>* runs,
+                     std::set<uint64_t>* busy) const;
+  // Compaction of runs[start,end) into level-0
+  Compaction* NewIntraL0Compaction(const std::vector<FileMetaData*>& runs,
+                                   size_t start, size_t end);
+  Compaction* CompactionForFile(int level, FileMetaData* f);
+
+  // Range of keys held by f, a file of "level" in v, and its buffer
+  // nodes.  A node starting its source table has no lower bound but the
+  // previous file of the level; if f is the first one, *smallest is left
+  // empty, which stands for the beginning of the key space.
+  void GetFileRange(Version* v, int level, const FileMetaData* f,
+                    InternalKey* smallest, InternalKey* largest) const;
+
+  // Range of keys c reads or writes, buffer nodes included.
+  void GetCompactionRange(const Compaction* c,
+                          InternalKey* smallest, InternalKey* largest) const;
+
+  // Returns true iff a compaction of "level" over [smallest,largest]
+  // could touch a file or key range a running compaction works on.
+  // An empty smallest stands for the beginning of the key space.
+  bool OverlapsRunningCompaction(int level, const InternalKey& smallest,
+                                 const InternalKey& largest) const;
+
+  void RegisterCompaction(Compaction* c);
+
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
 
@@ -380,7 +603,7 @@ class VersionSet {
   //const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;  //whc change
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
 
@@ -398,6 +621,20 @@ class VersionSet {
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
 
+  //whc add
+  // Running compactions by level
+  std::set<Compaction*> running_compactions_[config::kNumLevels];
+
+  // See NeedsRangeDeletions()
+  bool range_deletions_pending_;
+
+  // See NumIntraL0Compactions()
+  int64_t intra_l0_compactions_;
+
+  // See NumBufferMerges() and NumBufferMergedFiles()
+  int64_t buffer_merges_[config::kNumLevels];
+  int64_t buffer_merged_files_[config::kNumLevels];
+
   // No copying allowed
   VersionSet(const VersionSet&);
   void operator=(const VersionSet&);
@@ -412,6 +649,16 @@ class Compaction {
   // and "level+1" will be merged to produce a set of "level+1" files.
   int level() const { return level_; }
 
+  //whc add
+  // Return the level the outputs are written to: "level" for buffer
+  // merges and intra level-0 compactions, "level+1" otherwise.
+  int output_level() const {
+    return (IsBufferCompact || intra_l0_) ? level_ : level_ + 1;
+  }
+
+  // Does this compaction merge the newest level-0 files into level-0?
+  bool IsIntraL0() const { return intra_l0_; }
+
   // Return the object that holds the edits to the descriptor done
   // by this compaction.
   VersionEdit* edit() { return &edit_; }
@@ -440,10 +687,36 @@ class Compaction {
   // in levels greater than "level+1".
   bool IsBaseLevelForKey(const Slice& user_key);
 
+  //whc add
+  // Same, but keeps its position in "level_ptrs" (config::kNumLevels
+  // entries, initially zero) so that each thread of a buffer merge can
+  // check its own keys in order.
+  bool IsBaseLevelForKey(const Slice& user_key, size_t* level_ptrs);
+
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
   bool ShouldStopBefore(const Slice& internal_key);
 
+  //whc add
+  // Position of ShouldStopBefore in the grandparent files
+  struct GrandparentState {
+    size_t grandparent_index;   // Index in grandparents_
+    bool seen_key;              // Some output key has been seen
+    int64_t overlapped_bytes;   // Bytes of overlap between current output
+                                // and grandparent files
+    GrandparentState()
+        : grandparent_index(0), seen_key(false), overlapped_bytes(0) { }
+  };
+
+  // Same, but keeps its position in "state" so that each subcompaction
+  // can check its own keys in order.
+  bool ShouldStopBefore(const Slice& internal_key, GrandparentState* state);
+
+  // Store in *splits up to "n"-1 user keys, in order, that cut the
+  // inputs into ranges (split[i-1], split[i]] of about the same number
+  // of input bytes.  Cuts fall on the largest keys of input files.
+  void GetSubcompactionSplits(int n, std::vector<std::string>* splits) const;
+
   // Release the input version for the compaction, once the compaction
   // is successful.
   void ReleaseInputs();
@@ -474,10 +747,7 @@ class Compaction {
   // State used to check for number of of overlapping grandparent files
   // (parent == level_ + 1, grandparent == level_ + 2)
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
+  GrandparentState grandparent_state_;
 
   // State for implementing IsBaseLevelForKey
 
@@ -487,6 +757,14 @@ class Compaction {
   // all L >= level_ + 2).
   size_t level_ptrs_[config::kNumLevels];
   Buffer* endbuffer;
+
+  //whc add
+  // Range of user keys the compaction works on, set while it is running
+  InternalKey smallest_;
+  InternalKey largest_;
+
+  bool intra_l0_;
+  bool includes_oldest_l0_;   // Intra level-0 inputs hold the oldest file
 };
 
 }  // namespace leveldb
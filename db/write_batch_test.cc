@@ -43,6 +43,17 @@ static std::string PrintContents(WriteBatch* b) {
     state.append(NumberToString(ikey.sequence));
   }
   delete iter;
+  std::vector<RangeTombstone> tombstones;
+  mem->GetRangeTombstones(kMaxSequenceNumber, &tombstones);
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    state.append("DeleteRange(");
+    state.append(tombstones[i].begin);
+    state.append(", ");
+    state.append(tombstones[i].end);
+    state.append(")@");
+    state.append(NumberToString(tombstones[i].sequence));
+    count++;
+  }
   if (!s.ok()) {
     state.append("ParseError()");
   } else if (count != WriteBatchInternal::Count(b)) {
@@ -74,6 +85,34 @@ TEST(WriteBatchTest, Multiple) {
             PrintContents(&batch));
 }
 
+TEST(WriteBatchTest, DeleteRange) {
+  WriteBatch batch;
+  batch.Put(Slice("foo"), Slice("bar"));
+  batch.DeleteRange(Slice("a"), Slice("g"));
+  batch.DeleteRange(Slice("b"), Slice("c"));
+  WriteBatchInternal::SetSequence(&batch, 100);
+  ASSERT_EQ(3, WriteBatchInternal::Count(&batch));
+  ASSERT_EQ("Put(foo, bar)@100"
+            "DeleteRange(a, g)@101"
+            "DeleteRange(b, c)@102",
+            PrintContents(&batch));
+
+  // Tombstones delete the older entries of their range only
+  InternalKeyComparator cmp(BytewiseComparator());
+  MemTable* mem = new MemTable(cmp);
+  mem->Ref();
+  ASSERT_OK(WriteBatchInternal::InsertInto(&batch, mem));
+  std::string value;
+  Status deleted, found;
+  ASSERT_TRUE(mem->Get(LookupKey("foo", 200), &value, &deleted));
+  ASSERT_TRUE(deleted.IsNotFound());
+  ASSERT_TRUE(mem->Get(LookupKey("foo", 100), &value, &found));
+  ASSERT_OK(found);
+  ASSERT_EQ("bar", value);
+  ASSERT_TRUE(!mem->Get(LookupKey("g", 200), &value, &found));
+  mem->Unref();
+}
+
 TEST(WriteBatchTest, Corruption) {
   WriteBatch batch;
   batch.Put(Slice("foo"), Slice("bar"));
@@ -0,0 +1,135 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include <stdio.h>
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+// The slowest pace is max_rate / kMinRateDivisor
+static const uint64_t kMinRateDivisor = 16;
+
+// Debt above the soft limit at which the slowest pace is reached, in
+// multiples of the soft limit
+static const uint64_t kDebtSpread = 3;
+
+// The bucket holds at most this many micros worth of tokens, so writes
+// pausing for a while do not come back in a burst
+static const uint64_t kMaxBurstMicros = 1000;
+
+WriteController::WriteController(uint64_t max_rate, uint64_t soft_debt_limit)
+    : max_rate_(max_rate),
+      soft_debt_limit_(soft_debt_limit),
+      level0_files_(0),
+      debt_(0),
+      rate_(0),
+      tokens_(0),
+      last_refill_(0),
+      delayed_writes_(0),
+      delayed_micros_(0) {
+}
+
+void WriteController::Update(uint64_t now_micros, int level0_files,
+                             uint64_t debt) {
+  level0_files_ = level0_files;
+  debt_ = debt;
+
+  // Pressure grows from 0, when writes start being delayed, to 1 right
+  // before level-0 stops them or at kDebtSpread soft limits past the
+  // soft limit
+  double pressure = -1;
+  if (level0_files >= config::kL0_SlowdownWritesTrigger) {
+    pressure = static_cast<double>(
+        level0_files - config::kL0_SlowdownWritesTrigger + 1) /
+        (config::kL0_StopWritesTrigger - config::kL0_SlowdownWritesTrigger + 1);
+  }
+  if (soft_debt_limit_ > 0 && debt >= soft_debt_limit_) {
+    const double p = static_cast<double>(debt - soft_debt_limit_) /
+                     (kDebtSpread * soft_debt_limit_);
+    if (p > pressure) pressure = p;
+  }
+
+  if (pressure < 0) {
+    rate_ = 0;
+    return;
+  }
+  if (pressure > 1) pressure = 1;
+  const uint64_t min_rate = max_rate_ / kMinRateDivisor;
+  uint64_t rate = max_rate_ - static_cast<uint64_t>(
+      (max_rate_ - min_rate) * pressure);
+  if (rate == 0) rate = 1;
+
+  if (rate_ == 0) {
+    // Start delaying with an empty bucket
+    tokens_ = 0;
+    last_refill_ = now_micros;
+  } else {
+    Refill(now_micros);
+  }
+  rate_ = rate;
+}
+
+bool WriteController::IsStopped() const {
+  return level0_files_ >= config::kL0_StopWritesTrigger;
+}
+
+void WriteController::Refill(uint64_t now_micros) {
+  if (now_micros > last_refill_) {
+    const uint64_t added = (now_micros - last_refill_) * rate_ / 1000000;
+    tokens_ += static_cast<int64_t>(added);
+    // Micros worth less than a byte are left for the next refill
+    last_refill_ += added * 1000000 / rate_;
+    const int64_t burst = static_cast<int64_t>(
+        rate_ * kMaxBurstMicros / 1000000);
+    if (tokens_ > burst) {
+      tokens_ = burst;
+      last_refill_ = now_micros;
+    }
+  }
+}
+
+uint64_t WriteController::GetDelay(uint64_t now_micros) {
+  if (rate_ == 0) {
+    return 0;
+  }
+  Refill(now_micros);
+  if (tokens_ >= 0) {
+    return 0;
+  }
+  // Micros until the bucket is paid back, rounded up
+  return (static_cast<uint64_t>(-tokens_) * 1000000 + rate_ - 1) / rate_;
+}
+
+void WriteController::Consume(uint64_t bytes) {
+  if (rate_ > 0) {
+    tokens_ -= static_cast<int64_t>(bytes);
+  }
+}
+
+void WriteController::RecordDelay(uint64_t micros) {
+  delayed_writes_++;
+  delayed_micros_ += micros;
+}
+
+std::string WriteController::DebugString() const {
+  char buf[300];
+  snprintf(buf, sizeof(buf),
+           "state: %s\n"
+           "rate(bytes/sec): %llu\n"
+           "level0-files: %d\n"
+           "compaction-debt(bytes): %llu\n"
+           "delayed-writes: %llu\n"
+           "delayed-micros: %llu\n",
+           IsStopped() ? "stopped" : (IsDelayed() ? "delayed" : "normal"),
+           static_cast<unsigned long long>(rate_),
+           level0_files_,
+           static_cast<unsigned long long>(debt_),
+           static_cast<unsigned long long>(delayed_writes_),
+           static_cast<unsigned long long>(delayed_micros_));
+  return buf;
+}
+
+}  // namespace leveldb
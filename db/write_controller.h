@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Paces writes while compactions fall behind.  A token bucket refilled at
+// a rate that drops as the compaction debt grows is drained by every
+// write group; a leader finding the bucket empty waits until it is paid
+// back.  Stalls at config::kL0_StopWritesTrigger are left to
+// DBImpl::MakeRoomForWrite.
+//
+// External synchronization: all calls are made under DBImpl::mutex_.
+
+#ifndef STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+#define STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+
+#include <string>
+#include <stdint.h>
+
+namespace leveldb {
+
+class WriteController {
+ public:
+  // Writes are delayed to at most "max_rate" bytes per second once there
+  // are config::kL0_SlowdownWritesTrigger level-0 files or
+  // "soft_debt_limit" bytes waiting to be compacted.
+  WriteController(uint64_t max_rate, uint64_t soft_debt_limit);
+
+  // Recompute the rate from the state of the current version.
+  void Update(uint64_t now_micros, int level0_files, uint64_t debt);
+
+  bool IsDelayed() const { return rate_ > 0; }
+  bool IsStopped() const;
+
+  // Return the micros a write group leader has to wait before writing,
+  // zero if the bucket holds enough tokens.
+  uint64_t GetDelay(uint64_t now_micros);
+
+  // Take the "bytes" of a write group out of the bucket.  The bucket may
+  // go into debt, which the next leader waits to be paid back.
+  void Consume(uint64_t bytes);
+
+  // Account for a delay a leader has waited.
+  void RecordDelay(uint64_t micros);
+
+  // Human readable state, see the "leveldb.write-controller" property.
+  std::string DebugString() const;
+
+ private:
+  void Refill(uint64_t now_micros);
+
+  const uint64_t max_rate_;
+  const uint64_t soft_debt_limit_;
+
+  // State of the current version
+  int level0_files_;
+  uint64_t debt_;
+
+  uint64_t rate_;          // Bytes per second, 0 while not delayed
+  int64_t tokens_;         // Bytes that may be written without waiting
+  uint64_t last_refill_;   // Micros of the last refill
+
+  // Statistics
+  uint64_t delayed_writes_;
+  uint64_t delayed_micros_;
+
+  // No copying allowed
+  WriteController(const WriteController&);
+  void operator=(const WriteController&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
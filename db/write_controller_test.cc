@@ -0,0 +1,95 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include "db/dbformat.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static const uint64_t kRate = 1 << 20;
+static const uint64_t kSoftLimit = 64 << 20;
+
+class WriteControllerTest {
+ public:
+  WriteController controller_;
+
+  WriteControllerTest() : controller_(kRate, kSoftLimit) { }
+
+  // Rate the controller paces writes to for "level0_files" and "debt"
+  static uint64_t RateFor(int level0_files, uint64_t debt) {
+    WriteController controller(kRate, kSoftLimit);
+    controller.Update(0, level0_files, debt);
+    if (!controller.IsDelayed()) {
+      return 0;
+    }
+    // Measure how long the bucket takes to pay back a second of writes
+    controller.Consume(kRate);
+    return kRate * 1000000 / controller.GetDelay(0);
+  }
+};
+
+TEST(WriteControllerTest, NotDelayedBelowTriggers) {
+  controller_.Update(0, config::kL0_SlowdownWritesTrigger - 1,
+                     kSoftLimit - 1);
+  ASSERT_TRUE(!controller_.IsDelayed());
+  ASSERT_TRUE(!controller_.IsStopped());
+  controller_.Consume(100 << 20);
+  ASSERT_EQ(0, controller_.GetDelay(0));
+}
+
+TEST(WriteControllerTest, RateDropsWithPressure) {
+  const uint64_t l0_first = RateFor(config::kL0_SlowdownWritesTrigger, 0);
+  const uint64_t l0_last = RateFor(config::kL0_StopWritesTrigger - 1, 0);
+  ASSERT_GT(l0_first, 0);
+  ASSERT_LE(l0_first, kRate);
+  ASSERT_GT(l0_first, l0_last);
+  ASSERT_GE(l0_last, kRate / 16);
+
+  const uint64_t debt_first = RateFor(0, kSoftLimit);
+  const uint64_t debt_mid = RateFor(0, 2 * kSoftLimit);
+  const uint64_t debt_max = RateFor(0, 100 * kSoftLimit);
+  ASSERT_EQ(kRate, debt_first);
+  ASSERT_GT(debt_first, debt_mid);
+  ASSERT_GT(debt_mid, debt_max);
+  ASSERT_EQ(kRate / 16, debt_max);
+
+  // The stronger of both pressures wins
+  ASSERT_EQ(debt_max, RateFor(config::kL0_SlowdownWritesTrigger,
+                              100 * kSoftLimit));
+
+  controller_.Update(0, config::kL0_StopWritesTrigger, 0);
+  ASSERT_TRUE(controller_.IsStopped());
+}
+
+TEST(WriteControllerTest, TokenBucket) {
+  controller_.Update(0, 0, kSoftLimit);
+  ASSERT_TRUE(controller_.IsDelayed());
+
+  // Starts empty: a write group of 1/4s worth of bytes delays the next
+  ASSERT_EQ(0, controller_.GetDelay(0));
+  controller_.Consume(kRate / 4);
+  ASSERT_EQ(250000, controller_.GetDelay(0));
+  const uint64_t delay = controller_.GetDelay(100000);
+  ASSERT_GE(delay, 150000);
+  ASSERT_LE(delay, 150001);
+  ASSERT_EQ(0, controller_.GetDelay(250000));
+
+  // Idle time does not build up a burst beyond a millisecond of writes
+  ASSERT_EQ(0, controller_.GetDelay(10000000));
+  controller_.Consume(kRate / 4);
+  ASSERT_GE(controller_.GetDelay(10000000), 249000);
+
+  // Back to normal
+  controller_.Update(10000000, 0, 0);
+  ASSERT_TRUE(!controller_.IsDelayed());
+  ASSERT_EQ(0, controller_.GetDelay(10000000));
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -197,6 +197,8 @@ extern void leveldb_options_set_info_log(leveldb_options_t*, leveldb_logger_t*);
 extern void leveldb_options_set_write_buffer_size(leveldb_options_t*, size_t);
 extern void leveldb_options_set_max_open_files(leveldb_options_t*, int);
 extern void leveldb_options_set_cache(leveldb_options_t*, leveldb_cache_t*);
+extern void leveldb_options_set_row_cache(leveldb_options_t*,
+                                          leveldb_cache_t*);
 extern void leveldb_options_set_block_size(leveldb_options_t*, size_t);
 extern void leveldb_options_set_block_restart_interval(leveldb_options_t*, int);
 
@@ -261,6 +263,8 @@ extern void leveldb_writeoptions_set_sync(
 /* Cache */
 
 extern leveldb_cache_t* leveldb_cache_create_lru(size_t capacity);
+extern leveldb_cache_t* leveldb_cache_create_clock(size_t capacity,
+                                                   int num_shard_bits);
 extern void leveldb_cache_destroy(leveldb_cache_t* cache);
 
 /* Env */
@@ -10,10 +10,10 @@
 // length strings, may use the length of the string as the charge for
 // the string.
 //
-// A builtin cache implementation with a least-recently-used eviction
-// policy is provided.  Clients may use their own implementations if
-// they want something more sophisticated (like scan-resistance, a
-// custom eviction policy, variable cache sizing, etc.)
+// Builtin cache implementations with a least-recently-used and with a
+// scan-resistant CLOCK eviction policy are provided.  Clients may use
+// their own implementations if they want something more sophisticated
+// (like a custom eviction policy, variable cache sizing, etc.)
 
 #ifndef STORAGE_LEVELDB_INCLUDE_CACHE_H_
 #define STORAGE_LEVELDB_INCLUDE_CACHE_H_
@@ -29,6 +29,15 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity split over
+// 2^num_shard_bits shards, or over a number of shards picked from the
+// capacity if num_shard_bits is negative.  This implementation runs a
+// CLOCK per shard, and a new entry must be hit again before it competes
+// with the frequently used ones, so that a scan touching each entry
+// once does not flush the cache.  Hits do not reorder entries and
+// Release() takes no lock.
+extern Cache* NewClockCache(size_t capacity, int num_shard_bits = -1);
+
 class Cache {
  public:
   Cache() { }
@@ -52,6 +61,13 @@ class Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  // Like Insert(), but the entry is worth more than the ones inserted
+  // by Insert() and should outlive them, e.g. because it is needed to
+  // find them.  The default implementation calls Insert().
+  virtual Handle* InsertHighPriority(
+      const Slice& key, void* value, size_t charge,
+      void (*deleter)(const Slice& key, void* value));
+
   // If the cache has no mapping for "key", returns NULL.
   //
   // Else return a handle that corresponds to the mapping.  The caller
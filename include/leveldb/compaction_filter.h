@@ -0,0 +1,67 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a CompactionFilter that is shown the
+// values rewritten by compactions and buffer merges.  It may keep a
+// value, replace it or remove it, so that expired or otherwise unwanted
+// data is garbage collected by I/O the database does anyway instead of
+// by a separate scan-and-delete pass.
+//
+// A filter only sees the newest value of each key that every snapshot
+// sees; deletions, older values and values newer than the oldest live
+// snapshot are left alone.  Reads keep returning a value the filter
+// would remove until a compaction actually meets it.
+//
+// Most people wanting to expire data will want to use the builtin TTL
+// filter (see NewTTLCompactionFilter() below).
+
+#ifndef STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+#define STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace leveldb {
+
+class Env;
+class Slice;
+
+class CompactionFilter {
+ public:
+  virtual ~CompactionFilter();
+
+  // Return the name of this filter.
+  virtual const char* Name() const = 0;
+
+  // Called for the value "existing_value" of "key" read from "level" by
+  // a compaction.  Return true to remove the key.  Otherwise the value is
+  // kept, unless the filter stores a replacement in *new_value and sets
+  // *value_changed to true.
+  //
+  // Compactions run on several threads at once, so this method must be
+  // thread-safe.
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const = 0;
+};
+
+// Append the write time "unix_seconds" to "value" in the form read by
+// the filter returned by NewTTLCompactionFilter().
+extern void AppendTTLTimestamp(std::string* value, uint64_t unix_seconds);
+
+// Return a new filter removing the values written more than
+// "ttl_seconds" ago.  Values must end with the time they were written,
+// see AppendTTLTimestamp(); shorter values are kept.  The current time
+// is read from "env", Env::Default() if NULL.  Values returned by reads
+// still carry their timestamp.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern const CompactionFilter* NewTTLCompactionFilter(uint64_t ttl_seconds,
+                                                      Env* env = NULL);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
@@ -7,6 +7,8 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
 
@@ -68,6 +70,14 @@ class DB {
   // Note: consider setting options.sync = true.
   virtual Status Delete(const WriteOptions& options, const Slice& key) = 0;
 
+  // Remove the database entries (if any) for the keys in [begin, end).
+  // Returns OK on success, and a non-OK status on error.  The entries are
+  // hidden at once and their space reclaimed by later compactions, which
+  // drop whole files the range covers without reading them.
+  // Note: consider setting options.sync = true.
+  virtual Status DeleteRange(const WriteOptions& options,
+                             const Slice& begin, const Slice& end) = 0;
+
   // Apply the specified updates to the database.
   // Returns OK on success, non-OK on failure.
   // Note: consider setting options.sync = true.
@@ -83,6 +93,15 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Look up each of "keys" like Get(), storing the value and status of
+  // keys[i] in (*values)[i] and (*statuses)[i].  All keys are read from
+  // the same state of the database, and keys stored close to each other
+  // share the lookup work.  Both vectors are resized to keys.size().
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -111,6 +130,17 @@ class DB {
   //
   //  "leveldb.num-files-at-level<N>" - return the number of files at level <N>,
   //     where <N> is an ASCII representation of a level number (e.g. "0").
+  //  "leveldb.num-buffer-nodes-at-level<N>" - return the number of buffer
+  //     nodes held by the files at level <N>.
+  //  "leveldb.buffer-table-bytes-at-level<N>" - return the combined size of
+  //     the source tables read by the buffer nodes at level <N>.
+  //  "leveldb.num-buffer-merges-at-level<N>" - return the number of buffer
+  //     merges picked at level <N> since the DB was opened.
+  //  "leveldb.num-buffer-merged-files-at-level<N>" - return the number of
+  //     files those buffer merges covered.
+  //  "leveldb.write-controller" - returns a multi-line string with the
+  //     state and rate of write pacing, the compaction debt and the time
+  //     writes have been delayed (see Options::delayed_write_rate).
   //  "leveldb.stats" - returns a multi-line string that describes statistics
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
@@ -140,6 +140,11 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Make at least "number" threads available to run the functions passed
+  // to Schedule().  Never shrinks the pool.  The default implementation
+  // does nothing, so those functions may all run on one thread.
+  virtual void SetBackgroundThreads(int number);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -327,6 +332,9 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void SetBackgroundThreads(int number) {
+    return target_->SetBackgroundThreads(number);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
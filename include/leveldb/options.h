@@ -6,14 +6,18 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <stddef.h>
+#include <string>
+#include <vector>
 
 namespace leveldb {
 
 class Cache;
+class CompactionFilter;
 class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class RateLimiter;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -27,6 +31,21 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+//whc add
+// How background compactions shape the levels.
+enum CompactionStyle {
+  // Each level holds one sorted run, kept under a size limit by merging
+  // its files into the next level.
+  kCompactionStyleLevel = 0,
+
+  // Every level-0 file is a sorted run.  Runs of similar size are merged
+  // into one level-0 file, and all of them once the newer runs take too
+  // much space next to the oldest.  Entries are rewritten far less often
+  // than with leveled compaction, at the cost of more space and of more
+  // files probed by lookups.
+  kCompactionStyleUniversal = 1
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct Options {
   // -------------------
@@ -94,9 +113,29 @@ struct Options {
 
   // If non-NULL, use the specified cache for blocks.
   // If NULL, leveldb will automatically create and use an 8MB internal cache.
+  // Set it to NewClockCache() for a cache that scans do not flush.
   // Default: NULL
   Cache* block_cache;
 
+  //whc add
+  // If true, the index and filter blocks of tables read into heap memory
+  // are kept in block_cache at high priority and charged to it, rather
+  // than held by the open tables.  Tables of levels 0 and 1 keep theirs
+  // pinned in the cache while open.  Blocks read through mmap cost no
+  // heap and stay with their table.
+  // Default: false
+  bool cache_index_and_filter_blocks;
+
+  //whc add
+  // If non-NULL, use the specified cache for the results of point
+  // lookups in table files, keyed by file and user key.  A hit skips the
+  // index, filter and data blocks of the file.  Charged by the bytes of
+  // key and value; a cache of NewLRUCache(size) or NewClockCache(size)
+  // fits.  Only lookups at or above the newest sequence number of a
+  // file use it, which covers reads without a snapshot.
+  // Default: NULL
+  Cache* row_cache;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -161,6 +200,117 @@ struct Options {
   // sizeof(level1)
   // Default: 10*1024*1024
   double top_level_size;
+
+  // If bit i is set, compactions out of level i dispatch their input
+  // files as buffer nodes into the overlapping files of level i+1
+  // instead of merging with them.  Level-0 and the last level always
+  // merge.
+  // Default: 0 (leveled merging on every level)
+  int buffer_compact_levels;
+
+  // A file of level i that holds buffer nodes is merged with them once
+  // it has buffer_merge_threshold[i] nodes, unless it is rarely read, in
+  // which case it waits until it has twice as many.  Files read often
+  // enough to pay for the merge are merged earlier.  Levels without an
+  // entry use a threshold of 5.
+  // Default: empty
+  std::vector<int> buffer_merge_threshold;
+
+  // Maximum number of threads merging files with their buffers at the
+  // same time.  Each file is merged by a single thread and all results
+  // are installed together.
+  // Default: 4
+  int max_buffer_merge_threads;
+
+  // Directory of the fast (SSD) tier.  Tables of levels below ssd_levels
+  // and the source tables read by buffer nodes live there, the other
+  // tables in the DB directory.  Compactions write their outputs to the
+  // tier of their output level.  Changing it for an existing DB is not
+  // supported.
+  // Default: empty (every table in the DB directory)
+  std::string ssd_path;
+
+  // Env used for the files under ssd_path.  If NULL, env is used.
+  // Default: NULL
+  Env* ssd_env;
+
+  // Number of levels, from level-0 down, kept on the fast tier.
+  // Default: 3
+  int ssd_levels;
+
+  // Part of max_open_files used by the table cache of the fast tier.
+  // Default: 200
+  int ssd_max_open_files;
+
+  // Maximum number of compactions, dispatches and buffer merges running
+  // at the same time on env's background threads.  Jobs running together
+  // never share a key range on neighbouring levels.  Memtable flushes get
+  // a background thread of their own on top of these.
+  // Default: 1
+  int max_background_compactions;
+
+  // Maximum number of threads a compaction into the next level splits its
+  // key range over.  Ranges are cut at input file boundaries, each is
+  // merged by its own thread and all outputs are installed together.
+  // Default: 1
+  int max_subcompactions;
+
+  // Once level-0 reaches its slowdown trigger or compactions fall
+  // soft_pending_compaction_bytes_limit bytes behind, writes are paced to
+  // at most delayed_write_rate bytes per second.  The pace drops smoothly
+  // to a sixteenth of that as the backlog grows, instead of stalling
+  // writes when level-0 is full.  The state is reported by the
+  // "leveldb.write-controller" property.
+  // Default: 16MB
+  size_t delayed_write_rate;
+
+  // Default: 64MB; 0 paces on level-0 files only
+  size_t soft_pending_compaction_bytes_limit;
+
+  // If non-NULL, memtable flushes, compactions, dispatches and buffer
+  // merges request the bytes they read and write from this limiter, with
+  // flushes served first.  Writes reported as stalled by the write
+  // controller above let an auto-tuned limiter speed up.  See
+  // NewGenericRateLimiter().
+  // Default: NULL
+  RateLimiter* rate_limiter;
+
+  // Number of threads compressing and checksumming the data blocks of
+  // each table being built while the thread adding entries goes on.
+  // Blocks are still written in order by that thread.  0 compresses
+  // blocks inline.
+  // Default: 0
+  int block_compression_threads;
+
+  // If non-zero, compactions and buffer merges read their inputs on a
+  // thread of their own, up to this many bytes ahead of the merge.
+  // Default: 0
+  size_t compaction_readahead_size;
+
+  // If non-NULL, compactions and buffer merges pass the values they
+  // rewrite through this filter, which may remove or replace them.  See
+  // include/leveldb/compaction_filter.h.
+  // Default: NULL
+  const CompactionFilter* compaction_filter;
+
+  // Default: kCompactionStyleLevel
+  CompactionStyle compaction_style;
+
+  // Universal compaction merges the newest runs that are, each, at most
+  // this percentage larger than the runs newer than them together.
+  // Default: 1
+  int universal_size_ratio;
+
+  // Least number of runs a universal compaction merges.
+  // Default: 2
+  int universal_min_merge_width;
+
+  // Once the runs newer than the oldest take more than this percentage of
+  // its size, universal compaction merges every run into one.  Files of
+  // levels above level-0, written by CompactRange(), count with the
+  // oldest run.
+  // Default: 200
+  int universal_max_size_amplification_percent;
   
   
   // Create an Options object with default values for all fields.
@@ -0,0 +1,60 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a RateLimiter that bounds the disk
+// bandwidth of its background work.  Memtable flushes, compactions,
+// dispatches and buffer merges request the bytes they are about to read
+// or write and wait until they are granted, so that foreground reads and
+// log writes are not starved by bursts of background I/O.  A single
+// RateLimiter may be shared by several databases on the same disk.
+//
+// Most people will want to use the builtin token bucket (see
+// NewGenericRateLimiter() below).
+
+#ifndef STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace leveldb {
+
+class RateLimiter {
+ public:
+  enum IOPriority {
+    kIOLow = 0,     // Compactions, dispatches and buffer merges
+    kIOHigh = 1,    // Memtable flushes, which writers may be waiting for
+    kNumPriorities = 2
+  };
+
+  virtual ~RateLimiter();
+
+  // Block until "bytes" may be read or written at priority "pri".
+  // Pending high priority requests are granted first.
+  virtual void Request(size_t bytes, IOPriority pri) = 0;
+
+  // Called by a database whose writes were delayed or stopped because
+  // background work fell behind.  Auto-tuned limiters raise their rate.
+  virtual void ReportWriteStall() { }
+
+  // Current limit in bytes per second.
+  virtual int64_t GetBytesPerSecond() const = 0;
+
+  // Total bytes granted at priority "pri".
+  virtual int64_t GetTotalBytesThrough(IOPriority pri) const = 0;
+};
+
+// Return a new token bucket allowing "bytes_per_second" of background
+// I/O.  If "auto_tuned" is true, "bytes_per_second" is an upper bound:
+// the limit starts at a sixteenth of it, grows while databases report
+// write stalls and slowly falls back once they stop.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern RateLimiter* NewGenericRateLimiter(int64_t bytes_per_second,
+                                          bool auto_tuned = false);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
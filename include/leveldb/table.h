@@ -6,12 +6,14 @@
 #define STORAGE_LEVELDB_INCLUDE_TABLE_H_
 
 #include <stdint.h>
+#include "leveldb/cache.h"
 #include "leveldb/iterator.h"
 
 namespace leveldb {
 
 class Block;
 class BlockHandle;
+class FilterBlockReader;
 class Footer;
 struct Options;
 class RandomAccessFile;
@@ -35,10 +37,16 @@ class Table {
   // for the duration of the returned table's lifetime.
   //
   // *file must remain live while this Table is in use.
+  //
+  //whc change
+  // If options.cache_index_and_filter_blocks and "pin_metadata" are set,
+  // the index and filter blocks stay pinned in the block cache for the
+  // lifetime of the table.
   static Status Open(const Options& options,
                      RandomAccessFile* file,
                      uint64_t file_size,
-                     Table** table);
+                     Table** table,
+                     bool pin_metadata = false);
 
   ~Table();
 
@@ -71,10 +79,30 @@ class Table {
       void* arg,
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
+  //whc add
+  // Like InternalGet() for each of the "n" keys of "keys", which are
+  // sorted by the table's comparator, calling (*handle_result)(args[i],
+  // ...) and storing the status of the lookup in statuses[i].  All
+  // filter checks run off one index seek per key, and keys falling into
+  // the same block share one read of it.
+  void InternalMultiGet(
+      const ReadOptions&, int n, const Slice* keys, void* const* args,
+      Status* statuses,
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
 
+  //whc add
+  // Return an iterator over the index block, reading it back into the
+  // block cache if it was evicted from there.
+  Iterator* NewIndexIterator() const;
+
+  // Return the filter, or NULL if there is none or it cannot be read.
+  // If the filter lives in the block cache, "*handle" is set to the
+  // handle to release once done with it, else to NULL.
+  FilterBlockReader* GetFilter(Cache::Handle** handle) const;
+
   // No copying allowed
   Table(const Table&);
   void operator=(const Table&);
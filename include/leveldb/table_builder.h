@@ -78,6 +78,17 @@ class TableBuilder {
   bool ok() const { return status().ok(); }
   void WriteBlock(BlockBuilder* block, BlockHandle* handle);
   void WriteRawBlock(const Slice& data, CompressionType, BlockHandle* handle);
+  void WriteBlockContents(const Slice& data, const char* trailer,
+                          BlockHandle* handle);
+
+  // Hand data_block to the compression threads, see
+  // Options::block_compression_threads
+  void QueueBlock();
+  // Write compressed blocks in order until at most "max_pending" are left
+  void WriteBackBlocks(size_t max_pending);
+  void StopCompressionThreads();
+  static void CompressionWork(void* arg);
+  struct PendingBlock;
 
   struct Rep;
   Rep* rep_;
@@ -39,6 +39,10 @@ class WriteBatch {
   // If the database contains a mapping for "key", erase it.  Else do nothing.
   void Delete(const Slice& key);
 
+  // Erase the mappings of all keys in ["begin", "end"), if any.  Keys
+  // are ordered by the database's comparator.
+  void DeleteRange(const Slice& begin, const Slice& end);
+
   // Clear all updates buffered in this batch.
   void Clear();
 
@@ -48,6 +52,8 @@ class WriteBatch {
     virtual ~Handler();
     virtual void Put(const Slice& key, const Slice& value) = 0;
     virtual void Delete(const Slice& key) = 0;
+    // The default implementation ignores range deletions.
+    virtual void DeleteRange(const Slice& begin, const Slice& end);
   };
   Status Iterate(Handler* handler) const;
 
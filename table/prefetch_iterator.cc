@@ -0,0 +1,226 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/prefetch_iterator.h"
+
+#include <assert.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+// Entries copied out of the source iterator
+struct Batch {
+  struct Entry {
+    size_t offset;        // Of the key in data, the value follows it
+    size_t key_size;
+    size_t value_size;
+  };
+  std::string data;
+  std::vector<Entry> entries;
+
+  void Add(const Slice& key, const Slice& value) {
+    Entry e;
+    e.offset = data.size();
+    e.key_size = key.size();
+    e.value_size = value.size();
+    data.append(key.data(), key.size());
+    data.append(value.data(), value.size());
+    entries.push_back(e);
+  }
+};
+
+class PrefetchingIterator : public Iterator {
+ public:
+  PrefetchingIterator(Iterator* iter, Env* env, size_t readahead_bytes)
+      : iter_(iter),
+        env_(env),
+        readahead_bytes_(readahead_bytes),
+        batch_bytes_(readahead_bytes / 4 > 4096 ? readahead_bytes / 4 : 4096),
+        cv_(&mu_),
+        ready_bytes_(0),
+        running_(false),
+        stop_(false),
+        current_(NULL),
+        index_(0) {
+  }
+
+  virtual ~PrefetchingIterator() {
+    Stop();
+    delete current_;
+    delete iter_;
+  }
+
+  virtual bool Valid() const {
+    return current_ != NULL;
+  }
+  virtual Slice key() const {
+    assert(Valid());
+    const Batch::Entry& e = current_->entries[index_];
+    return Slice(current_->data.data() + e.offset, e.key_size);
+  }
+  virtual Slice value() const {
+    assert(Valid());
+    const Batch::Entry& e = current_->entries[index_];
+    return Slice(current_->data.data() + e.offset + e.key_size, e.value_size);
+  }
+  virtual Status status() const {
+    MutexLock l(&mu_);
+    return status_;
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    index_++;
+    if (index_ < current_->entries.size()) {
+      return;
+    }
+    delete current_;
+    current_ = NULL;
+    index_ = 0;
+    MutexLock l(&mu_);
+    while (ready_.empty() && running_) {
+      cv_.Wait();
+    }
+    if (!ready_.empty()) {
+      current_ = ready_.front();
+      ready_.pop_front();
+      ready_bytes_ -= current_->data.size();
+      cv_.SignalAll();  // Room for another batch
+    }
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    const std::string k = key().ToString();
+    Stop();
+    iter_->Seek(k);
+    if (iter_->Valid()) {
+      iter_->Prev();
+    }
+    Restart();
+  }
+  virtual void Seek(const Slice& target) {
+    Stop();
+    iter_->Seek(target);
+    Restart();
+  }
+  virtual void SeekToFirst() {
+    Stop();
+    iter_->SeekToFirst();
+    Restart();
+  }
+  virtual void SeekToLast() {
+    Stop();
+    iter_->SeekToLast();
+    Restart();
+  }
+
+ private:
+  // Wait for the read-ahead thread to exit and drop what it read
+  void Stop() {
+    MutexLock l(&mu_);
+    stop_ = true;
+    cv_.SignalAll();
+    while (running_) {
+      cv_.Wait();
+    }
+    stop_ = false;
+    while (!ready_.empty()) {
+      delete ready_.front();
+      ready_.pop_front();
+    }
+    ready_bytes_ = 0;
+  }
+
+  // Yield the entry iter_ is positioned at and read on from there
+  void Restart() {
+    delete current_;
+    current_ = NULL;
+    index_ = 0;
+    MutexLock l(&mu_);
+    status_ = iter_->status();
+    if (iter_->Valid()) {
+      current_ = new Batch;
+      current_->Add(iter_->key(), iter_->value());
+      running_ = true;
+      env_->StartThread(&PrefetchingIterator::ReadAheadWork, this);
+    }
+  }
+
+  static void ReadAheadWork(void* arg) {
+    reinterpret_cast<PrefetchingIterator*>(arg)->ReadAhead();
+  }
+
+  void ReadAhead() {
+    Batch* batch = new Batch;
+    bool valid = true;
+    while (valid) {
+      iter_->Next();
+      valid = iter_->Valid();
+      if (valid) {
+        batch->Add(iter_->key(), iter_->value());
+        if (batch->data.size() < batch_bytes_) {
+          continue;
+        }
+      }
+
+      // Hand the batch over once it is full or the input ends
+      MutexLock l(&mu_);
+      while (ready_bytes_ >= readahead_bytes_ && !stop_) {
+        cv_.Wait();
+      }
+      if (stop_) {
+        break;
+      }
+      if (!batch->entries.empty()) {
+        ready_bytes_ += batch->data.size();
+        ready_.push_back(batch);
+        batch = new Batch;
+        cv_.SignalAll();
+      }
+    }
+    delete batch;
+
+    MutexLock l(&mu_);
+    if (!valid) {
+      status_ = iter_->status();
+    }
+    running_ = false;
+    cv_.SignalAll();
+  }
+
+  Iterator* const iter_;    // Used by the read-ahead thread while running_
+  Env* const env_;
+  const size_t readahead_bytes_;
+  const size_t batch_bytes_;
+
+  mutable port::Mutex mu_;
+  port::CondVar cv_;
+  std::deque<Batch*> ready_;  // Batches read ahead, in order
+  size_t ready_bytes_;
+  bool running_;              // The read-ahead thread has not exited
+  bool stop_;                 // The read-ahead thread should exit
+  Status status_;
+
+  // Owned by the caller's thread
+  Batch* current_;
+  size_t index_;
+};
+
+}  // namespace
+
+Iterator* NewPrefetchingIterator(Iterator* iter, Env* env,
+                                 size_t readahead_bytes) {
+  return new PrefetchingIterator(iter, env, readahead_bytes);
+}
+
+}  // namespace leveldb
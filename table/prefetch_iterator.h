@@ -0,0 +1,28 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_PREFETCH_ITERATOR_H_
+#define STORAGE_LEVELDB_TABLE_PREFETCH_ITERATOR_H_
+
+#include <stddef.h>
+
+namespace leveldb {
+
+class Env;
+class Iterator;
+
+// Return an iterator yielding the entries of "iter", which a thread
+// started through "env" reads ahead, copying up to "readahead_bytes" of
+// keys and values, so that reading and decompressing blocks overlaps
+// with the work of the caller.  Takes ownership of "iter", which must
+// not be shared with other threads.
+//
+// Meant for forward scans: every positioning call other than Next()
+// stops the read-ahead thread and starts it again.
+extern Iterator* NewPrefetchingIterator(Iterator* iter, Env* env,
+                                        size_t readahead_bytes);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_PREFETCH_ITERATOR_H_
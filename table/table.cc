@@ -19,10 +19,19 @@
 namespace leveldb {
 
 struct Table::Rep {
+  //whc change
   ~Rep() {
-    delete filter;
-    delete [] filter_data;
-    delete index_block;
+    if (filter_cache_handle != NULL) {
+      options.block_cache->Release(filter_cache_handle);
+    } else {
+      delete filter;
+      delete [] filter_data;
+    }
+    if (index_cache_handle != NULL) {
+      options.block_cache->Release(index_cache_handle);
+    } else {
+      delete index_block;
+    }
   }
 
   Options options;
@@ -34,12 +43,63 @@ struct Table::Rep {
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+
+  //whc add
+  // With Options::cache_index_and_filter_blocks the index block and the
+  // filter may live in the block cache, keyed like data blocks by their
+  // offset.  index_block and filter are then NULL, unless the table pins
+  // them through the cache handles below.
+  BlockHandle index_handle;
+  BlockHandle filter_handle;
+  bool index_in_cache;
+  bool filter_in_cache;
+  bool pin_metadata;
+  Cache::Handle* index_cache_handle;
+  Cache::Handle* filter_cache_handle;
 };
 
+static void DeleteBlock(void* arg, void* ignored) {
+  delete reinterpret_cast<Block*>(arg);
+}
+
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  Block* block = reinterpret_cast<Block*>(value);
+  delete block;
+}
+
+static void ReleaseBlock(void* arg, void* h) {
+  Cache* cache = reinterpret_cast<Cache*>(arg);
+  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
+  cache->Release(handle);
+}
+
+//whc add
+// A filter kept in the block cache, owning the filter data
+struct CachedFilter {
+  FilterBlockReader* reader;
+  const char* data;
+};
+
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  CachedFilter* filter = reinterpret_cast<CachedFilter*>(value);
+  delete filter->reader;
+  delete[] filter->data;
+  delete filter;
+}
+
+// Key of the block at "offset" of the table with "cache_id" in the
+// block cache, stored in buf[0..15]
+static Slice BlockCacheKey(uint64_t cache_id, uint64_t offset, char* buf) {
+  EncodeFixed64(buf, cache_id);
+  EncodeFixed64(buf+8, offset);
+  return Slice(buf, 16);
+}
+
 Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
-                   Table** table) {
+                   Table** table,
+                   bool pin_metadata) {
   *table = NULL;
   if (size < Footer::kEncodedLength) {
     return Status::Corruption("file is too short to be an sstable");
@@ -80,6 +140,30 @@ Status Table::Open(const Options& options,
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = NULL;
     rep->filter = NULL;
+    //whc add
+    rep->index_handle = footer.index_handle();
+    rep->index_in_cache = false;
+    rep->filter_in_cache = false;
+    rep->pin_metadata = pin_metadata;
+    rep->index_cache_handle = NULL;
+    rep->filter_cache_handle = NULL;
+    // Blocks that are not on the heap may point into a mapping of the
+    // file, which must not outlive the table
+    Cache* cache = options.block_cache;
+    if (options.cache_index_and_filter_blocks && cache != NULL &&
+        contents.heap_allocated) {
+      char buf[16];
+      Cache::Handle* handle = cache->InsertHighPriority(
+          BlockCacheKey(rep->cache_id, rep->index_handle.offset(), buf),
+          index_block, index_block->size(), &DeleteCachedBlock);
+      rep->index_in_cache = true;
+      if (pin_metadata) {
+        rep->index_cache_handle = handle;
+      } else {
+        cache->Release(handle);
+        rep->index_block = NULL;
+      }
+    }
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   } else {
@@ -136,6 +220,28 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
     return;
   }
+  //whc change
+  Cache* cache = rep_->options.block_cache;
+  if (rep_->options.cache_index_and_filter_blocks && cache != NULL &&
+      block.heap_allocated) {
+    CachedFilter* filter = new CachedFilter;
+    filter->reader =
+        new FilterBlockReader(rep_->options.filter_policy, block.data);
+    filter->data = block.data.data();
+    char buf[16];
+    Cache::Handle* handle = cache->InsertHighPriority(
+        BlockCacheKey(rep_->cache_id, filter_handle.offset(), buf),
+        filter, block.data.size(), &DeleteCachedFilter);
+    rep_->filter_handle = filter_handle;
+    rep_->filter_in_cache = true;
+    if (rep_->pin_metadata) {
+      rep_->filter_cache_handle = handle;
+      rep_->filter = filter->reader;
+    } else {
+      cache->Release(handle);
+    }
+    return;
+  }
   if (block.heap_allocated) {
     rep_->filter_data = block.data.data();     // Will need to delete later
   }
@@ -146,21 +252,6 @@ Table::~Table() {
   delete rep_;
 }
 
-static void DeleteBlock(void* arg, void* ignored) {
-  delete reinterpret_cast<Block*>(arg);
-}
-
-static void DeleteCachedBlock(const Slice& key, void* value) {
-  Block* block = reinterpret_cast<Block*>(value);
-  delete block;
-}
-
-static void ReleaseBlock(void* arg, void* h) {
-  Cache* cache = reinterpret_cast<Cache*>(arg);
-  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
-  cache->Release(handle);
-}
-
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
@@ -219,9 +310,76 @@ Iterator* Table::BlockReader(void* arg,
   return iter;
 }
 
+//whc add
+Iterator* Table::NewIndexIterator() const {
+  if (rep_->index_block != NULL) {
+    return rep_->index_block->NewIterator(rep_->options.comparator);
+  }
+  assert(rep_->index_in_cache);
+  Cache* cache = rep_->options.block_cache;
+  char buf[16];
+  Slice key = BlockCacheKey(rep_->cache_id, rep_->index_handle.offset(), buf);
+  Cache::Handle* handle = cache->Lookup(key);
+  Block* block;
+  if (handle != NULL) {
+    block = reinterpret_cast<Block*>(cache->Value(handle));
+  } else {
+    ReadOptions opt;
+    if (rep_->options.paranoid_checks) {
+      opt.verify_checksums = true;
+    }
+    BlockContents contents;
+    Status s = ReadBlock(rep_->file, opt, rep_->index_handle, &contents);
+    if (!s.ok()) {
+      return NewErrorIterator(s);
+    }
+    block = new Block(contents);
+    if (!contents.heap_allocated) {
+      Iterator* iter = block->NewIterator(rep_->options.comparator);
+      iter->RegisterCleanup(&DeleteBlock, block, NULL);
+      return iter;
+    }
+    handle = cache->InsertHighPriority(key, block, block->size(),
+                                       &DeleteCachedBlock);
+  }
+  Iterator* iter = block->NewIterator(rep_->options.comparator);
+  iter->RegisterCleanup(&ReleaseBlock, cache, handle);
+  return iter;
+}
+
+FilterBlockReader* Table::GetFilter(Cache::Handle** handle) const {
+  *handle = NULL;
+  if (!rep_->filter_in_cache || rep_->filter != NULL) {
+    return rep_->filter;
+  }
+  Cache* cache = rep_->options.block_cache;
+  char buf[16];
+  Slice key = BlockCacheKey(rep_->cache_id, rep_->filter_handle.offset(),
+                            buf);
+  *handle = cache->Lookup(key);
+  if (*handle == NULL) {
+    ReadOptions opt;
+    if (rep_->options.paranoid_checks) {
+      opt.verify_checksums = true;
+    }
+    BlockContents block;
+    if (!ReadBlock(rep_->file, opt, rep_->filter_handle, &block).ok() ||
+        !block.heap_allocated) {
+      return NULL;  // Lookups go without the filter
+    }
+    CachedFilter* filter = new CachedFilter;
+    filter->reader =
+        new FilterBlockReader(rep_->options.filter_policy, block.data);
+    filter->data = block.data.data();
+    *handle = cache->InsertHighPriority(key, filter, block.data.size(),
+                                        &DeleteCachedFilter);
+  }
+  return reinterpret_cast<CachedFilter*>(cache->Value(*handle))->reader;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
   return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
+      NewIndexIterator(),
       &Table::BlockReader, const_cast<Table*>(this), options);
 }
 
@@ -229,11 +387,12 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter = NewIndexIterator();  //whc change
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
+    Cache::Handle* filter_cache_handle;
+    FilterBlockReader* filter = GetFilter(&filter_cache_handle);
     BlockHandle handle;
     
     //whc add
@@ -256,6 +415,9 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
       s = block_iter->status();
       delete block_iter;
     }
+    if (filter_cache_handle != NULL) {
+      rep_->options.block_cache->Release(filter_cache_handle);
+    }
   }
   if (s.ok()) {
     s = iiter->status();
@@ -264,10 +426,51 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
   return s;
 }
 
+//whc add
+void Table::InternalMultiGet(const ReadOptions& options, int n,
+                             const Slice* keys, void* const* args,
+                             Status* statuses,
+                             void (*saver)(void*, const Slice&, const Slice&)) {
+  Iterator* iiter = NewIndexIterator();
+  Cache::Handle* filter_cache_handle;
+  FilterBlockReader* filter = GetFilter(&filter_cache_handle);
+  Iterator* block_iter = NULL;
+  uint64_t block_offset = 0;  // Of the block read by block_iter
+  for (int i = 0; i < n; i++) {
+    const Slice& k = keys[i];
+    statuses[i] = Status::OK();
+    iiter->Seek(k);
+    if (!iiter->Valid()) {
+      statuses[i] = iiter->status();
+      continue;
+    }
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    const bool decoded = handle.DecodeFrom(&handle_value).ok();
+    if (filter != NULL && decoded &&
+        !filter->KeyMayMatch(handle.offset(), k)) {
+      continue;  // Not found
+    }
+    if (block_iter == NULL || !decoded || handle.offset() != block_offset) {
+      delete block_iter;
+      block_iter = BlockReader(this, options, iiter->value());
+      block_offset = decoded ? handle.offset() : ~static_cast<uint64_t>(0);
+    }
+    block_iter->Seek(k);
+    if (block_iter->Valid()) {
+      (*saver)(args[i], block_iter->key(), block_iter->value());
+    }
+    statuses[i] = block_iter->status();
+  }
+  delete block_iter;
+  delete iiter;
+  if (filter_cache_handle != NULL) {
+    rep_->options.block_cache->Release(filter_cache_handle);
+  }
+}
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator();  //whc change
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -5,6 +5,8 @@
 #include "leveldb/table_builder.h"
 
 #include <assert.h>
+#include <deque>
+#include <vector>
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
@@ -12,12 +14,62 @@
 #include "table/block_builder.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "port/port.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/mutexlock.h"
 #include <iostream>
 
 namespace leveldb {
 
+//whc add
+// A data block handed to the compression threads
+struct TableBuilder::PendingBlock {
+  std::string raw;
+  CompressionType type;
+  std::vector<std::string> filter_keys;  // Keys to add to the filter
+  std::string index_key;                 // Key of its index entry
+  bool has_index_key;                    // Set once the next key is seen
+
+  // Filled in by a compression thread
+  std::string compressed;
+  bool use_compressed;
+  char trailer[kBlockTrailerSize];
+  bool done;
+
+  PendingBlock() : has_index_key(false), use_compressed(false), done(false) { }
+};
+
+// Compress "raw" into *compressed if "type" asks for it and it pays off.
+// Returns the type the block is stored with.
+static CompressionType CompressBlock(const Slice& raw, CompressionType type,
+                                     std::string* compressed) {
+  // TODO(postrelease): Support more compression options: zlib?
+  switch (type) {
+    case kNoCompression:
+      break;
+
+    case kSnappyCompression: {
+      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
+          compressed->size() < raw.size() - (raw.size() / 8u)) {
+        return kSnappyCompression;
+      }
+      // Snappy not supported, or compressed less than 12.5%, so just
+      // store uncompressed form
+      break;
+    }
+  }
+  return kNoCompression;
+}
+
+static void EncodeBlockTrailer(const Slice& block_contents,
+                               CompressionType type, char* trailer) {
+  trailer[0] = type;
+  uint32_t crc = crc32c::Value(block_contents.data(), block_contents.size());
+  crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
+  EncodeFixed32(trailer+1, crc32c::Mask(crc));
+}
+
 struct TableBuilder::Rep {
   Options options;
   Options index_block_options;
@@ -45,6 +97,20 @@ struct TableBuilder::Rep {
 
   std::string compressed_output;
 
+  //whc add
+  // Data blocks are compressed and checksummed by up to
+  // options.block_compression_threads threads and written back in file
+  // order by the thread calling Add() and Finish().
+  port::Mutex mu;
+  port::CondVar work_cv;   // A block was queued or threads should exit
+  port::CondVar done_cv;   // A block was compressed or a thread exited
+  std::deque<PendingBlock*> pending;      // Blocks not written yet, in order
+  std::deque<PendingBlock*> to_compress;  // Protected by mu
+  int threads;                            // Protected by mu
+  bool shutting_down;                     // Protected by mu
+  uint64_t pending_bytes;                 // Raw bytes of pending blocks
+  std::vector<std::string> block_keys;    // Filter keys of data_block
+
   Rep(const Options& opt, WritableFile* f)
       : options(opt),
         index_block_options(opt),
@@ -56,9 +122,16 @@ struct TableBuilder::Rep {
         closed(false),
         filter_block(opt.filter_policy == NULL ? NULL
                      : new FilterBlockBuilder(opt.filter_policy)),
-        pending_index_entry(false) {
+        pending_index_entry(false),
+        work_cv(&mu),
+        done_cv(&mu),
+        threads(0),
+        shutting_down(false),
+        pending_bytes(0) {
     index_block_options.block_restart_interval = 1;
   }
+
+  bool parallel() const { return options.block_compression_threads > 0; }
 };
 
 TableBuilder::TableBuilder(const Options& options, WritableFile* file)
@@ -81,6 +154,12 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  //whc add
+  if (options.block_compression_threads !=
+      rep_->options.block_compression_threads) {
+    return Status::InvalidArgument(
+        "changing block_compression_threads while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -101,14 +180,28 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
     r->options.comparator->FindShortestSeparator(&r->last_key, key);
-    std::string handle_encoding;
-    r->pending_handle.EncodeTo(&handle_encoding);
-    r->index_block.Add(r->last_key, Slice(handle_encoding));
+    //whc change
+    if (r->parallel()) {
+      // Added to the index block once the block is written
+      PendingBlock* b = r->pending.back();
+      b->index_key = r->last_key;
+      b->has_index_key = true;
+    } else {
+      std::string handle_encoding;
+      r->pending_handle.EncodeTo(&handle_encoding);
+      r->index_block.Add(r->last_key, Slice(handle_encoding));
+    }
     r->pending_index_entry = false;
   }
 
   if (r->filter_block != NULL) {
-    r->filter_block->AddKey(key);
+    //whc change
+    // The filter is built as blocks are written, see WriteBackBlocks()
+    if (r->parallel()) {
+      r->block_keys.push_back(key.ToString());
+    } else {
+      r->filter_block->AddKey(key);
+    }
   }
 
   r->last_key.assign(key.data(), key.size());
@@ -127,6 +220,11 @@ void TableBuilder::Flush() {
   if (!ok()) return;
   if (r->data_block.empty()) return;
   assert(!r->pending_index_entry);
+  //whc add
+  if (r->parallel()) {
+    QueueBlock();
+    return;
+  }
   WriteBlock(&r->data_block, &r->pending_handle);
   if (ok()) {
     r->pending_index_entry = true;
@@ -146,28 +244,11 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   Rep* r = rep_;
   Slice raw = block->Finish();
 
-  Slice block_contents;
-  CompressionType type = r->options.compression;
-  // TODO(postrelease): Support more compression options: zlib?
-  switch (type) {
-    case kNoCompression:
-      block_contents = raw;
-      break;
-
-    case kSnappyCompression: {
-      std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
-          compressed->size() < raw.size() - (raw.size() / 8u)) {
-        block_contents = *compressed;
-      } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
-        // store uncompressed form
-        block_contents = raw;
-        type = kNoCompression;
-      }
-      break;
-    }
-  }
+  //whc change
+  const CompressionType type = CompressBlock(raw, r->options.compression,
+                                             &r->compressed_output);
+  const Slice block_contents =
+      (type == kNoCompression) ? raw : Slice(r->compressed_output);
   WriteRawBlock(block_contents, type, handle);
   r->compressed_output.clear();
   block->Reset();
@@ -176,16 +257,20 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
 void TableBuilder::WriteRawBlock(const Slice& block_contents,
                                  CompressionType type,
                                  BlockHandle* handle) {
+  char trailer[kBlockTrailerSize];
+  EncodeBlockTrailer(block_contents, type, trailer);
+  WriteBlockContents(block_contents, trailer, handle);
+}
+
+//whc add
+void TableBuilder::WriteBlockContents(const Slice& block_contents,
+                                      const char* trailer,
+                                      BlockHandle* handle) {
   Rep* r = rep_;
   handle->set_offset(r->offset);
   handle->set_size(block_contents.size());
   r->status = r->file->Append(block_contents);
   if (r->status.ok()) {
-    char trailer[kBlockTrailerSize];
-    trailer[0] = type;
-    uint32_t crc = crc32c::Value(block_contents.data(), block_contents.size());
-    crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
-    EncodeFixed32(trailer+1, crc32c::Mask(crc));
     r->status = r->file->Append(Slice(trailer, kBlockTrailerSize));
     if (r->status.ok()) {
       r->offset += block_contents.size() + kBlockTrailerSize;
@@ -193,6 +278,114 @@ void TableBuilder::WriteRawBlock(const Slice& block_contents,
   }
 }
 
+//whc add
+void TableBuilder::QueueBlock() {
+  Rep* r = rep_;
+  PendingBlock* b = new PendingBlock;
+  b->raw = r->data_block.Finish().ToString();
+  b->type = r->options.compression;
+  b->filter_keys.swap(r->block_keys);
+  r->data_block.Reset();
+  r->pending.push_back(b);
+  r->pending_bytes += b->raw.size() + kBlockTrailerSize;
+  r->pending_index_entry = true;
+  {
+    MutexLock l(&r->mu);
+    r->to_compress.push_back(b);
+    if (r->threads < r->options.block_compression_threads &&
+        r->threads < static_cast<int>(r->to_compress.size())) {
+      r->threads++;
+      r->options.env->StartThread(&TableBuilder::CompressionWork, r);
+    }
+    r->work_cv.Signal();
+  }
+
+  // Bound the memory of blocks waiting for their turn to be written
+  WriteBackBlocks(2 * r->options.block_compression_threads + 1);
+}
+
+//whc add
+void TableBuilder::CompressionWork(void* arg) {
+  Rep* r = reinterpret_cast<Rep*>(arg);
+  MutexLock l(&r->mu);
+  while (true) {
+    while (r->to_compress.empty() && !r->shutting_down) {
+      r->work_cv.Wait();
+    }
+    if (r->to_compress.empty()) {
+      break;
+    }
+    PendingBlock* b = r->to_compress.front();
+    r->to_compress.pop_front();
+    r->mu.Unlock();
+    const Slice raw(b->raw);
+    const CompressionType type = CompressBlock(raw, b->type, &b->compressed);
+    b->use_compressed = (type != kNoCompression);
+    EncodeBlockTrailer(b->use_compressed ? Slice(b->compressed) : raw, type,
+                       b->trailer);
+    r->mu.Lock();
+    b->done = true;
+    r->done_cv.SignalAll();
+  }
+  r->threads--;
+  r->done_cv.SignalAll();
+}
+
+//whc add
+void TableBuilder::WriteBackBlocks(size_t max_pending) {
+  Rep* r = rep_;
+  while (!r->pending.empty()) {
+    PendingBlock* b = r->pending.front();
+    {
+      MutexLock l(&r->mu);
+      while (!b->done && r->pending.size() > max_pending) {
+        r->done_cv.Wait();
+      }
+      if (!b->done) {
+        break;
+      }
+    }
+    if (!b->has_index_key) {
+      // The last block; its index key comes with the next Add()
+      break;
+    }
+    r->pending.pop_front();
+    r->pending_bytes -= b->raw.size() + kBlockTrailerSize;
+    if (ok()) {
+      if (r->filter_block != NULL) {
+        for (size_t i = 0; i < b->filter_keys.size(); i++) {
+          r->filter_block->AddKey(b->filter_keys[i]);
+        }
+      }
+      BlockHandle handle;
+      WriteBlockContents(b->use_compressed ? Slice(b->compressed)
+                                           : Slice(b->raw),
+                         b->trailer, &handle);
+      if (ok()) {
+        std::string handle_encoding;
+        handle.EncodeTo(&handle_encoding);
+        r->index_block.Add(b->index_key, Slice(handle_encoding));
+        r->status = r->file->Flush();
+      }
+      if (r->filter_block != NULL) {
+        r->filter_block->StartBlock(r->offset);
+      }
+    }
+    delete b;
+  }
+}
+
+//whc add
+void TableBuilder::StopCompressionThreads() {
+  Rep* r = rep_;
+  MutexLock l(&r->mu);
+  r->shutting_down = true;
+  r->work_cv.SignalAll();
+  while (r->threads > 0) {
+    r->done_cv.Wait();
+  }
+}
+
 Status TableBuilder::status() const {
   return rep_->status;
 }
@@ -203,6 +396,18 @@ Status TableBuilder::Finish() {
   assert(!r->closed);
   r->closed = true;
 
+  //whc add
+  if (r->parallel()) {
+    if (r->pending_index_entry) {
+      r->options.comparator->FindShortSuccessor(&r->last_key);
+      r->pending.back()->index_key = r->last_key;
+      r->pending.back()->has_index_key = true;
+      r->pending_index_entry = false;
+    }
+    WriteBackBlocks(0);
+    StopCompressionThreads();
+  }
+
   BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
 
   // Write filter block
@@ -260,6 +465,19 @@ void TableBuilder::Abandon() {
   Rep* r = rep_;
   assert(!r->closed);
   r->closed = true;
+  //whc add
+  if (r->parallel()) {
+    {
+      MutexLock l(&r->mu);
+      r->to_compress.clear();
+    }
+    StopCompressionThreads();
+    for (size_t i = 0; i < r->pending.size(); i++) {
+      delete r->pending[i];
+    }
+    r->pending.clear();
+    r->pending_bytes = 0;
+  }
 }
 
 uint64_t TableBuilder::NumEntries() const {
@@ -267,7 +485,9 @@ uint64_t TableBuilder::NumEntries() const {
 }
 
 uint64_t TableBuilder::FileSize() const {
-  return rep_->offset;
+  //whc change
+  // Blocks still being compressed count with their raw size
+  return rep_->offset + rep_->pending_bytes;
 }
 
 }  // namespace leveldb
@@ -9,13 +9,16 @@
 #include "db/dbformat.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
 #include "leveldb/iterator.h"
 #include "leveldb/table_builder.h"
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
+#include "table/prefetch_iterator.h"
 #include "util/random.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
@@ -869,6 +872,159 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 2 * min_z, 2 * max_z));
 }
 
+
+static std::string BuildTable(const Options& options, const KVMap& data) {
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  for (KVMap::const_iterator it = data.begin(); it != data.end(); ++it) {
+    builder.Add(it->first, it->second);
+  }
+  ASSERT_OK(builder.Finish());
+  ASSERT_EQ(sink.contents().size(), builder.FileSize());
+  return sink.contents();
+}
+
+TEST(TableTest, BlockCompressionThreads) {
+  Random rnd(301);
+  KVMap data;
+  std::string tmp;
+  for (int i = 0; i < 2000; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "k%06d", i);
+    data[key] = test::CompressibleString(&rnd, 0.25, rnd.Uniform(500),
+                                         &tmp).ToString();
+  }
+  const FilterPolicy* policy = NewBloomFilterPolicy(10);
+  Options options;
+  options.block_size = 1024;
+  options.compression = kSnappyCompression;
+  options.filter_policy = policy;
+  const std::string expected = BuildTable(options, data);
+
+  // Blocks compressed in parallel are written out in the same order
+  for (int threads = 1; threads <= 4; threads++) {
+    options.block_compression_threads = threads;
+    ASSERT_TRUE(BuildTable(options, data) == expected);
+  }
+  delete policy;
+}
+
+//whc add
+TEST(TableTest, IndexAndFilterInBlockCache) {
+  const FilterPolicy* policy = NewBloomFilterPolicy(10);
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  options.filter_policy = policy;
+  KVMap data;
+  for (int i = 0; i < 1000; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "k%06d", i * 2);
+    data[key] = std::string(20, 'a' + i % 26);
+  }
+  const std::string contents = BuildTable(options, data);
+  StringSource source(contents);
+  ReadOptions ro;
+  ro.fill_cache = false;  // Only metadata gets charged
+
+  for (int mode = 0; mode < 3; mode++) {
+    // Kept by the table, cached, cached and pinned
+    Cache* cache = NewClockCache(1 << 20);
+    Options table_options = options;
+    table_options.block_cache = cache;
+    table_options.cache_index_and_filter_blocks = (mode > 0);
+    Table* table = NULL;
+    ASSERT_OK(Table::Open(table_options, &source, contents.size(), &table,
+                          mode == 2));
+    const size_t charge = cache->TotalCharge();
+    if (mode == 0) {
+      ASSERT_EQ(0, charge);
+    } else {
+      ASSERT_GT(charge, 0);
+    }
+    cache->Prune();
+    ASSERT_EQ(mode == 2 ? charge : 0, cache->TotalCharge());
+
+    // Evicted metadata is read back
+    Iterator* iter = table->NewIterator(ro);
+    for (KVMap::const_iterator it = data.begin(); it != data.end(); ++it) {
+      iter->Seek(it->first);
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(it->first, iter->key().ToString());
+      ASSERT_EQ(it->second, iter->value().ToString());
+    }
+    delete iter;
+    if (mode == 1) {
+      ASSERT_GT(cache->TotalCharge(), 0);
+    }
+    ASSERT_TRUE(table->ApproximateOffsetOf("k001000") > 0);
+
+    delete table;
+    cache->Prune();
+    ASSERT_EQ(0, cache->TotalCharge());
+    delete cache;
+  }
+  delete policy;
+}
+
+TEST(TableTest, PrefetchingIterator) {
+  Random rnd(301);
+  TableConstructor c(BytewiseComparator());
+  std::string tmp;
+  for (int i = 0; i < 1000; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "k%06d", i * 2);
+    c.Add(key, test::RandomString(&rnd, rnd.Uniform(100), &tmp).ToString());
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 256;
+  c.Finish(options, &keys, &kvmap);
+
+  Iterator* expected = c.NewIterator();
+  Iterator* iter = NewPrefetchingIterator(c.NewIterator(), Env::Default(),
+                                          1024);
+  iter->SeekToFirst();
+  for (expected->SeekToFirst(); expected->Valid(); expected->Next()) {
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(expected->key().ToString(), iter->key().ToString());
+    ASSERT_EQ(expected->value().ToString(), iter->value().ToString());
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_OK(iter->status());
+
+  // Seeks and steps back restart the read-ahead
+  for (int i = 0; i < 100; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "k%06d", rnd.Uniform(2100));
+    expected->Seek(key);
+    iter->Seek(key);
+    ASSERT_EQ(expected->Valid(), iter->Valid());
+    if (!expected->Valid()) continue;
+    ASSERT_EQ(expected->key().ToString(), iter->key().ToString());
+    for (int step = rnd.Uniform(50); step > 0 && expected->Valid(); step--) {
+      if (rnd.OneIn(3)) {
+        expected->Prev();
+        iter->Prev();
+      } else {
+        expected->Next();
+        iter->Next();
+      }
+      ASSERT_EQ(expected->Valid(), iter->Valid());
+      if (expected->Valid()) {
+        ASSERT_EQ(expected->key().ToString(), iter->key().ToString());
+      }
+    }
+  }
+  expected->SeekToLast();
+  iter->SeekToLast();
+  ASSERT_EQ(expected->key().ToString(), iter->key().ToString());
+  delete iter;
+  delete expected;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -5,6 +5,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
 
 #include "leveldb/cache.h"
 #include "port/port.h"
@@ -16,6 +19,12 @@ namespace leveldb {
 Cache::~Cache() {
 }
 
+Cache::Handle* Cache::InsertHighPriority(
+    const Slice& key, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value)) {
+  return Insert(key, value, charge, deleter);
+}
+
 namespace {
 
 // LRU cache implementation
@@ -67,19 +76,20 @@ struct LRUHandle {
 // of porting hacks and is also faster than some of the built-in hash
 // table implementations in some of the compiler/runtime combinations
 // we have tested.  E.g., readrandom speeds up by ~5% over the g++
-// 4.4.3's builtin hashtable.
+// 4.4.3's builtin hashtable.  "Handle" is LRUHandle or ClockHandle.
+template <class Handle>
 class HandleTable {
  public:
   HandleTable() : length_(0), elems_(0), list_(NULL) { Resize(); }
   ~HandleTable() { delete[] list_; }
 
-  LRUHandle* Lookup(const Slice& key, uint32_t hash) {
+  Handle* Lookup(const Slice& key, uint32_t hash) {
     return *FindPointer(key, hash);
   }
 
-  LRUHandle* Insert(LRUHandle* h) {
-    LRUHandle** ptr = FindPointer(h->key(), h->hash);
-    LRUHandle* old = *ptr;
+  Handle* Insert(Handle* h) {
+    Handle** ptr = FindPointer(h->key(), h->hash);
+    Handle* old = *ptr;
     h->next_hash = (old == NULL ? NULL : old->next_hash);
     *ptr = h;
     if (old == NULL) {
@@ -93,9 +103,9 @@ class HandleTable {
     return old;
   }
 
-  LRUHandle* Remove(const Slice& key, uint32_t hash) {
-    LRUHandle** ptr = FindPointer(key, hash);
-    LRUHandle* result = *ptr;
+  Handle* Remove(const Slice& key, uint32_t hash) {
+    Handle** ptr = FindPointer(key, hash);
+    Handle* result = *ptr;
     if (result != NULL) {
       *ptr = result->next_hash;
       --elems_;
@@ -108,13 +118,13 @@ class HandleTable {
   // a linked list of cache entries that hash into the bucket.
   uint32_t length_;
   uint32_t elems_;
-  LRUHandle** list_;
+  Handle** list_;
 
   // Return a pointer to slot that points to a cache entry that
   // matches key/hash.  If there is no such cache entry, return a
   // pointer to the trailing slot in the corresponding linked list.
-  LRUHandle** FindPointer(const Slice& key, uint32_t hash) {
-    LRUHandle** ptr = &list_[hash & (length_ - 1)];
+  Handle** FindPointer(const Slice& key, uint32_t hash) {
+    Handle** ptr = &list_[hash & (length_ - 1)];
     while (*ptr != NULL &&
            ((*ptr)->hash != hash || key != (*ptr)->key())) {
       ptr = &(*ptr)->next_hash;
@@ -127,15 +137,15 @@ class HandleTable {
     while (new_length < elems_) {
       new_length *= 2;
     }
-    LRUHandle** new_list = new LRUHandle*[new_length];
+    Handle** new_list = new Handle*[new_length];
     memset(new_list, 0, sizeof(new_list[0]) * new_length);
     uint32_t count = 0;
     for (uint32_t i = 0; i < length_; i++) {
-      LRUHandle* h = list_[i];
+      Handle* h = list_[i];
       while (h != NULL) {
-        LRUHandle* next = h->next_hash;
+        Handle* next = h->next_hash;
         uint32_t hash = h->hash;
-        LRUHandle** ptr = &new_list[hash & (new_length - 1)];
+        Handle** ptr = &new_list[hash & (new_length - 1)];
         h->next_hash = *ptr;
         *ptr = h;
         h = next;
@@ -194,7 +204,7 @@ class LRUCache {
   // Entries are in use by clients, and have refs >= 2 and in_cache==true.
   LRUHandle in_use_;
 
-  HandleTable table_;
+  HandleTable<LRUHandle> table_;
 };
 
 LRUCache::LRUCache()
@@ -396,10 +406,403 @@ class ShardedLRUCache : public Cache {
   }
 };
 
+//whc add
+// CLOCK cache implementation
+//
+// Each shard keeps the entries in the cache on one of two rings, both
+// swept like a clock by taking entries off the front:
+// - probation:  entries inserted and not hit since.  The hand evicts
+//   them unless they are pinned by a client or have been hit, in which
+//   case they move to the protected ring.
+// - protected:  entries hit at least once after their insertion.  When
+//   they outgrow their share of the capacity, the hand moves entries
+//   not hit since its last pass back to the end of probation.
+// A scan touches every entry once, so its entries cycle through
+// probation without evicting the protected working set.  Entries
+// inserted with InsertHighPriority() start on the protected ring.
+//
+// A hit sets the "referenced" bit instead of relinking the entry, so
+// Lookup() holds the shard mutex only to probe the hash table.  The
+// reference count is atomic: Release() takes no lock, and whoever drops
+// the last reference frees the entry.  Every client reference is taken
+// under the mutex, so the hand may evict an entry holding only the
+// cache's reference.
+struct ClockHandle {
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  ClockHandle* next_hash;
+  ClockHandle* next;
+  ClockHandle* prev;
+  size_t charge;
+  size_t key_length;
+  std::atomic<uint32_t> refs;  // References, including the cache's one
+  bool in_cache;      // Whether entry is in the cache.
+  bool referenced;    // Hit since the hand last passed, guarded by mutex
+  bool is_protected;  // On the protected ring
+  uint32_t hash;
+  char key_data[1];   // Beginning of key
+
+  Slice key() const {
+    return Slice(key_data, key_length);
+  }
+};
+
+static void UnrefClockHandle(ClockHandle* e) {
+  if (e->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    assert(!e->in_cache);
+    (*e->deleter)(e->key(), e->value);
+    free(e);
+  }
+}
+
+// A single shard of ShardedClockCache.
+class ClockCacheShard {
+ public:
+  ClockCacheShard();
+  ~ClockCacheShard();
+
+  // Separate from constructor so caller can easily make an array of shards.
+  // A fifth of the capacity is kept for probation.
+  void SetCapacity(size_t capacity) {
+    capacity_ = capacity;
+    protected_capacity_ = capacity - capacity / 5;
+  }
+
+  // Like Cache methods, but with an extra "hash" parameter.  A high
+  // priority entry skips probation.
+  Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                        void* value, size_t charge,
+                        void (*deleter)(const Slice& key, void* value),
+                        bool high_priority);
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle) {
+    UnrefClockHandle(reinterpret_cast<ClockHandle*>(handle));
+  }
+  void Erase(const Slice& key, uint32_t hash);
+  void Prune();
+  size_t TotalCharge() const {
+    MutexLock l(&mutex_);
+    return usage_;
+  }
+
+ private:
+  void Ring_Remove(ClockHandle* e);
+  void Ring_Append(ClockHandle* ring, ClockHandle* e);
+  void Promote(ClockHandle* e);
+  void Protect(ClockHandle* e);
+  bool Demote();
+  void EvictToCapacity();
+  bool FinishErase(ClockHandle* e);
+
+  // Initialized before use.
+  size_t capacity_;
+  size_t protected_capacity_;
+
+  // mutex_ protects the following state.
+  mutable port::Mutex mutex_;
+  size_t usage_;
+  size_t protected_usage_;
+  size_t probation_count_;
+  size_t protected_count_;
+
+  // Dummy heads of the rings; next is the entry under the hand.
+  ClockHandle probation_;
+  ClockHandle protected_;
+
+  HandleTable<ClockHandle> table_;
+};
+
+ClockCacheShard::ClockCacheShard()
+    : capacity_(0),
+      protected_capacity_(0),
+      usage_(0),
+      protected_usage_(0),
+      probation_count_(0),
+      protected_count_(0) {
+  probation_.next = &probation_;
+  probation_.prev = &probation_;
+  protected_.next = &protected_;
+  protected_.prev = &protected_;
+}
+
+ClockCacheShard::~ClockCacheShard() {
+  ClockHandle* rings[2] = { &probation_, &protected_ };
+  for (int i = 0; i < 2; i++) {
+    for (ClockHandle* e = rings[i]->next; e != rings[i]; ) {
+      ClockHandle* next = e->next;
+      assert(e->in_cache);
+      // Error if caller has an unreleased handle
+      assert(e->refs.load(std::memory_order_relaxed) == 1);
+      e->in_cache = false;
+      UnrefClockHandle(e);
+      e = next;
+    }
+  }
+}
+
+void ClockCacheShard::Ring_Remove(ClockHandle* e) {
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+}
+
+void ClockCacheShard::Ring_Append(ClockHandle* ring, ClockHandle* e) {
+  // Make "e" the entry the hand reaches last
+  e->next = ring;
+  e->prev = ring->prev;
+  e->prev->next = e;
+  e->next->prev = e;
+}
+
+// Move the probationary entry "e" to the protected ring, making room
+// there by demoting others.
+void ClockCacheShard::Promote(ClockHandle* e) {
+  assert(!e->is_protected);
+  Ring_Remove(e);
+  probation_count_--;
+  e->referenced = false;
+  Protect(e);
+}
+
+// Add "e", which is on no ring, to the protected ring.
+void ClockCacheShard::Protect(ClockHandle* e) {
+  e->is_protected = true;
+  Ring_Append(&protected_, e);
+  protected_count_++;
+  protected_usage_ += e->charge;
+  while (protected_usage_ > protected_capacity_ && Demote()) { }
+}
+
+// Advance the protected hand to an entry not hit since its last pass
+// and move it to the end of probation.  Returns false if the protected
+// ring is empty.
+bool ClockCacheShard::Demote() {
+  // After one full turn every entry has its bit cleared
+  for (size_t n = 0; n <= protected_count_; n++) {
+    ClockHandle* e = protected_.next;
+    if (e == &protected_) {
+      return false;
+    }
+    Ring_Remove(e);
+    if (e->referenced) {
+      e->referenced = false;
+      Ring_Append(&protected_, e);
+    } else {
+      protected_count_--;
+      protected_usage_ -= e->charge;
+      e->is_protected = false;
+      Ring_Append(&probation_, e);
+      probation_count_++;
+      return true;
+    }
+  }
+  assert(false);
+  return false;
+}
+
+void ClockCacheShard::EvictToCapacity() {
+  // Each visit evicts, promotes or passes over a pinned entry, so three
+  // visits per entry are enough to get below capacity unless the pinned
+  // entries alone exceed it.
+  size_t visits = 3 * (probation_count_ + protected_count_);
+  while (usage_ > capacity_ && visits-- > 0) {
+    ClockHandle* e = probation_.next;
+    if (e == &probation_) {
+      if (!Demote()) {
+        break;
+      }
+    } else if (e->referenced) {
+      Promote(e);
+    } else if (e->refs.load(std::memory_order_acquire) > 1) {
+      Ring_Remove(e);
+      Ring_Append(&probation_, e);
+    } else {
+      bool erased = FinishErase(table_.Remove(e->key(), e->hash));
+      if (!erased) {  // to avoid unused variable when compiled NDEBUG
+        assert(erased);
+      }
+    }
+  }
+}
+
+Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
+  ClockHandle* e = table_.Lookup(key, hash);
+  if (e != NULL) {
+    e->refs.fetch_add(1, std::memory_order_relaxed);
+    e->referenced = true;
+  }
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+Cache::Handle* ClockCacheShard::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value), bool high_priority) {
+  ClockHandle* e = reinterpret_cast<ClockHandle*>(
+      malloc(sizeof(ClockHandle)-1 + key.size()));
+  e->value = value;
+  e->deleter = deleter;
+  e->charge = charge;
+  e->key_length = key.size();
+  e->hash = hash;
+  e->in_cache = false;
+  e->referenced = false;
+  e->is_protected = false;
+  new (&e->refs) std::atomic<uint32_t>(1);  // for the returned handle.
+  memcpy(e->key_data, key.data(), key.size());
+
+  MutexLock l(&mutex_);
+  if (capacity_ > 0) {
+    e->refs.fetch_add(1, std::memory_order_relaxed);  // for the cache's.
+    e->in_cache = true;
+    if (high_priority) {
+      Protect(e);
+    } else {
+      Ring_Append(&probation_, e);
+      probation_count_++;
+    }
+    usage_ += charge;
+    FinishErase(table_.Insert(e));
+  } // else don't cache.  (Tests use capacity_==0 to turn off caching.)
+
+  EvictToCapacity();
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+// If e != NULL, finish removing *e from the cache; it has already been removed
+// from the hash table.  Return whether e != NULL.  Requires mutex_ held.
+bool ClockCacheShard::FinishErase(ClockHandle* e) {
+  if (e != NULL) {
+    assert(e->in_cache);
+    Ring_Remove(e);
+    if (e->is_protected) {
+      protected_count_--;
+      protected_usage_ -= e->charge;
+    } else {
+      probation_count_--;
+    }
+    e->in_cache = false;
+    usage_ -= e->charge;
+    UnrefClockHandle(e);
+  }
+  return e != NULL;
+}
+
+void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
+  FinishErase(table_.Remove(key, hash));
+}
+
+void ClockCacheShard::Prune() {
+  MutexLock l(&mutex_);
+  ClockHandle* rings[2] = { &probation_, &protected_ };
+  for (int i = 0; i < 2; i++) {
+    for (ClockHandle* e = rings[i]->next; e != rings[i]; ) {
+      ClockHandle* next = e->next;
+      if (e->refs.load(std::memory_order_acquire) == 1) {
+        bool erased = FinishErase(table_.Remove(e->key(), e->hash));
+        if (!erased) {  // to avoid unused variable when compiled NDEBUG
+          assert(erased);
+        }
+      }
+      e = next;
+    }
+  }
+}
+
+static const int kMaxClockShardBits = 16;
+
+class ShardedClockCache : public Cache {
+ private:
+  ClockCacheShard* shards_;
+  const int shard_bits_;
+  std::atomic<uint64_t> last_id_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  uint32_t Shard(uint32_t hash) const {
+    return shard_bits_ == 0 ? 0 : hash >> (32 - shard_bits_);
+  }
+
+  // One shard per 512KB of capacity, at most 64 of them
+  static int DefaultShardBits(size_t capacity) {
+    int bits = 0;
+    while (bits < 6 && (capacity >> (bits + 1)) >= (512 << 10)) {
+      bits++;
+    }
+    return bits;
+  }
+
+ public:
+  ShardedClockCache(size_t capacity, int num_shard_bits)
+      : shard_bits_(num_shard_bits < 0 ? DefaultShardBits(capacity) :
+                    std::min(num_shard_bits, kMaxClockShardBits)),
+        last_id_(0) {
+    const int num_shards = 1 << shard_bits_;
+    shards_ = new ClockCacheShard[num_shards];
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    for (int s = 0; s < num_shards; s++) {
+      shards_[s].SetCapacity(per_shard);
+    }
+  }
+  virtual ~ShardedClockCache() {
+    delete[] shards_;
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    const uint32_t hash = HashSlice(key);
+    return shards_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                       false);
+  }
+  virtual Handle* InsertHighPriority(
+      const Slice& key, void* value, size_t charge,
+      void (*deleter)(const Slice& key, void* value)) {
+    const uint32_t hash = HashSlice(key);
+    return shards_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                       true);
+  }
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    return shards_[Shard(hash)].Lookup(key, hash);
+  }
+  virtual void Release(Handle* handle) {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    shards_[Shard(h->hash)].Release(handle);
+  }
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    shards_[Shard(hash)].Erase(key, hash);
+  }
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockHandle*>(handle)->value;
+  }
+  virtual uint64_t NewId() {
+    return last_id_.fetch_add(1) + 1;
+  }
+  virtual void Prune() {
+    for (int s = 0; s < (1 << shard_bits_); s++) {
+      shards_[s].Prune();
+    }
+  }
+  virtual size_t TotalCharge() const {
+    size_t total = 0;
+    for (int s = 0; s < (1 << shard_bits_); s++) {
+      total += shards_[s].TotalCharge();
+    }
+    return total;
+  }
+};
+
 }  // end anonymous namespace
 
 Cache* NewLRUCache(size_t capacity) {
   return new ShardedLRUCache(capacity);
 }
 
+//whc add
+Cache* NewClockCache(size_t capacity, int num_shard_bits) {
+  return new ShardedClockCache(capacity, num_shard_bits);
+}
+
 }  // namespace leveldb
@@ -4,8 +4,11 @@
 
 #include "leveldb/cache.h"
 
+#include <atomic>
 #include <vector>
+#include "leveldb/env.h"
 #include "util/coding.h"
+#include "util/random.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -219,6 +222,257 @@ TEST(CacheTest, Prune) {
   ASSERT_EQ(-1, Lookup(2));
 }
 
+//whc add
+class ClockCacheTest : public CacheTest {
+ public:
+  ClockCacheTest() {
+    delete cache_;
+    cache_ = NewClockCache(kCacheSize);
+  }
+};
+
+TEST(ClockCacheTest, ClockHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1,  Lookup(200));
+
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(200);
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(2, deleted_keys_.size());
+}
+
+TEST(ClockCacheTest, ClockEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+
+  Insert(100, 102);
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+
+  cache_->Release(h2);
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST(ClockCacheTest, ClockEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+  Insert(300, 301);
+  Cache::Handle* h = cache_->Lookup(EncodeKey(300));
+
+  // Frequently used entry must be kept around,
+  // as must things that are still in use.
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(301, Lookup(300));
+  cache_->Release(h);
+}
+
+TEST(ClockCacheTest, ClockScanResistance) {
+  // A working set hit twice survives a scan many times the cache size
+  const int kHot = kCacheSize / 2;
+  for (int i = 0; i < kHot; i++) {
+    Insert(i, 1000+i);
+  }
+  for (int i = 0; i < kHot; i++) {
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(100000+i, i);
+  }
+  for (int i = 0; i < kHot; i++) {
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+  ASSERT_LE(cache_->TotalCharge(), static_cast<size_t>(kCacheSize));
+
+  // The scanned entries cannot take the working set's place either
+  int scanned = 0;
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    if (Lookup(100000+i) >= 0) scanned++;
+  }
+  ASSERT_LE(scanned, kCacheSize - kHot);
+}
+
+TEST(ClockCacheTest, ClockHighPriority) {
+  // High priority entries are protected without being hit
+  cache_->Release(cache_->InsertHighPriority(EncodeKey(1), EncodeValue(101),
+                                             1, &CacheTest::Deleter));
+  Insert(2, 102);
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(100000+i, i);
+  }
+  ASSERT_EQ(101, Lookup(1));
+  ASSERT_EQ(-1, Lookup(2));
+
+  // The LRU cache treats them as any other entry
+  Cache* lru = NewLRUCache(kCacheSize);
+  lru->Release(lru->InsertHighPriority(EncodeKey(1), EncodeValue(101), 1,
+                                       &CacheTest::Deleter));
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    lru->Release(lru->Insert(EncodeKey(100000+i), EncodeValue(i), 1,
+                             &CacheTest::Deleter));
+  }
+  ASSERT_TRUE(lru->Lookup(EncodeKey(1)) == NULL);
+  delete lru;
+}
+
+TEST(ClockCacheTest, ClockUseExceedsCacheSize) {
+  // Overfill the cache, keeping handles on all inserted entries.
+  std::vector<Cache::Handle*> h;
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    h.push_back(InsertAndReturnHandle(1000+i, 2000+i));
+  }
+
+  // Check that all the entries can be found in the cache.
+  for (int i = 0; i < h.size(); i++) {
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+  }
+
+  for (int i = 0; i < h.size(); i++) {
+    cache_->Release(h[i]);
+  }
+
+  // Released entries are evicted again by the next insertion
+  Insert(0, 0);
+  ASSERT_LE(cache_->TotalCharge(), static_cast<size_t>(kCacheSize));
+}
+
+TEST(ClockCacheTest, ClockHeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2*kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000+index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000+i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
+}
+
+TEST(ClockCacheTest, ClockPrune) {
+  Insert(1, 100);
+  Insert(2, 200);
+  ASSERT_EQ(200, Lookup(2));  // Promoted entries are pruned as well
+
+  Cache::Handle* handle = cache_->Lookup(EncodeKey(1));
+  ASSERT_TRUE(handle);
+  cache_->Prune();
+  cache_->Release(handle);
+
+  ASSERT_EQ(100, Lookup(1));
+  ASSERT_EQ(-1, Lookup(2));
+  ASSERT_NE(cache_->NewId(), cache_->NewId());
+}
+
+namespace {
+std::atomic<int> clock_deleted(0);
+
+void CountingDeleter(const Slice& key, void* v) {
+  ASSERT_EQ(DecodeKey(key), DecodeValue(v));
+  clock_deleted.fetch_add(1);
+}
+
+struct ConcurrentState {
+  Cache* cache;
+  int seed;
+  std::atomic<int>* inserted;
+  std::atomic<int>* done;
+};
+
+void ConcurrentUser(void* arg) {
+  ConcurrentState* state = reinterpret_cast<ConcurrentState*>(arg);
+  Random rnd(state->seed);
+  std::vector<Cache::Handle*> held;
+  for (int i = 0; i < 20000; i++) {
+    const int k = rnd.Skewed(11);
+    Cache::Handle* h = state->cache->Lookup(EncodeKey(k));
+    if (h == NULL) {
+      h = state->cache->Insert(EncodeKey(k), EncodeValue(k), 1 + (k & 3),
+                               &CountingDeleter);
+      state->inserted->fetch_add(1);
+    }
+    ASSERT_EQ(k, DecodeValue(state->cache->Value(h)));
+    if (rnd.OneIn(3)) {
+      held.push_back(h);
+    } else {
+      state->cache->Release(h);
+    }
+    if (held.size() > 8) {
+      const size_t j = rnd.Uniform(held.size());
+      state->cache->Release(held[j]);
+      held.erase(held.begin() + j);
+    }
+  }
+  for (size_t i = 0; i < held.size(); i++) {
+    state->cache->Release(held[i]);
+  }
+  state->done->fetch_add(1);
+}
+}  // namespace
+
+TEST(ClockCacheTest, ClockConcurrent) {
+  const int kThreads = 4;
+  Cache* cache = NewClockCache(kCacheSize, 2);
+  std::atomic<int> inserted(0);
+  std::atomic<int> done(0);
+  ConcurrentState states[kThreads];
+  for (int t = 0; t < kThreads; t++) {
+    states[t].cache = cache;
+    states[t].seed = 301 + t;
+    states[t].inserted = &inserted;
+    states[t].done = &done;
+    Env::Default()->StartThread(&ConcurrentUser, &states[t]);
+  }
+  while (done.load() < kThreads) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  // Entries pinned by the last insertions may exceed the capacity
+  ASSERT_LE(cache->TotalCharge(), kCacheSize + kThreads * 9 * 4);
+  delete cache;
+  ASSERT_EQ(inserted.load(), clock_deleted.load());
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
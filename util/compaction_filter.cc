@@ -0,0 +1,54 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/compaction_filter.h"
+
+#include "leveldb/env.h"
+#include "leveldb/slice.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+CompactionFilter::~CompactionFilter() { }
+
+void AppendTTLTimestamp(std::string* value, uint64_t unix_seconds) {
+  PutFixed64(value, unix_seconds);
+}
+
+namespace {
+class TTLCompactionFilter : public CompactionFilter {
+ private:
+  const uint64_t ttl_;
+  Env* const env_;
+
+ public:
+  TTLCompactionFilter(uint64_t ttl_seconds, Env* env)
+      : ttl_(ttl_seconds),
+        env_(env != NULL ? env : Env::Default()) { }
+
+  virtual const char* Name() const {
+    return "leveldb.TTLCompactionFilter";
+  }
+
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const {
+    if (existing_value.size() < 8) {
+      return false;
+    }
+    const uint64_t written =
+        DecodeFixed64(existing_value.data() + existing_value.size() - 8);
+    const uint64_t now = env_->NowMicros() / 1000000;
+    return now > written && now - written > ttl_;
+  }
+};
+}  // namespace
+
+const CompactionFilter* NewTTLCompactionFilter(uint64_t ttl_seconds,
+                                               Env* env) {
+  return new TTLCompactionFilter(ttl_seconds, env);
+}
+
+}  // namespace leveldb
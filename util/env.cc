@@ -13,6 +13,9 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+void Env::SetBackgroundThreads(int number) {
+}
+
 SequentialFile::~SequentialFile() {
 }
 
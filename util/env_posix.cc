@@ -462,6 +462,8 @@ class PosixEnv : public Env {
 
   virtual void Schedule(void (*function)(void*), void* arg);
 
+  virtual void SetBackgroundThreads(int number);
+
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
   virtual Status GetTestDirectory(std::string* result) {
@@ -514,7 +516,7 @@ class PosixEnv : public Env {
     }
   }
 
-  // BGThread() is the body of the background thread
+  // BGThread() is the body of the background threads
   void BGThread();
   static void* BGThreadWrapper(void* arg) {
     reinterpret_cast<PosixEnv*>(arg)->BGThread();
@@ -523,8 +525,8 @@ class PosixEnv : public Env {
 
   pthread_mutex_t mu_;
   pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
+  int bgthreads_;                // Background threads started so far
+  int max_bgthreads_;            // Threads Schedule() starts, at least one
 
   // Entry per Schedule() call
   struct BGItem { void* arg; void (*function)(void*); };
@@ -535,7 +537,7 @@ class PosixEnv : public Env {
   MmapLimiter mmap_limit_;
 };
 
-PosixEnv::PosixEnv() : started_bgthread_(false) {
+PosixEnv::PosixEnv() : bgthreads_(0), max_bgthreads_(1) {
   PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
   PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
 }
@@ -543,19 +545,19 @@ PosixEnv::PosixEnv() : started_bgthread_(false) {
 void PosixEnv::Schedule(void (*function)(void*), void* arg) {
   PthreadCall("lock", pthread_mutex_lock(&mu_));
 
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
+  // Start background threads if necessary
+  while (bgthreads_ < max_bgthreads_) {
+    pthread_t t;
     PthreadCall(
         "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
+        pthread_create(&t, NULL,  &PosixEnv::BGThreadWrapper, this));
+    bgthreads_++;
   }
 
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
-  }
+  // Some background thread may be waiting.  Signal even if the queue is
+  // not empty: with several threads, the one woken up for an earlier
+  // item may not have taken it yet.
+  PthreadCall("signal", pthread_cond_signal(&bgsignal_));
 
   // Add to priority queue
   queue_.push_back(BGItem());
@@ -565,6 +567,14 @@ void PosixEnv::Schedule(void (*function)(void*), void* arg) {
   PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
+void PosixEnv::SetBackgroundThreads(int number) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  if (number > max_bgthreads_) {
+    max_bgthreads_ = number;
+  }
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
 void PosixEnv::BGThread() {
   while (true) {
     // Wait until there is an item that is ready to run
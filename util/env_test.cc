@@ -97,6 +97,57 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+struct RendezvousState {
+  port::Mutex mu;
+  int arrived;
+  int met;      // Callbacks that saw the other one running
+  int done;
+};
+
+// Waits a while for a second callback to start
+static void Rendezvous(void* arg) {
+  RendezvousState* s = reinterpret_cast<RendezvousState*>(arg);
+  s->mu.Lock();
+  s->arrived++;
+  s->mu.Unlock();
+  for (int i = 0; i < 100; i++) {
+    s->mu.Lock();
+    const bool both = (s->arrived == 2);
+    s->mu.Unlock();
+    if (both) {
+      s->mu.Lock();
+      s->met++;
+      s->mu.Unlock();
+      break;
+    }
+    Env::Default()->SleepForMicroseconds(kDelayMicros / 10);
+  }
+  s->mu.Lock();
+  s->done++;
+  s->mu.Unlock();
+}
+
+// Runs last: RunMany relies on a single background thread
+TEST(EnvPosixTest, SetBackgroundThreads) {
+  env_->SetBackgroundThreads(2);
+  RendezvousState state;
+  state.arrived = 0;
+  state.met = 0;
+  state.done = 0;
+  env_->Schedule(&Rendezvous, &state);
+  env_->Schedule(&Rendezvous, &state);
+  while (true) {
+    state.mu.Lock();
+    int num = state.done;
+    state.mu.Unlock();
+    if (num == 2) {
+      break;
+    }
+    Env::Default()->SleepForMicroseconds(kDelayMicros);
+  }
+  ASSERT_EQ(state.met, 2);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
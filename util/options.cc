@@ -21,6 +21,8 @@ Options::Options()
       write_buffer_size(4<<20),
       max_open_files(1000),
       block_cache(NULL),
+      cache_index_and_filter_blocks(false),
+      row_cache(NULL),
       block_size(4096),
       block_restart_interval(16),
       max_file_size(2<<20),
@@ -28,7 +30,24 @@ Options::Options()
       reuse_logs(false),
       filter_policy(NewBloomFilterPolicy(100)),
       amplify(4.0),
-      top_level_size(10.0*1048576.0){
+      top_level_size(10.0*1048576.0),
+      buffer_compact_levels(0),
+      max_buffer_merge_threads(4),
+      ssd_env(NULL),
+      ssd_levels(3),
+      ssd_max_open_files(200),
+      max_background_compactions(1),
+      max_subcompactions(1),
+      delayed_write_rate(16<<20),
+      soft_pending_compaction_bytes_limit(64<<20),
+      rate_limiter(NULL),
+      block_compression_threads(0),
+      compaction_readahead_size(0),
+      compaction_filter(NULL),
+      compaction_style(kCompactionStyleLevel),
+      universal_size_ratio(1),
+      universal_min_merge_width(2),
+      universal_max_size_amplification_percent(200){
           //std::cout<<"options:filter:"<<filter_policy<<std::endl;
 }
 
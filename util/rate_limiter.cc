@@ -0,0 +1,271 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/rate_limiter.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <deque>
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+RateLimiter::~RateLimiter() {
+}
+
+namespace {
+
+// Tokens are added once per period, so waiting requests are woken a few
+// times per second at most
+static const uint64_t kRefillPeriodMicros = 100000;
+
+// Auto-tuned limiters adjust their rate once per interval
+static const uint64_t kTuneIntervalMicros = 1000000;
+
+// Auto-tuned limiters stay between max / kMinRateDivisor and max
+static const int64_t kMinRateDivisor = 16;
+
+class GenericRateLimiter : public RateLimiter {
+ public:
+  GenericRateLimiter(Env* env, int64_t bytes_per_second, bool auto_tuned)
+      : env_(env),
+        max_rate_(bytes_per_second > 0 ? bytes_per_second : 1),
+        auto_tuned_(auto_tuned),
+        rate_(auto_tuned_ ? MinRate() : max_rate_),
+        available_(0),
+        next_refill_(env_->NowMicros()),
+        next_tune_(next_refill_ + kTuneIntervalMicros),
+        stalls_(0),
+        refilling_(false) {
+    total_bytes_[kIOLow] = 0;
+    total_bytes_[kIOHigh] = 0;
+  }
+
+  virtual void Request(size_t bytes, IOPriority pri) {
+    assert(pri < kNumPriorities);
+    MutexLock l(&mu_);
+    total_bytes_[pri] += bytes;
+    while (bytes > 0) {
+      // No request asks for more than a period brings
+      const size_t chunk = std::min<uint64_t>(bytes, RefillBytes());
+      RequestChunk(chunk, pri);
+      bytes -= chunk;
+    }
+  }
+
+  virtual void ReportWriteStall() {
+    MutexLock l(&mu_);
+    stalls_++;
+  }
+
+  virtual int64_t GetBytesPerSecond() const {
+    MutexLock l(&mu_);
+    return rate_;
+  }
+
+  virtual int64_t GetTotalBytesThrough(IOPriority pri) const {
+    MutexLock l(&mu_);
+    return total_bytes_[pri];
+  }
+
+ private:
+  struct Req {
+    size_t bytes;
+    bool granted;
+    port::CondVar cv;
+    Req(port::Mutex* mu, size_t b) : bytes(b), granted(false), cv(mu) { }
+  };
+
+  int64_t MinRate() const {
+    const int64_t r = max_rate_ / kMinRateDivisor;
+    return r > 0 ? r : 1;
+  }
+
+  uint64_t RefillBytes() const {
+    const uint64_t b = rate_ * kRefillPeriodMicros / 1000000;
+    return b > 0 ? b : 1;
+  }
+
+  void RequestChunk(size_t bytes, IOPriority pri) {
+    if (queue_[kIOLow].empty() && queue_[kIOHigh].empty()) {
+      Refill();
+      if (available_ > 0) {
+        available_ -= bytes;
+        return;
+      }
+    }
+
+    // Wait in line.  One of the waiting threads sleeps until the next
+    // refill and hands the new tokens out, the others wait to be woken.
+    Req r(&mu_, bytes);
+    queue_[pri].push_back(&r);
+    while (!r.granted) {
+      if (refilling_) {
+        r.cv.Wait();
+        continue;
+      }
+      refilling_ = true;
+      const uint64_t now = env_->NowMicros();
+      if (next_refill_ > now) {
+        mu_.Unlock();
+        env_->SleepForMicroseconds(static_cast<int>(next_refill_ - now));
+        mu_.Lock();
+      }
+      Refill();
+      Grant();
+      refilling_ = false;
+      // Hand the refills over to another waiting request
+      for (int p = kIOHigh; p >= kIOLow; p--) {
+        if (!queue_[p].empty()) {
+          queue_[p].front()->cv.Signal();
+          break;
+        }
+      }
+    }
+  }
+
+  // Add the tokens of the periods that have passed.  Tokens unused for a
+  // whole period are dropped, so an idle limiter does not allow a burst.
+  void Refill() {
+    const uint64_t now = env_->NowMicros();
+    if (now < next_refill_) {
+      return;
+    }
+    if (auto_tuned_ && now >= next_tune_) {
+      Tune();
+      next_tune_ = now + kTuneIntervalMicros;
+    }
+    const int64_t refill = RefillBytes();
+    const int64_t periods = (now - next_refill_) / kRefillPeriodMicros + 1;
+    available_ = std::min(available_ + periods * refill, refill);
+    next_refill_ += periods * kRefillPeriodMicros;
+  }
+
+  // Grant waiting requests, high priority first, while tokens last.  The
+  // last one granted may overdraw the tokens, which the next periods
+  // pay back.
+  void Grant() {
+    for (int p = kIOHigh; p >= kIOLow; p--) {
+      while (!queue_[p].empty() && available_ > 0) {
+        Req* r = queue_[p].front();
+        queue_[p].pop_front();
+        available_ -= r->bytes;
+        r->granted = true;
+        r->cv.Signal();
+      }
+      if (!queue_[p].empty()) {
+        return;  // Lower priorities wait for the tokens to come back
+      }
+    }
+  }
+
+  // Double the rate while writers stall, else fall back by 1/20th
+  void Tune() {
+    if (stalls_ > 0) {
+      rate_ = std::min(rate_ * 2, max_rate_);
+    } else {
+      rate_ = std::max(rate_ - rate_ / 20, MinRate());
+    }
+    stalls_ = 0;
+  }
+
+  Env* const env_;
+  const int64_t max_rate_;
+  const bool auto_tuned_;
+
+  mutable port::Mutex mu_;
+  int64_t rate_;
+  int64_t available_;       // Tokens of the current period, may be overdrawn
+  uint64_t next_refill_;    // Micros of the next refill
+  uint64_t next_tune_;      // Micros of the next Tune(), if auto_tuned_
+  int stalls_;              // Write stalls reported since the last Tune()
+  bool refilling_;          // Some waiting thread sleeps until next_refill_
+  std::deque<Req*> queue_[kNumPriorities];
+  int64_t total_bytes_[kNumPriorities];
+};
+
+class RateLimitedWritableFile : public WritableFile {
+ public:
+  RateLimitedWritableFile(WritableFile* file, RateLimiter* limiter,
+                          RateLimiter::IOPriority pri)
+      : file_(file), limiter_(limiter), pri_(pri) { }
+  virtual ~RateLimitedWritableFile() { delete file_; }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size(), pri_);
+    return file_->Append(data);
+  }
+  virtual Status Close() { return file_->Close(); }
+  virtual Status Flush() { return file_->Flush(); }
+  virtual Status Sync() { return file_->Sync(); }
+
+ private:
+  WritableFile* const file_;
+  RateLimiter* const limiter_;
+  const RateLimiter::IOPriority pri_;
+};
+
+// Entries are requested a block's worth at a time
+static const size_t kIteratorRequestBytes = 64 << 10;
+
+class RateLimitedIterator : public Iterator {
+ public:
+  RateLimitedIterator(Iterator* iter, RateLimiter* limiter,
+                      RateLimiter::IOPriority pri)
+      : iter_(iter), limiter_(limiter), pri_(pri), pending_(0) { }
+  virtual ~RateLimitedIterator() { delete iter_; }
+
+  virtual bool Valid() const { return iter_->Valid(); }
+  virtual Slice key() const { return iter_->key(); }
+  virtual Slice value() const { return iter_->value(); }
+  virtual Status status() const { return iter_->status(); }
+  virtual void Next() { iter_->Next(); Charge(); }
+  virtual void Prev() { iter_->Prev(); Charge(); }
+  virtual void Seek(const Slice& target) { iter_->Seek(target); Charge(); }
+  virtual void SeekToFirst() { iter_->SeekToFirst(); Charge(); }
+  virtual void SeekToLast() { iter_->SeekToLast(); Charge(); }
+
+ private:
+  void Charge() {
+    if (iter_->Valid()) {
+      pending_ += iter_->key().size() + iter_->value().size();
+      if (pending_ >= kIteratorRequestBytes) {
+        limiter_->Request(pending_, pri_);
+        pending_ = 0;
+      }
+    }
+  }
+
+  Iterator* const iter_;
+  RateLimiter* const limiter_;
+  const RateLimiter::IOPriority pri_;
+  size_t pending_;    // Bytes yielded but not requested yet
+};
+
+}  // namespace
+
+RateLimiter* NewGenericRateLimiter(Env* env, int64_t bytes_per_second,
+                                   bool auto_tuned) {
+  return new GenericRateLimiter(env, bytes_per_second, auto_tuned);
+}
+
+RateLimiter* NewGenericRateLimiter(int64_t bytes_per_second, bool auto_tuned) {
+  return NewGenericRateLimiter(Env::Default(), bytes_per_second, auto_tuned);
+}
+
+WritableFile* NewRateLimitedWritableFile(WritableFile* file,
+                                         RateLimiter* limiter,
+                                         RateLimiter::IOPriority pri) {
+  return new RateLimitedWritableFile(file, limiter, pri);
+}
+
+Iterator* NewRateLimitedIterator(Iterator* iter, RateLimiter* limiter,
+                                 RateLimiter::IOPriority pri) {
+  return new RateLimitedIterator(iter, limiter, pri);
+}
+
+}  // namespace leveldb
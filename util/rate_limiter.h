@@ -0,0 +1,36 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
+
+#include "leveldb/rate_limiter.h"
+
+namespace leveldb {
+
+class Env;
+class Iterator;
+class WritableFile;
+
+// Like NewGenericRateLimiter(), reading the clock and sleeping through
+// "env".
+extern RateLimiter* NewGenericRateLimiter(Env* env, int64_t bytes_per_second,
+                                          bool auto_tuned);
+
+// Return a file requesting the bytes of every Append() from "limiter" at
+// priority "pri" before writing them.  Takes ownership of "file".
+extern WritableFile* NewRateLimitedWritableFile(WritableFile* file,
+                                                RateLimiter* limiter,
+                                                RateLimiter::IOPriority pri);
+
+// Return an iterator requesting the bytes of the entries it yields from
+// "limiter" at priority "pri", a chunk at a time.  Takes ownership of
+// "iter".
+extern Iterator* NewRateLimitedIterator(Iterator* iter,
+                                        RateLimiter* limiter,
+                                        RateLimiter::IOPriority pri);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
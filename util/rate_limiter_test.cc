@@ -0,0 +1,85 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/rate_limiter.h"
+
+#include "leveldb/env.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+// Env whose clock only moves when someone sleeps
+class FakeClockEnv : public EnvWrapper {
+ public:
+  uint64_t now_;
+
+  FakeClockEnv() : EnvWrapper(Env::Default()), now_(1000000) { }
+
+  virtual uint64_t NowMicros() { return now_; }
+  virtual void SleepForMicroseconds(int micros) { now_ += micros; }
+};
+
+class RateLimiterTest {
+ public:
+  FakeClockEnv env_;
+};
+
+TEST(RateLimiterTest, Throughput) {
+  const int64_t kRate = 1 << 20;
+  RateLimiter* limiter = NewGenericRateLimiter(&env_, kRate, false);
+  ASSERT_EQ(kRate, limiter->GetBytesPerSecond());
+  const uint64_t start = env_.now_;
+  for (int i = 0; i < 32; i++) {
+    limiter->Request(64 << 10, RateLimiter::kIOLow);
+  }
+  limiter->Request(1 << 20, RateLimiter::kIOHigh);
+
+  // 3MB at 1MB/s; the first period is granted right away
+  const uint64_t elapsed = env_.now_ - start;
+  ASSERT_GE(elapsed, 2800000);
+  ASSERT_LE(elapsed, 3000000);
+  ASSERT_EQ(2 << 20, limiter->GetTotalBytesThrough(RateLimiter::kIOLow));
+  ASSERT_EQ(1 << 20, limiter->GetTotalBytesThrough(RateLimiter::kIOHigh));
+  delete limiter;
+}
+
+TEST(RateLimiterTest, NoBurstAfterIdle) {
+  RateLimiter* limiter = NewGenericRateLimiter(&env_, 1 << 20, false);
+  limiter->Request(1 << 20, RateLimiter::kIOLow);
+  env_.now_ += 10000000;
+
+  // Tokens of the idle periods are gone
+  const uint64_t start = env_.now_;
+  limiter->Request(1 << 20, RateLimiter::kIOLow);
+  ASSERT_GE(env_.now_ - start, 800000);
+  delete limiter;
+}
+
+TEST(RateLimiterTest, AutoTune) {
+  const int64_t kMaxRate = 16 << 20;
+  RateLimiter* limiter = NewGenericRateLimiter(&env_, kMaxRate, true);
+  ASSERT_EQ(kMaxRate / 16, limiter->GetBytesPerSecond());
+
+  // Stalled writers let background work speed up, up to the limit
+  for (int i = 0; i < 10; i++) {
+    limiter->ReportWriteStall();
+    env_.now_ += 1000000;
+    limiter->Request(1, RateLimiter::kIOLow);
+  }
+  ASSERT_EQ(kMaxRate, limiter->GetBytesPerSecond());
+
+  // Then slow down again once they stop
+  for (int i = 0; i < 100; i++) {
+    env_.now_ += 1000000;
+    limiter->Request(1, RateLimiter::kIOLow);
+  }
+  ASSERT_EQ(kMaxRate / 16, limiter->GetBytesPerSecond());
+  delete limiter;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
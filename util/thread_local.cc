@@ -0,0 +1,176 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_local.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <atomic>
+#include <map>
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+struct ThreadLocalPtr::Slot {
+  std::atomic<void*> ptr;
+
+  Slot() : ptr(NULL) { }
+};
+
+// The slots of one thread, keyed by ThreadLocalPtr::id_.  Dropped when
+// the thread exits.
+struct ThreadLocalData {
+  std::map<uint64_t, ThreadLocalPtr::Slot*> slots;
+  uint64_t last_id;                  // Most recently used entry of slots
+  ThreadLocalPtr::Slot* last_slot;
+
+  ThreadLocalData() : last_id(0), last_slot(NULL) { }
+
+  // Hand the pointers of the exiting thread owning "data" to the
+  // handlers of the ThreadLocalPtrs still alive.  The slots of dead
+  // ones were freed by their destructor.
+  static void Exit(ThreadLocalData* data);
+};
+
+namespace {
+
+// Live ThreadLocalPtrs by id.  Held while a thread exits so that the
+// ThreadLocalPtrs it hands its pointers to stay alive.  Lock order:
+// registry_mu, then a ThreadLocalPtr's mu_ or whatever its handler locks.
+port::OnceType once = LEVELDB_ONCE_INIT;
+port::Mutex* registry_mu;
+std::map<uint64_t, ThreadLocalPtr*>* registry;
+uint64_t next_id;
+pthread_key_t thread_key;
+
+void OnThreadExit(void* arg);
+
+void InitRegistry() {
+  registry_mu = new port::Mutex;
+  registry = new std::map<uint64_t, ThreadLocalPtr*>;
+  next_id = 1;
+  if (pthread_key_create(&thread_key, &OnThreadExit) != 0) {
+    abort();
+  }
+}
+
+}  // namespace
+
+void ThreadLocalData::Exit(ThreadLocalData* data) {
+  MutexLock l(registry_mu);
+  for (std::map<uint64_t, ThreadLocalPtr::Slot*>::iterator it =
+           data->slots.begin();
+       it != data->slots.end(); ++it) {
+    std::map<uint64_t, ThreadLocalPtr*>::iterator owner =
+        registry->find(it->first);
+    if (owner == registry->end()) {
+      continue;
+    }
+    ThreadLocalPtr* tls = owner->second;
+    ThreadLocalPtr::Slot* slot = it->second;
+    tls->mu_.Lock();
+    tls->slots_.erase(slot);
+    tls->mu_.Unlock();
+    void* ptr = slot->ptr.exchange(NULL);
+    delete slot;
+    if (ptr != NULL && tls->handler_ != NULL) {
+      (*tls->handler_)(ptr);
+    }
+  }
+  delete data;
+}
+
+namespace {
+void OnThreadExit(void* arg) {
+  ThreadLocalData::Exit(reinterpret_cast<ThreadLocalData*>(arg));
+}
+uint64_t NewId() {
+  port::InitOnce(&once, InitRegistry);
+  MutexLock l(registry_mu);
+  return next_id++;
+}
+}  // namespace
+
+ThreadLocalPtr::ThreadLocalPtr(UnrefHandler handler)
+    : id_(NewId()),
+      handler_(handler) {
+  MutexLock l(registry_mu);
+  (*registry)[id_] = this;
+}
+
+ThreadLocalPtr::~ThreadLocalPtr() {
+  MutexLock l(registry_mu);
+  registry->erase(id_);
+  // Threads look their slot up by id_ first, so they never touch the
+  // freed slots again
+  MutexLock m(&mu_);
+  for (std::set<Slot*>::iterator it = slots_.begin();
+       it != slots_.end(); ++it) {
+    delete *it;
+  }
+  slots_.clear();
+}
+
+ThreadLocalPtr::Slot* ThreadLocalPtr::GetSlot() {
+  ThreadLocalData* data =
+      reinterpret_cast<ThreadLocalData*>(pthread_getspecific(thread_key));
+  if (data != NULL && data->last_id == id_) {
+    return data->last_slot;
+  }
+  if (data == NULL) {
+    data = new ThreadLocalData;
+    if (pthread_setspecific(thread_key, data) != 0) {
+      abort();
+    }
+  }
+
+  Slot* slot;
+  std::map<uint64_t, Slot*>::iterator it = data->slots.find(id_);
+  if (it != data->slots.end()) {
+    slot = it->second;
+  } else {
+    // First use by this thread.  Forget the ids of dead ThreadLocalPtrs
+    // while at it.
+    {
+      MutexLock l(registry_mu);
+      for (it = data->slots.begin(); it != data->slots.end(); ) {
+        if (registry->count(it->first) == 0) {
+          data->slots.erase(it++);
+        } else {
+          ++it;
+        }
+      }
+    }
+    slot = new Slot;
+    {
+      MutexLock l(&mu_);
+      slots_.insert(slot);
+    }
+    data->slots[id_] = slot;
+  }
+  data->last_id = id_;
+  data->last_slot = slot;
+  return slot;
+}
+
+void* ThreadLocalPtr::Swap(void* ptr) {
+  return GetSlot()->ptr.exchange(ptr);
+}
+
+bool ThreadLocalPtr::CompareAndSwap(void* ptr, void** expected) {
+  return GetSlot()->ptr.compare_exchange_strong(*expected, ptr);
+}
+
+void ThreadLocalPtr::Scrape(std::vector<void*>* ptrs, void* replacement) {
+  MutexLock l(&mu_);
+  for (std::set<Slot*>::iterator it = slots_.begin();
+       it != slots_.end(); ++it) {
+    void* ptr = (*it)->ptr.exchange(replacement);
+    if (ptr != NULL) {
+      ptrs->push_back(ptr);
+    }
+  }
+}
+
+}  // namespace leveldb
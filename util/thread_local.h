@@ -0,0 +1,65 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_THREAD_LOCAL_H_
+#define STORAGE_LEVELDB_UTIL_THREAD_LOCAL_H_
+
+#include <stdint.h>
+#include <set>
+#include <vector>
+#include "port/port.h"
+
+namespace leveldb {
+
+// A ThreadLocalPtr holds one pointer per thread, NULL until the thread
+// stores something else.  A thread reads and replaces its own pointer
+// without locking; Scrape() replaces the pointers of all threads at
+// once, e.g. to take back values that went stale.
+class ThreadLocalPtr {
+ public:
+  // Called with the non-NULL pointer of a thread exiting while this
+  // ThreadLocalPtr is alive.  May be NULL.
+  typedef void (*UnrefHandler)(void* ptr);
+
+  explicit ThreadLocalPtr(UnrefHandler handler);
+
+  // Pointers still held by threads are dropped without calling the
+  // handler; Scrape() them first if they need cleaning up.
+  // REQUIRES: No thread is using this ThreadLocalPtr.
+  ~ThreadLocalPtr();
+
+  // Store "ptr" as the pointer of the calling thread and return the
+  // previous one.
+  void* Swap(void* ptr);
+
+  // If the pointer of the calling thread is "expected", replace it with
+  // "ptr" and return true.  Otherwise store the pointer in "*expected"
+  // and return false.
+  bool CompareAndSwap(void* ptr, void** expected);
+
+  // Replace the pointer of every thread by "replacement", appending the
+  // previous non-NULL pointers to "*ptrs".
+  void Scrape(std::vector<void*>* ptrs, void* replacement);
+
+ private:
+  struct Slot;
+  friend struct ThreadLocalData;
+
+  // Return the slot of the calling thread, creating it if needed
+  Slot* GetSlot();
+
+  const uint64_t id_;            // Never reused, names us in thread data
+  const UnrefHandler handler_;
+
+  port::Mutex mu_;
+  std::set<Slot*> slots_;  // One per thread that used us, guarded by mu_
+
+  // No copying allowed
+  ThreadLocalPtr(const ThreadLocalPtr&);
+  void operator=(const ThreadLocalPtr&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_THREAD_LOCAL_H_
@@ -0,0 +1,169 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_local.h"
+
+#include <algorithm>
+#include "leveldb/env.h"
+#include "util/mutexlock.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+namespace {
+port::Mutex handler_mu;
+std::vector<void*> handled;  // Pointers passed to RecordUnref()
+
+void RecordUnref(void* ptr) {
+  MutexLock l(&handler_mu);
+  handled.push_back(ptr);
+}
+
+struct ThreadState {
+  ThreadLocalPtr* tls;
+  void* value;
+  port::Mutex mu;
+  port::CondVar cv;
+  bool stored;    // The thread stored value
+  bool release;   // The thread may exit
+  bool done;
+
+  ThreadState() : cv(&mu), stored(false), release(false), done(false) { }
+};
+
+void StoreAndWait(void* arg) {
+  ThreadState* state = reinterpret_cast<ThreadState*>(arg);
+  state->tls->Swap(state->value);
+  MutexLock l(&state->mu);
+  state->stored = true;
+  state->cv.SignalAll();
+  while (!state->release) {
+    state->cv.Wait();
+  }
+  state->done = true;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+class ThreadLocalTest { };
+
+TEST(ThreadLocalTest, SwapAndCompareAndSwap) {
+  ThreadLocalPtr tls(NULL);
+  int a, b;
+  ASSERT_TRUE(tls.Swap(&a) == NULL);
+  ASSERT_TRUE(tls.Swap(&b) == &a);
+
+  void* expected = &a;
+  ASSERT_TRUE(!tls.CompareAndSwap(&a, &expected));
+  ASSERT_TRUE(expected == &b);
+  ASSERT_TRUE(tls.CompareAndSwap(&a, &expected));
+  ASSERT_TRUE(tls.Swap(NULL) == &a);
+
+  // Another instance holds a pointer of its own
+  ThreadLocalPtr other(NULL);
+  ASSERT_TRUE(other.Swap(&b) == NULL);
+  ASSERT_TRUE(tls.Swap(NULL) == NULL);
+  ASSERT_TRUE(other.Swap(NULL) == &b);
+}
+
+// Start "n" threads storing states[i].value and wait until they did
+static void StartThreads(ThreadLocalPtr* tls, int n, void** values,
+                         ThreadState* states) {
+  for (int i = 0; i < n; i++) {
+    states[i].tls = tls;
+    states[i].value = values[i];
+    Env::Default()->StartThread(&StoreAndWait, &states[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    MutexLock l(&states[i].mu);
+    while (!states[i].stored) {
+      states[i].cv.Wait();
+    }
+  }
+}
+
+static void StopThreads(int n, ThreadState* states) {
+  for (int i = 0; i < n; i++) {
+    MutexLock l(&states[i].mu);
+    states[i].release = true;
+    states[i].cv.SignalAll();
+    while (!states[i].done) {
+      states[i].cv.Wait();
+    }
+  }
+}
+
+static size_t NumHandled() {
+  MutexLock l(&handler_mu);
+  return handled.size();
+}
+
+TEST(ThreadLocalTest, Scrape) {
+  const int kThreads = 4;
+  int values[kThreads];
+  void* ptrs[kThreads];
+  for (int i = 0; i < kThreads; i++) ptrs[i] = &values[i];
+  ThreadState states[kThreads];
+  ThreadLocalPtr tls(&RecordUnref);
+  StartThreads(&tls, kThreads, ptrs, states);
+
+  int own;
+  tls.Swap(&own);
+  int replacement;
+  std::vector<void*> scraped;
+  tls.Scrape(&scraped, &replacement);
+  ASSERT_EQ(kThreads + 1, scraped.size());
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT_TRUE(std::find(scraped.begin(), scraped.end(), ptrs[i]) !=
+                scraped.end());
+  }
+  ASSERT_TRUE(tls.Swap(NULL) == &replacement);
+
+  // Scrape again so that exiting threads leave nothing to the handler
+  scraped.clear();
+  tls.Scrape(&scraped, NULL);
+  ASSERT_EQ(kThreads, scraped.size());
+  const size_t before = NumHandled();
+  StopThreads(kThreads, states);
+  Env::Default()->SleepForMicroseconds(100000);
+  ASSERT_EQ(before, NumHandled());
+}
+
+TEST(ThreadLocalTest, ThreadExit) {
+  const int kThreads = 4;
+  int values[kThreads];
+  void* ptrs[kThreads];
+  for (int i = 0; i < kThreads; i++) ptrs[i] = &values[i];
+  ThreadState states[kThreads];
+  ThreadLocalPtr tls(&RecordUnref);
+  StartThreads(&tls, kThreads, ptrs, states);
+  StopThreads(kThreads, states);
+
+  // The handler runs once the threads are gone
+  for (int i = 0; i < 1000; i++) {
+    bool all = true;
+    {
+      MutexLock l(&handler_mu);
+      for (int j = 0; j < kThreads; j++) {
+        if (std::find(handled.begin(), handled.end(), ptrs[j]) ==
+            handled.end()) {
+          all = false;
+        }
+      }
+    }
+    if (all) break;
+    Env::Default()->SleepForMicroseconds(10000);
+  }
+  MutexLock l(&handler_mu);
+  for (int j = 0; j < kThreads; j++) {
+    ASSERT_TRUE(std::find(handled.begin(), handled.end(), ptrs[j]) !=
+                handled.end());
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}